@@ -39,10 +39,14 @@ def getInstance():
 USER_AGENT = 'Mozilla/5.0 (X11; Linux x86_64; rv:49.0) Gecko/20100101 Firefox/49.0'
 AKAMAIHD_PV_KEY = bytearray.fromhex('bd938d5ee6d9f42016f9c56577b6fdcf415fe4b184932b785ab32bcadc9bb592')
 
+# The client can't decrypt Akamai-encrypted HDS, and drops those fragments.
+# Set this to play the streams through AdobeHDS.php instead, which can (and
+# needs PHP installed).
+USE_PHP_HDS = False
+
 class ABCPVRImpl(BasePVR):
 	def loadData(self, props):
 		self.clientPath = props['clientPath']
-		self.streamProc = None
 		
 		# Channels
 		self.channels = (ABCHelper(self).getChannels() +
@@ -100,25 +104,6 @@ class ABCPVRImpl(BasePVR):
 		channel = next(x for x in self.channels if x.uniqueId == channelId)
 		return channel._data['helper'].OpenLiveStream(channel)
 	
-	def ReadLiveStream(self, bufferSize):
-		if self.streamProc is not None:
-			buf = self.streamProc.stdout.read(bufferSize)
-			#print 'Read {} bytes'.format(len(buf))
-			#sys.stdout.write(buf)
-			return len(buf), buf
-		
-		return 0, None
-	
-	def CloseLiveStream(self):
-		if self.streamProc is not None:
-			# Release the reference immediately, but keep a copy ourselves to kill in the background
-			streamProc = self.streamProc
-			self.streamProc = None
-			
-			streamProc.kill()
-			print 'Waiting for process to exit'
-			streamProc.communicate()
-	
 	def CanPauseStream(self):
 		return True
 	
@@ -309,7 +294,7 @@ class ABCHelper:
 		
 		raise PVRListDone(PVR_ERROR.NO_ERROR)
 	
-	def GetStreamOptions(self, manifestBase):
+	def GetHDSStream(self, manifestBase):
 		if self.swfhash is None:
 			# Fetch the verification swf
 			handle = urllib2.urlopen(urllib2.Request('http://iview.abc.net.au/assets/swf/CineramaWrapper_Acc_022.swf?version=0.2', headers={'User-Agent': USER_AGENT}))
@@ -336,20 +321,37 @@ class ABCHelper:
 		auth = hmac.new(AKAMAIHD_PV_KEY, msg.encode('ascii'), hashlib.sha256)
 		pvtoken = '{}~hmac={}'.format(msg, auth.hexdigest())
 		
-		return ['--manifest', manifestUrl, '--auth', urllib.urlencode({'pvtoken': pvtoken, 'hdcore': '2.11.3', 'hdntl': hdntl[6:]}), '--useragent', USER_AGENT, '--play']
+		# The client fetches and remuxes the fragments itself
+		return PVRHDSStream(manifestUrl, auth=urllib.urlencode({'pvtoken': pvtoken, 'hdcore': '2.11.3', 'hdntl': hdntl[6:]}), userAgent=USER_AGENT)
 	
-	def OpenLiveStream(channel):
+	def OpenLiveStream(self, channel):
 		try:
-			cmd = ['php', os.path.join(pvrImpl.clientPath, 'examples', 'AdobeHDS.php')] + self.GetStreamOptions('http://abctvlivehds-lh.akamaihd.net/z/{}/manifest.f4m'.format(channel._data['hdsId']))
-			
-			pvrImpl.streamProc = subprocess.Popen(cmd, stdout=subprocess.PIPE)
-			
-			return True
+			stream = self.GetHDSStream('http://abctvlivehds-lh.akamaihd.net/z/{}/manifest.f4m'.format(channel._data['hdsId']))
+			if USE_PHP_HDS:
+				return True, AdobeHDSSession(self.pvrImpl.clientPath, stream)
+			return True, stream
 		except:
 			traceback.print_exc()
 		
 		return False
 
+# Plays a PVRHDSStream through AdobeHDS.php, reading the FLV it writes out
+class AdobeHDSSession(PVRStreamSession):
+	def __init__(self, clientPath, stream):
+		cmd = ['php', os.path.join(clientPath, 'examples', 'AdobeHDS.php'), '--manifest', stream.manifestURL, '--auth', stream.auth, '--useragent', stream.userAgent, '--play']
+		self.proc = subprocess.Popen(cmd, stdout=subprocess.PIPE)
+	
+	def Read(self, bufferSize):
+		buf = self.proc.stdout.read(bufferSize)
+		return len(buf), buf
+	
+	def CanPause(self):
+		return True
+	
+	def Close(self):
+		self.proc.kill()
+		self.proc.communicate()
+
 class SevenHelper:
 	def __init__(self, pvrImpl):
 		self.pvrImpl = pvrImpl
@@ -17,6 +17,7 @@
 
 import bridge
 
+import datetime
 import time
 
 # Classes
@@ -64,6 +65,11 @@ def _datetimeToC(dt):
 		return 0
 	return time.mktime(dt.timetuple())
 
+def _datetimeFromC(t):
+	if not t:
+		return None
+	return datetime.datetime.fromtimestamp(t)
+
 class EPGTag:
 	INVALID_UID = 0
 	
@@ -110,9 +116,25 @@ class EPGTag:
 	def _cfirstAired(self):
 		return _datetimeToC(self.firstAired)
 
+# Searches the EPG natively for words, words ending in '*' (matching any word
+# they start) and "quoted phrases". Only titles are searched unless fullText
+# is set. Returns (channelUid, uniqueBroadcastId, startTime, endTime, title)
+# tuples in start order.
+def searchEPG(query, fullText = True, channelUid = PVRChannel.INVALID_UID, startTime = None, endTime = None):
+	return [(uid, broadcastId, _datetimeFromC(start), _datetimeFromC(end), title)
+		for uid, broadcastId, start, end, title
+		in bridge.EPG_Search(query, fullText, channelUid, int(_datetimeToC(startTime)), int(_datetimeToC(endTime)))]
+
 class PVRTimer:
 	NO_PARENT = 0
 	TYPE_NONE = 0
+	# The timer types pvr.python offers to Kodi
+	TYPE_ONCE_MANUAL = 1
+	TYPE_ONCE_EPG = 2
+	TYPE_ONCE_CREATED_BY_REPEATING = 3
+	TYPE_REPEATING_MANUAL = 4
+	TYPE_ONCE_CREATED_BY_EPG_SEARCH = 5
+	TYPE_REPEATING_EPG_SEARCH = 6
 	
 	# y u no '*' in arguments list, python 2? :/
 	def __init__(self,
@@ -157,6 +179,13 @@ class PVRTimer:
 	@property
 	def _cfirstDay(self):
 		return _datetimeToC(self.firstDay)
+	
+	@classmethod
+	def _fromC(cls, ctimer):
+		kwargs = dict(ctimer)
+		for key in ('startTime', 'endTime', 'firstDay'):
+			kwargs[key] = _datetimeFromC(kwargs[key])
+		return cls(**kwargs)
 
 class PVRRecording:
 	CHANNEL_TYPE_UNKNOWN = 0
@@ -197,6 +226,101 @@ class PVRRecording:
 	@property
 	def _crecordingTime(self):
 		return _datetimeToC(self.recordingTime)
+	
+	@classmethod
+	def _fromC(cls, crecording):
+		kwargs = dict(crecording)
+		kwargs['recordingTime'] = _datetimeFromC(kwargs['recordingTime'])
+		return cls(**kwargs)
+
+# One open stream. OpenLiveStream and OpenRecordedStream can return
+# (True, session) to give each stream its own state, so that several can be
+# open at the same time. Close is called once Kodi is done with it.
+class PVRStreamSession:
+	def Read(self, bufferSize):
+		return -1, None
+	
+	def Seek(self, position, whence):
+		return -1
+	
+	def Position(self):
+		return -1
+	
+	def Length(self):
+		return -1
+	
+	def CanPause(self):
+		return False
+	
+	def CanSeek(self):
+		return False
+	
+	def Close(self):
+		pass
+
+# A stream fetched and demultiplexed by the client itself, without any of the
+# data passing through Python
+class PVRNativeStream:
+	def _cSpec(self):
+		return {}
+
+# An Adobe HDS (F4M) stream, played as FLV. auth is the query string sent with
+# every request, and maxBitrate (in kbit/s) limits which rendition is picked.
+class PVRHDSStream(PVRNativeStream):
+	def __init__(self,
+	             manifestURL,
+	             auth = '',
+	             userAgent = '',
+	             maxBitrate = 0
+	):
+		for k, v in locals().items():
+			setattr(self, k, v)
+	
+	def _cSpec(self):
+		return {'type': 'hds', 'manifestURL': self.manifestURL, 'auth': self.auth, 'userAgent': self.userAgent, 'maxBitrate': self.maxBitrate}
+
+# A UDP or RTP stream, usually multicast IPTV. url is udp://[source]@group:port
+# or rtp://[source]@group:port, where a source asks for source-specific
+# multicast; a plain (True, url) does the same with the defaults. interface is
+# the address of the network interface to join the group on, and latency (in ms)
+# how long RTP packets are held back to be put in order.
+class PVRMulticastStream(PVRNativeStream):
+	def __init__(self,
+	             url,
+	             interface = '',
+	             latency = 200
+	):
+		for k, v in locals().items():
+			setattr(self, k, v)
+	
+	def _cSpec(self):
+		return {'type': 'multicast', 'url': self.url, 'interface': self.interface, 'latency': self.latency}
+
+# The one live stream of a backend implementing ReadLiveStream and friends itself
+class _LiveStreamSession(PVRStreamSession):
+	def __init__(self, pvr):
+		self.pvr = pvr
+	
+	def Read(self, bufferSize):
+		return self.pvr.ReadLiveStream(bufferSize)
+	
+	def Seek(self, position, whence):
+		return self.pvr.SeekLiveStream(position, whence)
+	
+	def Position(self):
+		return self.pvr.PositionLiveStream()
+	
+	def Length(self):
+		return self.pvr.LengthLiveStream()
+	
+	def CanPause(self):
+		return self.pvr.CanPauseStream()
+	
+	def CanSeek(self):
+		return self.pvr.CanSeekStream()
+	
+	def Close(self):
+		self.pvr.CloseLiveStream()
 
 # raised when the PVR_ERROR result is ready
 # y u no 'return' from generators, python 2? :/
@@ -217,6 +341,34 @@ class BasePVR:
 		
 		return ADDON_STATUS.OK
 	
+	# Called before the system sleeps. Connections and sessions won't survive
+	# it, so drop them here.
+	def OnSystemSleep(self):
+		pass
+	
+	# Called in the background after the system wakes, before anything else
+	# is asked of the backend. Log in again or refresh tokens here; Kodi is
+	# served from the catalog in the meantime.
+	def OnSystemWake(self):
+		pass
+	
+	# How long Kodi waits for each of these calls, in seconds. A call that runs
+	# over has bridge.DeadlineExceeded raised in it at its next function call or
+	# return, and Kodi is answered from the catalog, if it can be, without it.
+	# Calls left out (or given 0) are waited on for as long as they take.
+	def GetCallDeadlines(self):
+		return {
+			'GetChannels': 30,
+			'GetChannelGroups': 30,
+			'GetChannelGroupMembers': 30,
+			'GetTimers': 30,
+			'GetRecordings': 30,
+			'GetEPGForChannel': 30,
+			'OpenLiveStream': 20,
+			'OpenRecordedStream': 20,
+			'OnSystemSleep': 10,
+		}
+	
 	def GetAddonCapabilities(self):
 		bridge.XBMC_Log('GetAddonCapabilities - NYI')
 		return PVR_ERROR.NOT_IMPLEMENTED
@@ -242,10 +394,10 @@ class BasePVR:
 		bridge.XBMC_Log('GetChannels - NYI')
 		raise PVRListDone(PVR_ERROR.NOT_IMPLEMENTED)
 	
-	def _cGetChannels(self, radio):
+	def _cGetChannels(self, handle, radio):
 		try:
 			for item in self.GetChannels(radio):
-				bridge.PVR_TransferChannelEntry(item)
+				bridge.PVR_TransferChannelEntry(handle, item)
 		except PVRListDone as ex:
 			return ex.value
 		
@@ -256,10 +408,10 @@ class BasePVR:
 		bridge.XBMC_Log('GetChannelGroups - NYI')
 		raise PVRListDone(PVR_ERROR.NOT_IMPLEMENTED)
 	
-	def _cGetChannelGroups(self, radio):
+	def _cGetChannelGroups(self, handle, radio):
 		try:
 			for item in self.GetChannelGroups(radio):
-				bridge.PVR_TransferChannelGroup(item)
+				bridge.PVR_TransferChannelGroup(handle, item)
 		except PVRListDone as ex:
 			return ex.value
 	
@@ -268,10 +420,10 @@ class BasePVR:
 		bridge.XBMC_Log('GetChannelGroupMembers - NYI')
 		raise PVRListDone(PVR_ERROR.NOT_IMPLEMENTED)
 	
-	def _cGetChannelGroupMembers(self, groupName):
+	def _cGetChannelGroupMembers(self, handle, groupName):
 		try:
 			for item in self.GetChannelGroupMembers(groupName):
-				bridge.PVR_TransferChannelGroupMember(item)
+				bridge.PVR_TransferChannelGroupMember(handle, item)
 		except PVRListDone as ex:
 			return ex.value
 	
@@ -280,10 +432,10 @@ class BasePVR:
 		bridge.XBMC_Log('GetTimers - NYI')
 		raise PVRListDone(PVR_ERROR.NOT_IMPLEMENTED)
 	
-	def _cGetTimers(self):
+	def _cGetTimers(self, handle):
 		try:
 			for item in self.GetTimers():
-				bridge.PVR_TransferTimerEntry(item)
+				bridge.PVR_TransferTimerEntry(handle, item)
 		except PVRListDone as ex:
 			return ex.value
 	
@@ -292,13 +444,57 @@ class BasePVR:
 		bridge.XBMC_Log('GetRecordings - NYI')
 		raise PVRListDone(PVR_ERROR.NOT_IMPLEMENTED)
 	
-	def _cGetRecordings(self, deleted):
+	def _cGetRecordings(self, handle, deleted):
 		try:
 			for item in self.GetRecordings(deleted):
-				bridge.PVR_TransferRecordingEntry(item)
+				bridge.PVR_TransferRecordingEntry(handle, item)
 		except PVRListDone as ex:
 			return ex.value
 	
+	# A local directory of recordings can be indexed by pvr.python itself, in
+	# which case GetRecordings is no longer called. '' leaves it to the backend.
+	def GetRecordingsPath(self):
+		return ''
+	
+	# Called for each new or changed file in the recordings directory. Return
+	# the recording with any extra metadata filled in, or None to keep it as is.
+	def EnrichRecording(self, recording, path):
+		return None
+	
+	def _cEnrichRecording(self, crecording, path):
+		return self.EnrichRecording(PVRRecording._fromC(crecording), path)
+	
+	# With a recordings path, pvr.python can record the timers into it itself.
+	# Each recording opens its channel through OpenRecorderStream, alongside
+	# whatever is being watched.
+	def UseNativeRecorder(self):
+		return False
+	
+	# Timers are kept by pvr.python itself. These are only called so the
+	# backend can act on them, and do nothing by default.
+	
+	def AddTimer(self, timer):
+		return PVR_ERROR.NO_ERROR
+	
+	def _cAddTimer(self, ctimer):
+		return self.AddTimer(PVRTimer._fromC(ctimer))
+	
+	def UpdateTimer(self, timer):
+		return PVR_ERROR.NO_ERROR
+	
+	def _cUpdateTimer(self, ctimer):
+		return self.UpdateTimer(PVRTimer._fromC(ctimer))
+	
+	def DeleteTimer(self, timer, forceDelete):
+		return PVR_ERROR.NO_ERROR
+	
+	def _cDeleteTimer(self, ctimer, forceDelete):
+		return self.DeleteTimer(PVRTimer._fromC(ctimer), forceDelete)
+	
+	# Used to detect timer conflicts. 0 means no limit.
+	def GetTunerCount(self):
+		return 0
+	
 	def GetDriveSpace(self):
 		bridge.XBMC_Log('GetDriveSpace - NYI')
 		return PVR_ERROR.NOT_IMPLEMENTED, -1, -1
@@ -320,17 +516,52 @@ class BasePVR:
 		bridge.XBMC_Log('GetEPGForChannel - NYI')
 		raise PVRListDone(PVR_ERROR.NOT_IMPLEMENTED)
 	
-	def _cGetEPGForChannel(self, channelId, cstartTime, cendTime):
+	def _cGetEPGForChannel(self, handle, channelId, cstartTime, cendTime):
 		try:
 			for item in self.GetEPGForChannel(channelId, cstartTime, cendTime):
-				bridge.PVR_TransferEpgEntry(item)
+				bridge.PVR_TransferEpgEntry(handle, item)
 		except PVRListDone as ex:
 			return ex.value
 	
+	# Returns False, True to use ReadLiveStream and friends, (True, path) for
+	# Kodi to open the stream itself (udp:// and rtp:// paths are received by
+	# the client), (True, PVRStreamSession), or (True, PVRNativeStream) for the
+	# client to fetch it, e.g. PVRHDSStream or PVRMulticastStream.
 	def OpenLiveStream(self, channelId):
 		bridge.XBMC_Log('OpenLiveStream - NYI')
 		return False
 	
+	def _cOpenLiveStream(self, channelId):
+		return self._cStream(self.OpenLiveStream(channelId), _LiveStreamSession(self))
+	
+	# Returns the same as OpenLiveStream, except that a bare True isn't enough,
+	# as ReadLiveStream belongs to the stream being watched
+	def OpenRecorderStream(self, channelId):
+		return self.OpenLiveStream(channelId)
+	
+	def _cOpenRecorderStream(self, channelId):
+		return self._cStream(self.OpenRecorderStream(channelId), None)
+	
+	# Only called for recordings without a streamURL. Returns the same as
+	# OpenLiveStream, except that a bare True isn't enough.
+	def OpenRecordedStream(self, recording):
+		bridge.XBMC_Log('OpenRecordedStream - NYI')
+		return False
+	
+	def _cOpenRecordedStream(self, crecording):
+		return self._cStream(self.OpenRecordedStream(PVRRecording._fromC(crecording)), None)
+	
+	# A path, a session, a native stream spec, or None if the stream couldn't be opened
+	def _cStream(self, result, default):
+		if isinstance(result, tuple):
+			if not result[0]:
+				return None
+			stream = result[1] if len(result) > 1 else default
+			if isinstance(stream, PVRNativeStream):
+				return stream._cSpec()
+			return stream
+		return default if result else None
+	
 	def ReadLiveStream(self, bufferSize):
 		bridge.XBMC_Log('ReadLiveStream - NYI')
 		return -1, None
@@ -347,6 +578,9 @@ class BasePVR:
 		bridge.XBMC_Log('LengthLiveStream - NYI')
 		return -1
 	
+	def CloseLiveStream(self):
+		pass
+	
 	def CanPauseStream(self):
 		bridge.XBMC_Log('CanPauseStream - NYI')
 		return False
@@ -366,6 +600,29 @@ class ADDON_STATUS:
 	NEED_SAVEDSETTINGS = 5
 	PERMANENT_FAILURE = 6
 
+class PVR_TIMER_STATE:
+	NEW = 0
+	SCHEDULED = 1
+	RECORDING = 2
+	COMPLETED = 3
+	ABORTED = 4
+	CANCELLED = 5
+	CONFLICT_OK = 6
+	CONFLICT_NOK = 7
+	ERROR = 8
+	DISABLED = 9
+
+class PVR_WEEKDAY:
+	NONE = 0x00
+	MONDAY = 0x01
+	TUESDAY = 0x02
+	WEDNESDAY = 0x04
+	THURSDAY = 0x08
+	FRIDAY = 0x10
+	SATURDAY = 0x20
+	SUNDAY = 0x40
+	ALLDAYS = 0x7F
+
 class PVR_ERROR:
 	NO_ERROR = 0
 	UNKNOWN = -1
@@ -0,0 +1,252 @@
+/*
+ *  pvr.python - A PVR client for Kodi using Python
+ *  Copyright © 2016 RunasSudo (Yingtong Li)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "calls.h"
+
+#include <p8-platform/util/timeutils.h>
+
+#include <algorithm>
+
+using namespace std;
+using namespace P8PLATFORM;
+
+CDeadlineCall::CDeadlineCall() :
+	m_iRefs(1),
+	m_bDone(false),
+	m_bAbandoned(false)
+{
+}
+
+bool CDeadlineCall::IsAbandoned()
+{
+	CLockObject lock(m_mutex);
+	return m_bAbandoned;
+}
+
+void CDeadlineCall::Release()
+{
+	bool bLast;
+	{
+		CLockObject lock(m_mutex);
+		bLast = (--m_iRefs == 0);
+	}
+	if (bLast)
+		delete this;
+}
+
+// BEGIN POOL
+
+// Runs the calls it is handed until it is stopped. m_call is guarded by the
+// pool's mutex, and stays set while the call runs so the pool can cancel it.
+class CCallWorker : public CThread
+{
+public:
+	CCallWorker(CCallPool& pool, CDeadlineCall* call) : m_pool(pool), m_call(call) {}
+
+	virtual void* Process(void) {
+		while (!IsStopped()) {
+			CDeadlineCall* call;
+			{
+				CLockObject lock(m_pool.m_mutex);
+				call = m_call;
+			}
+			if (call == NULL) {
+				m_assigned.Wait();
+				continue;
+			}
+
+			CCallPool::Execute(call);
+			call = m_pool.Next(this);
+			call->Release();
+		}
+		return NULL;
+	}
+
+	CCallPool& m_pool;
+	CDeadlineCall* m_call;
+	CEvent m_assigned;
+};
+
+CCallPool::CCallPool(unsigned int iMaxThreads) :
+	m_iMaxThreads(iMaxThreads),
+	m_bStopped(false)
+{
+}
+
+bool CCallPool::Run(CDeadlineCall* call, uint32_t iTimeoutMs)
+{
+	{
+		CLockObject lock(m_mutex);
+		if (m_bStopped)
+			return false;
+
+		{
+			CLockObject callLock(call->m_mutex);
+			call->m_iRefs++;
+		}
+		if (!m_idle.empty()) {
+			CCallWorker* worker = m_idle.back();
+			m_idle.pop_back();
+			worker->m_call = call;
+			worker->m_assigned.Signal();
+		} else if (m_workers.size() < m_iMaxThreads) {
+			CCallWorker* worker = new CCallWorker(*this, call);
+			m_workers.push_back(worker);
+			worker->CreateThread();
+		} else {
+			m_queue.push_back(call);
+		}
+	}
+
+	bool bFinished = (iTimeoutMs > 0) ? call->m_done.Wait(iTimeoutMs) : call->m_done.Wait();
+	if (!bFinished) {
+		CLockObject lock(call->m_mutex);
+		bFinished = call->m_bDone;
+		call->m_bAbandoned = !bFinished;
+	}
+	if (!bFinished)
+		call->Cancel();
+	return bFinished;
+}
+
+CDeadlineCall* CCallPool::Next(CCallWorker* worker)
+{
+	CLockObject lock(m_mutex);
+	CDeadlineCall* finished = worker->m_call;
+	worker->m_call = NULL;
+	if (m_bStopped || worker->IsStopped())
+		return finished;
+
+	if (!m_queue.empty()) {
+		worker->m_call = m_queue.front();
+		m_queue.pop_front();
+	} else {
+		m_idle.push_back(worker);
+	}
+	return finished;
+}
+
+void CCallPool::Execute(CDeadlineCall* call)
+{
+	// Calls that waited in the queue past their deadline aren't worth making
+	if (!call->IsAbandoned())
+		call->Run();
+
+	CLockObject lock(call->m_mutex);
+	call->m_bDone = true;
+	call->m_done.Signal();
+}
+
+bool CCallPool::Stop(uint32_t iWaitMs)
+{
+	vector<CCallWorker*> workers;
+	vector<CDeadlineCall*> running;
+	deque<CDeadlineCall*> queued;
+	{
+		CLockObject lock(m_mutex);
+		m_bStopped = true;
+		workers.swap(m_workers);
+		queued.swap(m_queue);
+		m_idle.clear();
+		for (vector<CCallWorker*>::const_iterator it = workers.begin(); it != workers.end(); ++it) {
+			if ((*it)->m_call != NULL) {
+				CLockObject callLock((*it)->m_call->m_mutex);
+				(*it)->m_call->m_iRefs++;
+				running.push_back((*it)->m_call);
+			}
+		}
+	}
+
+	for (vector<CDeadlineCall*>::const_iterator it = running.begin(); it != running.end(); ++it) {
+		(*it)->Cancel();
+		(*it)->Release();
+	}
+	for (deque<CDeadlineCall*>::const_iterator it = queued.begin(); it != queued.end(); ++it) {
+		(*it)->Release();
+	}
+
+	for (vector<CCallWorker*>::const_iterator it = workers.begin(); it != workers.end(); ++it) {
+		(*it)->StopThread(-1);
+		(*it)->m_assigned.Signal();
+	}
+
+	// Don't free the ones still stuck in a call
+	bool bStopped = true;
+	int64_t iEnd = GetTimeMs() + iWaitMs;
+	for (vector<CCallWorker*>::iterator it = workers.begin(); it != workers.end(); ++it) {
+		int64_t iLeft = max(iEnd - GetTimeMs(), (int64_t) 1);
+		if ((*it)->StopThread((int) iLeft)) {
+			delete *it;
+		} else {
+			bStopped = false;
+		}
+	}
+
+	CLockObject lock(m_mutex);
+	m_bStopped = false;
+	return bStopped;
+}
+
+// END POOL
+
+CCircuitBreaker::CCircuitBreaker(unsigned int iThreshold, uint32_t iCooldownMs, uint32_t iMaxCooldownMs) :
+	m_iThreshold(iThreshold),
+	m_iFailures(0),
+	m_iBaseCooldownMs(iCooldownMs),
+	m_iMaxCooldownMs(iMaxCooldownMs),
+	m_iCooldownMs(iCooldownMs),
+	m_iRetryTime(0),
+	m_bTrial(false)
+{
+}
+
+bool CCircuitBreaker::Allow()
+{
+	CLockObject lock(m_mutex);
+	if (m_iFailures < m_iThreshold)
+		return true;
+	if (m_bTrial || GetTimeMs() < m_iRetryTime)
+		return false;
+
+	m_bTrial = true;
+	return true;
+}
+
+void CCircuitBreaker::Succeeded()
+{
+	CLockObject lock(m_mutex);
+	m_iFailures = 0;
+	m_iCooldownMs = m_iBaseCooldownMs;
+	m_bTrial = false;
+}
+
+bool CCircuitBreaker::Failed()
+{
+	CLockObject lock(m_mutex);
+	m_iFailures++;
+	if (m_iFailures < m_iThreshold)
+		return false;
+
+	bool bOpened = m_bTrial || m_iFailures == m_iThreshold;
+	if (m_bTrial)
+		m_iCooldownMs = min(m_iCooldownMs * 2, m_iMaxCooldownMs);
+	m_bTrial = false;
+	m_iRetryTime = GetTimeMs() + m_iCooldownMs;
+	return bOpened;
+}
@@ -0,0 +1,123 @@
+#pragma once
+/*
+ *  pvr.python - A PVR client for Kodi using Python
+ *  Copyright © 2016 RunasSudo (Yingtong Li)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <p8-platform/threads/mutex.h>
+#include <p8-platform/threads/threads.h>
+
+#include <stdint.h>
+
+#include <deque>
+#include <vector>
+
+// A call that its caller may stop waiting for. It is reference counted, as
+// whichever of the caller and the pool thread running it is done last frees it.
+class CDeadlineCall
+{
+public:
+	CDeadlineCall();
+	virtual ~CDeadlineCall() {}
+
+	// Runs on a pool thread
+	virtual void Run() = 0;
+
+	// Called from the caller's thread once it has given up, while Run may
+	// still be going or may just have finished
+	virtual void Cancel() {}
+
+	// Whether the caller gave up on the call, so Run has to pass its result on itself
+	bool IsAbandoned();
+
+	// Gives up the caller's reference
+	void Release();
+
+private:
+	friend class CCallPool;
+
+	P8PLATFORM::CMutex m_mutex;
+	P8PLATFORM::CEvent m_done;
+	int m_iRefs;
+	bool m_bDone;
+	bool m_bAbandoned;
+};
+
+class CCallWorker;
+
+// Runs calls on a pool of threads, so the thread making a call only waits
+// until its deadline, even when the call itself never returns. Threads are
+// started as needed, up to iMaxThreads; calls beyond that wait their turn.
+class CCallPool
+{
+public:
+	CCallPool(unsigned int iMaxThreads);
+
+	// Runs call and waits up to iTimeoutMs for it. Returns true if it
+	// finished in time; otherwise it is cancelled and left to finish on its
+	// own. The caller keeps its reference either way.
+	bool Run(CDeadlineCall* call, uint32_t iTimeoutMs);
+
+	// Cancels whatever is still running and waits up to iWaitMs for the
+	// threads to end. Returns false if some of them are stuck. The pool can be
+	// used again afterwards.
+	bool Stop(uint32_t iWaitMs);
+
+private:
+	friend class CCallWorker;
+
+	// Hands a worker that has finished its call the next one, if there is
+	// one. Returns the finished call, for the worker to release.
+	CDeadlineCall* Next(CCallWorker* worker);
+	static void Execute(CDeadlineCall* call);
+
+	P8PLATFORM::CMutex m_mutex;
+	unsigned int m_iMaxThreads;
+	bool m_bStopped;
+	std::vector<CCallWorker*> m_workers;
+	std::vector<CCallWorker*> m_idle;
+	std::deque<CDeadlineCall*> m_queue;
+};
+
+// Stops waiting on a backend that keeps missing its deadlines. After
+// iThreshold misses in a row the circuit opens, and calls are turned away
+// straight away, except for one trial call each cooldown. A trial that misses
+// too doubles the cooldown, up to iMaxCooldownMs; one that makes it closes
+// the circuit again.
+class CCircuitBreaker
+{
+public:
+	CCircuitBreaker(unsigned int iThreshold, uint32_t iCooldownMs, uint32_t iMaxCooldownMs);
+
+	// Whether a call should be made at all
+	bool Allow();
+
+	void Succeeded();
+
+	// Returns whether this miss (re)opened the circuit
+	bool Failed();
+
+private:
+	P8PLATFORM::CMutex m_mutex;
+	unsigned int m_iThreshold;
+	unsigned int m_iFailures;
+	uint32_t m_iBaseCooldownMs;
+	uint32_t m_iMaxCooldownMs;
+	uint32_t m_iCooldownMs;
+	int64_t m_iRetryTime;
+	bool m_bTrial; // A trial call is in progress
+};
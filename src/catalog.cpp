@@ -0,0 +1,803 @@
+/*
+ *  pvr.python - A PVR client for Kodi using Python
+ *  Copyright © 2016 RunasSudo (Yingtong Li)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "catalog.h"
+#include "snapshot.h"
+
+#include <string.h>
+#include <time.h>
+
+using namespace std;
+using namespace P8PLATFORM;
+
+#define CATALOG_SNAPSHOT_MAGIC "PVRPYCAT"
+
+// BEGIN SERIALISATION
+
+static void WriteChannel(CSnapshotWriter& writer, const PVR_CHANNEL& channel)
+{
+	writer.PutUInt32(channel.iUniqueId);
+	writer.PutUInt8(channel.bIsRadio);
+	writer.PutUInt32(channel.iChannelNumber);
+	writer.PutUInt32(channel.iSubChannelNumber);
+	writer.PutString(channel.strChannelName);
+	writer.PutString(channel.strInputFormat);
+	writer.PutString(channel.strStreamURL);
+	writer.PutUInt32(channel.iEncryptionSystem);
+	writer.PutString(channel.strIconPath);
+	writer.PutUInt8(channel.bIsHidden);
+}
+
+static void ReadChannel(CSnapshotReader& reader, PVR_CHANNEL& channel)
+{
+	memset(&channel, 0, sizeof(PVR_CHANNEL));
+	channel.iUniqueId = reader.GetUInt32();
+	channel.bIsRadio = reader.GetUInt8() != 0;
+	channel.iChannelNumber = reader.GetUInt32();
+	channel.iSubChannelNumber = reader.GetUInt32();
+	reader.GetString(channel.strChannelName, sizeof(channel.strChannelName));
+	reader.GetString(channel.strInputFormat, sizeof(channel.strInputFormat));
+	reader.GetString(channel.strStreamURL, sizeof(channel.strStreamURL));
+	channel.iEncryptionSystem = reader.GetUInt32();
+	reader.GetString(channel.strIconPath, sizeof(channel.strIconPath));
+	channel.bIsHidden = reader.GetUInt8() != 0;
+}
+
+static void WriteChannelGroup(CSnapshotWriter& writer, const PVR_CHANNEL_GROUP& group)
+{
+	writer.PutString(group.strGroupName);
+	writer.PutUInt8(group.bIsRadio);
+	writer.PutUInt32(group.iPosition);
+}
+
+static void ReadChannelGroup(CSnapshotReader& reader, PVR_CHANNEL_GROUP& group)
+{
+	memset(&group, 0, sizeof(PVR_CHANNEL_GROUP));
+	reader.GetString(group.strGroupName, sizeof(group.strGroupName));
+	group.bIsRadio = reader.GetUInt8() != 0;
+	group.iPosition = reader.GetUInt32();
+}
+
+static void WriteChannelGroupMember(CSnapshotWriter& writer, const PVR_CHANNEL_GROUP_MEMBER& member)
+{
+	writer.PutString(member.strGroupName);
+	writer.PutUInt32(member.iChannelUniqueId);
+	writer.PutUInt32(member.iChannelNumber);
+}
+
+static void ReadChannelGroupMember(CSnapshotReader& reader, PVR_CHANNEL_GROUP_MEMBER& member)
+{
+	memset(&member, 0, sizeof(PVR_CHANNEL_GROUP_MEMBER));
+	reader.GetString(member.strGroupName, sizeof(member.strGroupName));
+	member.iChannelUniqueId = reader.GetUInt32();
+	member.iChannelNumber = reader.GetUInt32();
+}
+
+void WriteTimer(CSnapshotWriter& writer, const PVR_TIMER& timer)
+{
+	writer.PutUInt32(timer.iClientIndex);
+	writer.PutUInt32(timer.iParentClientIndex);
+	writer.PutInt32(timer.iClientChannelUid);
+	writer.PutInt64(timer.startTime);
+	writer.PutInt64(timer.endTime);
+	writer.PutUInt8(timer.bStartAnyTime);
+	writer.PutUInt8(timer.bEndAnyTime);
+	writer.PutInt32(timer.state);
+	writer.PutUInt32(timer.iTimerType);
+	writer.PutString(timer.strTitle);
+	writer.PutString(timer.strEpgSearchString);
+	writer.PutUInt8(timer.bFullTextEpgSearch);
+	writer.PutString(timer.strDirectory);
+	writer.PutString(timer.strSummary);
+	writer.PutInt32(timer.iPriority);
+	writer.PutInt32(timer.iLifetime);
+	writer.PutInt32(timer.iMaxRecordings);
+	writer.PutUInt32(timer.iRecordingGroup);
+	writer.PutInt64(timer.firstDay);
+	writer.PutUInt32(timer.iWeekdays);
+	writer.PutUInt32(timer.iPreventDuplicateEpisodes);
+	writer.PutUInt32(timer.iEpgUid);
+	writer.PutUInt32(timer.iMarginStart);
+	writer.PutUInt32(timer.iMarginEnd);
+	writer.PutInt32(timer.iGenreType);
+	writer.PutInt32(timer.iGenreSubType);
+}
+
+void ReadTimer(CSnapshotReader& reader, PVR_TIMER& timer)
+{
+	memset(&timer, 0, sizeof(PVR_TIMER));
+	timer.iClientIndex = reader.GetUInt32();
+	timer.iParentClientIndex = reader.GetUInt32();
+	timer.iClientChannelUid = reader.GetInt32();
+	timer.startTime = reader.GetInt64();
+	timer.endTime = reader.GetInt64();
+	timer.bStartAnyTime = reader.GetUInt8() != 0;
+	timer.bEndAnyTime = reader.GetUInt8() != 0;
+	timer.state = (PVR_TIMER_STATE) reader.GetInt32();
+	timer.iTimerType = reader.GetUInt32();
+	reader.GetString(timer.strTitle, sizeof(timer.strTitle));
+	reader.GetString(timer.strEpgSearchString, sizeof(timer.strEpgSearchString));
+	timer.bFullTextEpgSearch = reader.GetUInt8() != 0;
+	reader.GetString(timer.strDirectory, sizeof(timer.strDirectory));
+	reader.GetString(timer.strSummary, sizeof(timer.strSummary));
+	timer.iPriority = reader.GetInt32();
+	timer.iLifetime = reader.GetInt32();
+	timer.iMaxRecordings = reader.GetInt32();
+	timer.iRecordingGroup = reader.GetUInt32();
+	timer.firstDay = reader.GetInt64();
+	timer.iWeekdays = reader.GetUInt32();
+	timer.iPreventDuplicateEpisodes = reader.GetUInt32();
+	timer.iEpgUid = reader.GetUInt32();
+	timer.iMarginStart = reader.GetUInt32();
+	timer.iMarginEnd = reader.GetUInt32();
+	timer.iGenreType = reader.GetInt32();
+	timer.iGenreSubType = reader.GetInt32();
+}
+
+void WriteRecording(CSnapshotWriter& writer, const PVR_RECORDING& recording)
+{
+	writer.PutString(recording.strRecordingId);
+	writer.PutString(recording.strTitle);
+	writer.PutString(recording.strEpisodeName);
+	writer.PutInt32(recording.iSeriesNumber);
+	writer.PutInt32(recording.iEpisodeNumber);
+	writer.PutInt32(recording.iYear);
+	writer.PutString(recording.strStreamURL);
+	writer.PutString(recording.strDirectory);
+	writer.PutString(recording.strPlotOutline);
+	writer.PutString(recording.strPlot);
+	writer.PutString(recording.strChannelName);
+	writer.PutString(recording.strIconPath);
+	writer.PutString(recording.strThumbnailPath);
+	writer.PutString(recording.strFanartPath);
+	writer.PutInt64(recording.recordingTime);
+	writer.PutInt32(recording.iDuration);
+	writer.PutInt32(recording.iPriority);
+	writer.PutInt32(recording.iLifetime);
+	writer.PutInt32(recording.iGenreType);
+	writer.PutInt32(recording.iGenreSubType);
+	writer.PutInt32(recording.iPlayCount);
+	writer.PutInt32(recording.iLastPlayedPosition);
+	writer.PutUInt8(recording.bIsDeleted);
+	writer.PutUInt32(recording.iEpgEventId);
+	writer.PutInt32(recording.iChannelUid);
+	writer.PutInt32(recording.channelType);
+}
+
+void ReadRecording(CSnapshotReader& reader, PVR_RECORDING& recording)
+{
+	memset(&recording, 0, sizeof(PVR_RECORDING));
+	reader.GetString(recording.strRecordingId, sizeof(recording.strRecordingId));
+	reader.GetString(recording.strTitle, sizeof(recording.strTitle));
+	reader.GetString(recording.strEpisodeName, sizeof(recording.strEpisodeName));
+	recording.iSeriesNumber = reader.GetInt32();
+	recording.iEpisodeNumber = reader.GetInt32();
+	recording.iYear = reader.GetInt32();
+	reader.GetString(recording.strStreamURL, sizeof(recording.strStreamURL));
+	reader.GetString(recording.strDirectory, sizeof(recording.strDirectory));
+	reader.GetString(recording.strPlotOutline, sizeof(recording.strPlotOutline));
+	reader.GetString(recording.strPlot, sizeof(recording.strPlot));
+	reader.GetString(recording.strChannelName, sizeof(recording.strChannelName));
+	reader.GetString(recording.strIconPath, sizeof(recording.strIconPath));
+	reader.GetString(recording.strThumbnailPath, sizeof(recording.strThumbnailPath));
+	reader.GetString(recording.strFanartPath, sizeof(recording.strFanartPath));
+	recording.recordingTime = reader.GetInt64();
+	recording.iDuration = reader.GetInt32();
+	recording.iPriority = reader.GetInt32();
+	recording.iLifetime = reader.GetInt32();
+	recording.iGenreType = reader.GetInt32();
+	recording.iGenreSubType = reader.GetInt32();
+	recording.iPlayCount = reader.GetInt32();
+	recording.iLastPlayedPosition = reader.GetInt32();
+	recording.bIsDeleted = reader.GetUInt8() != 0;
+	recording.iEpgEventId = reader.GetUInt32();
+	recording.iChannelUid = reader.GetInt32();
+	recording.channelType = (PVR_RECORDING_CHANNEL_TYPE) reader.GetInt32();
+}
+
+static void WriteEpgEntry(CSnapshotWriter& writer, const CEpgEntry& entry)
+{
+	writer.PutUInt32(entry.tag.iUniqueBroadcastId);
+	writer.PutString(entry.strTitle);
+	writer.PutUInt32(entry.tag.iChannelNumber);
+	writer.PutInt64(entry.tag.startTime);
+	writer.PutInt64(entry.tag.endTime);
+	writer.PutString(entry.strPlotOutline);
+	writer.PutString(entry.strPlot);
+	writer.PutString(entry.strOriginalTitle);
+	writer.PutString(entry.strCast);
+	writer.PutString(entry.strDirector);
+	writer.PutString(entry.strWriter);
+	writer.PutInt32(entry.tag.iYear);
+	writer.PutString(entry.strIMDBNumber);
+	writer.PutString(entry.strIconPath);
+	writer.PutInt32(entry.tag.iGenreType);
+	writer.PutInt32(entry.tag.iGenreSubType);
+	writer.PutString(entry.strGenreDescription);
+	writer.PutInt64(entry.tag.firstAired);
+	writer.PutInt32(entry.tag.iParentalRating);
+	writer.PutInt32(entry.tag.iStarRating);
+	writer.PutUInt8(entry.tag.bNotify);
+	writer.PutInt32(entry.tag.iSeriesNumber);
+	writer.PutInt32(entry.tag.iEpisodeNumber);
+	writer.PutInt32(entry.tag.iEpisodePartNumber);
+	writer.PutString(entry.strEpisodeName);
+	writer.PutUInt32(entry.tag.iFlags);
+}
+
+static void ReadEpgEntry(CSnapshotReader& reader, CEpgEntry& entry)
+{
+	entry.tag.iUniqueBroadcastId = reader.GetUInt32();
+	entry.strTitle = reader.GetString();
+	entry.tag.iChannelNumber = reader.GetUInt32();
+	entry.tag.startTime = reader.GetInt64();
+	entry.tag.endTime = reader.GetInt64();
+	entry.strPlotOutline = reader.GetString();
+	entry.strPlot = reader.GetString();
+	entry.strOriginalTitle = reader.GetString();
+	entry.strCast = reader.GetString();
+	entry.strDirector = reader.GetString();
+	entry.strWriter = reader.GetString();
+	entry.tag.iYear = reader.GetInt32();
+	entry.strIMDBNumber = reader.GetString();
+	entry.strIconPath = reader.GetString();
+	entry.tag.iGenreType = reader.GetInt32();
+	entry.tag.iGenreSubType = reader.GetInt32();
+	entry.strGenreDescription = reader.GetString();
+	entry.tag.firstAired = reader.GetInt64();
+	entry.tag.iParentalRating = reader.GetInt32();
+	entry.tag.iStarRating = reader.GetInt32();
+	entry.tag.bNotify = reader.GetUInt8() != 0;
+	entry.tag.iSeriesNumber = reader.GetInt32();
+	entry.tag.iEpisodeNumber = reader.GetInt32();
+	entry.tag.iEpisodePartNumber = reader.GetInt32();
+	entry.strEpisodeName = reader.GetString();
+	entry.tag.iFlags = reader.GetUInt32();
+}
+
+// Only the capabilities GetAddonCapabilities fills in are kept
+static void WriteBackendInfo(CSnapshotWriter& writer, const CBackendInfo& info)
+{
+	const PVR_ADDON_CAPABILITIES& caps = info.capabilities;
+	writer.PutUInt8(caps.bSupportsEPG);
+	writer.PutUInt8(caps.bSupportsTV);
+	writer.PutUInt8(caps.bSupportsRadio);
+	writer.PutUInt8(caps.bSupportsRecordings);
+	writer.PutUInt8(caps.bSupportsRecordingsUndelete);
+	writer.PutUInt8(caps.bSupportsTimers);
+	writer.PutUInt8(caps.bSupportsChannelGroups);
+	writer.PutUInt8(caps.bSupportsChannelScan);
+	writer.PutUInt8(caps.bSupportsChannelSettings);
+	writer.PutUInt8(caps.bHandlesInputStream);
+	writer.PutUInt8(caps.bHandlesDemuxing);
+	writer.PutUInt8(caps.bSupportsRecordingPlayCount);
+	writer.PutUInt8(caps.bSupportsLastPlayedPosition);
+	writer.PutUInt8(caps.bSupportsRecordingEdl);
+	writer.PutString(info.strName);
+	writer.PutString(info.strVersion);
+	writer.PutString(info.strConnection);
+	writer.PutString(info.strHostname);
+}
+
+static void ReadBackendInfo(CSnapshotReader& reader, CBackendInfo& info)
+{
+	PVR_ADDON_CAPABILITIES& caps = info.capabilities;
+	caps.bSupportsEPG = reader.GetUInt8() != 0;
+	caps.bSupportsTV = reader.GetUInt8() != 0;
+	caps.bSupportsRadio = reader.GetUInt8() != 0;
+	caps.bSupportsRecordings = reader.GetUInt8() != 0;
+	caps.bSupportsRecordingsUndelete = reader.GetUInt8() != 0;
+	caps.bSupportsTimers = reader.GetUInt8() != 0;
+	caps.bSupportsChannelGroups = reader.GetUInt8() != 0;
+	caps.bSupportsChannelScan = reader.GetUInt8() != 0;
+	caps.bSupportsChannelSettings = reader.GetUInt8() != 0;
+	caps.bHandlesInputStream = reader.GetUInt8() != 0;
+	caps.bHandlesDemuxing = reader.GetUInt8() != 0;
+	caps.bSupportsRecordingPlayCount = reader.GetUInt8() != 0;
+	caps.bSupportsLastPlayedPosition = reader.GetUInt8() != 0;
+	caps.bSupportsRecordingEdl = reader.GetUInt8() != 0;
+	info.strName = reader.GetString();
+	info.strVersion = reader.GetString();
+	info.strConnection = reader.GetString();
+	info.strHostname = reader.GetString();
+}
+
+template <typename T>
+static void WriteList(CSnapshotWriter& writer, const vector<T>& list, void (*write)(CSnapshotWriter&, const T&))
+{
+	writer.PutUInt32(list.size());
+	for (typename vector<T>::const_iterator it = list.begin(); it != list.end(); ++it)
+		write(writer, *it);
+}
+
+template <typename T>
+static bool ReadList(CSnapshotReader& reader, vector<T>& list, void (*read)(CSnapshotReader&, T&))
+{
+	uint32_t count = reader.GetUInt32();
+	list.clear();
+	for (uint32_t i = 0; i < count && !reader.Failed(); i++) {
+		T item;
+		read(reader, item);
+		list.push_back(item);
+	}
+	return !reader.Failed();
+}
+
+// BEGIN SCOPES
+
+static bool InScope(const PVR_CHANNEL& channel, const CCatalogCapture& capture)
+{
+	return channel.bIsRadio == capture.bFlag;
+}
+
+static bool InScope(const PVR_CHANNEL_GROUP& group, const CCatalogCapture& capture)
+{
+	return group.bIsRadio == capture.bFlag;
+}
+
+static bool InScope(const PVR_CHANNEL_GROUP_MEMBER& member, const CCatalogCapture& capture)
+{
+	return capture.strGroupName == member.strGroupName;
+}
+
+static bool InScope(const PVR_TIMER& timer, const CCatalogCapture& capture)
+{
+	return true;
+}
+
+static bool InScope(const PVR_RECORDING& recording, const CCatalogCapture& capture)
+{
+	return recording.bIsDeleted == capture.bFlag;
+}
+
+static bool InScope(const CEpgEntry& entry, const CCatalogCapture& capture)
+{
+	return entry.tag.endTime >= capture.iStart && entry.tag.startTime <= capture.iEnd;
+}
+
+// Swaps the in-scope part of list for replacement, if they differ
+template <typename T>
+static bool ReplaceScope(vector<T>& list, const vector<T>& replacement, const CCatalogCapture& capture, void (*write)(CSnapshotWriter&, const T&))
+{
+	CSnapshotWriter before;
+	CSnapshotWriter after;
+	vector<T> kept;
+
+	for (typename vector<T>::const_iterator it = list.begin(); it != list.end(); ++it) {
+		if (InScope(*it, capture))
+			write(before, *it);
+		else
+			kept.push_back(*it);
+	}
+	for (typename vector<T>::const_iterator it = replacement.begin(); it != replacement.end(); ++it)
+		write(after, *it);
+
+	if (before.Data() == after.Data())
+		return false;
+
+	kept.insert(kept.end(), replacement.begin(), replacement.end());
+	list.swap(kept);
+	return true;
+}
+
+// BEGIN CLASSES
+
+CBackendInfo::CBackendInfo()
+{
+	memset(&capabilities, 0, sizeof(PVR_ADDON_CAPABILITIES));
+}
+
+CEpgEntry::CEpgEntry()
+{
+	memset(&tag, 0, sizeof(EPG_TAG));
+}
+
+static string SafeString(const char* value)
+{
+	return value ? string(value) : string();
+}
+
+CEpgEntry::CEpgEntry(const EPG_TAG& xbmcTag) :
+	tag(xbmcTag),
+	strTitle(SafeString(xbmcTag.strTitle)),
+	strPlotOutline(SafeString(xbmcTag.strPlotOutline)),
+	strPlot(SafeString(xbmcTag.strPlot)),
+	strOriginalTitle(SafeString(xbmcTag.strOriginalTitle)),
+	strCast(SafeString(xbmcTag.strCast)),
+	strDirector(SafeString(xbmcTag.strDirector)),
+	strWriter(SafeString(xbmcTag.strWriter)),
+	strIMDBNumber(SafeString(xbmcTag.strIMDBNumber)),
+	strIconPath(SafeString(xbmcTag.strIconPath)),
+	strGenreDescription(SafeString(xbmcTag.strGenreDescription)),
+	strEpisodeName(SafeString(xbmcTag.strEpisodeName))
+{
+}
+
+void CEpgEntry::ToTag(EPG_TAG& xbmcTag) const
+{
+	xbmcTag = tag;
+	xbmcTag.strTitle = strTitle.c_str();
+	xbmcTag.strPlotOutline = strPlotOutline.c_str();
+	xbmcTag.strPlot = strPlot.c_str();
+	xbmcTag.strOriginalTitle = strOriginalTitle.c_str();
+	xbmcTag.strCast = strCast.c_str();
+	xbmcTag.strDirector = strDirector.c_str();
+	xbmcTag.strWriter = strWriter.c_str();
+	xbmcTag.strIMDBNumber = strIMDBNumber.c_str();
+	xbmcTag.strIconPath = strIconPath.c_str();
+	xbmcTag.strGenreDescription = strGenreDescription.c_str();
+	xbmcTag.strEpisodeName = strEpisodeName.c_str();
+}
+
+CCatalogCapture::CCatalogCapture(CatalogList captureList) :
+	list(captureList),
+	bFlag(false),
+	iChannelUid(0),
+	iStart(0),
+	iEnd(0)
+{
+}
+
+CCatalog::CCatalog() :
+	m_bDirty(false),
+	m_iEpgDays(0),
+	m_bBackendInfoKnown(false)
+{
+	for (int i = 0; i < CATALOG_LIST_COUNT; i++) {
+		m_bStale[i] = false;
+		m_bKnown[i] = false;
+	}
+}
+
+bool CCatalog::Load(const string& strPath)
+{
+	CSnapshotReader reader;
+	if (!reader.Open(strPath, CATALOG_SNAPSHOT_MAGIC, CATALOG_SNAPSHOT_VERSION))
+		return false;
+
+	CLockObject lock(m_mutex);
+
+	if (!Read(reader)) {
+		// Checksummed but unreadable, so written by a broken build. Start afresh.
+		m_channels.clear();
+		m_groups.clear();
+		m_members.clear();
+		m_timers.clear();
+		m_recordings.clear();
+		m_epg.clear();
+		m_bBackendInfoKnown = false;
+		return false;
+	}
+
+	for (int i = 0; i < CATALOG_LIST_COUNT; i++) {
+		m_bStale[i] = true;
+		m_bKnown[i] = true;
+	}
+	m_bDirty = false;
+	return true;
+}
+
+bool CCatalog::Save(const string& strPath)
+{
+	CSnapshotWriter writer;
+	{
+		CLockObject lock(m_mutex);
+		Write(writer);
+		m_bDirty = false;
+	}
+
+	if (!writer.Save(strPath, CATALOG_SNAPSHOT_MAGIC, CATALOG_SNAPSHOT_VERSION)) {
+		CLockObject lock(m_mutex);
+		m_bDirty = true;
+		return false;
+	}
+	return true;
+}
+
+bool CCatalog::IsDirty()
+{
+	CLockObject lock(m_mutex);
+	return m_bDirty;
+}
+
+void CCatalog::Write(CSnapshotWriter& writer)
+{
+	WriteList(writer, m_channels, WriteChannel);
+	WriteList(writer, m_groups, WriteChannelGroup);
+	WriteList(writer, m_members, WriteChannelGroupMember);
+	WriteList(writer, m_timers, WriteTimer);
+	WriteList(writer, m_recordings, WriteRecording);
+
+	// Programmes which have already finished are not worth keeping
+	time_t now = time(NULL);
+	writer.PutUInt32(m_epg.size());
+	for (map<unsigned int, vector<CEpgEntry> >::const_iterator it = m_epg.begin(); it != m_epg.end(); ++it) {
+		vector<CEpgEntry> current;
+		for (vector<CEpgEntry>::const_iterator entry = it->second.begin(); entry != it->second.end(); ++entry) {
+			if (entry->tag.endTime >= now)
+				current.push_back(*entry);
+		}
+		writer.PutUInt32(it->first);
+		WriteList(writer, current, WriteEpgEntry);
+	}
+
+	writer.PutUInt8(m_bBackendInfoKnown);
+	WriteBackendInfo(writer, m_backendInfo);
+}
+
+bool CCatalog::Read(CSnapshotReader& reader)
+{
+	if (!ReadList(reader, m_channels, ReadChannel)
+		|| !ReadList(reader, m_groups, ReadChannelGroup)
+		|| !ReadList(reader, m_members, ReadChannelGroupMember)
+		|| !ReadList(reader, m_timers, ReadTimer)
+		|| !ReadList(reader, m_recordings, ReadRecording))
+		return false;
+
+	m_epg.clear();
+	uint32_t channelCount = reader.GetUInt32();
+	for (uint32_t i = 0; i < channelCount && !reader.Failed(); i++) {
+		unsigned int iChannelUid = reader.GetUInt32();
+		ReadList(reader, m_epg[iChannelUid], ReadEpgEntry);
+	}
+
+	m_bBackendInfoKnown = reader.GetUInt8() != 0;
+	ReadBackendInfo(reader, m_backendInfo);
+
+	return !reader.Failed() && reader.AtEnd();
+}
+
+bool CCatalog::Commit(const CCatalogCapture& capture)
+{
+	CLockObject lock(m_mutex);
+
+	bool changed = false;
+	switch (capture.list) {
+		case CATALOG_CHANNELS:
+			changed = ReplaceScope(m_channels, capture.channels, capture, WriteChannel);
+			break;
+		case CATALOG_CHANNEL_GROUPS:
+			changed = ReplaceScope(m_groups, capture.groups, capture, WriteChannelGroup);
+			break;
+		case CATALOG_CHANNEL_GROUP_MEMBERS:
+			changed = ReplaceScope(m_members, capture.members, capture, WriteChannelGroupMember);
+			break;
+		case CATALOG_TIMERS:
+			changed = ReplaceScope(m_timers, capture.timers, capture, WriteTimer);
+			break;
+		case CATALOG_RECORDINGS:
+			changed = ReplaceScope(m_recordings, capture.recordings, capture, WriteRecording);
+			break;
+		case CATALOG_EPG:
+			changed = ReplaceScope(m_epg[capture.iChannelUid], capture.epg, capture, WriteEpgEntry);
+			TrimEpg(m_epg[capture.iChannelUid]);
+			break;
+		default:
+			break;
+	}
+
+	m_bKnown[capture.list] = true;
+	if (changed)
+		m_bDirty = true;
+	return changed;
+}
+
+void CCatalog::SetBackendInfo(const CBackendInfo& info)
+{
+	CSnapshotWriter before;
+	CSnapshotWriter after;
+	WriteBackendInfo(after, info);
+
+	CLockObject lock(m_mutex);
+	WriteBackendInfo(before, m_backendInfo);
+	if (!m_bBackendInfoKnown || before.Data() != after.Data())
+		m_bDirty = true;
+	m_backendInfo = info;
+	m_bBackendInfoKnown = true;
+}
+
+bool CCatalog::GetBackendInfo(CBackendInfo& info)
+{
+	CLockObject lock(m_mutex);
+	if (!m_bBackendInfoKnown)
+		return false;
+	info = m_backendInfo;
+	return true;
+}
+
+void CCatalog::SetEpgWindow(int iDays)
+{
+	CLockObject lock(m_mutex);
+	m_iEpgDays = iDays;
+}
+
+// Drops the programmes that have finished or lie beyond the EPG window, so
+// a long-running Kodi doesn't keep every guide it was ever sent
+void CCatalog::TrimEpg(vector<CEpgEntry>& epg)
+{
+	time_t now = time(NULL);
+	time_t horizon = now + (time_t) m_iEpgDays * 24 * 60 * 60;
+	vector<CEpgEntry> kept;
+	for (vector<CEpgEntry>::const_iterator it = epg.begin(); it != epg.end(); ++it) {
+		if (it->tag.endTime >= now && (m_iEpgDays <= 0 || it->tag.startTime <= horizon))
+			kept.push_back(*it);
+	}
+	if (kept.size() != epg.size())
+		epg.swap(kept);
+}
+
+bool CCatalog::IsStale(CatalogList list)
+{
+	CLockObject lock(m_mutex);
+	return m_bStale[list];
+}
+
+void CCatalog::SetStale(CatalogList list, bool bStale)
+{
+	CLockObject lock(m_mutex);
+	m_bStale[list] = bStale;
+}
+
+// BEGIN TRANSFERS
+
+void CCatalog::TransferChannels(ADDON_HANDLE handle, bool bRadio)
+{
+	CLockObject lock(m_mutex);
+	for (vector<PVR_CHANNEL>::const_iterator it = m_channels.begin(); it != m_channels.end(); ++it) {
+		if (it->bIsRadio == bRadio)
+			PVR->TransferChannelEntry(handle, &(*it));
+	}
+}
+
+void CCatalog::TransferChannelGroups(ADDON_HANDLE handle, bool bRadio)
+{
+	CLockObject lock(m_mutex);
+	for (vector<PVR_CHANNEL_GROUP>::const_iterator it = m_groups.begin(); it != m_groups.end(); ++it) {
+		if (it->bIsRadio == bRadio)
+			PVR->TransferChannelGroup(handle, &(*it));
+	}
+}
+
+void CCatalog::TransferChannelGroupMembers(ADDON_HANDLE handle, const string& strGroupName)
+{
+	CLockObject lock(m_mutex);
+	for (vector<PVR_CHANNEL_GROUP_MEMBER>::const_iterator it = m_members.begin(); it != m_members.end(); ++it) {
+		if (strGroupName == it->strGroupName)
+			PVR->TransferChannelGroupMember(handle, &(*it));
+	}
+}
+
+void CCatalog::TransferRecordings(ADDON_HANDLE handle, bool bDeleted)
+{
+	CLockObject lock(m_mutex);
+	for (vector<PVR_RECORDING>::const_iterator it = m_recordings.begin(); it != m_recordings.end(); ++it) {
+		if (it->bIsDeleted == bDeleted)
+			PVR->TransferRecordingEntry(handle, &(*it));
+	}
+}
+
+void CCatalog::TransferEpg(ADDON_HANDLE handle, unsigned int iChannelUid, time_t iStart, time_t iEnd)
+{
+	CLockObject lock(m_mutex);
+	map<unsigned int, vector<CEpgEntry> >::const_iterator channel = m_epg.find(iChannelUid);
+	if (channel == m_epg.end())
+		return;
+
+	for (vector<CEpgEntry>::const_iterator it = channel->second.begin(); it != channel->second.end(); ++it) {
+		if (it->tag.endTime >= iStart && it->tag.startTime <= iEnd) {
+			EPG_TAG xbmcTag;
+			it->ToTag(xbmcTag);
+			PVR->TransferEpgEntry(handle, &xbmcTag);
+		}
+	}
+}
+
+bool CCatalog::Transfer(ADDON_HANDLE handle, const CCatalogCapture& scope)
+{
+	{
+		CLockObject lock(m_mutex);
+		if (!m_bKnown[scope.list] || (scope.list == CATALOG_EPG && m_epg.find(scope.iChannelUid) == m_epg.end()))
+			return false;
+	}
+
+	switch (scope.list) {
+		case CATALOG_CHANNELS:
+			TransferChannels(handle, scope.bFlag);
+			return true;
+		case CATALOG_CHANNEL_GROUPS:
+			TransferChannelGroups(handle, scope.bFlag);
+			return true;
+		case CATALOG_CHANNEL_GROUP_MEMBERS:
+			TransferChannelGroupMembers(handle, scope.strGroupName);
+			return true;
+		case CATALOG_RECORDINGS:
+			TransferRecordings(handle, scope.bFlag);
+			return true;
+		case CATALOG_EPG:
+			TransferEpg(handle, scope.iChannelUid, scope.iStart, scope.iEnd);
+			return true;
+		default:
+			// Timers are served from the timer store
+			return false;
+	}
+}
+
+void CCatalogCapture::Transfer(ADDON_HANDLE handle) const
+{
+	for (vector<PVR_CHANNEL>::const_iterator it = channels.begin(); it != channels.end(); ++it)
+		PVR->TransferChannelEntry(handle, &(*it));
+	for (vector<PVR_CHANNEL_GROUP>::const_iterator it = groups.begin(); it != groups.end(); ++it)
+		PVR->TransferChannelGroup(handle, &(*it));
+	for (vector<PVR_CHANNEL_GROUP_MEMBER>::const_iterator it = members.begin(); it != members.end(); ++it)
+		PVR->TransferChannelGroupMember(handle, &(*it));
+	for (vector<PVR_TIMER>::const_iterator it = timers.begin(); it != timers.end(); ++it)
+		PVR->TransferTimerEntry(handle, &(*it));
+	for (vector<PVR_RECORDING>::const_iterator it = recordings.begin(); it != recordings.end(); ++it)
+		PVR->TransferRecordingEntry(handle, &(*it));
+	for (vector<CEpgEntry>::const_iterator it = epg.begin(); it != epg.end(); ++it) {
+		EPG_TAG xbmcTag;
+		it->ToTag(xbmcTag);
+		PVR->TransferEpgEntry(handle, &xbmcTag);
+	}
+}
+
+int CCatalog::GetChannelsAmount()
+{
+	CLockObject lock(m_mutex);
+	return m_channels.size();
+}
+
+int CCatalog::GetRecordingsAmount(bool bDeleted)
+{
+	CLockObject lock(m_mutex);
+	int count = 0;
+	for (vector<PVR_RECORDING>::const_iterator it = m_recordings.begin(); it != m_recordings.end(); ++it) {
+		if (it->bIsDeleted == bDeleted)
+			count++;
+	}
+	return count;
+}
+
+vector<PVR_CHANNEL> CCatalog::GetChannels()
+{
+	CLockObject lock(m_mutex);
+	return m_channels;
+}
+
+vector<PVR_CHANNEL_GROUP> CCatalog::GetChannelGroups()
+{
+	CLockObject lock(m_mutex);
+	return m_groups;
+}
+
+vector<unsigned int> CCatalog::GetEpgChannels()
+{
+	CLockObject lock(m_mutex);
+	vector<unsigned int> channels;
+	for (map<unsigned int, vector<CEpgEntry> >::const_iterator it = m_epg.begin(); it != m_epg.end(); ++it)
+		channels.push_back(it->first);
+	return channels;
+}
+
+vector<CEpgEntry> CCatalog::GetEpg(unsigned int iChannelUid)
+{
+	CLockObject lock(m_mutex);
+	map<unsigned int, vector<CEpgEntry> >::const_iterator it = m_epg.find(iChannelUid);
+	return (it != m_epg.end()) ? it->second : vector<CEpgEntry>();
+}
@@ -0,0 +1,177 @@
+#pragma once
+/*
+ *  pvr.python - A PVR client for Kodi using Python
+ *  Copyright © 2016 RunasSudo (Yingtong Li)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "client.h"
+
+#include <p8-platform/threads/mutex.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+class CSnapshotReader;
+class CSnapshotWriter;
+
+// Bumped whenever the layout written by CCatalog::Save changes
+#define CATALOG_SNAPSHOT_VERSION 2
+
+enum CatalogList
+{
+	CATALOG_CHANNELS = 0,
+	CATALOG_CHANNEL_GROUPS,
+	CATALOG_CHANNEL_GROUP_MEMBERS,
+	CATALOG_TIMERS,
+	CATALOG_RECORDINGS,
+	CATALOG_EPG,
+	CATALOG_LIST_COUNT
+};
+
+// EPG_TAG only holds pointers, so keep our own copies of the strings
+struct CEpgEntry
+{
+	CEpgEntry();
+	CEpgEntry(const EPG_TAG& tag);
+
+	// The pointers in tag stay valid for as long as this entry is unchanged
+	void ToTag(EPG_TAG& tag) const;
+
+	EPG_TAG tag;
+	std::string strTitle;
+	std::string strPlotOutline;
+	std::string strPlot;
+	std::string strOriginalTitle;
+	std::string strCast;
+	std::string strDirector;
+	std::string strWriter;
+	std::string strIMDBNumber;
+	std::string strIconPath;
+	std::string strGenreDescription;
+	std::string strEpisodeName;
+};
+
+// What the backend says about itself, so Kodi can be answered while it starts
+struct CBackendInfo
+{
+	CBackendInfo();
+
+	PVR_ADDON_CAPABILITIES capabilities;
+	std::string strName;
+	std::string strVersion;
+	std::string strConnection;
+	std::string strHostname;
+};
+
+// Collects the entries transferred by one _cGet* call, along with which part
+// of the catalog they replace
+class CCatalogCapture
+{
+public:
+	CCatalogCapture(CatalogList list);
+
+	CatalogList list;
+	bool bFlag;                // bRadio or bDeleted, depending on the list
+	std::string strGroupName;  // CATALOG_CHANNEL_GROUP_MEMBERS
+	unsigned int iChannelUid;  // CATALOG_EPG
+	time_t iStart;             // CATALOG_EPG
+	time_t iEnd;               // CATALOG_EPG
+
+	std::vector<PVR_CHANNEL> channels;
+	std::vector<PVR_CHANNEL_GROUP> groups;
+	std::vector<PVR_CHANNEL_GROUP_MEMBER> members;
+	std::vector<PVR_TIMER> timers;
+	std::vector<PVR_RECORDING> recordings;
+	std::vector<CEpgEntry> epg;
+
+	// Hands the captured entries to Kodi
+	void Transfer(ADDON_HANDLE handle) const;
+};
+
+// Field-by-field serialisation, shared with the other native stores
+void WriteTimer(CSnapshotWriter& writer, const PVR_TIMER& timer);
+void ReadTimer(CSnapshotReader& reader, PVR_TIMER& timer);
+void WriteRecording(CSnapshotWriter& writer, const PVR_RECORDING& recording);
+void ReadRecording(CSnapshotReader& reader, PVR_RECORDING& recording);
+
+// The last known state of everything Kodi has pulled from the backend. This is
+// persisted to userPath so it can be served straight away on the next start,
+// while the backend catches up in the background.
+class CCatalog
+{
+public:
+	CCatalog();
+
+	bool Load(const std::string& strPath);
+	bool Save(const std::string& strPath);
+	bool IsDirty();
+
+	// Replaces the captured part of the catalog. Returns whether anything changed.
+	bool Commit(const CCatalogCapture& capture);
+
+	// A list is stale when it was loaded from a snapshot and has not been
+	// revalidated against the backend yet
+	bool IsStale(CatalogList list);
+	void SetStale(CatalogList list, bool bStale);
+
+	void SetBackendInfo(const CBackendInfo& info);
+	// Returns false if the backend has never been asked
+	bool GetBackendInfo(CBackendInfo& info);
+
+	// How many days ahead programmes are kept, as Kodi's iEpgMaxDays. 0 or
+	// less keeps everything that hasn't finished yet.
+	void SetEpgWindow(int iDays);
+
+	void TransferChannels(ADDON_HANDLE handle, bool bRadio);
+	void TransferChannelGroups(ADDON_HANDLE handle, bool bRadio);
+	void TransferChannelGroupMembers(ADDON_HANDLE handle, const std::string& strGroupName);
+	void TransferRecordings(ADDON_HANDLE handle, bool bDeleted);
+	void TransferEpg(ADDON_HANDLE handle, unsigned int iChannelUid, time_t iStart, time_t iEnd);
+
+	// Transfers the part of the catalog that scope would replace. Returns
+	// false if the catalog has never held it.
+	bool Transfer(ADDON_HANDLE handle, const CCatalogCapture& scope);
+
+	int GetChannelsAmount();
+	int GetRecordingsAmount(bool bDeleted);
+
+	std::vector<PVR_CHANNEL> GetChannels();
+	std::vector<PVR_CHANNEL_GROUP> GetChannelGroups();
+	std::vector<unsigned int> GetEpgChannels();
+	std::vector<CEpgEntry> GetEpg(unsigned int iChannelUid);
+
+private:
+	void Write(CSnapshotWriter& writer);
+	bool Read(CSnapshotReader& reader);
+	void TrimEpg(std::vector<CEpgEntry>& epg);
+
+	P8PLATFORM::CMutex m_mutex;
+	bool m_bStale[CATALOG_LIST_COUNT];
+	bool m_bKnown[CATALOG_LIST_COUNT]; // Loaded or committed at least once
+	bool m_bDirty;
+	int m_iEpgDays;
+
+	std::vector<PVR_CHANNEL> m_channels;
+	std::vector<PVR_CHANNEL_GROUP> m_groups;
+	std::vector<PVR_CHANNEL_GROUP_MEMBER> m_members;
+	std::vector<PVR_TIMER> m_timers;
+	std::vector<PVR_RECORDING> m_recordings;
+	std::map<unsigned int, std::vector<CEpgEntry> > m_epg; // By channel uid
+	bool m_bBackendInfoKnown;
+	CBackendInfo m_backendInfo;
+};
@@ -20,29 +20,106 @@
 #include <Python.h>
 
 #include "client.h"
+#include "calls.h"
+#include "catalog.h"
+#include "epgsearch.h"
+#include "hds.h"
+#include "multicast.h"
+#include "recorder.h"
+#include "recordings.h"
+#include "streamprops.h"
+#include "streams.h"
+#include "timers.h"
+#include "trace.h"
 #include "xbmc_pvr_dll.h"
+#include <p8-platform/threads/threads.h>
 #include <p8-platform/util/util.h>
 
+#include <stdarg.h>
+#include <string.h>
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
 using namespace std;
 using namespace ADDON;
+using namespace P8PLATFORM;
 
 CHelper_libXBMC_addon *XBMC = NULL;
 CHelper_libXBMC_pvr *PVR = NULL;
+CHelper_libXBMC_codec *CODEC = NULL;
 
 PyThreadState* pyState;
 PyObject* pvrImpl;
-void* streamHandle;
 
-ADDON_HANDLE addon_handle;
+// Every thread that has called into Python, other than the one that created the interpreter
+CMutex pyThreadStatesMutex;
+vector<PyThreadState*> pyThreadStates;
+unsigned int pyGeneration = 0;
+
+CStreamSlot liveStream;
+CStreamSlot recordedStream;
+atomic<int> lastChannelUid(PVR_CHANNEL_INVALID_UID); // Kept after the stream closes, to be first in line after a wake
+atomic<int> streamsOpening(0);
+atomic<bool> backendReady(false); // Set once the Python ADDON_Create has succeeded; until then nothing may call the backend
+
+string userPath;
+string clientPath;
+int epgMaxDays;
+
+CCatalog catalog;
+string catalogPath;
+
+CEpgSearchIndex epgIndex;
+
+CTimerStore timerStore;
+string timersPath;
+
+CRecordingsIndex* recordingsIndex = NULL;
+CRecorder* recorder = NULL;
+
+CStreamPropertiesCache streamProperties;
+string streamPropertiesPath;
+
+string tracePath;
 
 extern "C" {
 
+// When tracing, calls go into the trace instead of the log
+#if PVRPYTHON_TRACE_LEVEL >= 1
+#define MAYBE_LOG_CALL() TRACE_CALL();
+#else
 #define MAYBE_LOG_CALL() XBMC->Log(LOG_DEBUG, "%s - Called", __FUNCTION__);
+#endif
 #define MAYBE_LOG_NYI() XBMC->Log(LOG_DEBUG, "%s - NYI", __FUNCTION__);
 
-#define PYTHON_LOCK() PyEval_AcquireLock(); PyThreadState_Swap(pyState);
+#define PYTHON_LOCK() { TRACE_WAIT_BEGIN(); PyEval_AcquireLock(); TRACE_WAIT_END("PYTHON_LOCK"); } PyThreadState_Swap(pyThreadState());
 #define PYTHON_UNLOCK() PyThreadState_Swap(NULL); PyEval_ReleaseLock();
 
+// Kodi calls us from several threads, and Python needs a thread state for
+// each of them. They're made on first use and kept until the interpreter goes.
+// The Python lock must be held.
+PyThreadState* pyThreadState() {
+	static thread_local PyThreadState* state = NULL;
+	static thread_local unsigned int generation = 0;
+	if (state == NULL || generation != pyGeneration) {
+		state = PyThreadState_New(pyState->interp);
+		generation = pyGeneration;
+		CLockObject lock(pyThreadStatesMutex);
+		pyThreadStates.push_back(state);
+	}
+	return state;
+}
+
+// Counts the streams being opened, so background work can make way for them
+struct CStreamOpening
+{
+	CStreamOpening() { streamsOpening++; }
+	~CStreamOpening() { streamsOpening--; }
+};
+
 // BEGIN PYTHON<->C HELPER FUNCTIONS
 
 long PyInt_AsLong_DR(PyObject* obj) {
@@ -85,27 +162,44 @@ char* PyString_SafeAsString_DR(PyObject* obj) {
 	return val;
 }
 
-// You must Py_DECREF the return value once you're done!
+// Copies into a fixed-size field, cutting the string short if it has to
+void PyString_CopyTo_DR(PyObject* obj, char* dest, size_t size) {
+	char* val = PyString_SafeAsString_DR(obj);
+	strncpy(dest, val, size - 1);
+	dest[size - 1] = '\0';
+	free(val);
+}
+
+// Builds the arguments for a call from a Py_BuildValue format, or NULL for
+// none. The Python lock must be held.
+PyObject* pyBuildArgs(const char* format, va_list args) {
+	return (format != NULL) ? Py_VaBuildValue(format, args) : NULL;
+}
+
+// You must Py_DECREF the return value once you're done! args is consumed.
+// Errors are printed and come back as None.
 PyObject* pyCall(PyObject* obj, const char* func, PyObject* args) {
+	PyObject* pyArgs = (args != NULL) ? args : PyTuple_New(0);
 	PyObject* pyFunc = PyObject_GetAttrString(obj, func);
-	PyObject* pyArgs = args;
-	if (args == NULL) {
-		pyArgs = PyTuple_New(0);
+	PyObject* pyReturnValue = (pyFunc != NULL) ? PyObject_CallObject(pyFunc, pyArgs) : NULL;
+	Py_XDECREF(pyFunc);
+	Py_XDECREF(pyArgs);
+	if (pyReturnValue == NULL) {
+		if (PyErr_Occurred() != NULL) { PyErr_Print(); PyErr_Clear(); }
+		Py_INCREF(Py_None);
+		return Py_None;
 	}
-	PyObject* pyReturnValue = PyObject_CallObject(pyFunc, pyArgs);
-	if (PyErr_Occurred() != NULL) { PyErr_Print(); PyErr_Clear(); Py_INCREF(Py_None); PYTHON_UNLOCK(); return Py_None; }
-	if (args == NULL) {
-		Py_DECREF(pyArgs);
-	}
-	Py_DECREF(pyFunc);
 	
 	return pyReturnValue;
 }
 
 // You must Py_DECREF the return value once you're done!
-PyObject* pyLockCall(PyObject* obj, const char* func, PyObject* args) {
+PyObject* pyLockCall(PyObject* obj, const char* func, const char* format, ...) {
 	PYTHON_LOCK();
-	PyObject* pyReturnValue = pyCall(obj, func, args);
+	va_list args;
+	va_start(args, format);
+	PyObject* pyReturnValue = pyCall(obj, func, pyBuildArgs(format, args));
+	va_end(args);
 	PYTHON_UNLOCK();
 	return pyReturnValue;
 }
@@ -117,9 +211,12 @@ char* pyCallString(PyObject* obj, const char* func, PyObject* args) {
 	return returnValue;
 }
 
-char* pyLockCallString(PyObject* obj, const char* func, PyObject* args) {
+char* pyLockCallString(PyObject* obj, const char* func, const char* format, ...) {
 	PYTHON_LOCK();
-	char* returnValue = pyCallString(obj, func, args);
+	va_list args;
+	va_start(args, format);
+	char* returnValue = pyCallString(obj, func, pyBuildArgs(format, args));
+	va_end(args);
 	PYTHON_UNLOCK();
 	return returnValue;
 }
@@ -131,16 +228,22 @@ int pyCallInt(PyObject* obj, const char* func, PyObject* args) {
 	return returnValue;
 }
 
-int pyLockCallInt(PyObject* obj, const char* func, PyObject* args) {
+int pyLockCallInt(PyObject* obj, const char* func, const char* format, ...) {
 	PYTHON_LOCK();
-	int returnValue = pyCallInt(obj, func, args);
+	va_list args;
+	va_start(args, format);
+	int returnValue = pyCallInt(obj, func, pyBuildArgs(format, args));
+	va_end(args);
 	PYTHON_UNLOCK();
 	return returnValue;
 }
 
-PVR_ERROR pyLockCallPVRError(PyObject* obj, const char* func, PyObject* args) {
+PVR_ERROR pyLockCallPVRError(PyObject* obj, const char* func, const char* format, ...) {
 	PYTHON_LOCK();
-	int returnValue = pyCallInt(obj, func, args);
+	va_list args;
+	va_start(args, format);
+	int returnValue = pyCallInt(obj, func, pyBuildArgs(format, args));
+	va_end(args);
 	PYTHON_UNLOCK();
 	return ((PVR_ERROR) returnValue);
 }
@@ -152,15 +255,496 @@ bool pyCallBool(PyObject* obj, const char* func, PyObject* args) {
 	return returnValue;
 }
 
-bool pyLockCallBool(PyObject* obj, const char* func, PyObject* args) {
+bool pyLockCallBool(PyObject* obj, const char* func, const char* format, ...) {
+	PYTHON_LOCK();
+	va_list args;
+	va_start(args, format);
+	bool returnValue = pyCallBool(obj, func, pyBuildArgs(format, args));
+	va_end(args);
+	PYTHON_UNLOCK();
+	return returnValue;
+}
+
+// Where the entries transferred by one _cGet* call go. Python gets it as an
+// opaque handle to pass back, so concurrent calls can't mix up their entries.
+struct CTransferContext
+{
+	ADDON_HANDLE handle;       // Kodi's, or NULL if only capturing
+	CCatalogCapture* capture;
+};
+
+#define TRANSFER_CONTEXT_NAME "pvr.python.transfer"
+#define TRANSFER_CONTEXT_DONE_NAME "pvr.python.transfer.done"
+
+// Brings the search index in line with the catalog's EPG for a channel, and
+// the guide search timers in line with the index
+void UpdateEpgIndex(unsigned int iChannelUid) {
+	if (epgIndex.Update(iChannelUid, catalog.GetEpg(iChannelUid)) && timerStore.RefreshEpgSearches()) {
+		PVR->TriggerTimerUpdate();
+	}
+}
+
+// Calls one of the _cGet* functions. The Python lock must be held; pyArgs is consumed.
+PVR_ERROR pyCallTransfer(ADDON_HANDLE handle, CCatalogCapture& capture, const char* func, PyObject* pyArgs) {
+	CTransferContext context;
+	context.handle = handle;
+	context.capture = &capture;
+	
+	PyObject* pyHandle = PyCapsule_New(&context, TRANSFER_CONTEXT_NAME, NULL);
+	PyObject* pyAllArgs = PyTuple_New(1 + (pyArgs != NULL ? PyTuple_Size(pyArgs) : 0));
+	PyTuple_SET_ITEM(pyAllArgs, 0, pyHandle);
+	for (Py_ssize_t i = 1; i < PyTuple_Size(pyAllArgs); i++) {
+		PyObject* pyArg = PyTuple_GET_ITEM(pyArgs, i - 1);
+		Py_INCREF(pyArg);
+		PyTuple_SET_ITEM(pyAllArgs, i, pyArg);
+	}
+	Py_XDECREF(pyArgs);
+	
+	// Keep the capsule from outliving the context, in case Python held on to it
+	Py_INCREF(pyHandle);
+	PVR_ERROR returnValue = (PVR_ERROR) pyCallInt(pvrImpl, func, pyAllArgs);
+	PyCapsule_SetName(pyHandle, TRANSFER_CONTEXT_DONE_NAME);
+	Py_DECREF(pyHandle);
+	return returnValue;
+}
+
+// Keeps what a _cGet* call transferred. Only a complete list can replace what
+// we have. Returns whether anything changed.
+bool CommitTransfer(const CCatalogCapture& capture, PVR_ERROR returnValue) {
+	bool listChanged = (returnValue == PVR_ERROR_NO_ERROR) && catalog.Commit(capture);
+	if (listChanged && capture.list == CATALOG_EPG) {
+		UpdateEpgIndex(capture.iChannelUid);
+	}
+	return listChanged;
+}
+
+PVR_ERROR pyLockCallTransferV(ADDON_HANDLE handle, CCatalogCapture& capture, bool* changed, const char* func, const char* format, va_list args) {
+	PYTHON_LOCK();
+	PVR_ERROR returnValue = pyCallTransfer(handle, capture, func, pyBuildArgs(format, args));
+	PYTHON_UNLOCK();
+	
+	bool listChanged = CommitTransfer(capture, returnValue);
+	if (changed != NULL) {
+		*changed = listChanged;
+	}
+	return returnValue;
+}
+
+// Calls one of the _cGet* functions. The transferred entries go to Kodi (unless
+// handle is NULL) and into the catalog.
+PVR_ERROR pyLockCallTransfer(ADDON_HANDLE handle, CCatalogCapture& capture, const char* func, const char* format, ...) {
+	va_list args;
+	va_start(args, format);
+	PVR_ERROR returnValue = pyLockCallTransferV(handle, capture, NULL, func, format, args);
+	va_end(args);
+	return returnValue;
+}
+
+// BEGIN DEADLINES
+
+// Calls Kodi waits on are made on the pool, so Kodi can stop waiting on a
+// backend that hangs. Threads stuck in such calls aren't reused until they return.
+#define CALL_POOL_THREADS 8
+
+#define PYTHON_CALL_NAME "pvr.python.call"
+
+// Raised in a call that missed its deadline. It isn't an Exception, so a bare
+// "except Exception" in the backend doesn't swallow it.
+PyObject* pyDeadlineExceeded = NULL;
+
+// In ms, by function name without the _c. Functions without one are waited on for as long as they take.
+CMutex callDeadlinesMutex;
+map<string, uint32_t> callDeadlines;
+
+CCallPool callPool(CALL_POOL_THREADS);
+
+// After three missed deadlines in a row, one call is tried every 30 seconds
+// (backing off to 10 minutes) until the backend responds in time again
+CCircuitBreaker backendBreaker(3, 30 * 1000, 10 * 60 * 1000);
+
+uint32_t CallDeadlineMs(const char* func) {
+	if (strncmp(func, "_c", 2) == 0) {
+		func += 2;
+	}
+	CLockObject lock(callDeadlinesMutex);
+	map<string, uint32_t>::const_iterator it = callDeadlines.find(func);
+	return (it != callDeadlines.end()) ? it->second : 0;
+}
+
+// Reads the deadlines from the backend's GetCallDeadlines, in seconds. The Python lock must be held.
+void pyLoadCallDeadlines() {
+	map<string, uint32_t> deadlines;
+	PyObject* pyDeadlines = pyCall(pvrImpl, "GetCallDeadlines", NULL);
+	if (PyDict_Check(pyDeadlines)) {
+		PyObject* pyKey;
+		PyObject* pyValue;
+		Py_ssize_t pos = 0;
+		while (PyDict_Next(pyDeadlines, &pos, &pyKey, &pyValue)) {
+			double seconds = PyFloat_AsDouble(pyValue);
+			if (PyErr_Occurred() != NULL || !PyString_Check(pyKey)) {
+				PyErr_Clear();
+				continue;
+			}
+			if (seconds > 0) {
+				deadlines[PyString_AsString(pyKey)] = (uint32_t) (seconds * 1000);
+			}
+		}
+	}
+	Py_DECREF(pyDeadlines);
+	
+	CLockObject lock(callDeadlinesMutex);
+	callDeadlines.swap(deadlines);
+}
+
+// A call into Python made on the pool. Cancelling it raises DeadlineExceeded
+// from a profile hook at the next function call or return in that thread, so
+// it never has to wait for the Python lock. A call blocked in a socket read is
+// stopped once the read returns or times out.
+class CPythonCall : public CDeadlineCall
+{
+public:
+	CPythonCall() : m_bCancelled(false) {}
+	
+	virtual void Run() {
+		PYTHON_LOCK();
+		PyObject* pyContext = PyCapsule_New(this, PYTHON_CALL_NAME, NULL);
+		PyEval_SetProfile(ProfileHook, pyContext);
+		Py_DECREF(pyContext);
+		RunPython();
+		PyEval_SetProfile(NULL, NULL);
+		// Don't leave a stray error (say, from converting the None a cancelled
+		// call returns) for the next call on this thread
+		if (PyErr_Occurred() != NULL) { PyErr_Clear(); }
+		PYTHON_UNLOCK();
+		Finish();
+	}
+	
+	virtual void Cancel() {
+		m_bCancelled = true;
+	}
+	
+protected:
+	// Runs with the Python lock held
+	virtual void RunPython() = 0;
+	
+	// Runs once the Python lock has been released again
+	virtual void Finish() {}
+	
+private:
+	// Raises once per cancellation, so the backend's finally blocks can still clean up
+	static int ProfileHook(PyObject* pyContext, struct _frame* frame, int what, PyObject* arg) {
+		CPythonCall* call = (CPythonCall*) PyCapsule_GetPointer(pyContext, PYTHON_CALL_NAME);
+		if (call == NULL || !call->m_bCancelled.exchange(false)) {
+			return 0;
+		}
+		PyErr_SetString(pyDeadlineExceeded, "the call missed its deadline");
+		return -1;
+	}
+	
+	atomic<bool> m_bCancelled;
+};
+
+// Makes a call on the pool, waiting at most iDeadlineMs. Returns false if it
+// missed its deadline, or wasn't made because the backend keeps missing them.
+bool RunTimedCall(CPythonCall* call, const char* func, uint32_t iDeadlineMs) {
+	if (!backendBreaker.Allow()) {
+		XBMC->Log(LOG_DEBUG, "%s - Not calling %s while the backend keeps missing its deadlines", __FUNCTION__, func);
+		return false;
+	}
+	if (callPool.Run(call, iDeadlineMs)) {
+		backendBreaker.Succeeded();
+		return true;
+	}
+	
+	XBMC->Log(LOG_ERROR, "%s - %s missed its deadline of %u ms", __FUNCTION__, func, iDeadlineMs);
+	if (backendBreaker.Failed()) {
+		XBMC->Log(LOG_ERROR, "%s - The backend keeps missing its deadlines, turning calls away for a while", __FUNCTION__);
+	}
+	return false;
+}
+
+// Lets Kodi know a list it was answered without has arrived after all
+void TriggerListUpdate(const CCatalogCapture& capture) {
+	switch (capture.list) {
+		case CATALOG_CHANNELS:
+			PVR->TriggerChannelUpdate();
+			break;
+		case CATALOG_CHANNEL_GROUPS:
+		case CATALOG_CHANNEL_GROUP_MEMBERS:
+			PVR->TriggerChannelGroupsUpdate();
+			break;
+		case CATALOG_TIMERS:
+			PVR->TriggerTimerUpdate();
+			break;
+		case CATALOG_RECORDINGS:
+			PVR->TriggerRecordingUpdate();
+			break;
+		case CATALOG_EPG:
+			PVR->TriggerEpgUpdate(capture.iChannelUid);
+			break;
+		default:
+			break;
+	}
+}
+
+// One of the _cGet* functions made for Kodi. The entries are only captured
+// while it runs, and handed to Kodi once it has made its deadline.
+class CTransferCall : public CPythonCall
+{
+public:
+	// Takes over the reference to pyArgs
+	CTransferCall(const CCatalogCapture& capture, const char* func, PyObject* pyArgs) :
+		m_capture(capture),
+		m_func(func),
+		m_pyArgs(pyArgs),
+		m_returnValue(PVR_ERROR_SERVER_TIMEOUT) {}
+	
+	virtual ~CTransferCall() {
+		if (m_pyArgs != NULL) {
+			PYTHON_LOCK();
+			Py_DECREF(m_pyArgs);
+			PYTHON_UNLOCK();
+		}
+	}
+	
+	const CCatalogCapture& Capture() const { return m_capture; }
+	PVR_ERROR ReturnValue() const { return m_returnValue; }
+	
+protected:
+	virtual void RunPython() {
+		m_returnValue = pyCallTransfer(NULL, m_capture, m_func, m_pyArgs);
+		m_pyArgs = NULL;
+	}
+	
+	// A late list still goes into the catalog
+	virtual void Finish() {
+		if (CommitTransfer(m_capture, m_returnValue) && IsAbandoned()) {
+			TriggerListUpdate(m_capture);
+		}
+	}
+	
+private:
+	CCatalogCapture m_capture;
+	const char* m_func;
+	PyObject* m_pyArgs;
+	PVR_ERROR m_returnValue;
+};
+
+// Calls one of the _cGet* functions for Kodi, only waiting for it until the
+// function's deadline. Past that, or while the backend keeps missing its
+// deadlines, Kodi gets the catalog's copy of the list instead, or
+// PVR_ERROR_SERVER_TIMEOUT if there isn't one. With a NULL handle, the
+// entries only go into capture.
+PVR_ERROR pyTimedTransfer(ADDON_HANDLE handle, CCatalogCapture& capture, const char* func, const char* format, ...) {
+	va_list args;
+	va_start(args, format);
+	uint32_t iDeadlineMs = CallDeadlineMs(func);
+	if (iDeadlineMs == 0) {
+		PVR_ERROR returnValue = pyLockCallTransferV(handle, capture, NULL, func, format, args);
+		va_end(args);
+		return returnValue;
+	}
+	
 	PYTHON_LOCK();
-	bool returnValue = pyCallBool(obj, func, args);
+	PyObject* pyArgs = pyBuildArgs(format, args);
 	PYTHON_UNLOCK();
+	va_end(args);
+	
+	CTransferCall* call = new CTransferCall(capture, func, pyArgs);
+	PVR_ERROR returnValue;
+	if (RunTimedCall(call, func, iDeadlineMs)) {
+		capture = call->Capture();
+		returnValue = call->ReturnValue();
+		if (handle != NULL) {
+			capture.Transfer(handle);
+		}
+	} else if (handle != NULL && catalog.Transfer(handle, capture)) {
+		returnValue = PVR_ERROR_NO_ERROR;
+	} else {
+		returnValue = PVR_ERROR_SERVER_TIMEOUT;
+	}
+	call->Release();
 	return returnValue;
 }
 
+// A call for its side effects only, such as the power hooks
+class CNotifyCall : public CPythonCall
+{
+public:
+	CNotifyCall(const char* func) : m_func(func) {}
+	
+protected:
+	virtual void RunPython() {
+		Py_DECREF(pyCall(pvrImpl, m_func, NULL));
+	}
+	
+private:
+	const char* m_func;
+};
+
+// Calls a function that takes no arguments and returns nothing of use, only
+// waiting for it until its deadline. The Python lock must not be held.
+void pyTimedNotify(const char* func) {
+	uint32_t iDeadlineMs = CallDeadlineMs(func);
+	if (iDeadlineMs == 0) {
+		Py_DECREF(pyLockCall(pvrImpl, func, NULL));
+		return;
+	}
+	
+	CNotifyCall* call = new CNotifyCall(func);
+	RunTimedCall(call, func, iDeadlineMs);
+	call->Release();
+}
+
+// END DEADLINES
+
+PyObject* PyDict_FromTimer(const PVR_TIMER& timer) {
+	return Py_BuildValue("{s:I, s:I, s:i, s:L, s:L, s:N, s:N, s:i, s:I, s:s, s:s, s:N, s:s, s:s, s:i, s:i, s:i, s:I, s:L, s:I, s:I, s:I, s:I, s:I, s:i, s:i}",
+		"clientIndex", timer.iClientIndex,
+		"parentClientIndex", timer.iParentClientIndex,
+		"clientChannelUid", timer.iClientChannelUid,
+		"startTime", (long long) timer.startTime,
+		"endTime", (long long) timer.endTime,
+		"startAnyTime", PyBool_FromLong(timer.bStartAnyTime),
+		"endAnyTime", PyBool_FromLong(timer.bEndAnyTime),
+		"state", timer.state,
+		"timerType", timer.iTimerType,
+		"title", timer.strTitle,
+		"epgSearchString", timer.strEpgSearchString,
+		"fullTextEpgSearch", PyBool_FromLong(timer.bFullTextEpgSearch),
+		"directory", timer.strDirectory,
+		"summary", timer.strSummary,
+		"priority", timer.iPriority,
+		"lifetime", timer.iLifetime,
+		"maxRecordings", timer.iMaxRecordings,
+		"recordingGroup", timer.iRecordingGroup,
+		"firstDay", (long long) timer.firstDay,
+		"weekdays", timer.iWeekdays,
+		"preventDuplicateEpisodes", timer.iPreventDuplicateEpisodes,
+		"epgUid", timer.iEpgUid,
+		"marginStart", timer.iMarginStart,
+		"marginEnd", timer.iMarginEnd,
+		"genreType", timer.iGenreType,
+		"genreSubType", timer.iGenreSubType);
+}
+
+PyObject* PyDict_FromRecording(const PVR_RECORDING& recording) {
+	return Py_BuildValue("{s:s, s:s, s:s, s:s, s:i, s:i, s:i, s:s, s:s, s:s, s:s, s:s, s:s, s:s, s:L, s:i, s:i, s:i, s:i, s:i, s:i, s:i, s:N, s:I, s:i, s:i}",
+		"recordingId", recording.strRecordingId,
+		"title", recording.strTitle,
+		"streamURL", recording.strStreamURL,
+		"episodeName", recording.strEpisodeName,
+		"seriesNumber", recording.iSeriesNumber,
+		"episodeNumber", recording.iEpisodeNumber,
+		"year", recording.iYear,
+		"directory", recording.strDirectory,
+		"plotOutline", recording.strPlotOutline,
+		"plot", recording.strPlot,
+		"channelName", recording.strChannelName,
+		"iconPath", recording.strIconPath,
+		"thumbnailPath", recording.strThumbnailPath,
+		"fanartPath", recording.strFanartPath,
+		"recordingTime", (long long) recording.recordingTime,
+		"duration", recording.iDuration,
+		"priority", recording.iPriority,
+		"lifetime", recording.iLifetime,
+		"genreType", recording.iGenreType,
+		"genreSubType", recording.iGenreSubType,
+		"playCount", recording.iPlayCount,
+		"lastPlayedPosition", recording.iLastPlayedPosition,
+		"isDeleted", PyBool_FromLong(recording.bIsDeleted),
+		"epgEventId", recording.iEpgEventId,
+		"channelUid", recording.iChannelUid,
+		"channelType", recording.channelType);
+}
+
+void PyRecording_AsRecording(PyObject* pyEntry, PVR_RECORDING& xbmcEntry) {
+	memset(&xbmcEntry, 0, sizeof(PVR_RECORDING));
+	
+	PyString_CopyTo_DR(PyObject_GetAttrString(pyEntry, "recordingId"), xbmcEntry.strRecordingId, sizeof(xbmcEntry.strRecordingId));
+	PyString_CopyTo_DR(PyObject_GetAttrString(pyEntry, "title"), xbmcEntry.strTitle, sizeof(xbmcEntry.strTitle));
+	PyString_CopyTo_DR(PyObject_GetAttrString(pyEntry, "episodeName"), xbmcEntry.strEpisodeName, sizeof(xbmcEntry.strEpisodeName));
+	xbmcEntry.iSeriesNumber = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "seriesNumber"));
+	xbmcEntry.iEpisodeNumber = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "episodeNumber"));
+	xbmcEntry.iYear = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "year"));
+	PyString_CopyTo_DR(PyObject_GetAttrString(pyEntry, "streamURL"), xbmcEntry.strStreamURL, sizeof(xbmcEntry.strStreamURL));
+	PyString_CopyTo_DR(PyObject_GetAttrString(pyEntry, "directory"), xbmcEntry.strDirectory, sizeof(xbmcEntry.strDirectory));
+	PyString_CopyTo_DR(PyObject_GetAttrString(pyEntry, "plotOutline"), xbmcEntry.strPlotOutline, sizeof(xbmcEntry.strPlotOutline));
+	PyString_CopyTo_DR(PyObject_GetAttrString(pyEntry, "plot"), xbmcEntry.strPlot, sizeof(xbmcEntry.strPlot));
+	PyString_CopyTo_DR(PyObject_GetAttrString(pyEntry, "channelName"), xbmcEntry.strChannelName, sizeof(xbmcEntry.strChannelName));
+	PyString_CopyTo_DR(PyObject_GetAttrString(pyEntry, "iconPath"), xbmcEntry.strIconPath, sizeof(xbmcEntry.strIconPath));
+	PyString_CopyTo_DR(PyObject_GetAttrString(pyEntry, "thumbnailPath"), xbmcEntry.strThumbnailPath, sizeof(xbmcEntry.strThumbnailPath));
+	PyString_CopyTo_DR(PyObject_GetAttrString(pyEntry, "fanartPath"), xbmcEntry.strFanartPath, sizeof(xbmcEntry.strFanartPath));
+	xbmcEntry.recordingTime = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "_crecordingTime"));
+	xbmcEntry.iDuration = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "duration"));
+	xbmcEntry.iPriority = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "priority"));
+	xbmcEntry.iLifetime = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "lifetime"));
+	xbmcEntry.iGenreType = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "genreType"));
+	xbmcEntry.iGenreSubType = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "genreSubType"));
+	xbmcEntry.iPlayCount = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "playCount"));
+	xbmcEntry.iLastPlayedPosition = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "lastPlayedPosition"));
+	xbmcEntry.bIsDeleted = PyBool_AsBool_DR(PyObject_GetAttrString(pyEntry, "isDeleted"));
+	xbmcEntry.iEpgEventId = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "epgEventId"));
+	xbmcEntry.iChannelUid = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "channelUid"));
+	xbmcEntry.channelType = (PVR_RECORDING_CHANNEL_TYPE) PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "channelType"));
+}
+
+// Tells the backend about a change to the native timers
+PVR_ERROR pyLockCallTimer(const char* func, const PVR_TIMER& timer) {
+	PYTHON_LOCK();
+	int returnValue = pyCallInt(pvrImpl, func, Py_BuildValue("(N)", PyDict_FromTimer(timer)));
+	PYTHON_UNLOCK();
+	return ((PVR_ERROR) returnValue);
+}
+
+// Brings the timers reported by the backend into the native store. Returns
+// whether anything changed. With bDeadline, GetTimers's deadline applies. The
+// store is left as it was if the backend fails or misses the deadline.
+bool pySyncTimers(bool bDeadline) {
+	CCatalogCapture capture(CATALOG_TIMERS);
+	PVR_ERROR returnValue = bDeadline ? pyTimedTransfer(NULL, capture, "_cGetTimers", NULL) : pyLockCallTransfer(NULL, capture, "_cGetTimers", NULL);
+	if (returnValue != PVR_ERROR_NO_ERROR) {
+		return false;
+	}
+	
+	timerStore.SetTuners(pyLockCallInt(pvrImpl, "GetTunerCount", NULL));
+	if (!timerStore.SyncBackend(capture.timers)) {
+		return false;
+	}
+	
+	timerStore.Save(timersPath);
+	return true;
+}
+
+// Lets the backend add metadata to a newly indexed recording, on top of
+// what the timer said about one the client recorded itself
+bool pyEnrichRecording(const string& path, PVR_RECORDING& recording) {
+	bool described = (recorder != NULL && recorder->Describe(path, recording));
+	
+	PYTHON_LOCK();
+	PyObject* pyReturnValue = pyCall(pvrImpl, "_cEnrichRecording", Py_BuildValue("(N, s)", PyDict_FromRecording(recording), path.c_str()));
+	bool enriched = (pyReturnValue != Py_None);
+	if (enriched) {
+		PyRecording_AsRecording(pyReturnValue, recording);
+	}
+	Py_DECREF(pyReturnValue);
+	PYTHON_UNLOCK();
+	return enriched || described;
+}
+
 // BEGIN C->PYTHON BRIDGE FUNCTIONS
 
+// Unpacks the (handle, entry) arguments of a PVR_Transfer* call. Returns NULL,
+// with an exception set, if the handle isn't one from a _cGet* call in progress.
+static CTransferContext* bridge_TransferContext(PyObject* args, PyObject** pyEntry)
+{
+	PyObject* pyHandle;
+	if (!PyArg_ParseTuple(args, "OO", &pyHandle, pyEntry)) {
+		return NULL;
+	}
+	return (CTransferContext*) PyCapsule_GetPointer(pyHandle, TRANSFER_CONTEXT_NAME);
+}
+
 static PyObject* bridge_XBMC_Log(PyObject* self, PyObject* args)
 {
 	const char *s;
@@ -175,9 +759,96 @@ static PyObject* bridge_XBMC_Log(PyObject* self, PyObject* args)
 	return Py_None;
 }
 
+// Names passed from Python are interned, so only spans are worth tracing from there
+static PyObject* bridge_trace_begin(PyObject* self, PyObject* args)
+{
+	const char *s;
+	if (!PyArg_ParseTuple(args, "s", &s)) {
+		return NULL;
+	}
+	
+	TRACE_BEGIN(TraceIntern(s));
+	
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject* bridge_trace_end(PyObject* self, PyObject* args)
+{
+	const char *s;
+	if (!PyArg_ParseTuple(args, "s", &s)) {
+		return NULL;
+	}
+	
+	TRACE_END(TraceIntern(s));
+	
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+static PyObject* bridge_trace_dump(PyObject* self, PyObject* args)
+{
+	const char *s = tracePath.c_str();
+	if (!PyArg_ParseTuple(args, "|s", &s)) {
+		return NULL;
+	}
+	
+	bool result;
+	Py_BEGIN_ALLOW_THREADS
+	result = TraceDump(s);
+	Py_END_ALLOW_THREADS
+	
+	return PyBool_FromLong(result);
+}
+
+// Returns the programmes matching a query as (channelUid, uniqueBroadcastId,
+// startTime, endTime, title) tuples, by start time
+static PyObject* bridge_EPG_Search(PyObject* self, PyObject* args)
+{
+	char* query;
+	int fullText = 1;
+	int channelUid = PVR_TIMER_ANY_CHANNEL;
+	long long start = 0;
+	long long end = 0;
+	if (!PyArg_ParseTuple(args, "et|iiLL", "utf-8", &query, &fullText, &channelUid, &start, &end)) {
+		return NULL;
+	}
+	
+	vector<EpgSearchMatch> matches;
+	epgIndex.Search(query, fullText != 0, channelUid, (time_t) start, (time_t) end, matches);
+	PyMem_Free(query);
+	
+	PyObject* pyMatches = PyList_New(matches.size());
+	for (size_t i = 0; i < matches.size(); i++) {
+		PyList_SET_ITEM(pyMatches, i, Py_BuildValue("(I, I, L, L, s)",
+			matches[i].iChannelUid,
+			matches[i].iBroadcastId,
+			(long long) matches[i].startTime,
+			(long long) matches[i].endTime,
+			matches[i].strTitle.c_str()));
+	}
+	return pyMatches;
+}
+
+// The Python half of the tracing API, run in the bridge module
+static const char* bridgeTraceSource =
+	"class trace_span(object):\n"
+	"\tdef __init__(self, name):\n"
+	"\t\tself.name = name\n"
+	"\tdef __enter__(self):\n"
+	"\t\t_trace_begin(self.name)\n"
+	"\t\treturn self\n"
+	"\tdef __exit__(self, *excInfo):\n"
+	"\t\t_trace_end(self.name)\n"
+	"\t\treturn False\n";
+
 static PyObject* bridge_PVR_TransferChannelEntry(PyObject* self, PyObject* args)
 {
-	PyObject* pyChannel = PyTuple_GetItem(args, 0);
+	PyObject* pyChannel;
+	CTransferContext* context = bridge_TransferContext(args, &pyChannel);
+	if (context == NULL) {
+		return NULL;
+	}
 	
 	PVR_CHANNEL xbmcChannel;
 	memset(&xbmcChannel, 0, sizeof(PVR_CHANNEL));
@@ -193,7 +864,10 @@ static PyObject* bridge_PVR_TransferChannelEntry(PyObject* self, PyObject* args)
 	strcpy(xbmcChannel.strIconPath, PyString_SafeAsString_DR(PyObject_GetAttrString(pyChannel, "iconPath")));
 	xbmcChannel.bIsHidden = PyBool_AsBool_DR(PyObject_GetAttrString(pyChannel, "isHidden"));
 	
-	PVR->TransferChannelEntry(addon_handle, &xbmcChannel);
+	if (context->handle)
+		PVR->TransferChannelEntry(context->handle, &xbmcChannel);
+	if (context->capture)
+		context->capture->channels.push_back(xbmcChannel);
 	
 	Py_INCREF(Py_None);
 	return Py_None;
@@ -201,7 +875,11 @@ static PyObject* bridge_PVR_TransferChannelEntry(PyObject* self, PyObject* args)
 
 static PyObject* bridge_PVR_TransferChannelGroup(PyObject* self, PyObject* args)
 {
-	PyObject* pyGroup = PyTuple_GetItem(args, 0);
+	PyObject* pyGroup;
+	CTransferContext* context = bridge_TransferContext(args, &pyGroup);
+	if (context == NULL) {
+		return NULL;
+	}
 	
 	PVR_CHANNEL_GROUP xbmcGroup;
 	memset(&xbmcGroup, 0, sizeof(PVR_CHANNEL_GROUP));
@@ -210,7 +888,10 @@ static PyObject* bridge_PVR_TransferChannelGroup(PyObject* self, PyObject* args)
 	xbmcGroup.bIsRadio = PyBool_AsBool_DR(PyObject_GetAttrString(pyGroup, "isRadio"));
 	xbmcGroup.iPosition = PyInt_AsLong_DR(PyObject_GetAttrString(pyGroup, "position"));
 	
-	PVR->TransferChannelGroup(addon_handle, &xbmcGroup);
+	if (context->handle)
+		PVR->TransferChannelGroup(context->handle, &xbmcGroup);
+	if (context->capture)
+		context->capture->groups.push_back(xbmcGroup);
 	
 	Py_INCREF(Py_None);
 	return Py_None;
@@ -218,7 +899,11 @@ static PyObject* bridge_PVR_TransferChannelGroup(PyObject* self, PyObject* args)
 
 static PyObject* bridge_PVR_TransferChannelGroupMember(PyObject* self, PyObject* args)
 {
-	PyObject* pyGroupMember = PyTuple_GetItem(args, 0);
+	PyObject* pyGroupMember;
+	CTransferContext* context = bridge_TransferContext(args, &pyGroupMember);
+	if (context == NULL) {
+		return NULL;
+	}
 	
 	PVR_CHANNEL_GROUP_MEMBER xbmcGroupMember;
 	memset(&xbmcGroupMember, 0, sizeof(PVR_CHANNEL_GROUP_MEMBER));
@@ -227,7 +912,10 @@ static PyObject* bridge_PVR_TransferChannelGroupMember(PyObject* self, PyObject*
 	xbmcGroupMember.iChannelUniqueId = PyInt_AsLong_DR(PyObject_GetAttrString(pyGroupMember, "channelUniqueId"));
 	xbmcGroupMember.iChannelNumber = PyInt_AsLong_DR(PyObject_GetAttrString(pyGroupMember, "channelNumber"));
 	
-	PVR->TransferChannelGroupMember(addon_handle, &xbmcGroupMember);
+	if (context->handle)
+		PVR->TransferChannelGroupMember(context->handle, &xbmcGroupMember);
+	if (context->capture)
+		context->capture->members.push_back(xbmcGroupMember);
 	
 	Py_INCREF(Py_None);
 	return Py_None;
@@ -235,7 +923,11 @@ static PyObject* bridge_PVR_TransferChannelGroupMember(PyObject* self, PyObject*
 
 static PyObject* bridge_PVR_TransferTimerEntry(PyObject* self, PyObject* args)
 {
-	PyObject* pyEntry = PyTuple_GetItem(args, 0);
+	PyObject* pyEntry;
+	CTransferContext* context = bridge_TransferContext(args, &pyEntry);
+	if (context == NULL) {
+		return NULL;
+	}
 	
 	PVR_TIMER xbmcEntry;
 	memset(&xbmcEntry, 0, sizeof(PVR_TIMER));
@@ -267,7 +959,10 @@ static PyObject* bridge_PVR_TransferTimerEntry(PyObject* self, PyObject* args)
 	xbmcEntry.iGenreType = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "genreType"));
 	xbmcEntry.iGenreSubType = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "genreSubType"));
 	
-	PVR->TransferTimerEntry(addon_handle, &xbmcEntry);
+	if (context->handle)
+		PVR->TransferTimerEntry(context->handle, &xbmcEntry);
+	if (context->capture)
+		context->capture->timers.push_back(xbmcEntry);
 	
 	Py_INCREF(Py_None);
 	return Py_None;
@@ -275,40 +970,19 @@ static PyObject* bridge_PVR_TransferTimerEntry(PyObject* self, PyObject* args)
 
 static PyObject* bridge_PVR_TransferRecordingEntry(PyObject* self, PyObject* args)
 {
-	PyObject* pyEntry = PyTuple_GetItem(args, 0);
+	PyObject* pyEntry;
+	CTransferContext* context = bridge_TransferContext(args, &pyEntry);
+	if (context == NULL) {
+		return NULL;
+	}
 	
 	PVR_RECORDING xbmcEntry;
-	memset(&xbmcEntry, 0, sizeof(PVR_RECORDING));
+	PyRecording_AsRecording(pyEntry, xbmcEntry);
 	
-	strcpy(xbmcEntry.strRecordingId, PyString_SafeAsString_DR(PyObject_GetAttrString(pyEntry, "recordingId")));
-	strcpy(xbmcEntry.strTitle, PyString_SafeAsString_DR(PyObject_GetAttrString(pyEntry, "title")));
-	strcpy(xbmcEntry.strEpisodeName, PyString_SafeAsString_DR(PyObject_GetAttrString(pyEntry, "episodeName")));
-	xbmcEntry.iSeriesNumber = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "seriesNumber"));
-	xbmcEntry.iEpisodeNumber = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "episodeNumber"));
-	xbmcEntry.iYear = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "year"));
-	strcpy(xbmcEntry.strStreamURL, PyString_SafeAsString_DR(PyObject_GetAttrString(pyEntry, "streamURL")));
-	strcpy(xbmcEntry.strDirectory, PyString_SafeAsString_DR(PyObject_GetAttrString(pyEntry, "directory")));
-	strcpy(xbmcEntry.strPlotOutline, PyString_SafeAsString_DR(PyObject_GetAttrString(pyEntry, "plotOutline")));
-	strcpy(xbmcEntry.strPlot, PyString_SafeAsString_DR(PyObject_GetAttrString(pyEntry, "plot")));
-	strcpy(xbmcEntry.strChannelName, PyString_SafeAsString_DR(PyObject_GetAttrString(pyEntry, "channelName")));
-	strcpy(xbmcEntry.strIconPath, PyString_SafeAsString_DR(PyObject_GetAttrString(pyEntry, "iconPath")));
-	strcpy(xbmcEntry.strThumbnailPath, PyString_SafeAsString_DR(PyObject_GetAttrString(pyEntry, "thumbnailPath")));
-	strcpy(xbmcEntry.strFanartPath, PyString_SafeAsString_DR(PyObject_GetAttrString(pyEntry, "fanartPath")));
-	xbmcEntry.recordingTime = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "_crecordingTime"));
-	xbmcEntry.iDuration = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "duration"));
-	xbmcEntry.iPriority = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "priority"));
-	xbmcEntry.iLifetime = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "lifetime"));
-	xbmcEntry.iGenreType = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "genreType"));
-	xbmcEntry.iGenreSubType = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "genreSubType"));
-	xbmcEntry.iPlayCount = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "playCount"));
-	xbmcEntry.iLastPlayedPosition = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "lastPlayedPosition"));
-	xbmcEntry.bIsDeleted = PyBool_AsBool_DR(PyObject_GetAttrString(pyEntry, "isDeleted"));
-	xbmcEntry.iEpgEventId = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "epgEventId"));
-	xbmcEntry.iChannelUid = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "channelUid"));
-	xbmcEntry.iChannelUid = PVR_CHANNEL_INVALID_UID;
-	xbmcEntry.channelType = (PVR_RECORDING_CHANNEL_TYPE) PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "channelType"));
-	
-	PVR->TransferRecordingEntry(addon_handle, &xbmcEntry);
+	if (context->handle)
+		PVR->TransferRecordingEntry(context->handle, &xbmcEntry);
+	if (context->capture)
+		context->capture->recordings.push_back(xbmcEntry);
 	
 	Py_INCREF(Py_None);
 	return Py_None;
@@ -316,7 +990,11 @@ static PyObject* bridge_PVR_TransferRecordingEntry(PyObject* self, PyObject* arg
 
 static PyObject* bridge_PVR_TransferEpgEntry(PyObject* self, PyObject* args)
 {
-	PyObject* pyEntry = PyTuple_GetItem(args, 0);
+	PyObject* pyEntry;
+	CTransferContext* context = bridge_TransferContext(args, &pyEntry);
+	if (context == NULL) {
+		return NULL;
+	}
 	
 	EPG_TAG xbmcEntry;
 	memset(&xbmcEntry, 0, sizeof(EPG_TAG));
@@ -348,7 +1026,10 @@ static PyObject* bridge_PVR_TransferEpgEntry(PyObject* self, PyObject* args)
 	xbmcEntry.strEpisodeName = PyString_SafeAsString_DR(PyObject_GetAttrString(pyEntry, "episodeName"));
 	xbmcEntry.iFlags = PyInt_AsLong_DR(PyObject_GetAttrString(pyEntry, "flags"));
 	
-	PVR->TransferEpgEntry(addon_handle, &xbmcEntry);
+	if (context->handle)
+		PVR->TransferEpgEntry(context->handle, &xbmcEntry);
+	if (context->capture)
+		context->capture->epg.push_back(CEpgEntry(xbmcEntry));
 	
 	Py_INCREF(Py_None);
 	return Py_None;
@@ -362,11 +1043,642 @@ static PyMethodDef bridgeMethods[] = {
 	{"PVR_TransferTimerEntry", bridge_PVR_TransferTimerEntry, METH_VARARGS, ""},
 	{"PVR_TransferRecordingEntry", bridge_PVR_TransferRecordingEntry, METH_VARARGS, ""},
 	{"PVR_TransferEpgEntry", bridge_PVR_TransferEpgEntry, METH_VARARGS, ""},
+	{"EPG_Search", bridge_EPG_Search, METH_VARARGS, ""},
+	{"_trace_begin", bridge_trace_begin, METH_VARARGS, ""},
+	{"_trace_end", bridge_trace_end, METH_VARARGS, ""},
+	{"trace_dump", bridge_trace_dump, METH_VARARGS, ""},
 	{NULL, NULL, 0, NULL}
 };
 
 // END PYTHON<->C FUNCTIONS
 
+// BEGIN STREAM SESSIONS
+
+// A stream read through a session object returned by the backend
+class CPythonStreamSession : public CStreamSession
+{
+public:
+	// Takes over the reference to pySession
+	CPythonStreamSession(PyObject* pySession) : m_pySession(pySession), m_bAborted(false) {}
+	
+	virtual ~CPythonStreamSession() {
+		PYTHON_LOCK();
+		Py_DECREF(pyCall(m_pySession, "Close", NULL));
+		Py_DECREF(m_pySession);
+		PYTHON_UNLOCK();
+	}
+	
+	virtual int Read(unsigned char* pBuffer, unsigned int iBufferSize) {
+		// Python may hand back more than asked for; the rest is kept for next time
+		if (m_pending.empty()) {
+			// A read already in Python can't be broken off, but the next one isn't made
+			if (m_bAborted) {
+				return -1;
+			}
+			PYTHON_LOCK();
+			PyObject* pyReturnValue = pyCall(m_pySession, "Read", Py_BuildValue("(I)", iBufferSize));
+			int bytesRead = -1;
+			if (PyTuple_Check(pyReturnValue) && PyTuple_Size(pyReturnValue) == 2) {
+				bytesRead = PyInt_AsLong(PyTuple_GetItem(pyReturnValue, 0));
+				char* contents;
+				Py_ssize_t size;
+				if (bytesRead > 0 && PyString_AsStringAndSize(PyTuple_GetItem(pyReturnValue, 1), &contents, &size) == 0) {
+					m_pending.assign(contents, min((Py_ssize_t) bytesRead, size));
+				} else if (bytesRead > 0) {
+					PyErr_Clear();
+					bytesRead = -1;
+				}
+			}
+			Py_DECREF(pyReturnValue);
+			PYTHON_UNLOCK();
+			
+			if (bytesRead <= 0) {
+				return bytesRead;
+			}
+		}
+		
+		size_t bytesCopied = min(m_pending.size(), (size_t) iBufferSize);
+		memcpy(pBuffer, m_pending.data(), bytesCopied);
+		m_pending.erase(0, bytesCopied);
+		return bytesCopied;
+	}
+	
+	virtual long long Seek(long long iPosition, int iWhence) {
+		if (iWhence == SEEK_CUR) {
+			iPosition -= m_pending.size();
+		}
+		m_pending.clear();
+		return CallLongLong("Seek", Py_BuildValue("(L, i)", iPosition, iWhence));
+	}
+	
+	virtual long long Position() {
+		long long position = CallLongLong("Position", NULL);
+		return (position >= 0) ? position - (long long) m_pending.size() : position;
+	}
+	
+	virtual long long Length() {
+		return CallLongLong("Length", NULL);
+	}
+	
+	virtual bool CanPause() {
+		PYTHON_LOCK();
+		bool returnValue = pyCallBool(m_pySession, "CanPause", NULL);
+		PYTHON_UNLOCK();
+		return returnValue;
+	}
+	
+	virtual bool CanSeek() {
+		PYTHON_LOCK();
+		bool returnValue = pyCallBool(m_pySession, "CanSeek", NULL);
+		PYTHON_UNLOCK();
+		return returnValue;
+	}
+	
+	virtual void Abort() {
+		m_bAborted = true;
+	}
+	
+private:
+	// args is built by the caller, so this takes the lock first
+	long long CallLongLong(const char* func, PyObject* args);
+	
+	PyObject* m_pySession;
+	string m_pending;
+	atomic<bool> m_bAborted;
+};
+
+long long CPythonStreamSession::CallLongLong(const char* func, PyObject* args) {
+	PYTHON_LOCK();
+	PyObject* pyReturnValue = pyCall(m_pySession, func, args);
+	long long returnValue = (pyReturnValue != Py_None) ? PyLong_AsLongLong(pyReturnValue) : -1;
+	if (PyErr_Occurred() != NULL) { PyErr_Clear(); returnValue = -1; }
+	Py_DECREF(pyReturnValue);
+	PYTHON_UNLOCK();
+	return returnValue;
+}
+
+// Returns a string from a stream spec, or strDefault if it isn't there
+string PyDict_GetStreamOption(PyObject* pySpec, const char* key, const char* strDefault) {
+	PyObject* pyValue = PyDict_GetItemString(pySpec, key);
+	if (pyValue == NULL || (!PyString_Check(pyValue) && !PyUnicode_Check(pyValue))) {
+		return strDefault;
+	}
+	char* value = PyString_SafeAsString(pyValue);
+	string result = value;
+	free(value);
+	return result;
+}
+
+// Opens a stream the client fetches itself, from the dict made by a
+// PVRNativeStream's _cSpec. The Python lock must be held.
+CStreamSession* pyOpenNativeStream(PyObject* pySpec) {
+	string type = PyDict_GetStreamOption(pySpec, "type", "");
+	if (type == "hds") {
+		PyObject* pyMaxBitrate = PyDict_GetItemString(pySpec, "maxBitrate");
+		int maxBitrate = (pyMaxBitrate != NULL) ? PyInt_AsLong(pyMaxBitrate) : 0;
+		if (PyErr_Occurred() != NULL) { PyErr_Clear(); maxBitrate = 0; }
+		CHDSFetcher* fetcher = new CVFSFetcher(PyDict_GetStreamOption(pySpec, "userAgent", ""));
+		string manifestURL = PyDict_GetStreamOption(pySpec, "manifestURL", "");
+		string auth = PyDict_GetStreamOption(pySpec, "auth", "");
+		
+		// Fetching the manifest can take a while, and doesn't need Python
+		CStreamSession* session;
+		Py_BEGIN_ALLOW_THREADS
+		session = CHDSStreamSession::Open(fetcher, manifestURL, auth, maxBitrate);
+		Py_END_ALLOW_THREADS
+		return session;
+	}
+	if (type == "multicast") {
+		PyObject* pyLatency = PyDict_GetItemString(pySpec, "latency");
+		int latency = (pyLatency != NULL) ? PyInt_AsLong(pyLatency) : MULTICAST_DEFAULT_LATENCY_MS;
+		if (PyErr_Occurred() != NULL || latency < 0) { PyErr_Clear(); latency = MULTICAST_DEFAULT_LATENCY_MS; }
+		string url = PyDict_GetStreamOption(pySpec, "url", "");
+		string localInterface = PyDict_GetStreamOption(pySpec, "interface", "");
+		
+		// Waits for the first datagram
+		CStreamSession* session;
+		Py_BEGIN_ALLOW_THREADS
+		session = CMulticastStreamSession::Open(url, localInterface, latency);
+		Py_END_ALLOW_THREADS
+		return session;
+	}
+	
+	XBMC->Log(LOG_ERROR, "%s - Unknown native stream type '%s'", __FUNCTION__, type.c_str());
+	return NULL;
+}
+
+// Opens a stream through one of the _cOpen*Stream functions, which return a
+// path for Kodi to open, a session object, a native stream spec, or None. The
+// Python lock must be held.
+CStreamSession* pyOpenStream(bool bRecorded, const char* func, PyObject* args) {
+	PyObject* pyReturnValue = pyCall(pvrImpl, func, args);
+	if (pyReturnValue == Py_None) {
+		Py_DECREF(pyReturnValue);
+		return NULL;
+	}
+	
+	if (PyDict_Check(pyReturnValue)) {
+		CStreamSession* session = pyOpenNativeStream(pyReturnValue);
+		Py_DECREF(pyReturnValue);
+		XBMC->Log(LOG_DEBUG, "%s - %s native stream", __FUNCTION__, session ? "Opened" : "Failed to open");
+		return session;
+	}
+	
+	if (!PyString_Check(pyReturnValue) && !PyUnicode_Check(pyReturnValue)) {
+		XBMC->Log(LOG_DEBUG, "%s - Opened a Python stream session", __FUNCTION__);
+		return new CPythonStreamSession(pyReturnValue);
+	}
+	
+	// We are offloading the file handling to Kodi. Recordings can always be
+	// paused and seeked; for live streams that's up to the backend.
+	char* fileName = PyString_SafeAsString(pyReturnValue);
+	Py_DECREF(pyReturnValue);
+	
+	// Kodi's VFS can't take these, so they are received natively
+	MulticastAddress address;
+	if (ParseMulticastURL(fileName, address)) {
+		CStreamSession* session;
+		Py_BEGIN_ALLOW_THREADS
+		session = CMulticastStreamSession::Open(fileName, "", MULTICAST_DEFAULT_LATENCY_MS);
+		Py_END_ALLOW_THREADS
+		free(fileName);
+		return session;
+	}
+	
+	bool bCanPause = bRecorded || pyCallBool(pvrImpl, "CanPauseStream", NULL);
+	bool bCanSeek = bRecorded || pyCallBool(pvrImpl, "CanSeekStream", NULL);
+	CStreamSession* session = CFileStreamSession::Open(fileName, bCanPause, bCanSeek);
+	XBMC->Log(LOG_DEBUG, "%s - %s stream natively", __FUNCTION__, session ? "Opened" : "Failed to open");
+	free(fileName);
+	return session;
+}
+
+// One of the _cOpen*Stream functions made for Kodi. A session that is only
+// opened after Kodi stopped waiting is closed again.
+class COpenStreamCall : public CPythonCall
+{
+public:
+	// Takes over the reference to pyArgs
+	COpenStreamCall(bool bRecorded, const char* func, PyObject* pyArgs) :
+		m_bRecorded(bRecorded),
+		m_func(func),
+		m_pyArgs(pyArgs),
+		m_session(NULL) {}
+	
+	virtual ~COpenStreamCall() {
+		delete m_session;
+		if (m_pyArgs != NULL) {
+			PYTHON_LOCK();
+			Py_DECREF(m_pyArgs);
+			PYTHON_UNLOCK();
+		}
+	}
+	
+	CStreamSession* TakeSession() {
+		CStreamSession* session = m_session;
+		m_session = NULL;
+		return session;
+	}
+	
+protected:
+	virtual void RunPython() {
+		m_session = pyOpenStream(m_bRecorded, m_func, m_pyArgs);
+		m_pyArgs = NULL;
+	}
+	
+private:
+	bool m_bRecorded;
+	const char* m_func;
+	PyObject* m_pyArgs;
+	CStreamSession* m_session;
+};
+
+// Opens a stream for Kodi, giving up once the function's deadline passes.
+// pyArgs is consumed. The Python lock must not be held.
+CStreamSession* pyTimedOpenStream(bool bRecorded, const char* func, PyObject* pyArgs) {
+	uint32_t iDeadlineMs = CallDeadlineMs(func);
+	if (iDeadlineMs == 0) {
+		PYTHON_LOCK();
+		CStreamSession* session = pyOpenStream(bRecorded, func, pyArgs);
+		PYTHON_UNLOCK();
+		return session;
+	}
+	
+	COpenStreamCall* call = new COpenStreamCall(bRecorded, func, pyArgs);
+	CStreamSession* session = RunTimedCall(call, func, iDeadlineMs) ? call->TakeSession() : NULL;
+	call->Release();
+	return session;
+}
+
+CStreamSession* pyLockOpenStream(bool bRecorded, const char* func, const char* format, ...) {
+	PYTHON_LOCK();
+	va_list args;
+	va_start(args, format);
+	PyObject* pyArgs = pyBuildArgs(format, args);
+	va_end(args);
+	PYTHON_UNLOCK();
+	return pyTimedOpenStream(bRecorded, func, pyArgs);
+}
+
+// END STREAM SESSIONS
+
+// BEGIN CATALOG SNAPSHOT
+
+// How often the catalog is written back to userPath, if it has changed
+#define CATALOG_SAVE_INTERVAL_MS (5 * 60 * 1000)
+
+string userFilePath(const char* fileName) {
+	string path = userPath;
+	if (!path.empty() && path[path.size() - 1] != '/' && path[path.size() - 1] != '\\') {
+		path += '/';
+	}
+	return path + fileName;
+}
+
+// The Python lock must be held
+PVR_ERROR pyGetAddonCapabilities(PVR_ADDON_CAPABILITIES* pCapabilities) {
+	PyObject* pyFunc = PyObject_GetAttrString(pvrImpl, "GetAddonCapabilities");
+	PyObject* pyArgs = PyTuple_New(0);
+	PyObject* pyReturnValue = PyObject_CallObject(pyFunc, pyArgs);
+	Py_DECREF(pyArgs);
+	Py_DECREF(pyFunc);
+	if (PyErr_Occurred() != NULL) { PyErr_Print(); PyErr_Clear(); return PVR_ERROR_FAILED; }
+	
+	// Backends that don't implement it only return an error code
+	if (!PyTuple_Check(pyReturnValue) || PyTuple_Size(pyReturnValue) != 2 || !PyDict_Check(PyTuple_GetItem(pyReturnValue, 1))) {
+		long errorCode = PyInt_Check(pyReturnValue) ? PyInt_AsLong(pyReturnValue) : PVR_ERROR_FAILED;
+		Py_DECREF(pyReturnValue);
+		return (errorCode != PVR_ERROR_NO_ERROR) ? ((PVR_ERROR) errorCode) : PVR_ERROR_FAILED;
+	}
+	
+	PyObject* pyCapabilities = PyTuple_GetItem(pyReturnValue, 1);
+	pCapabilities->bSupportsEPG = (PyDict_GetItemString(pyCapabilities, "supportsEPG") == Py_True);
+	pCapabilities->bSupportsTV = (PyDict_GetItemString(pyCapabilities, "supportsTV") == Py_True);
+	pCapabilities->bSupportsRadio = (PyDict_GetItemString(pyCapabilities, "supportsRadio") == Py_True);
+	pCapabilities->bSupportsRecordings = (PyDict_GetItemString(pyCapabilities, "supportsRecordings") == Py_True);
+	pCapabilities->bSupportsRecordingsUndelete = (PyDict_GetItemString(pyCapabilities, "supportsRecordingsUndelete") == Py_True);
+	pCapabilities->bSupportsTimers = (PyDict_GetItemString(pyCapabilities, "supportsTimers") == Py_True);
+	pCapabilities->bSupportsChannelGroups = (PyDict_GetItemString(pyCapabilities, "supportsChannelGroups") == Py_True);
+	pCapabilities->bSupportsChannelScan = (PyDict_GetItemString(pyCapabilities, "supportsChannelScan") == Py_True);
+	pCapabilities->bSupportsChannelSettings = (PyDict_GetItemString(pyCapabilities, "supportsChannelSettings") == Py_True);
+	pCapabilities->bHandlesInputStream = (PyDict_GetItemString(pyCapabilities, "handlesInputStream") == Py_True);
+	pCapabilities->bHandlesDemuxing = (PyDict_GetItemString(pyCapabilities, "handlesDemuxing") == Py_True);
+	pCapabilities->bSupportsRecordingPlayCount = (PyDict_GetItemString(pyCapabilities, "supportsRecordingPlayCount") == Py_True);
+	pCapabilities->bSupportsLastPlayedPosition = (PyDict_GetItemString(pyCapabilities, "supportsLastPlayedPosition") == Py_True);
+	pCapabilities->bSupportsRecordingEdl = (PyDict_GetItemString(pyCapabilities, "supportsRecordingEdl") == Py_True);
+	
+	PyObject* pyErrorCode = PyTuple_GetItem(pyReturnValue, 0);
+	long errorCode = PyInt_AsLong(pyErrorCode);
+	Py_DECREF(pyReturnValue);
+	
+	return ((PVR_ERROR) errorCode);
+}
+
+// Keeps what the backend says about itself in the catalog, for Kodi to be
+// answered from before it is up the next time. The Python lock must be held.
+void pyRefreshBackendInfo() {
+	CBackendInfo info;
+	if (pyGetAddonCapabilities(&info.capabilities) != PVR_ERROR_NO_ERROR) {
+		return;
+	}
+	
+	char* value = pyCallString(pvrImpl, "GetBackendName", NULL);
+	info.strName = value;
+	free(value);
+	value = pyCallString(pvrImpl, "GetBackendVersion", NULL);
+	info.strVersion = value;
+	free(value);
+	value = pyCallString(pvrImpl, "GetConnectionString", NULL);
+	info.strConnection = value;
+	free(value);
+	value = pyCallString(pvrImpl, "GetBackendHostname", NULL);
+	info.strHostname = value;
+	free(value);
+	catalog.SetBackendInfo(info);
+}
+
+// Calls the Python ADDON_Create, then reads the deadlines for the backend's
+// calls, and lets Kodi's calls through to it. The Python lock must be held.
+ADDON_STATUS pyCreateBackend() {
+	PyObject* pyFunc = PyObject_GetAttrString(pvrImpl, "ADDON_Create");
+	PyObject* pyArgs = Py_BuildValue("({s:s, s:s, s:i})", "userPath", userPath.c_str(), "clientPath", clientPath.c_str(), "epgMaxDays", epgMaxDays);
+	PyObject* pyReturnValue = PyObject_CallObject(pyFunc, pyArgs);
+	Py_DECREF(pyArgs);
+	Py_DECREF(pyFunc);
+	if (PyErr_Occurred() != NULL) { PyErr_Print(); PyErr_Clear(); return ADDON_STATUS_PERMANENT_FAILURE; }
+	long returnValue = PyInt_AsLong(pyReturnValue);
+	Py_DECREF(pyReturnValue);
+	if (returnValue == ADDON_STATUS_OK) {
+		pyLoadCallDeadlines();
+		pyRefreshBackendInfo();
+		backendReady = true;
+	}
+	
+	// Enums take on their integer indexes as value
+	return ((ADDON_STATUS) returnValue);
+}
+
+// Opens a channel for the recorder, with a session apart from the one Kodi
+// plays. Only sessions implemented in Python take the lock to be read.
+CStreamSession* pyOpenRecorderStream(int channelUid) {
+	return pyLockOpenStream(false, "_cOpenRecorderStream", "(i)", channelUid);
+}
+
+// Starts indexing the backend's local recordings directory, if it has one,
+// and recording timers into it if the backend leaves that to us
+void pyStartRecordingsIndex() {
+	char* path = pyLockCallString(pvrImpl, "GetRecordingsPath", NULL);
+	string recordingsPath = path;
+	free(path);
+	if (recordingsPath.empty()) {
+		return;
+	}
+	
+	if (pyLockCallBool(pvrImpl, "UseNativeRecorder", NULL)) {
+		XBMC->Log(LOG_DEBUG, "%s - Recording timers to '%s'", __FUNCTION__, recordingsPath.c_str());
+		recorder = new CRecorder(recordingsPath, userFilePath("recorder.snapshot"), timerStore, streamProperties, pyOpenRecorderStream);
+		recorder->CreateThread();
+	}
+	
+	XBMC->Log(LOG_DEBUG, "%s - Indexing recordings in '%s'", __FUNCTION__, recordingsPath.c_str());
+	CRecordingsIndex* index = new CRecordingsIndex(recordingsPath, userFilePath("recordings.cache"), pyEnrichRecording);
+	index->CreateThread();
+	recordingsIndex = index;
+	catalog.SetStale(CATALOG_RECORDINGS, false);
+}
+
+// After a warm start, creates the Python backend and brings the lists served
+// from the snapshot back in line with it. Does the same again in the
+// background whenever the system wakes up. Also saves the catalog periodically.
+class CCatalogRevalidator : public P8PLATFORM::CThread
+{
+public:
+	CCatalogRevalidator(bool bWarmStart) :
+		m_bWarmStart(bWarmStart),
+		m_bPaused(false),
+		m_bWoken(false),
+		m_bAbandoned(false),
+		m_bInterrupted(false),
+		m_iPriorityChannel(PVR_CHANNEL_INVALID_UID) {}
+	
+	// Abandons any revalidation in progress, until resumed
+	void Pause() {
+		CLockObject lock(m_mutex);
+		m_bPaused = true;
+	}
+	
+	// With bRevalidate, Kodi is served from the catalog again until
+	// everything has been revalidated, starting with iPriorityChannel. A
+	// revalidation Pause cut short is carried on with either way.
+	void Resume(bool bRevalidate, int iPriorityChannel) {
+		CLockObject lock(m_mutex);
+		m_bPaused = false;
+		if (bRevalidate && backendReady) {
+			for (int list = 0; list < CATALOG_LIST_COUNT; list++) {
+				if (list != CATALOG_RECORDINGS || !recordingsIndex) {
+					catalog.SetStale((CatalogList) list, true);
+				}
+			}
+			m_bWoken = true;
+			m_iPriorityChannel = iPriorityChannel;
+		}
+		m_wakeEvent.Signal();
+	}
+	
+	virtual bool StopThread(int iWaitMs = 5000) {
+		CThread::StopThread(-1);
+		m_wakeEvent.Signal();
+		return CThread::StopThread(iWaitMs);
+	}
+	
+	virtual void* Process(void) {
+		if (m_bWarmStart) {
+			PYTHON_LOCK();
+			ADDON_STATUS status = pyCreateBackend();
+			PYTHON_UNLOCK();
+			
+			if (status == ADDON_STATUS_OK) {
+				pyStartRecordingsIndex();
+				Revalidate(PVR_CHANNEL_INVALID_UID);
+			} else {
+				XBMC->Log(LOG_ERROR, "%s - Python ADDON_Create returned %d, serving the snapshot only", __FUNCTION__, status);
+			}
+		}
+		
+		while (!IsStopped()) {
+			m_wakeEvent.Wait(CATALOG_SAVE_INTERVAL_MS);
+			
+			int iPriorityChannel;
+			bool bWoken;
+			if (TakeWake(iPriorityChannel, bWoken)) {
+				// Sessions and tokens first, so nothing else runs into dead ones
+				if (bWoken) {
+					Py_DECREF(pyLockCall(pvrImpl, "OnSystemWake", NULL));
+				}
+				Revalidate(iPriorityChannel);
+			}
+			if (catalog.IsDirty()) {
+				catalog.Save(catalogPath);
+			}
+			if (streamProperties.IsDirty()) {
+				streamProperties.Save(streamPropertiesPath);
+			}
+		}
+		
+		return NULL;
+	}
+	
+private:
+	bool Interrupted() {
+		CLockObject lock(m_mutex);
+		if (m_bPaused || IsStopped()) {
+			m_bAbandoned = true;
+			return true;
+		}
+		return false;
+	}
+	
+	// bWoken is set if the system woke since, rather than a revalidation
+	// being picked up again
+	bool TakeWake(int& iPriorityChannel, bool& bWoken) {
+		CLockObject lock(m_mutex);
+		if ((!m_bWoken && !m_bInterrupted) || m_bPaused) {
+			return false;
+		}
+		bWoken = m_bWoken;
+		m_bWoken = false;
+		m_bInterrupted = false;
+		iPriorityChannel = m_iPriorityChannel;
+		return true;
+	}
+	
+	// Whatever was left stale is revalidated again on the next Resume
+	void Requeue(int iPriorityChannel) {
+		CLockObject lock(m_mutex);
+		if (!m_bAbandoned) {
+			return;
+		}
+		m_bAbandoned = false;
+		m_bInterrupted = true;
+		if (!m_bWoken) {
+			m_iPriorityChannel = iPriorityChannel;
+		}
+		// In case it was resumed before we noticed
+		m_wakeEvent.Signal();
+	}
+	
+	// Lists are only marked as fresh once they have been revalidated in full
+	void Revalidated(CatalogList list) {
+		if (!Interrupted()) {
+			catalog.SetStale(list, false);
+		}
+	}
+	
+	void Revalidate(int iPriorityChannel) {
+		{
+			CLockObject lock(m_mutex);
+			m_bAbandoned = false;
+		}
+		time_t now = time(NULL);
+		if (iPriorityChannel != PVR_CHANNEL_INVALID_UID) {
+			RevalidateEpg(iPriorityChannel, now);
+		}
+		
+		bool changed = false;
+		for (int radio = 0; radio <= 1 && !Interrupted(); radio++) {
+			CCatalogCapture capture(CATALOG_CHANNELS);
+			capture.bFlag = radio;
+			changed |= RevalidateList(capture, "_cGetChannels", "(b)", radio);
+		}
+		Revalidated(CATALOG_CHANNELS);
+		if (changed) {
+			PVR->TriggerChannelUpdate();
+		}
+		
+		changed = false;
+		for (int radio = 0; radio <= 1 && !Interrupted(); radio++) {
+			CCatalogCapture capture(CATALOG_CHANNEL_GROUPS);
+			capture.bFlag = radio;
+			changed |= RevalidateList(capture, "_cGetChannelGroups", "(b)", radio);
+		}
+		vector<PVR_CHANNEL_GROUP> groups = catalog.GetChannelGroups();
+		for (vector<PVR_CHANNEL_GROUP>::const_iterator it = groups.begin(); it != groups.end() && !Interrupted(); ++it) {
+			CCatalogCapture capture(CATALOG_CHANNEL_GROUP_MEMBERS);
+			capture.strGroupName = it->strGroupName;
+			changed |= RevalidateList(capture, "_cGetChannelGroupMembers", "(s)", it->strGroupName);
+		}
+		Revalidated(CATALOG_CHANNEL_GROUPS);
+		Revalidated(CATALOG_CHANNEL_GROUP_MEMBERS);
+		if (changed) {
+			PVR->TriggerChannelGroupsUpdate();
+		}
+		
+		changed = !Interrupted() && pySyncTimers(false);
+		Revalidated(CATALOG_TIMERS);
+		if (changed) {
+			PVR->TriggerTimerUpdate();
+		}
+		
+		// The recordings index keeps itself up to date
+		changed = false;
+		for (int deleted = 0; deleted <= 1 && !Interrupted() && !recordingsIndex; deleted++) {
+			CCatalogCapture capture(CATALOG_RECORDINGS);
+			capture.bFlag = deleted;
+			changed |= RevalidateList(capture, "_cGetRecordings", "(b)", deleted);
+		}
+		Revalidated(CATALOG_RECORDINGS);
+		if (changed) {
+			PVR->TriggerRecordingUpdate();
+		}
+		
+		vector<PVR_CHANNEL> channels = catalog.GetChannels();
+		for (vector<PVR_CHANNEL>::const_iterator it = channels.begin(); it != channels.end() && !Interrupted(); ++it) {
+			if ((int) it->iUniqueId != iPriorityChannel) {
+				RevalidateEpg(it->iUniqueId, now);
+			}
+		}
+		Revalidated(CATALOG_EPG);
+		Requeue(iPriorityChannel);
+	}
+	
+	void RevalidateEpg(unsigned int iChannelUid, time_t now) {
+		CCatalogCapture capture(CATALOG_EPG);
+		capture.iChannelUid = iChannelUid;
+		capture.iStart = now;
+		capture.iEnd = now + (epgMaxDays > 0 ? epgMaxDays : 3) * 24 * 60 * 60;
+		if (RevalidateList(capture, "_cGetEPGForChannel", "(I, L, L)", capture.iChannelUid, (long long) capture.iStart, (long long) capture.iEnd)) {
+			PVR->TriggerEpgUpdate(iChannelUid);
+		}
+	}
+	
+	bool RevalidateList(CCatalogCapture& capture, const char* func, const char* format, ...) {
+		// Streams being opened go first; they're what someone is waiting on
+		while (streamsOpening > 0 && !Interrupted()) {
+			Sleep(10);
+		}
+		if (Interrupted()) {
+			return false;
+		}
+		bool changed = false;
+		va_list args;
+		va_start(args, format);
+		pyLockCallTransferV(NULL, capture, &changed, func, format, args);
+		va_end(args);
+		return changed;
+	}
+	
+	bool m_bWarmStart;
+	P8PLATFORM::CEvent m_wakeEvent;
+	P8PLATFORM::CMutex m_mutex;
+	bool m_bPaused;
+	bool m_bWoken;
+	bool m_bAbandoned;   // Something was left out of the revalidation in progress
+	bool m_bInterrupted; // A revalidation was cut short, to be picked up again
+	int m_iPriorityChannel;
+};
+
+CCatalogRevalidator* revalidator = NULL;
+
 //void ADDON_ReadSettings(void)
 //{
 	//STUB
@@ -386,9 +1698,18 @@ ADDON_STATUS ADDON_Create(void* hdl, void* props)
 		return ADDON_STATUS_PERMANENT_FAILURE;
 	}
 	
-	PVR = new CHelper_libXBMC_pvr;
-	if (!PVR->RegisterMe(hdl))
+	PVR = new CHelper_libXBMC_pvr;
+	if (!PVR->RegisterMe(hdl))
+	{
+		SAFE_DELETE(PVR);
+		SAFE_DELETE(XBMC);
+		return ADDON_STATUS_PERMANENT_FAILURE;
+	}
+	
+	CODEC = new CHelper_libXBMC_codec;
+	if (!CODEC->RegisterMe(hdl))
 	{
+		SAFE_DELETE(CODEC);
 		SAFE_DELETE(PVR);
 		SAFE_DELETE(XBMC);
 		return ADDON_STATUS_PERMANENT_FAILURE;
@@ -396,11 +1717,20 @@ ADDON_STATUS ADDON_Create(void* hdl, void* props)
 	
 	XBMC->Log(LOG_DEBUG, "%s - Creating the PVR demo add-on", __FUNCTION__);
 	
+	userPath = pvrprops->strUserPath;
+	clientPath = pvrprops->strClientPath;
+	epgMaxDays = pvrprops->iEpgMaxDays;
+	
 	PyEval_AcquireLock();
 	pyState = Py_NewInterpreter();
 	PyThreadState_Swap(pyState);
 	
-	Py_InitModule("bridge", bridgeMethods);
+	PyObject* bridgeDict = PyModule_GetDict(Py_InitModule("bridge", bridgeMethods));
+	PyDict_SetItemString(bridgeDict, "__builtins__", PyEval_GetBuiltins());
+	Py_XDECREF(PyRun_String(bridgeTraceSource, Py_file_input, bridgeDict, bridgeDict));
+	if (PyErr_Occurred() != NULL) { PyErr_Print(); PyErr_Clear(); }
+	pyDeadlineExceeded = PyErr_NewException((char*) "bridge.DeadlineExceeded", PyExc_BaseException, NULL);
+	PyDict_SetItemString(bridgeDict, "DeadlineExceeded", pyDeadlineExceeded);
 	
 	// Setup the path
 	PyObject* sysPath = PySys_GetObject((char*) "path");
@@ -416,6 +1746,7 @@ ADDON_STATUS ADDON_Create(void* hdl, void* props)
 	
 	if (pyModule == NULL) {
 		XBMC->Log(LOG_DEBUG, "%s - Failed to import Python PVR implementation module 'pvrimpl'", __FUNCTION__);
+		SAFE_DELETE(CODEC);
 		SAFE_DELETE(PVR);
 		SAFE_DELETE(XBMC);
 		return ADDON_STATUS_PERMANENT_FAILURE;
@@ -431,22 +1762,44 @@ ADDON_STATUS ADDON_Create(void* hdl, void* props)
 	Py_DECREF(pyArgs);
 	Py_DECREF(pyFunc);
 	
-	// Call the ADDON_Create function
-	pyFunc = PyObject_GetAttrString(pvrImpl, "ADDON_Create");
-	pyArgs = Py_BuildValue("({s:s, s:s, s:i})", "userPath", pvrprops->strUserPath, "clientPath", pvrprops->strClientPath, "epgMaxDays", pvrprops->iEpgMaxDays);
-	PyObject* pyReturnValue = PyObject_CallObject(pyFunc, pyArgs);
-	if (PyErr_Occurred() != NULL) { PyErr_Print(); PyErr_Clear(); PYTHON_UNLOCK(); return ADDON_STATUS_PERMANENT_FAILURE; }
-	long returnValue = PyInt_AsLong(pyReturnValue);
-	Py_DECREF(pyReturnValue);
-	Py_DECREF(pyArgs);
-	Py_DECREF(pyFunc);
+	// With a usable snapshot, Kodi is served from it while the backend starts up
+	// in the background. Otherwise the backend has to be up before we return.
+	XBMC->CreateDirectory(userPath.c_str());
+	catalogPath = userFilePath("catalog.snapshot");
+	timersPath = userFilePath("timers.snapshot");
+	streamPropertiesPath = userFilePath("streams.cache");
+	tracePath = userFilePath("trace.json");
+	TraceInit(userFilePath("trace-crash.json"));
+	timerStore.Load(timersPath);
+	timerStore.SetHorizon(epgMaxDays);
+	catalog.SetEpgWindow(epgMaxDays);
+	timerStore.SetEpgIndex(&epgIndex);
+	streamProperties.Load(streamPropertiesPath);
+	bool bWarmStart = catalog.Load(catalogPath);
+	vector<unsigned int> epgChannels = catalog.GetEpgChannels();
+	for (vector<unsigned int>::const_iterator it = epgChannels.begin(); it != epgChannels.end(); ++it) {
+		epgIndex.Update(*it, catalog.GetEpg(*it));
+	}
+	
+	ADDON_STATUS returnValue = ADDON_STATUS_OK;
+	if (bWarmStart) {
+		XBMC->Log(LOG_DEBUG, "%s - Loaded catalog snapshot '%s'", __FUNCTION__, catalogPath.c_str());
+	} else {
+		returnValue = pyCreateBackend();
+	}
 	
 	PyThreadState_Swap(NULL);
 	PyEval_ReleaseLock();
 	
-	// Process the return value
-	// Enums take on their integer indexes as value
-	return ((ADDON_STATUS) returnValue);
+	if (returnValue == ADDON_STATUS_OK) {
+		if (!bWarmStart) {
+			pyStartRecordingsIndex();
+		}
+		revalidator = new CCatalogRevalidator(bWarmStart);
+		revalidator->CreateThread();
+	}
+	
+	return returnValue;
 }
 
 ADDON_STATUS ADDON_GetStatus()
@@ -460,7 +1813,71 @@ ADDON_STATUS ADDON_GetStatus()
 void ADDON_Destroy()
 {
 	MAYBE_LOG_NYI();
-	PYTHON_LOCK();
+	
+	// Threads that didn't stop may still be in Python, or about to enter it
+	bool stopped = true;
+	if (revalidator) {
+		// Don't free it if it's still stuck in Python
+		if (revalidator->StopThread()) {
+			SAFE_DELETE(revalidator);
+		} else {
+			stopped = false;
+		}
+		revalidator = NULL;
+	}
+	if (recordingsIndex) {
+		if (recordingsIndex->StopThread()) {
+			SAFE_DELETE(recordingsIndex);
+		} else {
+			stopped = false;
+		}
+		recordingsIndex = NULL;
+	}
+	if (recorder) {
+		if (recorder->StopThread(RECORDER_STOP_TIMEOUT_MS)) {
+			SAFE_DELETE(recorder);
+		} else {
+			stopped = false;
+		}
+		recorder = NULL;
+	}
+	if (!callPool.Stop(5000)) {
+		// A worker leaving its cancelled call still unlocks and finishes it
+		XBMC->Log(LOG_ERROR, "%s - Some calls are still stuck in Python", __FUNCTION__);
+		stopped = false;
+	}
+	liveStream.Close();
+	recordedStream.Close();
+	catalog.Save(catalogPath);
+	timerStore.Save(timersPath);
+	if (streamProperties.IsDirty()) {
+		streamProperties.Save(streamPropertiesPath);
+	}
+	if (PVRPYTHON_TRACE_LEVEL > 0) {
+		TraceDump(tracePath);
+	}
+	TraceShutdown();
+	
+	// Freeing the thread states from under a live thread would crash Kodi, so
+	// the interpreter is left as it is instead
+	if (!stopped) {
+		XBMC->Log(LOG_ERROR, "%s - Leaving the Python interpreter running, as some threads didn't stop", __FUNCTION__);
+		return;
+	}
+	
+	// The interpreter can only be ended from its last thread state
+	PyEval_AcquireLock();
+	PyThreadState_Swap(pyState);
+	{
+		CLockObject lock(pyThreadStatesMutex);
+		for (vector<PyThreadState*>::iterator it = pyThreadStates.begin(); it != pyThreadStates.end(); ++it) {
+			PyThreadState_Clear(*it);
+			PyThreadState_Delete(*it);
+		}
+		pyThreadStates.clear();
+		pyGeneration++;
+	}
+	Py_CLEAR(pyDeadlineExceeded);
 	Py_EndInterpreter(pyState);
 	PYTHON_UNLOCK();
 	return;
@@ -502,65 +1919,71 @@ void ADDON_FreeSettings()
  * PVR Client AddOn specific public library functions
  ***********************************************************/
 
+// While the backend isn't up, or hasn't been caught up with since a warm
+// start or a wake, Kodi is served from the catalog
+bool servedFromCatalog(CatalogList list) {
+	return !backendReady || catalog.IsStale(list);
+}
+
 PVR_ERROR GetAddonCapabilities(PVR_ADDON_CAPABILITIES* pCapabilities)
 {
 	MAYBE_LOG_CALL();
 	
-	PYTHON_LOCK();
-	
-	PyObject* pyFunc = PyObject_GetAttrString(pvrImpl, "GetAddonCapabilities");
-	PyObject* pyArgs = PyTuple_New(0);
-	PyObject* pyReturnValue = PyObject_CallObject(pyFunc, pyArgs);
-	if (PyErr_Occurred() != NULL) { PyErr_Print(); PyErr_Clear(); PYTHON_UNLOCK(); return PVR_ERROR_FAILED; }
-	
-	PyObject* pyCapabilities = PyTuple_GetItem(pyReturnValue, 1);
-	pCapabilities->bSupportsEPG = (PyDict_GetItemString(pyCapabilities, "supportsEPG") == Py_True);
-	pCapabilities->bSupportsTV = (PyDict_GetItemString(pyCapabilities, "supportsTV") == Py_True);
-	pCapabilities->bSupportsRadio = (PyDict_GetItemString(pyCapabilities, "supportsRadio") == Py_True);
-	pCapabilities->bSupportsRecordings = (PyDict_GetItemString(pyCapabilities, "supportsRecordings") == Py_True);
-	pCapabilities->bSupportsRecordingsUndelete = (PyDict_GetItemString(pyCapabilities, "supportsRecordingsUndelete") == Py_True);
-	pCapabilities->bSupportsTimers = (PyDict_GetItemString(pyCapabilities, "supportsTimers") == Py_True);
-	pCapabilities->bSupportsChannelGroups = (PyDict_GetItemString(pyCapabilities, "supportsChannelGroups") == Py_True);
-	pCapabilities->bSupportsChannelScan = (PyDict_GetItemString(pyCapabilities, "supportsChannelScan") == Py_True);
-	pCapabilities->bSupportsChannelSettings = (PyDict_GetItemString(pyCapabilities, "supportsChannelSettings") == Py_True);
-	pCapabilities->bHandlesInputStream = (PyDict_GetItemString(pyCapabilities, "handlesInputStream") == Py_True);
-	pCapabilities->bHandlesDemuxing = (PyDict_GetItemString(pyCapabilities, "handlesDemuxing") == Py_True);
-	pCapabilities->bSupportsRecordingPlayCount = (PyDict_GetItemString(pyCapabilities, "supportsRecordingPlayCount") == Py_True);
-	pCapabilities->bSupportsLastPlayedPosition = (PyDict_GetItemString(pyCapabilities, "supportsLastPlayedPosition") == Py_True);
-	pCapabilities->bSupportsRecordingEdl = (PyDict_GetItemString(pyCapabilities, "supportsRecordingEdl") == Py_True);
-	
-	PyObject* pyErrorCode = PyTuple_GetItem(pyReturnValue, 0);
-	long errorCode = PyInt_AsLong(pyErrorCode);
-	Py_DECREF(pyReturnValue);
-	Py_DECREF(pyArgs);
-	Py_DECREF(pyFunc);
+	CBackendInfo info;
+	if (!backendReady) {
+		if (!catalog.GetBackendInfo(info)) {
+			return PVR_ERROR_SERVER_ERROR;
+		}
+		*pCapabilities = info.capabilities;
+		return PVR_ERROR_NO_ERROR;
+	}
 	
+	PYTHON_LOCK();
+	PVR_ERROR error = pyGetAddonCapabilities(pCapabilities);
 	PYTHON_UNLOCK();
-	
-	return ((PVR_ERROR) errorCode);
+	return error;
+}
+
+// Until the backend is up, Kodi gets what it said the last time
+const char* cachedBackendString(string CBackendInfo::* field) {
+	CBackendInfo info;
+	catalog.GetBackendInfo(info);
+	return strdup((info.*field).c_str());
 }
 
 const char *GetBackendName(void)
 {
 	MAYBE_LOG_CALL();
+	if (!backendReady) {
+		return cachedBackendString(&CBackendInfo::strName);
+	}
 	return pyLockCallString(pvrImpl, "GetBackendName", NULL);
 }
 
 const char *GetConnectionString(void)
 {
 	MAYBE_LOG_CALL();
+	if (!backendReady) {
+		return cachedBackendString(&CBackendInfo::strConnection);
+	}
 	return pyLockCallString(pvrImpl, "GetConnectionString", NULL);
 }
 
 const char *GetBackendVersion(void)
 {
 	MAYBE_LOG_CALL();
+	if (!backendReady) {
+		return cachedBackendString(&CBackendInfo::strVersion);
+	}
 	return pyLockCallString(pvrImpl, "GetBackendVersion", NULL);
 }
 
 const char *GetBackendHostname(void)
 {
 	MAYBE_LOG_CALL();
+	if (!backendReady) {
+		return cachedBackendString(&CBackendInfo::strHostname);
+	}
 	return pyLockCallString(pvrImpl, "GetBackendHostname", NULL);
 }
 
@@ -568,55 +1991,233 @@ PVR_ERROR GetChannels(ADDON_HANDLE handle, bool bRadio)
 {
 	MAYBE_LOG_CALL();
 	
-	addon_handle = handle;
-	return pyLockCallPVRError(pvrImpl, "_cGetChannels", Py_BuildValue("(b)", bRadio));
+	if (servedFromCatalog(CATALOG_CHANNELS)) {
+		catalog.TransferChannels(handle, bRadio);
+		return PVR_ERROR_NO_ERROR;
+	}
+	
+	CCatalogCapture capture(CATALOG_CHANNELS);
+	capture.bFlag = bRadio;
+	return pyTimedTransfer(handle, capture, "_cGetChannels", "(b)", bRadio);
 }
 
 PVR_ERROR GetChannelGroups(ADDON_HANDLE handle, bool bRadio)
 {
 	MAYBE_LOG_CALL();
 	
-	addon_handle = handle;
-	return pyLockCallPVRError(pvrImpl, "_cGetChannelGroups", Py_BuildValue("(b)", bRadio));
+	if (servedFromCatalog(CATALOG_CHANNEL_GROUPS)) {
+		catalog.TransferChannelGroups(handle, bRadio);
+		return PVR_ERROR_NO_ERROR;
+	}
+	
+	CCatalogCapture capture(CATALOG_CHANNEL_GROUPS);
+	capture.bFlag = bRadio;
+	return pyTimedTransfer(handle, capture, "_cGetChannelGroups", "(b)", bRadio);
 }
 
 PVR_ERROR GetChannelGroupMembers(ADDON_HANDLE handle, const PVR_CHANNEL_GROUP &group)
 {
 	MAYBE_LOG_CALL();
 	
-	addon_handle = handle;
-	return pyLockCallPVRError(pvrImpl, "_cGetChannelGroupMembers", Py_BuildValue("(s)", group.strGroupName));
+	if (servedFromCatalog(CATALOG_CHANNEL_GROUP_MEMBERS)) {
+		catalog.TransferChannelGroupMembers(handle, group.strGroupName);
+		return PVR_ERROR_NO_ERROR;
+	}
+	
+	CCatalogCapture capture(CATALOG_CHANNEL_GROUP_MEMBERS);
+	capture.strGroupName = group.strGroupName;
+	return pyTimedTransfer(handle, capture, "_cGetChannelGroupMembers", "(s)", group.strGroupName);
 }
 
 PVR_ERROR GetTimerTypes(PVR_TIMER_TYPE types[], int *size)
 {
-	MAYBE_LOG_NYI();
+	MAYBE_LOG_CALL();
 	
-	/* TODO: Implement this to get support for the timer features introduced with PVR API 1.9.7 */
-	return PVR_ERROR_NOT_IMPLEMENTED;
+	CTimerStore::GetTimerTypes(types, size);
+	return PVR_ERROR_NO_ERROR;
 }
 
 PVR_ERROR GetTimers(ADDON_HANDLE handle)
 {
 	MAYBE_LOG_CALL();
 	
-	addon_handle = handle;
-	/* TODO: Change implementation to get support for the timer features introduced with PVR API 1.9.7 */
-	return pyLockCallPVRError(pvrImpl, "_cGetTimers", NULL);
+	// After a warm start, the revalidator syncs the timers instead. A sync
+	// that fails or runs late leaves Kodi with what the store already has.
+	if (!servedFromCatalog(CATALOG_TIMERS)) {
+		pySyncTimers(true);
+	}
+	
+	timerStore.TransferTimers(handle);
+	return PVR_ERROR_NO_ERROR;
+}
+
+PVR_ERROR AddTimer(const PVR_TIMER &timer)
+{
+	MAYBE_LOG_CALL();
+	
+	if (!backendReady) {
+		return PVR_ERROR_SERVER_ERROR;
+	}
+	
+	PVR_TIMER newTimer = timer;
+	PVR_ERROR error = timerStore.Prepare(newTimer);
+	if (error != PVR_ERROR_NO_ERROR) {
+		return error;
+	}
+	
+	error = pyLockCallTimer("_cAddTimer", newTimer);
+	if (error != PVR_ERROR_NO_ERROR) {
+		return error;
+	}
+	
+	timerStore.Add(newTimer);
+	timerStore.Save(timersPath);
+	if (recorder) {
+		recorder->Wake();
+	}
+	PVR->TriggerTimerUpdate();
+	return PVR_ERROR_NO_ERROR;
+}
+
+PVR_ERROR UpdateTimer(const PVR_TIMER &timer)
+{
+	MAYBE_LOG_CALL();
+	
+	if (!backendReady) {
+		return PVR_ERROR_SERVER_ERROR;
+	}
+	
+	PVR_TIMER oldTimer;
+	if (timerStore.IsOccurrence(timer.iClientIndex)) {
+		return PVR_ERROR_REJECTED;
+	}
+	if (!timerStore.Get(timer.iClientIndex, oldTimer)) {
+		return PVR_ERROR_INVALID_PARAMETERS;
+	}
+	
+	PVR_TIMER backendTimer = timer;
+	timerStore.ToBackend(backendTimer);
+	PVR_ERROR error = pyLockCallTimer("_cUpdateTimer", backendTimer);
+	if (error != PVR_ERROR_NO_ERROR) {
+		return error;
+	}
+	
+	error = timerStore.Update(timer);
+	if (error == PVR_ERROR_NO_ERROR) {
+		timerStore.Save(timersPath);
+		if (recorder) {
+			recorder->Wake();
+		}
+		PVR->TriggerTimerUpdate();
+	}
+	return error;
+}
+
+PVR_ERROR DeleteTimer(const PVR_TIMER &timer, bool bForceDelete)
+{
+	MAYBE_LOG_CALL();
+	
+	if (!backendReady) {
+		return PVR_ERROR_SERVER_ERROR;
+	}
+	
+	PVR_TIMER oldTimer;
+	if (timerStore.IsOccurrence(timer.iClientIndex)) {
+		return PVR_ERROR_REJECTED;
+	}
+	if (!timerStore.Get(timer.iClientIndex, oldTimer)) {
+		return PVR_ERROR_INVALID_PARAMETERS;
+	}
+	
+	timerStore.ToBackend(oldTimer);
+	PYTHON_LOCK();
+	PVR_ERROR error = (PVR_ERROR) pyCallInt(pvrImpl, "_cDeleteTimer", Py_BuildValue("(N, b)", PyDict_FromTimer(oldTimer), bForceDelete));
+	PYTHON_UNLOCK();
+	if (error != PVR_ERROR_NO_ERROR) {
+		return error;
+	}
+	
+	error = timerStore.Delete(timer.iClientIndex);
+	if (error == PVR_ERROR_NO_ERROR) {
+		timerStore.Save(timersPath);
+		if (recorder) {
+			recorder->Wake();
+		}
+		PVR->TriggerTimerUpdate();
+	}
+	return error;
 }
 
 PVR_ERROR GetRecordings(ADDON_HANDLE handle, bool deleted)
 {
 	MAYBE_LOG_CALL();
 	
-	addon_handle = handle;
-	return pyLockCallPVRError(pvrImpl, "_cGetRecordings", Py_BuildValue("(b)", deleted));
+	if (recordingsIndex) {
+		recordingsIndex->TransferRecordings(handle, deleted);
+		return PVR_ERROR_NO_ERROR;
+	}
+	if (servedFromCatalog(CATALOG_RECORDINGS)) {
+		catalog.TransferRecordings(handle, deleted);
+		return PVR_ERROR_NO_ERROR;
+	}
+	
+	CCatalogCapture capture(CATALOG_RECORDINGS);
+	capture.bFlag = deleted;
+	return pyTimedTransfer(handle, capture, "_cGetRecordings", "(b)", deleted);
+}
+
+// Only recordings in the local index can be deleted, by moving them to its trash
+PVR_ERROR DeleteRecording(const PVR_RECORDING &recording)
+{
+	MAYBE_LOG_CALL();
+	if (!recordingsIndex || !recordingsIndex->Contains(recording)) {
+		return PVR_ERROR_NOT_IMPLEMENTED;
+	}
+	
+	PVR_ERROR error = recordingsIndex->Delete(recording);
+	if (error == PVR_ERROR_NO_ERROR) {
+		PVR->TriggerRecordingUpdate();
+	}
+	return error;
+}
+
+PVR_ERROR UndeleteRecording(const PVR_RECORDING& recording)
+{
+	MAYBE_LOG_CALL();
+	if (!recordingsIndex || !recordingsIndex->Contains(recording)) {
+		return PVR_ERROR_NOT_IMPLEMENTED;
+	}
+	
+	PVR_ERROR error = recordingsIndex->Undelete(recording);
+	if (error == PVR_ERROR_NO_ERROR) {
+		PVR->TriggerRecordingUpdate();
+	}
+	return error;
+}
+
+PVR_ERROR DeleteAllRecordingsFromTrash()
+{
+	MAYBE_LOG_CALL();
+	if (!recordingsIndex) {
+		return PVR_ERROR_NOT_IMPLEMENTED;
+	}
+	
+	bool bDeleted;
+	PVR_ERROR error = recordingsIndex->DeleteAllFromTrash(bDeleted);
+	if (bDeleted) {
+		PVR->TriggerRecordingUpdate();
+	}
+	return error;
 }
 
 PVR_ERROR GetDriveSpace(long long *iTotal, long long *iUsed)
 {
 	MAYBE_LOG_CALL();
 	
+	if (!backendReady) {
+		return PVR_ERROR_SERVER_ERROR;
+	}
+	
 	PYTHON_LOCK();
 	
 	PyObject* pyFunc = PyObject_GetAttrString(pvrImpl, "GetDriveSpace");
@@ -638,47 +2239,105 @@ PVR_ERROR GetDriveSpace(long long *iTotal, long long *iUsed)
 int GetChannelsAmount(void)
 {
 	MAYBE_LOG_CALL();
+	if (servedFromCatalog(CATALOG_CHANNELS)) {
+		return catalog.GetChannelsAmount();
+	}
 	return pyLockCallInt(pvrImpl, "GetChannelsAmount", NULL);
 }
 
 int GetTimersAmount(void)
 {
 	MAYBE_LOG_CALL();
-	return pyLockCallInt(pvrImpl, "GetTimersAmount", NULL);
+	return timerStore.GetTimersAmount();
 }
 
 int GetRecordingsAmount(bool deleted)
 {
 	MAYBE_LOG_CALL();
-	return pyLockCallInt(pvrImpl, "GetRecordingsAmount", Py_BuildValue("(b)", deleted));
+	if (recordingsIndex) {
+		return recordingsIndex->GetRecordingsAmount(deleted);
+	}
+	if (servedFromCatalog(CATALOG_RECORDINGS)) {
+		return catalog.GetRecordingsAmount(deleted);
+	}
+	return pyLockCallInt(pvrImpl, "GetRecordingsAmount", "(b)", deleted);
 }
 
 PVR_ERROR GetEPGForChannel(ADDON_HANDLE handle, const PVR_CHANNEL &channel, time_t iStart, time_t iEnd)
 {
 	MAYBE_LOG_CALL();
 	
-	addon_handle = handle;
-	return pyLockCallPVRError(pvrImpl, "_cGetEPGForChannel", Py_BuildValue("(i, i, i)", channel.iUniqueId, iStart, iEnd));
+	if (servedFromCatalog(CATALOG_EPG)) {
+		catalog.TransferEpg(handle, channel.iUniqueId, iStart, iEnd);
+		return PVR_ERROR_NO_ERROR;
+	}
+	
+	CCatalogCapture capture(CATALOG_EPG);
+	capture.iChannelUid = channel.iUniqueId;
+	capture.iStart = iStart;
+	capture.iEnd = iEnd;
+	return pyTimedTransfer(handle, capture, "_cGetEPGForChannel", "(I, L, L)", channel.iUniqueId, (long long) iStart, (long long) iEnd);
 }
 
+// Background work stops, and the backend drops its connections, which
+// wouldn't survive the sleep anyway
 void OnSystemSleep()
 {
-	MAYBE_LOG_NYI();
+	MAYBE_LOG_CALL();
+	
+	if (revalidator) {
+		revalidator->Pause();
+	}
+	if (recordingsIndex) {
+		recordingsIndex->Suspend();
+	}
+	catalog.Save(catalogPath);
+	timerStore.Save(timersPath);
+	if (streamProperties.IsDirty()) {
+		streamProperties.Save(streamPropertiesPath);
+	}
+	if (backendReady) {
+		pyTimedNotify("OnSystemSleep");
+	}
 }
 
+// Returns straight away. Kodi is served from the catalog while the backend
+// revalidates its sessions and the lists in the background, starting with
+// whatever was being watched.
 void OnSystemWake()
 {
-	MAYBE_LOG_NYI();
+	MAYBE_LOG_CALL();
+	
+	if (recordingsIndex) {
+		recordingsIndex->Resume(true);
+	}
+	if (revalidator) {
+		revalidator->Resume(true, lastChannelUid);
+	}
 }
 
 void OnPowerSavingActivated()
 {
-	MAYBE_LOG_NYI();
+	MAYBE_LOG_CALL();
+	
+	if (revalidator) {
+		revalidator->Pause();
+	}
+	if (recordingsIndex) {
+		recordingsIndex->Suspend();
+	}
 }
 
 void OnPowerSavingDeactivated()
 {
-	MAYBE_LOG_NYI();
+	MAYBE_LOG_CALL();
+	
+	if (recordingsIndex) {
+		recordingsIndex->Resume(false);
+	}
+	if (revalidator) {
+		revalidator->Resume(false, PVR_CHANNEL_INVALID_UID);
+	}
 }
 
 const char* GetPVRAPIVersion(void)
@@ -708,129 +2367,112 @@ bool OpenLiveStream(const PVR_CHANNEL &channel)
 	MAYBE_LOG_CALL();
 	
 	CloseLiveStream();
-	
-	PYTHON_LOCK();
-	
-	PyObject* pyFunc = PyObject_GetAttrString(pvrImpl, "OpenLiveStream");
-	PyObject* pyArgs = Py_BuildValue("(i)", channel.iUniqueId);
-	PyObject* pyReturnValue = PyObject_CallObject(pyFunc, pyArgs);
-	if (PyErr_Occurred() != NULL) { PyErr_Print(); PyErr_Clear(); PYTHON_UNLOCK(); return false; }
-	
-	bool returnValue;
-	
-	if (!PyTuple_Check(pyReturnValue)) {
-		returnValue = PyBool_AsBool(pyReturnValue);
-	} else {
-		returnValue = PyBool_AsBool(PyTuple_GetItem(pyReturnValue, 0));
-		
-		// Are we offloading the file handling to Kodi?
-		if (returnValue && PyTuple_Size(pyReturnValue) > 1) {
-			// We are!
-			char* fileName = PyString_SafeAsString(PyTuple_GetItem(pyReturnValue, 1));
-			
-			streamHandle = XBMC->OpenFile(fileName, 0);
-			
-			if (!streamHandle) {
-				XBMC->Log(LOG_DEBUG, "%s - Failed to open stream natively", __FUNCTION__);
-				returnValue = false;
-			} else {
-				XBMC->Log(LOG_DEBUG, "%s - Opened stream natively", __FUNCTION__);
-				returnValue = true;
-			}
-		}
+	if (!backendReady) {
+		return false;
 	}
 	
-	Py_DECREF(pyReturnValue);
-	Py_DECREF(pyArgs);
-	Py_DECREF(pyFunc);
-	
-	PYTHON_UNLOCK();
-	
-	return returnValue;
+	CStreamOpening opening;
+	lastChannelUid = channel.iUniqueId;
+	CStreamSession* session = pyLockOpenStream(false, "_cOpenLiveStream", "(I)", channel.iUniqueId);
+	liveStream.Open(session);
+	return (session != NULL);
 }
 
 int ReadLiveStream(unsigned char *pBuffer, unsigned int iBufferSize) {
 	//MAYBE_LOG_CALL(); // This gets called a lot.
-	
-	if (!streamHandle) {
-		PYTHON_LOCK();
-		
-		PyObject* pyReturnValue = pyCall(pvrImpl, "ReadLiveStream", Py_BuildValue("(i)", iBufferSize));
-		int bytesRead = PyInt_AsLong(PyTuple_GetItem(pyReturnValue, 0));
-		
-		if (bytesRead > 0) {
-			char* contents = PyString_SafeAsString(PyTuple_GetItem(pyReturnValue, 1));
-			memcpy(pBuffer, contents, bytesRead);
-		}
-		
-		Py_DECREF(pyReturnValue);
-		
-		PYTHON_UNLOCK();
-		
-		return bytesRead;
-	} else {
-		return XBMC->ReadFile(streamHandle, pBuffer, iBufferSize);
-	}
+	TRACE_CALL();
+	int iRead = liveStream.Read(pBuffer, iBufferSize);
+	TRACE_COUNTER("ReadLiveStream bytes", iRead);
+	return iRead;
 }
 
 long long SeekLiveStream(long long iPosition, int iWhence /* = SEEK_SET */) {
 	MAYBE_LOG_CALL();
-	
-	if (!streamHandle) {
-		return pyLockCallInt(pvrImpl, "SeekLiveStream", Py_BuildValue("(i, i)", iPosition, iWhence));
-	} else {
-		return XBMC->SeekFile(streamHandle, iPosition, iWhence);
-	}
+	return liveStream.Seek(iPosition, iWhence);
 }
 
 long long PositionLiveStream(void) {
 	MAYBE_LOG_CALL();
-	
-	if (!streamHandle) {
-		return pyLockCallInt(pvrImpl, "PositionLiveStream", NULL);
-	} else {
-		return XBMC->GetFilePosition(streamHandle);
-	}
+	return liveStream.Position();
 }
 
 long long LengthLiveStream(void) {
 	MAYBE_LOG_CALL();
-	
-	if (!streamHandle) {
-		return pyLockCallInt(pvrImpl, "LengthLiveStream", NULL);
-	} else {
-		return XBMC->GetFileLength(streamHandle);
-	}
+	return liveStream.Length();
 }
 
 void CloseLiveStream(void)
+{
+	MAYBE_LOG_CALL();
+	liveStream.Close();
+}
+
+bool OpenRecordedStream(const PVR_RECORDING &recording)
 {
 	MAYBE_LOG_CALL();
 	
-	if (!streamHandle) {
-		pyLockCall(pvrImpl, "CloseLiveStream", NULL);
-	} else {
-		XBMC->CloseFile(streamHandle);
-		streamHandle = NULL;
+	CloseRecordedStream();
+	if (!backendReady) {
+		return false;
 	}
+	
+	CStreamOpening opening;
+	PYTHON_LOCK();
+	PyObject* pyArgs = Py_BuildValue("(N)", PyDict_FromRecording(recording));
+	PYTHON_UNLOCK();
+	CStreamSession* session = pyTimedOpenStream(true, "_cOpenRecordedStream", pyArgs);
+	recordedStream.Open(session);
+	return (session != NULL);
+}
+
+int ReadRecordedStream(unsigned char *pBuffer, unsigned int iBufferSize) {
+	TRACE_CALL();
+	int iRead = recordedStream.Read(pBuffer, iBufferSize);
+	TRACE_COUNTER("ReadRecordedStream bytes", iRead);
+	return iRead;
+}
+
+long long SeekRecordedStream(long long iPosition, int iWhence /* = SEEK_SET */) {
+	MAYBE_LOG_CALL();
+	return recordedStream.Seek(iPosition, iWhence);
+}
+
+long long PositionRecordedStream(void) {
+	MAYBE_LOG_CALL();
+	return recordedStream.Position();
+}
+
+long long LengthRecordedStream(void) {
+	MAYBE_LOG_CALL();
+	return recordedStream.Length();
+}
+
+void CloseRecordedStream(void)
+{
+	MAYBE_LOG_CALL();
+	recordedStream.Close();
 }
 
 bool CanPauseStream(void) {
 	//MAYBE_LOG_CALL(); // Lots of calls.
-	return pyLockCallBool(pvrImpl, "CanPauseStream", NULL);
+	TRACE_CALL();
+	return recordedStream.IsOpen() ? recordedStream.CanPause() : liveStream.CanPause();
 }
 
 // Apparently the pause button only works if we can also seek.
 bool CanSeekStream(void) {
 	//MAYBE_LOG_CALL(); // Lots of calls.
-	return pyLockCallBool(pvrImpl, "CanSeekStream", NULL);
+	TRACE_CALL();
+	return recordedStream.IsOpen() ? recordedStream.CanSeek() : liveStream.CanSeek();
 }
 
 PVR_ERROR SignalStatus(PVR_SIGNAL_STATUS &signalStatus)
 {
 	//MAYBE_LOG_CALL(); // This gets called a lot.
+	TRACE_CALL();
 	
 	strcpy(signalStatus.strAdapterStatus, "OK");
+	liveStream.SignalStatus(signalStatus);
 	
 	return PVR_ERROR_NO_ERROR;
 	
@@ -849,10 +2491,17 @@ bool SwitchChannel(const PVR_CHANNEL &channel)
 	return OpenLiveStream(channel);
 }
 
+// The layout the recorder last found on the channel, so Kodi can skip probing it
 PVR_ERROR GetStreamProperties(PVR_STREAM_PROPERTIES* pProperties)
 {
-	MAYBE_LOG_NYI();
-	return PVR_ERROR_NOT_IMPLEMENTED;
+	MAYBE_LOG_CALL();
+	if (!liveStream.IsOpen() || lastChannelUid == PVR_CHANNEL_INVALID_UID) {
+		return PVR_ERROR_REJECTED;
+	}
+	if (!streamProperties.Get(lastChannelUid, *pProperties)) {
+		return PVR_ERROR_NOT_IMPLEMENTED;
+	}
+	return PVR_ERROR_NO_ERROR;
 }
 
 int GetChannelGroupsAmount(void)
@@ -874,24 +2523,14 @@ PVR_ERROR RenameChannel(const PVR_CHANNEL &channel) { return PVR_ERROR_NOT_IMPLE
 PVR_ERROR MoveChannel(const PVR_CHANNEL &channel) { return PVR_ERROR_NOT_IMPLEMENTED; }
 PVR_ERROR OpenDialogChannelSettings(const PVR_CHANNEL &channel) { return PVR_ERROR_NOT_IMPLEMENTED; }
 PVR_ERROR OpenDialogChannelAdd(const PVR_CHANNEL &channel) { return PVR_ERROR_NOT_IMPLEMENTED; }
-bool OpenRecordedStream(const PVR_RECORDING &recording) { return false; }
-void CloseRecordedStream(void) {}
-int ReadRecordedStream(unsigned char *pBuffer, unsigned int iBufferSize) { return 0; }
-long long SeekRecordedStream(long long iPosition, int iWhence /* = SEEK_SET */) { return 0; }
-long long PositionRecordedStream(void) { return -1; }
-long long LengthRecordedStream(void) { return 0; }
 void DemuxReset(void) {}
 void DemuxFlush(void) {}
 const char * GetLiveStreamURL(const PVR_CHANNEL &channel) { MAYBE_LOG_NYI(); return ""; }
-PVR_ERROR DeleteRecording(const PVR_RECORDING &recording) { return PVR_ERROR_NOT_IMPLEMENTED; }
 PVR_ERROR RenameRecording(const PVR_RECORDING &recording) { return PVR_ERROR_NOT_IMPLEMENTED; }
 PVR_ERROR SetRecordingPlayCount(const PVR_RECORDING &recording, int count) { return PVR_ERROR_NOT_IMPLEMENTED; }
 PVR_ERROR SetRecordingLastPlayedPosition(const PVR_RECORDING &recording, int lastplayedposition) { return PVR_ERROR_NOT_IMPLEMENTED; }
 int GetRecordingLastPlayedPosition(const PVR_RECORDING &recording) { return -1; }
 PVR_ERROR GetRecordingEdl(const PVR_RECORDING&, PVR_EDL_ENTRY[], int*) { return PVR_ERROR_NOT_IMPLEMENTED; };
-PVR_ERROR AddTimer(const PVR_TIMER &timer) { return PVR_ERROR_NOT_IMPLEMENTED; }
-PVR_ERROR DeleteTimer(const PVR_TIMER &timer, bool bForceDelete) { return PVR_ERROR_NOT_IMPLEMENTED; }
-PVR_ERROR UpdateTimer(const PVR_TIMER &timer) { return PVR_ERROR_NOT_IMPLEMENTED; }
 void DemuxAbort(void) {}
 DemuxPacket* DemuxRead(void) { return NULL; }
 unsigned int GetChannelSwitchDelay(void) { return 0; }
@@ -903,7 +2542,5 @@ bool IsRealTimeStream(void) { return true; }
 time_t GetPlayingTime() { return 0; }
 time_t GetBufferTimeStart() { return 0; }
 time_t GetBufferTimeEnd() { return 0; }
-PVR_ERROR UndeleteRecording(const PVR_RECORDING& recording) { return PVR_ERROR_NOT_IMPLEMENTED; }
-PVR_ERROR DeleteAllRecordingsFromTrash() { return PVR_ERROR_NOT_IMPLEMENTED; }
 PVR_ERROR SetEPGTimeFrame(int) { return PVR_ERROR_NOT_IMPLEMENTED; }
 }
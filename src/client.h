@@ -20,6 +20,8 @@
 
 #include "libXBMC_addon.h"
 #include "libXBMC_pvr.h"
+#include "libXBMC_codec.h"
 
 extern ADDON::CHelper_libXBMC_addon *XBMC;
 extern CHelper_libXBMC_pvr          *PVR;
+extern CHelper_libXBMC_codec        *CODEC;
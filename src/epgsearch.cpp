@@ -0,0 +1,422 @@
+/*
+ *  pvr.python - A PVR client for Kodi using Python
+ *  Copyright © 2016 RunasSudo (Yingtong Li)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "epgsearch.h"
+
+#include <algorithm>
+#include <iterator>
+#include <set>
+
+using namespace std;
+using namespace P8PLATFORM;
+
+// Words past this in one field aren't indexed, so a phrase can't run into the next field
+#define EPG_SEARCH_MAX_WORDS 0xffff
+
+// Removed documents are only dropped from the postings once they make up this
+// much of them
+#define EPG_SEARCH_COMPACT_MIN 4096
+
+// BEGIN TOKENIZING
+
+// Returns the code point at i and moves past it. Bytes that aren't valid UTF-8
+// are taken to be Latin-1.
+static uint32_t DecodeUTF8(const string& strText, size_t& i)
+{
+	unsigned char lead = strText[i];
+	size_t length = (lead >= 0xf0 && lead < 0xf8) ? 4 : (lead >= 0xe0) ? 3 : (lead >= 0xc2) ? 2 : 1;
+	if (lead >= 0xf8)
+		length = 1;
+	if (length == 1 || i + length > strText.size()) {
+		i++;
+		return lead;
+	}
+
+	uint32_t c = lead & (0x7f >> length);
+	for (size_t j = 1; j < length; j++) {
+		unsigned char next = strText[i + j];
+		if ((next & 0xc0) != 0x80) {
+			i++;
+			return lead;
+		}
+		c = (c << 6) | (next & 0x3f);
+	}
+	i += length;
+	return c;
+}
+
+static void AppendUTF8(string& strText, uint32_t c)
+{
+	if (c < 0x80) {
+		strText += (char) c;
+	} else if (c < 0x800) {
+		strText += (char) (0xc0 | (c >> 6));
+		strText += (char) (0x80 | (c & 0x3f));
+	} else if (c < 0x10000) {
+		strText += (char) (0xe0 | (c >> 12));
+		strText += (char) (0x80 | ((c >> 6) & 0x3f));
+		strText += (char) (0x80 | (c & 0x3f));
+	} else {
+		strText += (char) (0xf0 | (c >> 18));
+		strText += (char) (0x80 | ((c >> 12) & 0x3f));
+		strText += (char) (0x80 | ((c >> 6) & 0x3f));
+		strText += (char) (0x80 | (c & 0x3f));
+	}
+}
+
+static bool IsWordChar(uint32_t c)
+{
+	if (c < 0x80)
+		return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+	if (c < 0xc0 || c == 0xd7 || c == 0xf7)
+		return false; // Latin-1 punctuation and symbols
+	if ((c >= 0x2000 && c <= 0x2bff) || (c >= 0x3000 && c <= 0x303f))
+		return false; // Punctuation, currency, arrows, box drawing and the like
+	if ((c >= 0xfe10 && c <= 0xfe6f) || (c >= 0xff00 && c <= 0xff0f) || c >= 0xfff0)
+		return false;
+	return true;
+}
+
+// Simple case folding for the scripts EPG data is usually in
+static uint32_t FoldCase(uint32_t c)
+{
+	if (c >= 'A' && c <= 'Z')
+		return c + 0x20;
+	if (c >= 0xc0 && c <= 0xde && c != 0xd7)
+		return c + 0x20; // Latin-1
+	if ((c >= 0x100 && c <= 0x137) || (c >= 0x14a && c <= 0x177))
+		return c | 1; // Latin Extended-A, upper case at even code points
+	if ((c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17e))
+		return (c & 1) ? c + 1 : c; // And at odd ones
+	if (c >= 0x391 && c <= 0x3a9 && c != 0x3a2)
+		return c + 0x20; // Greek
+	if (c >= 0x410 && c <= 0x42f)
+		return c + 0x20; // Cyrillic
+	if (c >= 0x400 && c <= 0x40f)
+		return c + 0x50;
+	return c;
+}
+
+static bool IsApostrophe(uint32_t c)
+{
+	return c == '\'' || c == 0x2019;
+}
+
+void CEpgSearchIndex::Tokenize(const string& strText, vector<string>& words, vector<bool>* prefixes)
+{
+	string word;
+	size_t i = 0;
+	while (i < strText.size()) {
+		uint32_t c = DecodeUTF8(strText, i);
+		if (IsWordChar(c)) {
+			AppendUTF8(word, FoldCase(c));
+			continue;
+		}
+		if (IsApostrophe(c) && !word.empty())
+			continue; // "Grey's" is searched for as "greys"
+
+		if (!word.empty()) {
+			words.push_back(word);
+			if (prefixes != NULL)
+				prefixes->push_back(c == '*');
+			word.clear();
+		}
+	}
+	if (!word.empty()) {
+		words.push_back(word);
+		if (prefixes != NULL)
+			prefixes->push_back(false);
+	}
+}
+
+// BEGIN INDEX
+
+static uint64_t Fingerprint(const CEpgEntry& entry)
+{
+	// FNV-1a over everything the index keeps
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	const string* fields[] = { &entry.strTitle, &entry.strEpisodeName, &entry.strPlot, &entry.strPlotOutline, &entry.strCast };
+	for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+		for (size_t j = 0; j <= fields[i]->size(); j++) {
+			hash ^= (j < fields[i]->size()) ? (unsigned char) (*fields[i])[j] : 0;
+			hash *= 0x100000001b3ULL;
+		}
+	}
+	int64_t numbers[] = { entry.tag.startTime, entry.tag.endTime };
+	for (size_t i = 0; i < sizeof(numbers) / sizeof(numbers[0]); i++) {
+		for (int shift = 0; shift < 64; shift += 8) {
+			hash ^= (numbers[i] >> shift) & 0xff;
+			hash *= 0x100000001b3ULL;
+		}
+	}
+	return hash;
+}
+
+static bool MatchBefore(const EpgSearchMatch& a, const EpgSearchMatch& b)
+{
+	return a.startTime < b.startTime || (a.startTime == b.startTime && a.iChannelUid < b.iChannelUid);
+}
+
+CEpgSearchIndex::CEpgSearchIndex() :
+	m_iPostings(0),
+	m_iDeadPostings(0),
+	m_iGeneration(0)
+{
+}
+
+bool CEpgSearchIndex::Update(unsigned int iChannelUid, const vector<CEpgEntry>& entries)
+{
+	CLockObject lock(m_mutex);
+	map<unsigned int, uint32_t>& channel = m_channels[iChannelUid];
+
+	bool changed = false;
+	set<unsigned int> present;
+	for (vector<CEpgEntry>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+		uint64_t iFingerprint = Fingerprint(*it);
+		present.insert(it->tag.iUniqueBroadcastId);
+
+		map<unsigned int, uint32_t>::iterator indexed = channel.find(it->tag.iUniqueBroadcastId);
+		if (indexed != channel.end()) {
+			if (m_documents[indexed->second].iFingerprint == iFingerprint)
+				continue;
+			Remove(indexed->second);
+		}
+		Add(*it, iChannelUid, iFingerprint);
+		changed = true;
+	}
+
+	for (map<unsigned int, uint32_t>::iterator it = channel.begin(); it != channel.end(); ) {
+		if (present.count(it->first)) {
+			++it;
+			continue;
+		}
+		Remove(it->second);
+		channel.erase(it++);
+		changed = true;
+	}
+	if (channel.empty())
+		m_channels.erase(iChannelUid);
+
+	if (changed)
+		m_iGeneration++;
+	if (m_iDeadPostings >= EPG_SEARCH_COMPACT_MIN && m_iDeadPostings * 2 > m_iPostings)
+		Compact();
+	return changed;
+}
+
+void CEpgSearchIndex::Search(const string& strQuery, bool bFullText, int iChannelUid, time_t start, time_t end, vector<EpgSearchMatch>& result)
+{
+	CLockObject lock(m_mutex);
+
+	// Outside quotes every word is a clause of its own; inside, the words are one clause
+	vector<uint32_t> documents;
+	bool bFirst = true;
+	size_t from = 0;
+	for (int segment = 0; from <= strQuery.size(); segment++) {
+		size_t quote = strQuery.find('"', from);
+		if (quote == string::npos)
+			quote = strQuery.size();
+
+		vector<string> words;
+		vector<bool> prefixes;
+		Tokenize(strQuery.substr(from, quote - from), words, &prefixes);
+		from = quote + 1;
+
+		for (size_t i = 0; i < words.size(); ) {
+			size_t count = (segment % 2 == 1) ? words.size() : 1;
+			vector<string> phrase(words.begin() + i, words.begin() + i + count);
+			vector<bool> phrasePrefixes(prefixes.begin() + i, prefixes.begin() + i + count);
+			i += count;
+
+			vector<uint32_t> matched;
+			FindPhrase(phrase, phrasePrefixes, bFullText, matched);
+			if (bFirst) {
+				documents.swap(matched);
+				bFirst = false;
+			} else {
+				vector<uint32_t> both;
+				set_intersection(documents.begin(), documents.end(), matched.begin(), matched.end(), back_inserter(both));
+				documents.swap(both);
+			}
+			if (documents.empty())
+				return;
+		}
+	}
+
+	size_t first = result.size();
+	for (vector<uint32_t>::const_iterator it = documents.begin(); it != documents.end(); ++it) {
+		const Document& document = m_documents[*it];
+		if (!document.bLive)
+			continue;
+		if (iChannelUid != PVR_TIMER_ANY_CHANNEL && document.iChannelUid != (unsigned int) iChannelUid)
+			continue;
+		if (document.endTime <= start || (end != 0 && document.startTime >= end))
+			continue;
+
+		EpgSearchMatch match;
+		match.iChannelUid = document.iChannelUid;
+		match.iBroadcastId = document.iBroadcastId;
+		match.startTime = document.startTime;
+		match.endTime = document.endTime;
+		match.strTitle = document.strTitle;
+		match.strEpisodeName = document.strEpisodeName;
+		result.push_back(match);
+	}
+	sort(result.begin() + first, result.end(), MatchBefore);
+}
+
+bool CEpgSearchIndex::PostingBefore(const Posting& a, const Posting& b)
+{
+	return a.iDocument < b.iDocument || (a.iDocument == b.iDocument && a.iPosition < b.iPosition);
+}
+
+unsigned int CEpgSearchIndex::Generation()
+{
+	CLockObject lock(m_mutex);
+	return m_iGeneration;
+}
+
+void CEpgSearchIndex::Add(const CEpgEntry& entry, unsigned int iChannelUid, uint64_t iFingerprint)
+{
+	uint32_t iDocument = m_documents.size();
+
+	Document document;
+	document.iChannelUid = iChannelUid;
+	document.iBroadcastId = entry.tag.iUniqueBroadcastId;
+	document.startTime = entry.tag.startTime;
+	document.endTime = entry.tag.endTime;
+	document.strTitle = entry.strTitle;
+	document.strEpisodeName = entry.strEpisodeName;
+	document.iFingerprint = iFingerprint;
+	document.iPostings = 0;
+	document.bLive = true;
+
+	const string* fields[EPG_SEARCH_FIELD_COUNT];
+	fields[EPG_SEARCH_TITLE] = &entry.strTitle;
+	fields[EPG_SEARCH_EPISODE_NAME] = &entry.strEpisodeName;
+	fields[EPG_SEARCH_PLOT] = entry.strPlot.empty() ? &entry.strPlotOutline : &entry.strPlot;
+	fields[EPG_SEARCH_CAST] = &entry.strCast;
+
+	for (uint32_t field = 0; field < EPG_SEARCH_FIELD_COUNT; field++) {
+		vector<string> words;
+		Tokenize(*fields[field], words);
+		for (size_t i = 0; i < words.size() && i < EPG_SEARCH_MAX_WORDS; i++) {
+			Posting posting;
+			posting.iDocument = iDocument;
+			posting.iPosition = (field << 24) | i;
+			m_postings[words[i]].push_back(posting);
+			document.iPostings++;
+		}
+	}
+
+	m_documents.push_back(document);
+	m_channels[iChannelUid][document.iBroadcastId] = iDocument;
+	m_iPostings += document.iPostings;
+}
+
+// The postings are left in place, and skipped, until the next compaction
+void CEpgSearchIndex::Remove(uint32_t iDocument)
+{
+	Document& document = m_documents[iDocument];
+	document.bLive = false;
+	document.strTitle.clear();
+	document.strEpisodeName.clear();
+	m_iDeadPostings += document.iPostings;
+}
+
+// Drops removed documents, keeping the postings sorted by document
+void CEpgSearchIndex::Compact()
+{
+	vector<uint32_t> renumbered(m_documents.size(), 0);
+	vector<Document> documents;
+	for (size_t i = 0; i < m_documents.size(); i++) {
+		if (m_documents[i].bLive) {
+			renumbered[i] = documents.size();
+			documents.push_back(m_documents[i]);
+		}
+	}
+
+	for (map<string, vector<Posting> >::iterator it = m_postings.begin(); it != m_postings.end(); ) {
+		vector<Posting> kept;
+		for (vector<Posting>::const_iterator posting = it->second.begin(); posting != it->second.end(); ++posting) {
+			if (m_documents[posting->iDocument].bLive) {
+				kept.push_back(*posting);
+				kept.back().iDocument = renumbered[posting->iDocument];
+			}
+		}
+		if (kept.empty()) {
+			m_postings.erase(it++);
+		} else {
+			it->second.swap(kept);
+			++it;
+		}
+	}
+
+	for (map<unsigned int, map<unsigned int, uint32_t> >::iterator channel = m_channels.begin(); channel != m_channels.end(); ++channel) {
+		for (map<unsigned int, uint32_t>::iterator it = channel->second.begin(); it != channel->second.end(); ++it)
+			it->second = renumbered[it->second];
+	}
+
+	m_documents.swap(documents);
+	m_iPostings -= m_iDeadPostings;
+	m_iDeadPostings = 0;
+}
+
+// Postings for a word, or every word it starts, in the fields being searched
+void CEpgSearchIndex::FindWord(const string& strWord, bool bPrefix, bool bFullText, vector<Posting>& result)
+{
+	map<string, vector<Posting> >::const_iterator it = m_postings.lower_bound(strWord);
+	int lists = 0;
+	for (; it != m_postings.end() && it->first.compare(0, strWord.size(), strWord) == 0; ++it) {
+		if (!bPrefix && it->first.size() != strWord.size())
+			break;
+		for (vector<Posting>::const_iterator posting = it->second.begin(); posting != it->second.end(); ++posting) {
+			if (bFullText || (posting->iPosition >> 24) == EPG_SEARCH_TITLE)
+				result.push_back(*posting);
+		}
+		lists++;
+	}
+	if (lists > 1)
+		sort(result.begin(), result.end(), PostingBefore);
+}
+
+// Documents with the words in a row in one field, in order
+void CEpgSearchIndex::FindPhrase(const vector<string>& words, const vector<bool>& prefixes, bool bFullText, vector<uint32_t>& result)
+{
+	vector<Posting> starts;
+	FindWord(words[0], prefixes[0], bFullText, starts);
+	for (size_t i = 1; i < words.size() && !starts.empty(); i++) {
+		vector<Posting> next;
+		FindWord(words[i], prefixes[i], bFullText, next);
+
+		vector<Posting> kept;
+		for (vector<Posting>::const_iterator it = starts.begin(); it != starts.end(); ++it) {
+			Posting wanted = *it;
+			wanted.iPosition += i;
+			if (binary_search(next.begin(), next.end(), wanted, PostingBefore))
+				kept.push_back(*it);
+		}
+		starts.swap(kept);
+	}
+
+	for (vector<Posting>::const_iterator it = starts.begin(); it != starts.end(); ++it) {
+		if (result.empty() || result.back() != it->iDocument)
+			result.push_back(it->iDocument);
+	}
+}
@@ -0,0 +1,114 @@
+#pragma once
+/*
+ *  pvr.python - A PVR client for Kodi using Python
+ *  Copyright © 2016 RunasSudo (Yingtong Li)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "catalog.h"
+
+#include <p8-platform/threads/mutex.h>
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+// The parts of an EPG entry that are searched. Only the title is searched
+// unless a full-text search is asked for.
+enum EpgSearchField
+{
+	EPG_SEARCH_TITLE = 0,
+	EPG_SEARCH_EPISODE_NAME,
+	EPG_SEARCH_PLOT, // Or the plot outline, if there's no plot
+	EPG_SEARCH_CAST,
+	EPG_SEARCH_FIELD_COUNT
+};
+
+struct EpgSearchMatch
+{
+	unsigned int iChannelUid;
+	unsigned int iBroadcastId;
+	time_t startTime;
+	time_t endTime;
+	std::string strTitle;
+	std::string strEpisodeName;
+};
+
+// Inverted index over the EPG held in the catalog. Text is split into words
+// and case-folded, and each word remembers where it appears, so queries can
+// ask for phrases as well as single words.
+//
+// A query is a list of clauses, all of which must match: a word, a word
+// ending in '*' to match any word it starts, or a "quoted phrase" whose words
+// must appear in that order within one field.
+class CEpgSearchIndex
+{
+public:
+	CEpgSearchIndex();
+
+	// Brings the entries indexed for a channel in line with entries, only
+	// reindexing those that changed. Returns whether anything did.
+	bool Update(unsigned int iChannelUid, const std::vector<CEpgEntry>& entries);
+
+	// Matches on iChannelUid (PVR_TIMER_ANY_CHANNEL for every channel) that
+	// overlap [start, end), by start time. An end of 0 leaves the window open.
+	void Search(const std::string& strQuery, bool bFullText, int iChannelUid, time_t start, time_t end, std::vector<EpgSearchMatch>& result);
+
+	// Changes whenever the indexed entries do
+	unsigned int Generation();
+
+	// Splits text into case-folded words. If prefixes isn't NULL, it is set
+	// for each word that was directly followed by a '*'.
+	static void Tokenize(const std::string& strText, std::vector<std::string>& words, std::vector<bool>* prefixes = NULL);
+
+private:
+	struct Document
+	{
+		unsigned int iChannelUid;
+		unsigned int iBroadcastId;
+		time_t startTime;
+		time_t endTime;
+		std::string strTitle;
+		std::string strEpisodeName;
+		uint64_t iFingerprint;
+		uint32_t iPostings;
+		bool bLive;
+	};
+
+	struct Posting
+	{
+		uint32_t iDocument;
+		uint32_t iPosition; // Field in the top byte, word within the field below
+	};
+
+	static bool PostingBefore(const Posting& a, const Posting& b);
+
+	void Add(const CEpgEntry& entry, unsigned int iChannelUid, uint64_t iFingerprint);
+	void Remove(uint32_t iDocument);
+	void Compact();
+	void FindWord(const std::string& strWord, bool bPrefix, bool bFullText, std::vector<Posting>& result);
+	void FindPhrase(const std::vector<std::string>& words, const std::vector<bool>& prefixes, bool bFullText, std::vector<uint32_t>& result);
+
+	P8PLATFORM::CMutex m_mutex;
+	std::vector<Document> m_documents; // Removed ones stay until the next compaction
+	std::map<unsigned int, std::map<unsigned int, uint32_t> > m_channels; // Channel uid to broadcast id to document
+	std::map<std::string, std::vector<Posting> > m_postings; // Sorted, so prefixes are a range
+	size_t m_iPostings;
+	size_t m_iDeadPostings;
+	unsigned int m_iGeneration;
+};
@@ -0,0 +1,1020 @@
+/*
+ *  pvr.python - A PVR client for Kodi using Python
+ *  Copyright © 2016 RunasSudo (Yingtong Li)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "hds.h"
+
+#include <p8-platform/util/util.h>
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+using namespace ADDON;
+using namespace P8PLATFORM;
+
+#define HDS_FETCH_RETRIES 3
+#define HDS_POLL_INTERVAL_MS 100
+#define HDS_REFRESH_INTERVAL_MS 2000
+// Give up on a live stream that hasn't produced a fragment for this long
+#define HDS_READ_TIMEOUT_MS 30000
+// So a fetch stuck connecting doesn't hold up closing the stream for long
+#define HDS_CONNECT_TIMEOUT_S 10
+
+#define FLV_TAG_HEADER_SIZE 11
+#define FLV_TAG_AUDIO 8
+#define FLV_TAG_VIDEO 9
+#define FLV_TAG_SCRIPT 18
+#define FLV_CODEC_AAC 10
+#define FLV_CODEC_AVC 7
+#define FLV_FRAME_INFO 5
+// Timestamp jumps bigger than this are papered over, like AdobeHDS.php does
+#define FLV_FIX_WINDOW 1000
+#define FLV_FRAME_STEP 40
+
+// BEGIN FETCHING
+
+static string URLEncode(const string& str)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	string result;
+	for (size_t i = 0; i < str.size(); i++) {
+		unsigned char c = str[i];
+		if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+			result += c;
+		} else {
+			result += '%';
+			result += hex[c >> 4];
+			result += hex[c & 0xf];
+		}
+	}
+	return result;
+}
+
+bool CVFSFetcher::Fetch(const string& strURL, bool bFresh, string& strData)
+{
+	if (m_bAborted)
+		return false;
+
+	// Kodi takes request headers and protocol options after a '|'
+	char timeout[32];
+	snprintf(timeout, sizeof(timeout), "connection-timeout=%d", HDS_CONNECT_TIMEOUT_S);
+	string strOptions = timeout;
+	if (!m_strUserAgent.empty()) {
+		strOptions += "&User-Agent=" + URLEncode(m_strUserAgent);
+	}
+	if (bFresh) {
+		strOptions += "&Cache-Control=no-cache&Pragma=no-cache";
+	}
+	string strPath = strURL + "|" + strOptions;
+
+	void* handle = XBMC->OpenFile(strPath.c_str(), 0);
+	if (handle == NULL) {
+		XBMC->Log(LOG_ERROR, "%s - Failed to fetch '%s'", __FUNCTION__, strURL.c_str());
+		return false;
+	}
+	strData.clear();
+	char buffer[32 * 1024];
+	ssize_t iRead;
+	while (!m_bAborted && (iRead = XBMC->ReadFile(handle, buffer, sizeof(buffer))) > 0) {
+		strData.append(buffer, iRead);
+	}
+	XBMC->CloseFile(handle);
+	return !m_bAborted;
+}
+
+// END FETCHING
+
+// BEGIN BOOTSTRAP
+
+// Big-endian reads from a box. Reading past the end marks the reader failed
+// and returns zeroes, so callers only need to check once at the end.
+class CBoxReader
+{
+public:
+	CBoxReader(const string& strData, size_t iPosition, size_t iEnd) :
+		m_strData(strData),
+		m_iPosition(iPosition),
+		m_iEnd(iEnd),
+		m_bFailed(false)
+	{
+	}
+
+	uint64_t Read(int iBytes) {
+		if (m_bFailed || m_iEnd - m_iPosition < (size_t) iBytes) {
+			m_bFailed = true;
+			return 0;
+		}
+		uint64_t value = 0;
+		for (int i = 0; i < iBytes; i++) {
+			value = (value << 8) | (unsigned char) m_strData[m_iPosition++];
+		}
+		return value;
+	}
+
+	uint8_t U8() { return Read(1); }
+	uint32_t U32() { return Read(4); }
+	uint64_t U64() { return Read(8); }
+
+	string String() {
+		size_t iNull = m_strData.find('\0', m_iPosition);
+		if (m_bFailed || iNull == string::npos || iNull >= m_iEnd) {
+			m_bFailed = true;
+			return "";
+		}
+		string value = m_strData.substr(m_iPosition, iNull - m_iPosition);
+		m_iPosition = iNull + 1;
+		return value;
+	}
+
+	void Skip(size_t iBytes) {
+		if (m_iEnd - m_iPosition < iBytes) {
+			m_bFailed = true;
+		} else {
+			m_iPosition += iBytes;
+		}
+	}
+
+	// Reads a box header, leaving the position at the start of its contents
+	bool Box(string& strType, size_t& iBoxEnd) {
+		size_t iStart = m_iPosition;
+		uint64_t iSize = U32();
+		strType = m_strData.substr(m_iPosition, 4);
+		Skip(4);
+		if (iSize == 1) {
+			iSize = U64();
+		} else if (iSize == 0) {
+			iSize = m_iEnd - iStart; // To the end
+		}
+		if (m_bFailed || iSize < m_iPosition - iStart) {
+			m_bFailed = true;
+			return false;
+		}
+		// Some servers get the size wrong; don't trust it past the end
+		iBoxEnd = (iSize > m_iEnd - iStart) ? m_iEnd : iStart + iSize;
+		return true;
+	}
+
+	void Seek(size_t iPosition) { m_iPosition = iPosition; }
+	size_t Position() const { return m_iPosition; }
+	bool Failed() const { return m_bFailed; }
+
+private:
+	const string& m_strData;
+	size_t m_iPosition;
+	size_t m_iEnd;
+	bool m_bFailed;
+};
+
+CHDSBootstrap::CHDSBootstrap() :
+	m_bLive(false),
+	m_bCountValid(false),
+	m_iFragmentCount(0)
+{
+}
+
+bool CHDSBootstrap::Parse(const string& strData)
+{
+	CBoxReader reader(strData, 0, strData.size());
+	string strType;
+	size_t iBoxEnd;
+	if (!reader.Box(strType, iBoxEnd) || strType != "abst") {
+		return false;
+	}
+
+	reader.Skip(4 + 4); // Version and flags, bootstrap version
+	uint8_t iFlags = reader.U8();
+	bool bLive = (iFlags & 0x20) != 0;
+	bool bUpdate = (iFlags & 0x10) != 0;
+	reader.Skip(4 + 8 + 8); // Time scale, current media time, SMPTE offset
+	reader.String(); // Movie identifier
+	for (int i = reader.U8(); i > 0; i--) {
+		reader.String(); // Servers
+	}
+	for (int i = reader.U8(); i > 0; i--) {
+		reader.String(); // Qualities
+	}
+	reader.String(); // DRM data
+	reader.String(); // Metadata
+
+	// Only the first table of each kind is used, as with AdobeHDS.php
+	map<uint32_t, HDSSegmentRun> segments;
+	int iSegmentTables = reader.U8();
+	for (int i = 0; i < iSegmentTables && !reader.Failed(); i++) {
+		size_t iTableEnd;
+		if (!reader.Box(strType, iTableEnd)) {
+			break;
+		}
+		if (strType == "asrt" && i == 0) {
+			reader.Skip(4); // Version and flags
+			for (int j = reader.U8(); j > 0; j--) {
+				reader.String(); // Quality segment URL modifiers
+			}
+			for (uint32_t j = reader.U32(); j > 0 && !reader.Failed(); j--) {
+				HDSSegmentRun run;
+				run.iFirstSegment = reader.U32();
+				run.iFragmentsPerSegment = reader.U32();
+				if (run.iFragmentsPerSegment & 0x80000000) {
+					run.iFragmentsPerSegment = 0;
+				}
+				segments[run.iFirstSegment] = run;
+			}
+		}
+		reader.Seek(iTableEnd);
+	}
+
+	map<uint32_t, HDSFragmentRun> fragments;
+	bool bEnded = false;
+	int iFragmentTables = reader.U8();
+	for (int i = 0; i < iFragmentTables && !reader.Failed(); i++) {
+		size_t iTableEnd;
+		if (!reader.Box(strType, iTableEnd)) {
+			break;
+		}
+		if (strType == "afrt" && i == 0) {
+			reader.Skip(4 + 4); // Version and flags, time scale
+			for (int j = reader.U8(); j > 0; j--) {
+				reader.String(); // Quality segment URL modifiers
+			}
+			for (uint32_t j = reader.U32(); j > 0 && !reader.Failed(); j--) {
+				HDSFragmentRun run;
+				run.iFirstFragment = reader.U32();
+				run.iFirstTimestamp = reader.U64();
+				run.iDuration = reader.U32();
+				run.iDiscontinuity = (run.iDuration == 0) ? reader.U8() : 0;
+				// A final zero-length run with no discontinuity means the event is over
+				if (j == 1 && run.iDuration == 0 && run.iDiscontinuity == 0) {
+					bEnded = true;
+				} else {
+					fragments[run.iFirstFragment] = run;
+				}
+			}
+		}
+		reader.Seek(iTableEnd);
+	}
+
+	if (reader.Failed()) {
+		return false;
+	}
+
+	if (!bUpdate) {
+		m_segments.clear();
+		m_fragments.clear();
+	}
+	for (map<uint32_t, HDSSegmentRun>::iterator it = segments.begin(); it != segments.end(); ++it) {
+		m_segments[it->first] = it->second;
+	}
+	for (map<uint32_t, HDSFragmentRun>::iterator it = fragments.begin(); it != fragments.end(); ++it) {
+		m_fragments[it->first] = it->second;
+	}
+	m_bLive = bLive && !bEnded;
+	Count();
+	return true;
+}
+
+void CHDSBootstrap::Count()
+{
+	if (m_segments.empty() || m_fragments.empty()) {
+		m_iFragmentCount = 0;
+		m_bCountValid = false;
+		return;
+	}
+
+	// The segment table is run-length coded
+	map<uint32_t, HDSSegmentRun>::iterator prev = m_segments.begin();
+	int64_t iCount = prev->second.iFragmentsPerSegment;
+	for (map<uint32_t, HDSSegmentRun>::iterator it = ++m_segments.begin(); it != m_segments.end(); prev = it++) {
+		iCount += (int64_t) (it->first - prev->first - 1) * prev->second.iFragmentsPerSegment;
+		iCount += it->second.iFragmentsPerSegment;
+	}
+	iCount += m_fragments.begin()->first - 1;
+
+	m_bCountValid = (iCount >= 0 && iCount <= 0x7fffffff);
+	if (!m_bCountValid) {
+		iCount = 0;
+	}
+	uint32_t iLastRun = (--m_fragments.end())->first;
+	m_iFragmentCount = (iCount < iLastRun) ? iLastRun : iCount;
+}
+
+uint32_t CHDSBootstrap::StartFragment() const
+{
+	// Live streams start near the edge, others at the beginning
+	int64_t iStart;
+	if (m_bLive && m_bCountValid) {
+		iStart = (int64_t) m_iFragmentCount - 2;
+	} else {
+		iStart = m_fragments.empty() ? 0 : (int64_t) m_fragments.begin()->first - 1;
+	}
+	return (iStart < 0) ? 1 : iStart + 1;
+}
+
+uint32_t CHDSBootstrap::SegmentForFragment(uint32_t iFragment) const
+{
+	if (m_segments.empty()) {
+		return 1;
+	}
+	if (m_segments.size() == 1) {
+		return m_segments.begin()->first;
+	}
+
+	// Each run covers the segments up to the next one
+	uint64_t iStart = m_fragments.empty() ? 1 : m_fragments.begin()->first;
+	for (map<uint32_t, HDSSegmentRun>::const_iterator it = m_segments.begin(); it != m_segments.end(); ++it) {
+		map<uint32_t, HDSSegmentRun>::const_iterator next = it;
+		++next;
+		uint64_t iSegments = (next == m_segments.end()) ? 1 : next->first - it->first;
+		uint64_t iFragments = iSegments * it->second.iFragmentsPerSegment;
+		if (iFragment >= iStart && iFragment < iStart + iFragments) {
+			return it->first + (iFragment - iStart) / it->second.iFragmentsPerSegment;
+		}
+		iStart += iFragments;
+	}
+	return (--m_segments.end())->first;
+}
+
+bool CHDSBootstrap::IsDiscontinuity(uint32_t iFragment) const
+{
+	map<uint32_t, HDSFragmentRun>::const_iterator it = m_fragments.upper_bound(iFragment);
+	if (it == m_fragments.begin()) {
+		return false;
+	}
+	--it;
+	return (it->second.iDuration == 0);
+}
+
+// END BOOTSTRAP
+
+// BEGIN MANIFEST
+
+// Just enough XML for F4M manifests: flat elements, their attributes and text
+struct XMLElement
+{
+	map<string, string> attributes;
+	string strContent;
+};
+
+static string XMLDecode(const string& str)
+{
+	static const char* entities[][2] = { {"&lt;", "<"}, {"&gt;", ">"}, {"&quot;", "\""}, {"&apos;", "'"}, {"&amp;", "&"} };
+	string result;
+	for (size_t i = 0; i < str.size(); i++) {
+		bool bMatched = false;
+		if (str[i] == '&') {
+			for (size_t j = 0; j < sizeof(entities) / sizeof(entities[0]); j++) {
+				if (str.compare(i, strlen(entities[j][0]), entities[j][0]) == 0) {
+					result += entities[j][1];
+					i += strlen(entities[j][0]) - 1;
+					bMatched = true;
+					break;
+				}
+			}
+		}
+		if (!bMatched) {
+			result += str[i];
+		}
+	}
+	return result;
+}
+
+static string Trim(const string& str)
+{
+	size_t iStart = str.find_first_not_of(" \t\r\n");
+	if (iStart == string::npos) {
+		return "";
+	}
+	return str.substr(iStart, str.find_last_not_of(" \t\r\n") - iStart + 1);
+}
+
+static vector<XMLElement> FindElements(const string& strXML, const string& strName)
+{
+	vector<XMLElement> elements;
+	string strOpen = "<" + strName;
+	string strClose = "</" + strName + ">";
+	size_t iPos = 0;
+	while ((iPos = strXML.find(strOpen, iPos)) != string::npos) {
+		iPos += strOpen.size();
+		if (iPos >= strXML.size() || (!isspace(strXML[iPos]) && strXML[iPos] != '>' && strXML[iPos] != '/')) {
+			continue; // Only a prefix of another element's name
+		}
+
+		XMLElement element;
+		while (iPos < strXML.size()) {
+			while (iPos < strXML.size() && isspace(strXML[iPos])) {
+				iPos++;
+			}
+			if (iPos >= strXML.size() || strXML[iPos] == '>' || strXML[iPos] == '/') {
+				break;
+			}
+			size_t iEquals = strXML.find('=', iPos);
+			if (iEquals == string::npos || iEquals + 1 >= strXML.size()) {
+				return elements;
+			}
+			string strKey = Trim(strXML.substr(iPos, iEquals - iPos));
+			char quote = strXML[iEquals + 1];
+			size_t iValueEnd = strXML.find(quote, iEquals + 2);
+			if ((quote != '"' && quote != '\'') || iValueEnd == string::npos) {
+				return elements;
+			}
+			element.attributes[strKey] = XMLDecode(strXML.substr(iEquals + 2, iValueEnd - iEquals - 2));
+			iPos = iValueEnd + 1;
+		}
+		if (iPos >= strXML.size()) {
+			break;
+		}
+
+		if (strXML[iPos] == '>') {
+			size_t iEnd = strXML.find(strClose, iPos);
+			if (iEnd == string::npos) {
+				break;
+			}
+			element.strContent = strXML.substr(iPos + 1, iEnd - iPos - 1);
+			iPos = iEnd + strClose.size();
+		}
+		elements.push_back(element);
+	}
+	return elements;
+}
+
+static string Base64Decode(const string& str)
+{
+	string result;
+	uint32_t iBits = 0;
+	int iBitCount = 0;
+	for (size_t i = 0; i < str.size(); i++) {
+		char c = str[i];
+		int iValue;
+		if (c >= 'A' && c <= 'Z') iValue = c - 'A';
+		else if (c >= 'a' && c <= 'z') iValue = c - 'a' + 26;
+		else if (c >= '0' && c <= '9') iValue = c - '0' + 52;
+		else if (c == '+' || c == '-') iValue = 62;
+		else if (c == '/' || c == '_') iValue = 63;
+		else continue; // Whitespace and padding
+		iBits = (iBits << 6) | iValue;
+		iBitCount += 6;
+		if (iBitCount >= 8) {
+			iBitCount -= 8;
+			result += (char) ((iBits >> iBitCount) & 0xff);
+		}
+	}
+	return result;
+}
+
+static string AbsoluteURL(const string& strBase, const string& strURL)
+{
+	if (strURL.find("://") != string::npos) {
+		return strURL;
+	}
+	string strResult = strBase;
+	while (!strResult.empty() && strResult[strResult.size() - 1] == '/') {
+		strResult.erase(strResult.size() - 1);
+	}
+	size_t iStart = strURL.find_first_not_of('/');
+	return strResult + "/" + (iStart == string::npos ? "" : strURL.substr(iStart));
+}
+
+// Picks the highest bitrate no higher than iMaxBitrate, or failing that the lowest
+static const XMLElement* ChooseMedia(const vector<XMLElement>& media, int iMaxBitrate)
+{
+	const XMLElement* best = NULL;
+	int iBest = 0;
+	const XMLElement* lowest = NULL;
+	int iLowest = 0;
+	for (vector<XMLElement>::const_iterator it = media.begin(); it != media.end(); ++it) {
+		map<string, string>::const_iterator bitrate = it->attributes.find("bitrate");
+		int iBitrate = (bitrate == it->attributes.end()) ? 0 : atoi(bitrate->second.c_str());
+		if ((iMaxBitrate <= 0 || iBitrate <= iMaxBitrate) && (best == NULL || iBitrate > iBest)) {
+			best = &*it;
+			iBest = iBitrate;
+		}
+		if (lowest == NULL || iBitrate < iLowest) {
+			lowest = &*it;
+			iLowest = iBitrate;
+		}
+	}
+	return best ? best : lowest;
+}
+
+static bool ParseManifest(CHDSFetcher* fetcher, const string& strManifestURL, const string& strAuth, int iMaxBitrate, HDSMedia& media, int iDepth)
+{
+	string strXML;
+	if (!fetcher->Fetch(strManifestURL, true, strXML)) {
+		return false;
+	}
+
+	string strBaseURL;
+	vector<XMLElement> baseURLs = FindElements(strXML, "baseURL");
+	if (!baseURLs.empty()) {
+		strBaseURL = Trim(XMLDecode(baseURLs[0].strContent));
+	} else {
+		strBaseURL = strManifestURL.substr(0, strManifestURL.find('?'));
+		strBaseURL = strBaseURL.substr(0, strBaseURL.rfind('/'));
+	}
+
+	vector<XMLElement> allMedia = FindElements(strXML, "media");
+	const XMLElement* chosen = ChooseMedia(allMedia, iMaxBitrate);
+	if (chosen == NULL) {
+		XBMC->Log(LOG_ERROR, "%s - No media in '%s'", __FUNCTION__, strManifestURL.c_str());
+		return false;
+	}
+
+	// A set-level manifest points to the manifest for each bitrate
+	map<string, string>::const_iterator href = chosen->attributes.find("href");
+	if (href != chosen->attributes.end()) {
+		if (iDepth > 0) {
+			return false;
+		}
+		return ParseManifest(fetcher, AbsoluteURL(strBaseURL, href->second), strAuth, iMaxBitrate, media, iDepth + 1);
+	}
+
+	map<string, string>::const_iterator url = chosen->attributes.find("url");
+	if (url == chosen->attributes.end()) {
+		return false;
+	}
+	string strMediaURL = url->second;
+	for (size_t i = 0; (i = strMediaURL.find(' ', i)) != string::npos; ) {
+		strMediaURL.replace(i, 1, "%20");
+	}
+	// Authentication embedded in the manifest wins over ours
+	size_t iQuery = strMediaURL.find('?');
+	if (iQuery != string::npos) {
+		media.strQuery = strMediaURL.substr(iQuery);
+		strMediaURL.erase(iQuery);
+	} else {
+		media.strQuery = strAuth.empty() ? "" : "?" + strAuth;
+	}
+	media.strFragmentURL = AbsoluteURL(strBaseURL, strMediaURL);
+
+	vector<XMLElement> bootstraps = FindElements(strXML, "bootstrapInfo");
+	const XMLElement* bootstrap = bootstraps.empty() ? NULL : &bootstraps[0];
+	map<string, string>::const_iterator bootstrapId = chosen->attributes.find("bootstrapInfoId");
+	if (bootstrapId != chosen->attributes.end()) {
+		for (vector<XMLElement>::const_iterator it = bootstraps.begin(); it != bootstraps.end(); ++it) {
+			map<string, string>::const_iterator id = it->attributes.find("id");
+			if (id != it->attributes.end() && id->second == bootstrapId->second) {
+				bootstrap = &*it;
+			}
+		}
+	}
+	if (bootstrap == NULL) {
+		XBMC->Log(LOG_ERROR, "%s - No bootstrap in '%s'", __FUNCTION__, strManifestURL.c_str());
+		return false;
+	}
+	map<string, string>::const_iterator bootstrapURL = bootstrap->attributes.find("url");
+	if (bootstrapURL != bootstrap->attributes.end()) {
+		media.strBootstrapURL = AbsoluteURL(strBaseURL, bootstrapURL->second);
+		if (media.strBootstrapURL.find('?') == string::npos) {
+			media.strBootstrapURL += media.strQuery;
+		}
+	} else {
+		media.strBootstrap = Base64Decode(bootstrap->strContent);
+	}
+
+	vector<XMLElement> metadata = FindElements(chosen->strContent, "metadata");
+	if (!metadata.empty()) {
+		media.strMetadata = Base64Decode(metadata[0].strContent);
+	}
+	return true;
+}
+
+bool ParseHDSManifest(CHDSFetcher* fetcher, const string& strManifestURL, const string& strAuth, int iMaxBitrate, HDSMedia& media)
+{
+	return ParseManifest(fetcher, strManifestURL, strAuth, iMaxBitrate, media, 0);
+}
+
+// END MANIFEST
+
+// BEGIN REMUXING
+
+static uint32_t ReadU24(const unsigned char* p)
+{
+	return (p[0] << 16) | (p[1] << 8) | p[2];
+}
+
+static void WriteU24(unsigned char* p, uint32_t value)
+{
+	p[0] = value >> 16;
+	p[1] = value >> 8;
+	p[2] = value;
+}
+
+static void WriteU32(unsigned char* p, uint32_t value)
+{
+	p[0] = value >> 24;
+	WriteU24(p + 1, value);
+}
+
+CFLVRemuxer::CFLVRemuxer() :
+	m_iBaseTimestamp(-1),
+	m_iLastTimestamp(-1),
+	m_bAACHeader(false),
+	m_bAVCHeader(false),
+	m_bWarnedUnsupported(false)
+{
+}
+
+bool CFLVRemuxer::FindMediaData(const string& strFragment, size_t& iStart, size_t& iEnd)
+{
+	CBoxReader reader(strFragment, 0, strFragment.size());
+	string strType;
+	size_t iBoxEnd;
+	while (reader.Position() < strFragment.size() && reader.Box(strType, iBoxEnd)) {
+		if (strType == "mdat") {
+			iStart = reader.Position();
+			iEnd = iBoxEnd;
+			return true;
+		}
+		reader.Seek(iBoxEnd);
+	}
+	return false;
+}
+
+string CFLVRemuxer::Header(const string& strMetadata)
+{
+	// FLV version 1 with audio and video, then an empty previous tag
+	static const unsigned char header[] = { 'F', 'L', 'V', 1, 0x05, 0, 0, 0, 9, 0, 0, 0, 0 };
+	string strHeader((const char*) header, sizeof(header));
+	if (!strMetadata.empty()) {
+		unsigned char tag[FLV_TAG_HEADER_SIZE] = { FLV_TAG_SCRIPT };
+		WriteU24(tag + 1, strMetadata.size());
+		unsigned char trailer[4];
+		WriteU32(trailer, FLV_TAG_HEADER_SIZE + strMetadata.size());
+		strHeader.append((const char*) tag, sizeof(tag));
+		strHeader += strMetadata;
+		strHeader.append((const char*) trailer, sizeof(trailer));
+	}
+	return strHeader;
+}
+
+// Sequence headers are sent once; frames before one can't be decoded anyway
+bool CFLVRemuxer::KeepAudio(const unsigned char* pData, uint32_t iSize)
+{
+	if (iSize == 0) {
+		return false;
+	}
+	if ((pData[0] >> 4) == FLV_CODEC_AAC) {
+		if (iSize < 2) {
+			return false;
+		}
+		if (pData[1] == 0) {
+			if (m_bAACHeader) {
+				return false;
+			}
+			m_bAACHeader = true;
+		} else if (!m_bAACHeader) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool CFLVRemuxer::KeepVideo(const unsigned char* pData, uint32_t iSize)
+{
+	if (iSize == 0 || (pData[0] >> 4) == FLV_FRAME_INFO) {
+		return false;
+	}
+	if ((pData[0] & 0x0f) == FLV_CODEC_AVC) {
+		if (iSize < 2) {
+			return false;
+		}
+		if (pData[1] == 0) {
+			if (m_bAVCHeader) {
+				return false;
+			}
+			m_bAVCHeader = true;
+		} else if (!m_bAVCHeader) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Makes timestamps start at zero and carry on smoothly over skipped
+// fragments and discontinuities
+uint32_t CFLVRemuxer::Rebase(uint32_t iTimestamp)
+{
+	iTimestamp &= 0x7fffffff;
+	if (m_iBaseTimestamp < 0) {
+		m_iBaseTimestamp = iTimestamp;
+	}
+	int64_t iRebased = (int64_t) iTimestamp - m_iBaseTimestamp;
+	if (m_iLastTimestamp >= 0 && (iRebased > m_iLastTimestamp + FLV_FIX_WINDOW || iRebased < m_iLastTimestamp - FLV_FIX_WINDOW)) {
+		m_iBaseTimestamp += iRebased - (m_iLastTimestamp + FLV_FRAME_STEP);
+		iRebased = m_iLastTimestamp + FLV_FRAME_STEP;
+	}
+	if (iRebased > m_iLastTimestamp) {
+		m_iLastTimestamp = iRebased;
+	}
+	return (uint32_t) iRebased;
+}
+
+void CFLVRemuxer::Remux(string& strFragment, size_t iStart, size_t iEnd, vector<Range>& ranges)
+{
+	ranges.clear();
+	size_t iPos = iStart;
+	while (iPos + FLV_TAG_HEADER_SIZE <= iEnd) {
+		unsigned char* pTag = (unsigned char*) &strFragment[iPos];
+		uint32_t iSize = ReadU24(pTag + 1);
+		size_t iTagEnd = iPos + FLV_TAG_HEADER_SIZE + iSize + 4;
+		if (iTagEnd > iEnd) {
+			break;
+		}
+
+		bool bKeep = false;
+		switch (pTag[0]) {
+		case FLV_TAG_AUDIO:
+			bKeep = KeepAudio(pTag + FLV_TAG_HEADER_SIZE, iSize);
+			break;
+		case FLV_TAG_VIDEO:
+			bKeep = KeepVideo(pTag + FLV_TAG_HEADER_SIZE, iSize);
+			break;
+		case FLV_TAG_SCRIPT:
+			break;
+		default:
+			// Akamai-encrypted and DRM tags aren't supported
+			if (!m_bWarnedUnsupported) {
+				XBMC->Log(LOG_ERROR, "%s - Unsupported FLV tag type %d; encrypted streams can't be played", __FUNCTION__, pTag[0]);
+				m_bWarnedUnsupported = true;
+			}
+			return;
+		}
+
+		if (bKeep) {
+			uint32_t iTimestamp = Rebase(ReadU24(pTag + 4) | (pTag[7] << 24));
+			WriteU24(pTag + 4, iTimestamp & 0xffffff);
+			pTag[7] = iTimestamp >> 24;
+			if (!ranges.empty() && ranges.back().iStart + ranges.back().iLength == iPos) {
+				ranges.back().iLength += iTagEnd - iPos;
+			} else {
+				Range range = { iPos, iTagEnd - iPos };
+				ranges.push_back(range);
+			}
+		}
+		iPos = iTagEnd;
+	}
+}
+
+// END REMUXING
+
+// BEGIN SESSIONS
+
+class CHDSFetchWorker : public CThread
+{
+public:
+	CHDSFetchWorker(CHDSStreamSession* session) : m_session(session) {}
+
+	virtual void* Process(void) {
+		m_session->FetchFragments(*this);
+		return NULL;
+	}
+
+private:
+	CHDSStreamSession* m_session;
+};
+
+CHDSStreamSession* CHDSStreamSession::Open(CHDSFetcher* fetcher, const string& strManifestURL, const string& strAuth, int iMaxBitrate)
+{
+	HDSMedia media;
+	string strBootstrap;
+	CHDSBootstrap bootstrap;
+	if (!ParseHDSManifest(fetcher, strManifestURL, strAuth, iMaxBitrate, media)) {
+		XBMC->Log(LOG_ERROR, "%s - Failed to read the manifest '%s'", __FUNCTION__, strManifestURL.c_str());
+		delete fetcher;
+		return NULL;
+	}
+	strBootstrap = media.strBootstrap;
+	if ((!media.strBootstrapURL.empty() && !fetcher->Fetch(media.strBootstrapURL, true, strBootstrap)) ||
+	    !bootstrap.Parse(strBootstrap) || bootstrap.FragmentCount() == 0) {
+		XBMC->Log(LOG_ERROR, "%s - Failed to read the bootstrap for '%s'", __FUNCTION__, strManifestURL.c_str());
+		delete fetcher;
+		return NULL;
+	}
+
+	CHDSStreamSession* session = new CHDSStreamSession(fetcher, strManifestURL, strAuth, iMaxBitrate);
+	session->m_media = media;
+	session->m_bootstrap = bootstrap;
+	session->m_iNextFetch = session->m_iNextRead = bootstrap.StartFragment();
+	// Live streams have no metadata worth sending, as AdobeHDS.php found
+	session->m_strCurrent = CFLVRemuxer::Header(bootstrap.IsLive() ? "" : media.strMetadata);
+	CFLVRemuxer::Range header = { 0, session->m_strCurrent.size() };
+	session->m_ranges.push_back(header);
+	XBMC->Log(LOG_DEBUG, "%s - Starting at fragment %u of %u%s", __FUNCTION__, session->m_iNextRead, bootstrap.FragmentCount(), bootstrap.IsLive() ? " (live)" : "");
+
+	for (int i = 0; i < HDS_FETCH_THREADS; i++) {
+		CHDSFetchWorker* worker = new CHDSFetchWorker(session);
+		session->m_workers.push_back(worker);
+		worker->CreateThread(true);
+	}
+	return session;
+}
+
+CHDSStreamSession::CHDSStreamSession(CHDSFetcher* fetcher, const string& strManifestURL, const string& strAuth, int iMaxBitrate) :
+	m_fetcher(fetcher),
+	m_strManifestURL(strManifestURL),
+	m_strAuth(strAuth),
+	m_iMaxBitrate(iMaxBitrate),
+	m_bAborted(false),
+	m_bRefreshing(false),
+	m_iNextFetch(0),
+	m_iNextRead(0),
+	m_iRange(0),
+	m_iRangeOffset(0),
+	m_iPosition(0)
+{
+}
+
+CHDSStreamSession::~CHDSStreamSession()
+{
+	for (vector<CHDSFetchWorker*>::iterator it = m_workers.begin(); it != m_workers.end(); ++it) {
+		(*it)->StopThread(-1);
+	}
+	// Workers only ever wait on a fetch, or on these
+	m_fetcher->Abort();
+	m_consumedEvent.Broadcast();
+	m_stopEvent.Broadcast();
+	for (vector<CHDSFetchWorker*>::iterator it = m_workers.begin(); it != m_workers.end(); ++it) {
+		(*it)->StopThread(0);
+		delete *it;
+	}
+	for (map<uint32_t, string*>::iterator it = m_fetched.begin(); it != m_fetched.end(); ++it) {
+		delete it->second;
+	}
+	delete m_fetcher;
+}
+
+void CHDSStreamSession::FetchFragments(CHDSFetchWorker& worker)
+{
+	while (!worker.IsStopped()) {
+		uint32_t iFragment = 0;
+		string strURL;
+		bool bRefresh = false;
+		{
+			CLockObject lock(m_mutex);
+			if (m_iNextFetch > m_bootstrap.FragmentCount()) {
+				if (!m_bootstrap.IsLive()) {
+					break;
+				}
+				// One worker looks for new fragments while the others wait
+				bRefresh = !m_bRefreshing;
+				m_bRefreshing = true;
+			} else if (m_iNextFetch < m_iNextRead + HDS_FETCH_AHEAD) {
+				iFragment = m_iNextFetch++;
+				if (!m_bootstrap.IsDiscontinuity(iFragment)) {
+					char segment[32];
+					snprintf(segment, sizeof(segment), "Seg%u-Frag%u", m_bootstrap.SegmentForFragment(iFragment), iFragment);
+					strURL = m_media.strFragmentURL + segment + m_media.strQuery;
+				}
+			}
+		}
+
+		if (bRefresh) {
+			if (!Refresh()) {
+				m_stopEvent.Wait(HDS_REFRESH_INTERVAL_MS);
+			}
+			continue;
+		}
+		if (iFragment == 0) {
+			m_consumedEvent.Wait(HDS_POLL_INTERVAL_MS);
+			continue;
+		}
+
+		// Fragments that can't be fetched are skipped rather than stalling playback
+		string* data = NULL;
+		if (!strURL.empty()) {
+			data = new string();
+			bool bFetched = false;
+			for (int i = 0; i < HDS_FETCH_RETRIES && !bFetched && !worker.IsStopped(); i++) {
+				bFetched = m_fetcher->Fetch(strURL, false, *data);
+			}
+			size_t iStart, iEnd;
+			if (!bFetched || !CFLVRemuxer::FindMediaData(*data, iStart, iEnd)) {
+				XBMC->Log(LOG_ERROR, "%s - Skipping fragment %u", __FUNCTION__, iFragment);
+				SAFE_DELETE(data);
+			}
+		}
+		{
+			CLockObject lock(m_mutex);
+			m_fetched[iFragment] = data;
+		}
+		m_fetchedEvent.Signal();
+	}
+}
+
+// Returns whether there's anything new
+bool CHDSStreamSession::Refresh()
+{
+	string strBootstrap;
+	bool bFetched;
+	if (!m_media.strBootstrapURL.empty()) {
+		bFetched = m_fetcher->Fetch(m_media.strBootstrapURL, true, strBootstrap);
+	} else {
+		HDSMedia media;
+		bFetched = ParseHDSManifest(m_fetcher, m_strManifestURL, m_strAuth, m_iMaxBitrate, media);
+		strBootstrap = media.strBootstrap;
+	}
+
+	CLockObject lock(m_mutex);
+	uint32_t iBefore = m_bootstrap.FragmentCount();
+	if (bFetched) {
+		m_bootstrap.Parse(strBootstrap);
+	}
+	m_bRefreshing = false;
+	return (m_bootstrap.FragmentCount() > iBefore || !m_bootstrap.IsLive());
+}
+
+// Moves on to the next fragment in order. Returns false at the end of the stream.
+bool CHDSStreamSession::NextFragment()
+{
+	string* data = NULL;
+	int iWaited = 0;
+	for (;;) {
+		if (m_bAborted)
+			return false;
+		{
+			CLockObject lock(m_mutex);
+			if (m_iNextRead > m_bootstrap.FragmentCount() && !m_bootstrap.IsLive()) {
+				return false;
+			}
+			map<uint32_t, string*>::iterator it = m_fetched.find(m_iNextRead);
+			if (it != m_fetched.end()) {
+				data = it->second;
+				m_fetched.erase(it);
+				m_iNextRead++;
+				break;
+			}
+		}
+		if (iWaited >= HDS_READ_TIMEOUT_MS) {
+			XBMC->Log(LOG_ERROR, "%s - Timed out waiting for fragment %u", __FUNCTION__, m_iNextRead);
+			return false;
+		}
+		m_fetchedEvent.Wait(HDS_POLL_INTERVAL_MS);
+		iWaited += HDS_POLL_INTERVAL_MS;
+	}
+	m_consumedEvent.Broadcast();
+
+	m_ranges.clear();
+	m_iRange = 0;
+	m_iRangeOffset = 0;
+	if (data != NULL) {
+		m_strCurrent.swap(*data);
+		delete data;
+		size_t iStart, iEnd;
+		CFLVRemuxer::FindMediaData(m_strCurrent, iStart, iEnd);
+		m_remuxer.Remux(m_strCurrent, iStart, iEnd, m_ranges);
+	}
+	return true;
+}
+
+// The workers carry on until the session is deleted
+void CHDSStreamSession::Abort()
+{
+	m_bAborted = true;
+	m_fetchedEvent.Broadcast();
+}
+
+int CHDSStreamSession::Read(unsigned char* pBuffer, unsigned int iBufferSize)
+{
+	unsigned int iRead = 0;
+	while (iRead < iBufferSize) {
+		if (m_iRange == m_ranges.size()) {
+			// Hand over what we have rather than wait for the next fragment
+			if (iRead > 0 || !NextFragment()) {
+				break;
+			}
+			continue;
+		}
+		const CFLVRemuxer::Range& range = m_ranges[m_iRange];
+		size_t iCount = range.iLength - m_iRangeOffset;
+		if (iCount > iBufferSize - iRead) {
+			iCount = iBufferSize - iRead;
+		}
+		memcpy(pBuffer + iRead, m_strCurrent.data() + range.iStart + m_iRangeOffset, iCount);
+		iRead += iCount;
+		m_iRangeOffset += iCount;
+		if (m_iRangeOffset == range.iLength) {
+			m_iRange++;
+			m_iRangeOffset = 0;
+		}
+	}
+	m_iPosition += iRead;
+	return iRead;
+}
+
+// END SESSIONS
@@ -0,0 +1,201 @@
+#pragma once
+/*
+ *  pvr.python - A PVR client for Kodi using Python
+ *  Copyright © 2016 RunasSudo (Yingtong Li)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "streams.h"
+
+#include <p8-platform/threads/threads.h>
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+// Fragments fetched at the same time, and how far ahead of playback they may get
+#define HDS_FETCH_THREADS 3
+#define HDS_FETCH_AHEAD 6
+
+// Gets the body of a URL. Everything the HDS engine downloads goes through
+// here. Fetch is called from several threads at once.
+class CHDSFetcher
+{
+public:
+	virtual ~CHDSFetcher() {}
+
+	// bFresh asks for the resource not to come from a cache
+	virtual bool Fetch(const std::string& strURL, bool bFresh, std::string& strData) = 0;
+
+	// Makes fetches in progress fail at their next read, and any later ones
+	// straight away, so the threads making them can be stopped
+	virtual void Abort() {}
+};
+
+// Fetches through Kodi's VFS
+class CVFSFetcher : public CHDSFetcher
+{
+public:
+	CVFSFetcher(const std::string& strUserAgent) : m_strUserAgent(strUserAgent), m_bAborted(false) {}
+
+	virtual bool Fetch(const std::string& strURL, bool bFresh, std::string& strData);
+	virtual void Abort() { m_bAborted = true; }
+
+private:
+	std::string m_strUserAgent;
+	std::atomic<bool> m_bAborted;
+};
+
+struct HDSSegmentRun
+{
+	uint32_t iFirstSegment;
+	uint32_t iFragmentsPerSegment;
+};
+
+struct HDSFragmentRun
+{
+	uint32_t iFirstFragment;
+	uint64_t iFirstTimestamp;
+	uint32_t iDuration; // 0 marks a discontinuity
+	uint8_t iDiscontinuity;
+};
+
+// Which fragments exist, from the segment and fragment run tables of a
+// bootstrap (abst) box. Live bootstraps are parsed again as they're updated.
+class CHDSBootstrap
+{
+public:
+	CHDSBootstrap();
+
+	// Returns false, leaving the tables alone, if strData isn't an abst box
+	bool Parse(const std::string& strData);
+
+	bool IsLive() const { return m_bLive; }
+	uint32_t FragmentCount() const { return m_iFragmentCount; } // Number of the last fragment
+	uint32_t StartFragment() const; // Where playback should start
+	uint32_t SegmentForFragment(uint32_t iFragment) const;
+	bool IsDiscontinuity(uint32_t iFragment) const;
+
+private:
+	void Count();
+
+	std::map<uint32_t, HDSSegmentRun> m_segments;
+	std::map<uint32_t, HDSFragmentRun> m_fragments;
+	bool m_bLive;
+	bool m_bCountValid;
+	uint32_t m_iFragmentCount;
+};
+
+// The rendition picked from a manifest
+struct HDSMedia
+{
+	std::string strFragmentURL; // Followed by "Seg<n>-Frag<n>" and strQuery
+	std::string strQuery;
+	std::string strBootstrapURL; // Empty if the bootstrap was inline
+	std::string strBootstrap;
+	std::string strMetadata; // AMF onMetaData, possibly empty
+};
+
+// Picks the highest bitrate up to iMaxBitrate (0 for no limit), following
+// set-level manifests. strAuth is the query string to send with requests.
+bool ParseHDSManifest(CHDSFetcher* fetcher, const std::string& strManifestURL, const std::string& strAuth, int iMaxBitrate, HDSMedia& media);
+
+// Turns the mdat payloads of successive F4F fragments into one FLV stream. The
+// tags are already FLV tags, so they're left where they are in the fragment
+// and only their timestamps rewritten; the output is ranges of that buffer.
+class CFLVRemuxer
+{
+public:
+	struct Range
+	{
+		size_t iStart;
+		size_t iLength;
+	};
+
+	CFLVRemuxer();
+
+	static bool FindMediaData(const std::string& strFragment, size_t& iStart, size_t& iEnd);
+	static std::string Header(const std::string& strMetadata);
+
+	void Remux(std::string& strFragment, size_t iStart, size_t iEnd, std::vector<Range>& ranges);
+
+private:
+	bool KeepAudio(const unsigned char* pData, uint32_t iSize);
+	bool KeepVideo(const unsigned char* pData, uint32_t iSize);
+	uint32_t Rebase(uint32_t iTimestamp);
+
+	int64_t m_iBaseTimestamp;
+	int64_t m_iLastTimestamp;
+	bool m_bAACHeader;
+	bool m_bAVCHeader;
+	bool m_bWarnedUnsupported;
+};
+
+class CHDSFetchWorker;
+
+// A live or on-demand HDS stream, read as FLV. Fragments are fetched ahead
+// by a few threads and remuxed in order as Kodi reads.
+class CHDSStreamSession : public CStreamSession
+{
+public:
+	// Takes over fetcher. Returns NULL if the manifest or bootstrap can't be used.
+	static CHDSStreamSession* Open(CHDSFetcher* fetcher, const std::string& strManifestURL, const std::string& strAuth, int iMaxBitrate);
+	virtual ~CHDSStreamSession();
+
+	virtual int Read(unsigned char* pBuffer, unsigned int iBufferSize);
+	virtual long long Seek(long long iPosition, int iWhence) { return -1; }
+	virtual long long Position() { return m_iPosition; }
+	virtual long long Length() { return -1; }
+	virtual bool CanPause() { return true; }
+	virtual bool CanSeek() { return false; }
+	virtual void Abort();
+
+private:
+	CHDSStreamSession(CHDSFetcher* fetcher, const std::string& strManifestURL, const std::string& strAuth, int iMaxBitrate);
+
+	void FetchFragments(CHDSFetchWorker& worker);
+	bool Refresh();
+	bool NextFragment();
+
+	CHDSFetcher* m_fetcher;
+	std::string m_strManifestURL;
+	std::string m_strAuth;
+	int m_iMaxBitrate;
+	HDSMedia m_media;
+
+	P8PLATFORM::CMutex m_mutex;
+	P8PLATFORM::CEvent m_fetchedEvent;
+	P8PLATFORM::CEvent m_consumedEvent;
+	P8PLATFORM::CEvent m_stopEvent;
+	std::atomic<bool> m_bAborted;
+	CHDSBootstrap m_bootstrap;
+	bool m_bRefreshing;
+	uint32_t m_iNextFetch;
+	uint32_t m_iNextRead;
+	std::map<uint32_t, std::string*> m_fetched; // NULL where a fragment is skipped
+	std::vector<CHDSFetchWorker*> m_workers;
+
+	// Only touched by the reading thread
+	CFLVRemuxer m_remuxer;
+	std::string m_strCurrent;
+	std::vector<CFLVRemuxer::Range> m_ranges;
+	size_t m_iRange;
+	size_t m_iRangeOffset;
+	long long m_iPosition;
+
+	friend class CHDSFetchWorker;
+};
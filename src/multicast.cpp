@@ -0,0 +1,530 @@
+/*
+ *  pvr.python - A PVR client for Kodi using Python
+ *  Copyright © 2016 RunasSudo (Yingtong Li)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "multicast.h"
+
+#include <p8-platform/threads/threads.h>
+#include <p8-platform/util/timeutils.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace ADDON;
+using namespace P8PLATFORM;
+
+// Datagrams taken off the socket per call, and the largest one kept whole
+#define MULTICAST_BATCH 32
+#define MULTICAST_DATAGRAM_SIZE 9000
+
+#define MULTICAST_SOCKET_BUFFER (4 * 1024 * 1024)
+#define MULTICAST_BUFFER_SIZE (8 * 1024 * 1024)
+
+#define MULTICAST_POLL_INTERVAL_MS 50
+// A group nobody sends to fails the open instead of leaving Kodi waiting
+#define MULTICAST_OPEN_TIMEOUT_MS 5000
+#define MULTICAST_READ_TIMEOUT_MS 10000
+
+#define MULTICAST_MODE_DETECT 0 // udp:// that may turn out to carry RTP
+#define MULTICAST_MODE_UDP 1
+#define MULTICAST_MODE_RTP 2
+
+#define RTP_HEADER_SIZE 12
+#define RTP_PAYLOAD_MP2T 33
+// A sequence number this far off is a sender that has restarted, not jitter
+#define RTP_RESTART_DISTANCE 4096
+
+#define TS_SYNC_BYTE 0x47
+
+bool ParseMulticastURL(const string& strURL, MulticastAddress& address)
+{
+	if (strURL.compare(0, 6, "udp://") == 0)
+		address.bRTP = false;
+	else if (strURL.compare(0, 6, "rtp://") == 0)
+		address.bRTP = true;
+	else
+		return false;
+
+	// Options after the address, as in FFmpeg's URLs, don't apply here
+	string strAddress = strURL.substr(6);
+	size_t iEnd = strAddress.find_first_of("?/");
+	if (iEnd != string::npos)
+		strAddress.erase(iEnd);
+
+	size_t iAt = strAddress.find('@');
+	address.strSource = (iAt != string::npos) ? strAddress.substr(0, iAt) : "";
+	string strHost = (iAt != string::npos) ? strAddress.substr(iAt + 1) : strAddress;
+	size_t iColon = strHost.rfind(':');
+	if (iColon == string::npos || iColon + 1 == strHost.size())
+		return false;
+
+	char* pEnd;
+	long iPort = strtol(strHost.c_str() + iColon + 1, &pEnd, 10);
+	if (*pEnd != '\0' || iPort <= 0 || iPort > 65535)
+		return false;
+	address.strGroup = strHost.substr(0, iColon);
+	address.iPort = (uint16_t) iPort;
+	return true;
+}
+
+// BEGIN JITTER BUFFER
+
+CRTPJitterBuffer::CRTPJitterBuffer(unsigned int iLatencyMs) :
+	m_iLatencyMs(iLatencyMs),
+	m_slots(RTP_JITTER_SLOTS),
+	m_bStarted(false),
+	m_iNext(0),
+	m_iHighest(0),
+	m_iBuffered(0),
+	m_iGapSince(0),
+	m_iLost(0),
+	m_iReordered(0),
+	m_iLate(0)
+{
+}
+
+void CRTPJitterBuffer::Push(uint16_t iSequence, const unsigned char* pPayload, size_t iSize, int64_t iNow, string& strOut)
+{
+	if (!m_bStarted) {
+		m_bStarted = true;
+		m_iNext = iSequence;
+		m_iHighest = iSequence - 1;
+	}
+
+	int iAhead = (int16_t) (uint16_t) (iSequence - m_iNext);
+	if (iAhead <= -RTP_RESTART_DISTANCE || iAhead >= RTP_RESTART_DISTANCE) {
+		Restart(iSequence, strOut);
+		iAhead = 0;
+	} else if (iAhead < 0) {
+		m_iLate++;
+		return;
+	}
+
+	// Make room by giving up on the oldest gaps
+	for (; iAhead >= RTP_JITTER_SLOTS; iAhead--)
+		Advance(strOut);
+
+	Slot& slot = m_slots[iSequence & (RTP_JITTER_SLOTS - 1)];
+	if (slot.bFilled) {
+		m_iLate++;
+		return;
+	}
+	if ((int16_t) (uint16_t) (iSequence - m_iHighest) < 0)
+		m_iReordered++;
+	else
+		m_iHighest = iSequence;
+	slot.bFilled = true;
+	slot.strPayload.assign((const char*) pPayload, iSize);
+	m_iBuffered++;
+
+	Release(iNow, strOut);
+}
+
+void CRTPJitterBuffer::Expire(int64_t iNow, string& strOut)
+{
+	if (m_iBuffered == 0 || iNow - m_iGapSince < m_iLatencyMs)
+		return;
+
+	while (!m_slots[m_iNext & (RTP_JITTER_SLOTS - 1)].bFilled)
+		Advance(strOut);
+	Release(iNow, strOut);
+}
+
+void CRTPJitterBuffer::Release(int64_t iNow, string& strOut)
+{
+	bool bMoved = false;
+	while (m_slots[m_iNext & (RTP_JITTER_SLOTS - 1)].bFilled) {
+		Advance(strOut);
+		bMoved = true;
+	}
+
+	// Whatever is left waits on a gap, which is timed from when it first held anything up
+	if (m_iBuffered == 0)
+		m_iGapSince = 0;
+	else if (bMoved || m_iGapSince == 0)
+		m_iGapSince = iNow;
+}
+
+void CRTPJitterBuffer::Advance(string& strOut)
+{
+	Slot& slot = m_slots[m_iNext & (RTP_JITTER_SLOTS - 1)];
+	if (slot.bFilled) {
+		strOut.append(slot.strPayload);
+		slot.bFilled = false;
+		m_iBuffered--;
+	} else {
+		m_iLost++;
+	}
+	m_iNext++;
+}
+
+void CRTPJitterBuffer::Restart(uint16_t iSequence, string& strOut)
+{
+	while (m_iBuffered > 0)
+		Advance(strOut);
+	m_iNext = iSequence;
+	m_iHighest = iSequence - 1;
+	m_iGapSince = 0;
+}
+
+// END JITTER BUFFER
+
+// BEGIN SESSIONS
+
+class CMulticastReceiver : public CThread
+{
+public:
+	CMulticastReceiver(CMulticastStreamSession* session) : m_session(session) {}
+
+	virtual void* Process(void) {
+		m_session->Receive(*this);
+		return NULL;
+	}
+
+private:
+	CMulticastStreamSession* m_session;
+};
+
+#ifndef _WIN32
+// Binds to the group itself, which keeps out other groups sent to the same port
+static int OpenSocket(const MulticastAddress& address, const string& strInterface)
+{
+	struct in_addr group;
+	struct in_addr source;
+	struct in_addr localInterface;
+	group.s_addr = htonl(INADDR_ANY);
+	localInterface.s_addr = htonl(INADDR_ANY);
+	if ((!address.strGroup.empty() && inet_pton(AF_INET, address.strGroup.c_str(), &group) != 1) ||
+	    (!address.strSource.empty() && inet_pton(AF_INET, address.strSource.c_str(), &source) != 1) ||
+	    (!strInterface.empty() && inet_pton(AF_INET, strInterface.c_str(), &localInterface) != 1)) {
+		XBMC->Log(LOG_ERROR, "%s - Only numeric IPv4 addresses are supported", __FUNCTION__);
+		return -1;
+	}
+
+	int iSocket = socket(AF_INET, SOCK_DGRAM, 0);
+	if (iSocket < 0) {
+		XBMC->Log(LOG_ERROR, "%s - Failed to create a socket: %s", __FUNCTION__, strerror(errno));
+		return -1;
+	}
+	int iOn = 1;
+	int iBufferSize = MULTICAST_SOCKET_BUFFER;
+	setsockopt(iSocket, SOL_SOCKET, SO_REUSEADDR, &iOn, sizeof(iOn));
+	setsockopt(iSocket, SOL_SOCKET, SO_RCVBUF, &iBufferSize, sizeof(iBufferSize));
+#ifdef SO_RXQ_OVFL
+	setsockopt(iSocket, SOL_SOCKET, SO_RXQ_OVFL, &iOn, sizeof(iOn));
+#endif
+
+	struct sockaddr_in bindAddress;
+	memset(&bindAddress, 0, sizeof(bindAddress));
+	bindAddress.sin_family = AF_INET;
+	bindAddress.sin_port = htons(address.iPort);
+	bindAddress.sin_addr = group;
+	if (bind(iSocket, (struct sockaddr*) &bindAddress, sizeof(bindAddress)) < 0) {
+		XBMC->Log(LOG_ERROR, "%s - Failed to bind to %s:%u: %s", __FUNCTION__, address.strGroup.c_str(), address.iPort, strerror(errno));
+		close(iSocket);
+		return -1;
+	}
+
+	if (IN_MULTICAST(ntohl(group.s_addr))) {
+		int iResult;
+		if (!address.strSource.empty()) {
+			struct ip_mreq_source request;
+			memset(&request, 0, sizeof(request));
+			request.imr_multiaddr = group;
+			request.imr_interface = localInterface;
+			request.imr_sourceaddr = source;
+			iResult = setsockopt(iSocket, IPPROTO_IP, IP_ADD_SOURCE_MEMBERSHIP, &request, sizeof(request));
+		} else {
+			struct ip_mreq request;
+			request.imr_multiaddr = group;
+			request.imr_interface = localInterface;
+			iResult = setsockopt(iSocket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request, sizeof(request));
+		}
+		if (iResult < 0) {
+			XBMC->Log(LOG_ERROR, "%s - Failed to join %s: %s", __FUNCTION__, address.strGroup.c_str(), strerror(errno));
+			close(iSocket);
+			return -1;
+		}
+	}
+	return iSocket;
+}
+#endif
+
+CMulticastStreamSession* CMulticastStreamSession::Open(const string& strURL, const string& strInterface, unsigned int iLatencyMs)
+{
+#ifdef _WIN32
+	XBMC->Log(LOG_ERROR, "%s - UDP and RTP streams aren't supported on this platform", __FUNCTION__);
+	return NULL;
+#else
+	MulticastAddress address;
+	if (!ParseMulticastURL(strURL, address)) {
+		XBMC->Log(LOG_ERROR, "%s - Not a udp:// or rtp:// address: '%s'", __FUNCTION__, strURL.c_str());
+		return NULL;
+	}
+	int iSocket = OpenSocket(address, strInterface);
+	if (iSocket < 0)
+		return NULL;
+
+	CMulticastStreamSession* session = new CMulticastStreamSession(strURL, iSocket, address.bRTP, iLatencyMs);
+	session->m_receiver = new CMulticastReceiver(session);
+	session->m_receiver->CreateThread(false);
+
+	int iWaited = 0;
+	for (;;) {
+		{
+			CLockObject lock(session->m_mutex);
+			if (session->m_iBufferFill > 0)
+				break;
+		}
+		if (iWaited >= MULTICAST_OPEN_TIMEOUT_MS) {
+			XBMC->Log(LOG_ERROR, "%s - Nothing received from '%s'", __FUNCTION__, strURL.c_str());
+			delete session;
+			return NULL;
+		}
+		session->m_dataEvent.Wait(MULTICAST_POLL_INTERVAL_MS);
+		iWaited += MULTICAST_POLL_INTERVAL_MS;
+	}
+	XBMC->Log(LOG_DEBUG, "%s - Receiving '%s'", __FUNCTION__, strURL.c_str());
+	return session;
+#endif
+}
+
+CMulticastStreamSession::CMulticastStreamSession(const string& strURL, int iSocket, bool bRTP, unsigned int iLatencyMs) :
+	m_strURL(strURL),
+	m_iSocket(iSocket),
+	m_receiver(NULL),
+	m_iMode(bRTP ? MULTICAST_MODE_RTP : MULTICAST_MODE_DETECT),
+	m_jitter(iLatencyMs),
+	m_buffer(MULTICAST_BUFFER_SIZE),
+	m_iBufferStart(0),
+	m_iBufferFill(0),
+	m_iOverflows(0),
+	m_bRTP(bRTP),
+	m_bFailed(false),
+	m_bAborted(false)
+{
+}
+
+CMulticastStreamSession::~CMulticastStreamSession()
+{
+	if (m_receiver != NULL) {
+		m_receiver->StopThread(0);
+		delete m_receiver;
+	}
+#ifndef _WIN32
+	close(m_iSocket); // Which leaves the group
+#endif
+}
+
+void CMulticastStreamSession::Receive(CMulticastReceiver& receiver)
+{
+#ifndef _WIN32
+	vector<unsigned char> datagrams(MULTICAST_BATCH * MULTICAST_DATAGRAM_SIZE);
+#ifdef __linux__
+	struct mmsghdr messages[MULTICAST_BATCH];
+	struct iovec vectors[MULTICAST_BATCH];
+	char controls[MULTICAST_BATCH][CMSG_SPACE(sizeof(uint32_t))];
+	memset(messages, 0, sizeof(messages));
+	for (int i = 0; i < MULTICAST_BATCH; i++) {
+		vectors[i].iov_base = &datagrams[i * MULTICAST_DATAGRAM_SIZE];
+		vectors[i].iov_len = MULTICAST_DATAGRAM_SIZE;
+		messages[i].msg_hdr.msg_iov = &vectors[i];
+		messages[i].msg_hdr.msg_iovlen = 1;
+	}
+#endif
+
+	while (!receiver.IsStopped()) {
+		struct pollfd pollSocket = { m_iSocket, POLLIN, 0 };
+		int iReady = poll(&pollSocket, 1, MULTICAST_POLL_INTERVAL_MS);
+		int64_t iNow = GetTimeMs();
+		m_strBatch.clear();
+
+		int iCount = 0;
+		if (iReady > 0) {
+#ifdef __linux__
+			for (int i = 0; i < MULTICAST_BATCH; i++) {
+				messages[i].msg_hdr.msg_control = controls[i];
+				messages[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+			}
+			iCount = recvmmsg(m_iSocket, messages, MULTICAST_BATCH, MSG_DONTWAIT, NULL);
+			for (int i = 0; i < iCount; i++) {
+				Datagram(&datagrams[i * MULTICAST_DATAGRAM_SIZE], messages[i].msg_len, (messages[i].msg_hdr.msg_flags & MSG_TRUNC) != 0, iNow);
+#ifdef SO_RXQ_OVFL
+				for (struct cmsghdr* control = CMSG_FIRSTHDR(&messages[i].msg_hdr); control != NULL; control = CMSG_NXTHDR(&messages[i].msg_hdr, control)) {
+					if (control->cmsg_level == SOL_SOCKET && control->cmsg_type == SO_RXQ_OVFL)
+						memcpy(&m_received.iKernelDrops, CMSG_DATA(control), sizeof(uint32_t));
+				}
+#endif
+			}
+#else
+			ssize_t iSize;
+			while (iCount < MULTICAST_BATCH && (iSize = recv(m_iSocket, &datagrams[0], MULTICAST_DATAGRAM_SIZE, MSG_DONTWAIT)) >= 0) {
+				Datagram(&datagrams[0], iSize, false, iNow);
+				iCount++;
+			}
+			if (iCount == 0)
+				iCount = -1;
+#endif
+		}
+		if (iReady < 0 || iCount < 0) {
+			if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+				XBMC->Log(LOG_ERROR, "%s - Failed to receive '%s': %s", __FUNCTION__, m_strURL.c_str(), strerror(errno));
+				Deliver(true);
+				break;
+			}
+		}
+
+		if (m_iMode == MULTICAST_MODE_RTP)
+			m_jitter.Expire(iNow, m_strBatch);
+		Deliver(false);
+	}
+#endif
+}
+
+void CMulticastStreamSession::Datagram(const unsigned char* pData, size_t iSize, bool bTruncated, int64_t iNow)
+{
+	m_received.iDatagrams++;
+	if (bTruncated || iSize == 0) {
+		m_received.iInvalid++;
+		return;
+	}
+
+	// Plain UDP starts with a TS packet; some senders wrap it in RTP all the same
+	if (m_iMode == MULTICAST_MODE_DETECT) {
+		bool bRTP = pData[0] != TS_SYNC_BYTE && iSize >= RTP_HEADER_SIZE && (pData[0] >> 6) == 2 && (pData[1] & 0x7f) == RTP_PAYLOAD_MP2T;
+		m_iMode = bRTP ? MULTICAST_MODE_RTP : MULTICAST_MODE_UDP;
+	}
+	if (m_iMode == MULTICAST_MODE_UDP) {
+		m_strBatch.append((const char*) pData, iSize);
+		return;
+	}
+
+	size_t iHeader = RTP_HEADER_SIZE + 4 * (pData[0] & 0x0f);
+	if (iSize < RTP_HEADER_SIZE || (pData[0] >> 6) != 2 || iSize < iHeader) {
+		m_received.iInvalid++;
+		return;
+	}
+	if (pData[0] & 0x10) {
+		// Header extension
+		if (iSize < iHeader + 4) {
+			m_received.iInvalid++;
+			return;
+		}
+		iHeader += 4 + 4 * ((pData[iHeader + 2] << 8) | pData[iHeader + 3]);
+	}
+	size_t iEnd = iSize;
+	if (pData[0] & 0x20)
+		iEnd -= min((size_t) pData[iSize - 1], iSize); // Padding
+	if (iHeader > iEnd) {
+		m_received.iInvalid++;
+		return;
+	}
+	m_jitter.Push((pData[2] << 8) | pData[3], pData + iHeader, iEnd - iHeader, iNow, m_strBatch);
+}
+
+// Hands a batch over to the reading side, all at once
+void CMulticastStreamSession::Deliver(bool bFailed)
+{
+	m_received.iLost = m_jitter.Lost();
+	m_received.iReordered = m_jitter.Reordered();
+	m_received.iLate = m_jitter.Late();
+
+	CLockObject lock(m_mutex);
+	m_stats = m_received;
+	m_bRTP = (m_iMode == MULTICAST_MODE_RTP);
+	if (bFailed) {
+		m_bFailed = true;
+		m_dataEvent.Signal();
+	}
+	if (m_strBatch.empty())
+		return;
+
+	if (m_strBatch.size() > m_buffer.size() - m_iBufferFill) {
+		if (m_iOverflows++ == 0)
+			XBMC->Log(LOG_ERROR, "%s - '%s' isn't being read fast enough, dropping data", __FUNCTION__, m_strURL.c_str());
+		return;
+	}
+	size_t iEnd = (m_iBufferStart + m_iBufferFill) % m_buffer.size();
+	size_t iFirst = min(m_strBatch.size(), m_buffer.size() - iEnd);
+	memcpy(&m_buffer[iEnd], m_strBatch.data(), iFirst);
+	memcpy(&m_buffer[0], m_strBatch.data() + iFirst, m_strBatch.size() - iFirst);
+	m_iBufferFill += m_strBatch.size();
+	m_dataEvent.Signal();
+}
+
+int CMulticastStreamSession::Read(unsigned char* pBuffer, unsigned int iBufferSize)
+{
+	int iWaited = 0;
+	for (;;) {
+		{
+			CLockObject lock(m_mutex);
+			if (m_iBufferFill > 0) {
+				size_t iCount = min((size_t) iBufferSize, m_iBufferFill);
+				size_t iFirst = min(iCount, m_buffer.size() - m_iBufferStart);
+				memcpy(pBuffer, &m_buffer[m_iBufferStart], iFirst);
+				memcpy(pBuffer + iFirst, &m_buffer[0], iCount - iFirst);
+				m_iBufferStart = (m_iBufferStart + iCount) % m_buffer.size();
+				m_iBufferFill -= iCount;
+				return (int) iCount;
+			}
+			if (m_bFailed || m_bAborted)
+				return -1;
+		}
+		if (iWaited >= MULTICAST_READ_TIMEOUT_MS) {
+			XBMC->Log(LOG_ERROR, "%s - Nothing received from '%s' for %d seconds", __FUNCTION__, m_strURL.c_str(), MULTICAST_READ_TIMEOUT_MS / 1000);
+			return 0;
+		}
+		m_dataEvent.Wait(MULTICAST_POLL_INTERVAL_MS);
+		iWaited += MULTICAST_POLL_INTERVAL_MS;
+	}
+}
+
+void CMulticastStreamSession::Abort()
+{
+	CLockObject lock(m_mutex);
+	m_bAborted = true;
+	m_dataEvent.Broadcast();
+}
+
+// Losses show as uncorrected blocks, and the share of datagrams that made it as the signal
+void CMulticastStreamSession::SignalStatus(PVR_SIGNAL_STATUS& signalStatus)
+{
+	CLockObject lock(m_mutex);
+	uint64_t iLost = m_bRTP ? m_stats.iLost : m_stats.iKernelDrops;
+	snprintf(signalStatus.strAdapterName, sizeof(signalStatus.strAdapterName), "%s", m_strURL.c_str());
+	snprintf(signalStatus.strAdapterStatus, sizeof(signalStatus.strAdapterStatus), "%s, %llu lost, %llu reordered",
+		m_bFailed ? "Failed" : "OK", (unsigned long long) iLost, (unsigned long long) m_stats.iReordered);
+	signalStatus.iUNC = (long) iLost;
+	if (m_stats.iDatagrams + iLost > 0)
+		signalStatus.iSignal = (int) (0xffff * m_stats.iDatagrams / (m_stats.iDatagrams + iLost));
+}
+
+// END SESSIONS
@@ -0,0 +1,153 @@
+#pragma once
+/*
+ *  pvr.python - A PVR client for Kodi using Python
+ *  Copyright © 2016 RunasSudo (Yingtong Li)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "streams.h"
+
+#include <p8-platform/threads/mutex.h>
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// How long RTP packets are held back by default to be put in order
+#define MULTICAST_DEFAULT_LATENCY_MS 200
+
+// Sequence numbers the jitter buffer can hold at once, a power of two
+#define RTP_JITTER_SLOTS 1024
+
+struct MulticastAddress
+{
+	bool bRTP;
+	std::string strGroup;  // A multicast group, or a local address to take unicast on
+	std::string strSource; // Only for source-specific multicast
+	uint16_t iPort;
+};
+
+// Takes udp://[source]@group:port and rtp://[source]@group:port, as VLC
+// does. Addresses have to be numeric IPv4 ones.
+bool ParseMulticastURL(const std::string& strURL, MulticastAddress& address);
+
+// Puts RTP packets back in sequence order. A gap is waited on for up to the
+// latency, or until the packets behind it no longer fit, and then counted as
+// lost. Packets arriving after their turn has passed are dropped.
+class CRTPJitterBuffer
+{
+public:
+	CRTPJitterBuffer(unsigned int iLatencyMs);
+
+	// Appends the payloads that are now in order to strOut
+	void Push(uint16_t iSequence, const unsigned char* pPayload, size_t iSize, int64_t iNow, std::string& strOut);
+
+	// Gives up on a gap that has been waited on for the latency
+	void Expire(int64_t iNow, std::string& strOut);
+
+	uint64_t Lost() const { return m_iLost; }
+	uint64_t Reordered() const { return m_iReordered; }
+	uint64_t Late() const { return m_iLate; } // Including duplicates
+
+private:
+	struct Slot
+	{
+		Slot() : bFilled(false) {}
+
+		bool bFilled;
+		std::string strPayload;
+	};
+
+	void Release(int64_t iNow, std::string& strOut);
+	void Advance(std::string& strOut);
+	void Restart(uint16_t iSequence, std::string& strOut);
+
+	unsigned int m_iLatencyMs;
+	std::vector<Slot> m_slots; // By sequence number, modulo RTP_JITTER_SLOTS
+	bool m_bStarted;
+	uint16_t m_iNext;          // The next sequence number to go out
+	uint16_t m_iHighest;
+	unsigned int m_iBuffered;
+	int64_t m_iGapSince;       // When the head of the buffer started being waited on
+	uint64_t m_iLost;
+	uint64_t m_iReordered;
+	uint64_t m_iLate;
+};
+
+class CMulticastReceiver;
+
+struct MulticastStats
+{
+	MulticastStats() : iDatagrams(0), iInvalid(0), iKernelDrops(0), iLost(0), iReordered(0), iLate(0) {}
+
+	uint64_t iDatagrams;
+	uint64_t iInvalid;     // Truncated, or not RTP where RTP was expected
+	uint32_t iKernelDrops; // Datagrams the socket had no room for
+	uint64_t iLost;        // Gaps in the RTP sequence
+	uint64_t iReordered;
+	uint64_t iLate;        // Arrived after their turn, or twice
+};
+
+// A live UDP or RTP stream, multicast or unicast, taken straight off a
+// socket. A thread of its own receives it in batches and puts RTP back in
+// order, so nothing is lost while Kodi or Python is busy elsewhere.
+class CMulticastStreamSession : public CStreamSession
+{
+public:
+	// Returns NULL if the socket can't be set up, or no data arrives
+	static CMulticastStreamSession* Open(const std::string& strURL, const std::string& strInterface, unsigned int iLatencyMs);
+	virtual ~CMulticastStreamSession();
+
+	virtual int Read(unsigned char* pBuffer, unsigned int iBufferSize);
+	virtual long long Seek(long long iPosition, int iWhence) { return -1; }
+	virtual long long Position() { return -1; }
+	virtual long long Length() { return -1; }
+	virtual bool CanPause() { return false; }
+	virtual bool CanSeek() { return false; }
+	virtual void SignalStatus(PVR_SIGNAL_STATUS& signalStatus);
+	virtual void Abort();
+
+private:
+	CMulticastStreamSession(const std::string& strURL, int iSocket, bool bRTP, unsigned int iLatencyMs);
+
+	void Receive(CMulticastReceiver& receiver);
+	void Datagram(const unsigned char* pData, size_t iSize, bool bTruncated, int64_t iNow);
+	void Deliver(bool bFailed);
+
+	std::string m_strURL;
+	int m_iSocket;
+	CMulticastReceiver* m_receiver;
+
+	// Only touched by the receiving thread
+	int m_iMode; // MULTICAST_MODE_*
+	CRTPJitterBuffer m_jitter;
+	MulticastStats m_received;
+	std::string m_strBatch;
+
+	P8PLATFORM::CMutex m_mutex;
+	P8PLATFORM::CEvent m_dataEvent;
+	std::vector<unsigned char> m_buffer; // A ring of what is yet to be read
+	size_t m_iBufferStart;
+	size_t m_iBufferFill;
+	MulticastStats m_stats;
+	uint64_t m_iOverflows; // Batches dropped because Kodi wasn't reading
+	bool m_bRTP;
+	bool m_bFailed;
+	bool m_bAborted;
+
+	friend class CMulticastReceiver;
+};
@@ -0,0 +1,734 @@
+/*
+ *  pvr.python - A PVR client for Kodi using Python
+ *  Copyright © 2016 RunasSudo (Yingtong Li)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "recorder.h"
+#include "recordings.h"
+#include "snapshot.h"
+#include "streamprops.h"
+#include "streams.h"
+#include "timers.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include <p8-platform/util/timeutils.h>
+
+#include <algorithm>
+#include <set>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace ADDON;
+using namespace P8PLATFORM;
+
+#define RECORDER_STATE_MAGIC "PVRPYRCR"
+
+// How often the timers are looked at when nothing wakes the recorder
+#define RECORDER_POLL_INTERVAL_MS 1000
+
+// How long a job waits before opening its channel again
+#define RECORDER_RETRY_MS 10000
+
+// How long the jobs get to stop, within RECORDER_STOP_TIMEOUT_MS
+#define RECORDER_JOB_STOP_TIMEOUT_MS 10000
+
+// What a job asks its stream for at a time
+#define RECORDER_READ_SIZE (256 * 1024)
+
+// Disk space is reserved this far ahead of the writes
+#define RECORDER_PREALLOCATE_SIZE (64 * 1024 * 1024)
+
+// A file name that is taken gets " (2)" and so on, up to this
+#define RECORDER_MAX_SUFFIX 100
+
+static void CopyString(char* dest, size_t size, const string& src)
+{
+	strncpy(dest, src.c_str(), size - 1);
+	dest[size - 1] = '\0';
+}
+
+// Like mkdir -p, for the parents of strPath
+static void CreateParents(const string& strPath)
+{
+#ifndef _WIN32
+	for (size_t slash = strPath.find('/', 1); slash != string::npos; slash = strPath.find('/', slash + 1)) {
+		mkdir(strPath.substr(0, slash).c_str(), 0755);
+	}
+#endif
+}
+
+static bool FileExists(const string& strPath)
+{
+	struct stat info;
+	return stat(strPath.c_str(), &info) == 0;
+}
+
+// Makes a title usable as a file name. A leading dot would hide it from the index.
+static string SafeName(const string& strName)
+{
+	string strSafe = strName;
+	for (size_t i = 0; i < strSafe.size(); i++) {
+		unsigned char c = strSafe[i];
+		if (c < 0x20 || strchr("/\\:*?\"<>|", c) != NULL)
+			strSafe[i] = '_';
+	}
+	if (!strSafe.empty() && strSafe[0] == '.')
+		strSafe[0] = '_';
+	return strSafe;
+}
+
+// Keeps the subdirectories of a timer's directory inside the recordings directory
+static string SafeDirectory(const string& strDirectory)
+{
+	string strSafe;
+	size_t start = 0;
+	while (start <= strDirectory.size()) {
+		size_t slash = strDirectory.find_first_of("/\\", start);
+		if (slash == string::npos)
+			slash = strDirectory.size();
+		string strPart = strDirectory.substr(start, slash - start);
+		if (!strPart.empty() && strPart != "." && strPart != "..")
+			strSafe += (strSafe.empty() ? "" : "/") + SafeName(strPart);
+		start = slash + 1;
+	}
+	return strSafe;
+}
+
+// Guesses the container from the start of the stream, so the index and Kodi
+// know what the file is
+static const char* FileExtension(const unsigned char* pData, size_t iSize)
+{
+	if (iSize >= 3 && memcmp(pData, "FLV", 3) == 0)
+		return ".flv";
+	if (iSize >= 8 && memcmp(pData + 4, "ftyp", 4) == 0)
+		return ".mp4";
+	if (iSize >= 4 && pData[0] == 0x1A && pData[1] == 0x45 && pData[2] == 0xDF && pData[3] == 0xA3)
+		return ".mkv";
+	return ".ts";
+}
+
+// BEGIN WRITER
+
+CRecordingWriter::CRecordingWriter() :
+	m_iFile(-1),
+	m_bDirect(false),
+	m_iFilling(0),
+	m_iFill(0),
+	m_iOffset(0),
+	m_iReserved(0),
+	m_iPending(-1),
+	m_iPendingOffset(0),
+	m_bFailed(false)
+{
+	m_buffers[0] = NULL;
+	m_buffers[1] = NULL;
+}
+
+CRecordingWriter::~CRecordingWriter()
+{
+	if (IsOpen())
+		Close();
+	free(m_buffers[0]);
+	free(m_buffers[1]);
+}
+
+bool CRecordingWriter::Open(const string& strPath)
+{
+#ifdef _WIN32
+	errno = ENOSYS;
+	return false;
+#else
+	for (int i = 0; i < 2; i++) {
+		if (m_buffers[i] == NULL && posix_memalign((void**) &m_buffers[i], RECORDER_ALIGNMENT, RECORDER_BUFFER_SIZE) != 0) {
+			m_buffers[i] = NULL;
+			errno = ENOMEM;
+			return false;
+		}
+	}
+
+	// O_DIRECT is turned on afterwards, as a filesystem that refuses it
+	// only says so once the file has been created
+	m_iFile = open(strPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (m_iFile < 0)
+		return false;
+#ifdef O_DIRECT
+	m_bDirect = (fcntl(m_iFile, F_SETFL, fcntl(m_iFile, F_GETFL) | O_DIRECT) == 0);
+#endif
+
+	m_iFilling = 0;
+	m_iFill = 0;
+	m_iOffset = 0;
+	m_iReserved = 0;
+	m_iPending = -1;
+	m_bFailed = false;
+	CreateThread(true);
+	return true;
+#endif
+}
+
+bool CRecordingWriter::Write(const unsigned char* pData, size_t iSize)
+{
+	if (!IsOpen())
+		return false;
+
+	while (iSize > 0) {
+		size_t iCopied = min(iSize, (size_t) RECORDER_BUFFER_SIZE - m_iFill);
+		memcpy(m_buffers[m_iFilling] + m_iFill, pData, iCopied);
+		m_iFill += iCopied;
+		pData += iCopied;
+		iSize -= iCopied;
+		if (m_iFill < RECORDER_BUFFER_SIZE)
+			break;
+
+		// Hands the full buffer over, once the other one is free to fill
+		if (!WaitForPending())
+			return false;
+		{
+			CLockObject lock(m_mutex);
+			m_iPending = m_iFilling;
+			m_iPendingOffset = m_iOffset;
+		}
+		m_pendingEvent.Signal();
+		m_iFilling ^= 1;
+		m_iOffset += RECORDER_BUFFER_SIZE;
+		m_iFill = 0;
+	}
+
+	CLockObject lock(m_mutex);
+	return !m_bFailed;
+}
+
+// Returns false if a write has failed
+bool CRecordingWriter::WaitForPending()
+{
+	for (;;) {
+		{
+			CLockObject lock(m_mutex);
+			if (m_bFailed)
+				return false;
+			if (m_iPending < 0)
+				return true;
+		}
+		m_writtenEvent.Wait(1000);
+	}
+}
+
+#ifndef _WIN32
+static bool WriteAt(int iFile, const unsigned char* pData, size_t iSize, int64_t iOffset)
+{
+	while (iSize > 0) {
+		ssize_t iWritten = pwrite(iFile, pData, iSize, iOffset);
+		if (iWritten < 0 && errno == EINTR)
+			continue;
+		if (iWritten <= 0)
+			return false;
+		pData += iWritten;
+		iSize -= iWritten;
+		iOffset += iWritten;
+	}
+	return true;
+}
+#endif
+
+// Reserves the space up to iEnd and a good way past it, so the file isn't
+// fragmented by the other recordings growing at the same time. Only fails
+// when the disk is full.
+bool CRecordingWriter::Preallocate(int64_t iEnd)
+{
+#ifdef __linux__
+	if (iEnd <= m_iReserved)
+		return true;
+	int64_t iReserve = iEnd - m_iReserved + RECORDER_PREALLOCATE_SIZE;
+	if (fallocate(m_iFile, FALLOC_FL_KEEP_SIZE, m_iReserved, iReserve) == 0) {
+		m_iReserved += iReserve;
+		return true;
+	}
+	if (errno == ENOSPC)
+		return false;
+	m_iReserved = INT64_MAX; // Not supported here, so not tried again
+#endif
+	return true;
+}
+
+// Writes each buffer as it is handed over
+void* CRecordingWriter::Process(void)
+{
+#ifndef _WIN32
+	while (!IsStopped()) {
+		int iBuffer;
+		int64_t iOffset;
+		{
+			CLockObject lock(m_mutex);
+			iBuffer = m_iPending;
+			iOffset = m_iPendingOffset;
+		}
+		if (iBuffer < 0) {
+			m_pendingEvent.Wait(1000);
+			continue;
+		}
+
+		bool bWritten = Preallocate(iOffset + RECORDER_BUFFER_SIZE) && WriteAt(m_iFile, m_buffers[iBuffer], RECORDER_BUFFER_SIZE, iOffset);
+		if (!bWritten)
+			XBMC->Log(LOG_ERROR, "%s - Write failed: %s", __FUNCTION__, strerror(errno));
+		{
+			CLockObject lock(m_mutex);
+			m_iPending = -1;
+			if (!bWritten)
+				m_bFailed = true;
+		}
+		m_writtenEvent.Signal();
+	}
+#endif
+	return NULL;
+}
+
+bool CRecordingWriter::Close()
+{
+	if (!IsOpen())
+		return false;
+
+	bool bWritten = WaitForPending();
+	StopThread(-1);
+	m_pendingEvent.Signal();
+	StopThread();
+
+#ifndef _WIN32
+	// The last buffer is only partly filled, which O_DIRECT can't take
+	if (bWritten && m_iFill > 0) {
+#ifdef O_DIRECT
+		if (m_bDirect)
+			fcntl(m_iFile, F_SETFL, fcntl(m_iFile, F_GETFL) & ~O_DIRECT);
+#endif
+		bWritten = WriteAt(m_iFile, m_buffers[m_iFilling], m_iFill, m_iOffset);
+		if (!bWritten)
+			XBMC->Log(LOG_ERROR, "%s - Write failed: %s", __FUNCTION__, strerror(errno));
+	}
+	// Truncating to the size it already has frees the blocks reserved past it
+	if (m_iReserved > Size() && m_iReserved != INT64_MAX)
+		ftruncate(m_iFile, Size());
+	if (close(m_iFile) != 0)
+		bWritten = false;
+#endif
+	m_iFile = -1;
+	return bWritten;
+}
+
+// END WRITER
+
+// BEGIN JOBS
+
+CRecordingJob::CRecordingJob(CRecorder& recorder, const PVR_TIMER& timer, time_t end) :
+	m_recorder(recorder),
+	m_timer(timer),
+	m_bWriteFailed(false),
+	m_end(end),
+	m_bFinished(false),
+	m_session(NULL)
+{
+}
+
+void CRecordingJob::SetEnd(time_t end)
+{
+	CLockObject lock(m_mutex);
+	m_end = end;
+}
+
+time_t CRecordingJob::End()
+{
+	CLockObject lock(m_mutex);
+	return m_end;
+}
+
+void CRecordingJob::Stop()
+{
+	StopThread(-1);
+	m_stopEvent.Signal();
+
+	CLockObject lock(m_mutex);
+	if (m_session != NULL)
+		m_session->Abort();
+}
+
+bool CRecordingJob::IsFinished()
+{
+	CLockObject lock(m_mutex);
+	return m_bFinished;
+}
+
+bool CRecordingJob::Succeeded()
+{
+	return m_writer.Size() > 0 && !m_bWriteFailed;
+}
+
+bool CRecordingJob::IsDue()
+{
+	return !IsStopped() && time(NULL) < End();
+}
+
+void* CRecordingJob::Process(void)
+{
+	XBMC->Log(LOG_DEBUG, "%s - Recording '%s' from channel %d", __FUNCTION__, m_timer.strTitle, m_timer.iClientChannelUid);
+	while (IsDue() && !m_bWriteFailed) {
+		CStreamSession* session = m_recorder.Open(m_timer.iClientChannelUid);
+		if (session != NULL) {
+			{
+				// Stop may have come while it was being opened
+				CLockObject lock(m_mutex);
+				m_session = session;
+				if (IsStopped())
+					session->Abort();
+			}
+			Record(session);
+			{
+				CLockObject lock(m_mutex);
+				m_session = NULL;
+			}
+			delete session;
+		} else {
+			XBMC->Log(LOG_ERROR, "%s - Couldn't open channel %d for '%s'", __FUNCTION__, m_timer.iClientChannelUid, m_timer.strTitle);
+		}
+		time_t remaining = End() - time(NULL);
+		if (IsDue() && !m_bWriteFailed)
+			m_stopEvent.Wait(min((int64_t) RECORDER_RETRY_MS, (int64_t) remaining * 1000));
+	}
+
+	if (m_writer.IsOpen() && !m_writer.Close())
+		m_bWriteFailed = true;
+	XBMC->Log(LOG_DEBUG, "%s - Recorded %lld bytes of '%s'", __FUNCTION__, (long long) m_writer.Size(), m_timer.strTitle);
+
+	CLockObject lock(m_mutex);
+	m_bFinished = true;
+	return NULL;
+}
+
+// Copies the stream to the file until it ends or the timer does. Once the
+// job is stopped the recorder isn't touched, as it may be gone.
+void CRecordingJob::Record(CStreamSession* session)
+{
+	vector<unsigned char> buffer(RECORDER_READ_SIZE);
+	CTSProbe probe;
+	bool bProbing = true;
+	while (IsDue()) {
+		int iRead = session->Read(&buffer[0], buffer.size());
+		if (iRead <= 0 || IsStopped())
+			return;
+		if (!m_writer.IsOpen() && !Create(&buffer[0], iRead)) {
+			m_bWriteFailed = true;
+			return;
+		}
+		if (!m_writer.Write(&buffer[0], iRead)) {
+			m_bWriteFailed = true;
+			return;
+		}
+		// A probe cut short by the stream ending says nothing either way
+		if (bProbing && probe.Feed(&buffer[0], iRead)) {
+			m_recorder.Probed(m_timer.iClientChannelUid, probe);
+			bProbing = false;
+		}
+	}
+}
+
+// Creates the file once the first data shows what it is
+bool CRecordingJob::Create(const unsigned char* pData, size_t iSize)
+{
+	string strStem = m_recorder.Target(m_timer);
+	const char* extension = FileExtension(pData, iSize);
+	for (int i = 1; i <= RECORDER_MAX_SUFFIX; i++) {
+		char suffix[16] = "";
+		if (i > 1)
+			snprintf(suffix, sizeof(suffix), " (%d)", i);
+		string strPath = strStem + suffix + extension;
+		if (m_writer.Open(strPath)) {
+			m_recorder.Register(strPath, m_timer);
+			return true;
+		}
+		if (errno != EEXIST) {
+			XBMC->Log(LOG_ERROR, "%s - Can't create '%s': %s", __FUNCTION__, strPath.c_str(), strerror(errno));
+			return false;
+		}
+	}
+	XBMC->Log(LOG_ERROR, "%s - Too many recordings named '%s'", __FUNCTION__, strStem.c_str());
+	return false;
+}
+
+// END JOBS
+
+// BEGIN RECORDER
+
+CRecorder::CRecorder(const string& strRoot, const string& strStatePath, CTimerStore& timers, CStreamPropertiesCache& streamProperties, OpenFunc open) :
+	m_strRoot(strRoot),
+	m_strStatePath(strStatePath),
+	m_timers(timers),
+	m_streamProperties(streamProperties),
+	m_open(open)
+{
+	LoadState();
+}
+
+CRecorder::~CRecorder()
+{
+	StopThread();
+}
+
+void CRecorder::Wake()
+{
+	m_wakeEvent.Signal();
+}
+
+// Keeps what is known about recordings that are still there, in the trash or not
+bool CRecorder::LoadState()
+{
+	CSnapshotReader reader;
+	if (!reader.Open(m_strStatePath, RECORDER_STATE_MAGIC, RECORDER_STATE_VERSION))
+		return false;
+
+	map<string, CRecordingInfo> recordings;
+	uint32_t iCount = reader.GetUInt32();
+	for (uint32_t i = 0; i < iCount && !reader.Failed(); i++) {
+		string strPath = reader.GetString();
+		CRecordingInfo& info = recordings[strPath];
+		info.strTitle = reader.GetString();
+		info.strPlot = reader.GetString();
+		info.iChannelUid = reader.GetInt32();
+		info.iStart = reader.GetInt64();
+		info.iDuration = reader.GetInt32();
+		info.iEpgUid = reader.GetUInt32();
+		info.iGenreType = reader.GetInt32();
+		info.iGenreSubType = reader.GetInt32();
+	}
+	if (reader.Failed() || !reader.AtEnd())
+		return false;
+
+	CLockObject lock(m_mutex);
+	for (map<string, CRecordingInfo>::const_iterator it = recordings.begin(); it != recordings.end(); ++it) {
+		if (FileExists(m_strRoot + "/" + it->first) || FileExists(m_strRoot + "/" RECORDINGS_TRASH_DIRECTORY "/" + it->first))
+			m_recordings.insert(*it);
+	}
+	return true;
+}
+
+// The mutex must be held
+bool CRecorder::SaveState()
+{
+	CSnapshotWriter writer;
+	writer.PutUInt32(m_recordings.size());
+	for (map<string, CRecordingInfo>::const_iterator it = m_recordings.begin(); it != m_recordings.end(); ++it) {
+		writer.PutString(it->first);
+		writer.PutString(it->second.strTitle);
+		writer.PutString(it->second.strPlot);
+		writer.PutInt32(it->second.iChannelUid);
+		writer.PutInt64(it->second.iStart);
+		writer.PutInt32(it->second.iDuration);
+		writer.PutUInt32(it->second.iEpgUid);
+		writer.PutInt32(it->second.iGenreType);
+		writer.PutInt32(it->second.iGenreSubType);
+	}
+	return writer.Save(m_strStatePath, RECORDER_STATE_MAGIC, RECORDER_STATE_VERSION);
+}
+
+// The path of a file in the recordings directory, relative to it and outside
+// the trash, or "" for a file elsewhere
+string CRecorder::RelativePath(const string& strPath)
+{
+	string strPrefix = m_strRoot + "/";
+	if (strPath.compare(0, strPrefix.size(), strPrefix) != 0)
+		return "";
+	string strRelative = strPath.substr(strPrefix.size());
+	string strTrash = RECORDINGS_TRASH_DIRECTORY "/";
+	if (strRelative.compare(0, strTrash.size(), strTrash) == 0)
+		strRelative = strRelative.substr(strTrash.size());
+	return strRelative;
+}
+
+// Where a timer is recorded to, without the extension: in the timer's
+// directory, or one named after its title, with the start time added
+string CRecorder::Target(const PVR_TIMER& timer)
+{
+	string strTitle = SafeName(timer.strTitle);
+	if (strTitle.empty())
+		strTitle = "Recording";
+	string strDirectory = SafeDirectory(timer.strDirectory);
+	if (strDirectory.empty())
+		strDirectory = strTitle;
+
+	struct tm start;
+	time_t startTime = timer.startTime;
+#ifdef _WIN32
+	localtime_s(&start, &startTime);
+#else
+	localtime_r(&startTime, &start);
+#endif
+	char date[32];
+	strftime(date, sizeof(date), "%Y-%m-%d %H-%M", &start);
+
+	string strStem = m_strRoot + "/" + strDirectory + "/" + strTitle + " (" + date + ")";
+	CreateParents(strStem);
+	return strStem;
+}
+
+void CRecorder::Register(const string& strPath, const PVR_TIMER& timer)
+{
+	CRecordingInfo info;
+	info.strTitle = timer.strTitle;
+	info.strPlot = timer.strSummary;
+	info.iChannelUid = timer.iClientChannelUid;
+	info.iStart = timer.startTime;
+	info.iDuration = timer.endTime - timer.startTime;
+	info.iEpgUid = timer.iEpgUid;
+	info.iGenreType = timer.iGenreType;
+	info.iGenreSubType = timer.iGenreSubType;
+
+	CLockObject lock(m_mutex);
+	m_recordings[RelativePath(strPath)] = info;
+	SaveState();
+}
+
+void CRecorder::Probed(int iChannelUid, const CTSProbe& probe)
+{
+	m_streamProperties.Update(iChannelUid, probe);
+}
+
+bool CRecorder::Describe(const string& strPath, PVR_RECORDING& recording)
+{
+	CLockObject lock(m_mutex);
+	map<string, CRecordingInfo>::const_iterator it = m_recordings.find(RelativePath(strPath));
+	if (it == m_recordings.end())
+		return false;
+
+	const CRecordingInfo& info = it->second;
+	if (!info.strTitle.empty())
+		CopyString(recording.strTitle, sizeof(recording.strTitle), info.strTitle);
+	CopyString(recording.strPlot, sizeof(recording.strPlot), info.strPlot);
+	recording.iChannelUid = info.iChannelUid;
+	recording.channelType = PVR_RECORDING_CHANNEL_TYPE_TV;
+	recording.recordingTime = info.iStart;
+	recording.iDuration = info.iDuration;
+	recording.iEpgEventId = info.iEpgUid;
+	recording.iGenreType = info.iGenreType;
+	recording.iGenreSubType = info.iGenreSubType;
+	return true;
+}
+
+// Sets the state a finished job leaves its timer in. Its thread has left
+// Process by now, but has to be joined before the job can be freed.
+void CRecorder::Finish(const JobKey& key, CRecordingJob* job, PVR_TIMER_STATE state)
+{
+	m_timers.SetRecordingState(key.first, state);
+	job->StopThread();
+	delete job;
+}
+
+// Starts the jobs for the timers that are due, and reaps those that have ended
+void CRecorder::Schedule()
+{
+	time_t now = time(NULL);
+	bool bChanged = false;
+
+	vector<PVR_TIMER> due;
+	m_timers.Due(now, due);
+	set<JobKey> dueKeys;
+	for (vector<PVR_TIMER>::const_iterator it = due.begin(); it != due.end(); ++it) {
+		JobKey key(it->iClientIndex, it->startTime);
+		dueKeys.insert(key);
+		time_t end = it->endTime + it->iMarginEnd * 60;
+
+		map<JobKey, CRecordingJob*>::iterator job = m_jobs.find(key);
+		if (job != m_jobs.end()) {
+			job->second->SetEnd(end);
+			continue;
+		}
+		if (m_finished.count(key))
+			continue;
+
+		CRecordingJob* newJob = new CRecordingJob(*this, *it, end);
+		newJob->CreateThread(true);
+		m_jobs[key] = newJob;
+		m_timers.SetRecordingState(key.first, PVR_TIMER_STATE_RECORDING);
+		bChanged = true;
+	}
+
+	for (map<JobKey, CRecordingJob*>::iterator it = m_jobs.begin(); it != m_jobs.end();) {
+		CRecordingJob* job = it->second;
+		if (!job->IsFinished()) {
+			// Its timer was deleted or disabled while it recorded
+			if (!dueKeys.count(it->first) && now < job->End()) {
+				job->Stop();
+				m_cancelled.insert(it->first);
+			}
+			++it;
+			continue;
+		}
+
+		PVR_TIMER_STATE state = job->Succeeded() ? PVR_TIMER_STATE_COMPLETED : PVR_TIMER_STATE_ERROR;
+		if (m_cancelled.erase(it->first))
+			state = PVR_TIMER_STATE_ABORTED;
+		else if (now < job->End())
+			m_finished[it->first] = job->End(); // Not started again until its timer ends
+		Finish(it->first, job, state);
+		m_jobs.erase(it++);
+		bChanged = true;
+	}
+
+	for (map<JobKey, time_t>::iterator it = m_finished.begin(); it != m_finished.end();) {
+		if (it->second <= now)
+			m_finished.erase(it++);
+		else
+			++it;
+	}
+
+	if (bChanged)
+		PVR->TriggerTimerUpdate();
+}
+
+void* CRecorder::Process(void)
+{
+	while (!IsStopped()) {
+		Schedule();
+		m_wakeEvent.Wait(RECORDER_POLL_INTERVAL_MS);
+	}
+
+	// A job stuck where it can't be aborted, such as opening its channel or
+	// reading a file, is left behind rather than holding up the add-on being
+	// unloaded. Being stopped, it doesn't touch the recorder again.
+	for (map<JobKey, CRecordingJob*>::iterator it = m_jobs.begin(); it != m_jobs.end(); ++it)
+		it->second->Stop();
+	int64_t iEnd = GetTimeMs() + RECORDER_JOB_STOP_TIMEOUT_MS;
+	for (map<JobKey, CRecordingJob*>::iterator it = m_jobs.begin(); it != m_jobs.end(); ++it) {
+		int64_t iLeft = max(iEnd - GetTimeMs(), (int64_t) 1);
+		if (it->second->StopThread((int) iLeft)) {
+			Finish(it->first, it->second, PVR_TIMER_STATE_ABORTED);
+		} else {
+			XBMC->Log(LOG_ERROR, "%s - A recording of timer %u didn't stop", __FUNCTION__, it->first.first);
+			m_timers.SetRecordingState(it->first.first, PVR_TIMER_STATE_ABORTED);
+		}
+	}
+	m_jobs.clear();
+	return NULL;
+}
+
+// END RECORDER
@@ -0,0 +1,202 @@
+#pragma once
+/*
+ *  pvr.python - A PVR client for Kodi using Python
+ *  Copyright © 2016 RunasSudo (Yingtong Li)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "client.h"
+
+#include <p8-platform/threads/mutex.h>
+#include <p8-platform/threads/threads.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define RECORDER_STATE_VERSION 1
+
+// How long ADDON_Destroy waits for the recordings in progress to be closed
+#define RECORDER_STOP_TIMEOUT_MS 15000
+
+// Each buffer is written out in one go once it is full, at an offset that is
+// a multiple of its size. Has to be a multiple of RECORDER_ALIGNMENT.
+#define RECORDER_BUFFER_SIZE (4 * 1024 * 1024)
+
+// What O_DIRECT writes have to be aligned to, in memory and on disk
+#define RECORDER_ALIGNMENT 4096
+
+class CStreamPropertiesCache;
+class CStreamSession;
+class CTSProbe;
+class CTimerStore;
+
+// Writes a file through two large aligned buffers: one is filled while a
+// thread of its own writes the other, so a slow disk never holds up the
+// stream being read. The file is opened with O_DIRECT where the filesystem
+// allows it, and disk space is reserved well ahead of the writes.
+class CRecordingWriter : public P8PLATFORM::CThread
+{
+public:
+	CRecordingWriter();
+	virtual ~CRecordingWriter();
+
+	// Creates the file, failing if it already exists
+	bool Open(const std::string& strPath);
+	// Returns false once a write has failed
+	bool Write(const unsigned char* pData, size_t iSize);
+	// Writes what is left and gives back the space reserved past the end
+	bool Close();
+
+	bool IsOpen() const { return m_iFile >= 0; }
+	int64_t Size() const { return m_iOffset + m_iFill; }
+
+	virtual void* Process(void);
+
+private:
+	bool WaitForPending();
+	bool Preallocate(int64_t iEnd);
+
+	int m_iFile;
+	bool m_bDirect;
+	unsigned char* m_buffers[2];
+	int m_iFilling;      // The buffer Write appends to
+	size_t m_iFill;
+	int64_t m_iOffset;   // Where the buffer being filled goes in the file
+	int64_t m_iReserved; // How far the file has been preallocated
+
+	// Shared with the writing thread
+	P8PLATFORM::CMutex m_mutex;
+	P8PLATFORM::CEvent m_pendingEvent;
+	P8PLATFORM::CEvent m_writtenEvent;
+	int m_iPending;      // The buffer waiting to be written, or -1
+	int64_t m_iPendingOffset;
+	bool m_bFailed;
+};
+
+class CRecorder;
+
+// Records one timer: opens the channel the way Kodi would, and writes what
+// it reads until the timer ends. A source that fails or ends early is opened
+// again, with the file carrying on where it was.
+class CRecordingJob : public P8PLATFORM::CThread
+{
+public:
+	CRecordingJob(CRecorder& recorder, const PVR_TIMER& timer, time_t end);
+
+	// When the timer is changed while it records
+	void SetEnd(time_t end);
+	time_t End();
+	// Doesn't wait; a read in progress is aborted
+	void Stop();
+	// Set as the last thing Process does, so the job can be reaped
+	bool IsFinished();
+	// Once finished: whether anything was written, without a write failing
+	bool Succeeded();
+
+	virtual void* Process(void);
+
+private:
+	bool IsDue();
+	void Record(CStreamSession* session);
+	bool Create(const unsigned char* pData, size_t iSize);
+
+	CRecorder& m_recorder;
+	PVR_TIMER m_timer;
+	CRecordingWriter m_writer;
+	bool m_bWriteFailed;
+	P8PLATFORM::CEvent m_stopEvent;
+
+	P8PLATFORM::CMutex m_mutex;
+	time_t m_end; // Margin included
+	bool m_bFinished;
+	CStreamSession* m_session; // While one is being read
+};
+
+// Records the timers in the timer store into the recordings directory, each
+// on a thread of its own, apart from whatever Kodi is playing. What the
+// timer said about each recording is kept in strStatePath, and handed to
+// the recordings index through Describe. The first few megabytes of each
+// stream recorded are probed for the channel's stream layout, away from
+// Kodi's own reads.
+class CRecorder : public P8PLATFORM::CThread
+{
+public:
+	// Opens a channel for recording, or returns NULL
+	typedef CStreamSession* (*OpenFunc)(int iChannelUid);
+
+	CRecorder(const std::string& strRoot, const std::string& strStatePath, CTimerStore& timers, CStreamPropertiesCache& streamProperties, OpenFunc open);
+	virtual ~CRecorder();
+
+	// Looks at the timers again, after they have been changed
+	void Wake();
+
+	// Fills in what the timer said about a recording the recorder made.
+	// Returns false for files it didn't make.
+	bool Describe(const std::string& strPath, PVR_RECORDING& recording);
+
+	virtual void* Process(void);
+
+private:
+	struct CRecordingInfo
+	{
+		std::string strTitle;
+		std::string strPlot;
+		int iChannelUid;
+		int64_t iStart;
+		int32_t iDuration;
+		uint32_t iEpgUid;
+		int32_t iGenreType;
+		int32_t iGenreSubType;
+	};
+
+	// A timer or occurrence, and the start it had when it was picked up
+	typedef std::pair<unsigned int, time_t> JobKey;
+
+	bool LoadState();
+	bool SaveState();
+	void Schedule();
+	void Finish(const JobKey& key, CRecordingJob* job, PVR_TIMER_STATE state);
+	std::string RelativePath(const std::string& strPath);
+
+	// Called by the jobs
+	std::string Target(const PVR_TIMER& timer);
+	void Register(const std::string& strPath, const PVR_TIMER& timer);
+	CStreamSession* Open(int iChannelUid) { return m_open(iChannelUid); }
+	void Probed(int iChannelUid, const CTSProbe& probe);
+
+	std::string m_strRoot;
+	std::string m_strStatePath;
+	CTimerStore& m_timers;
+	CStreamPropertiesCache& m_streamProperties;
+	OpenFunc m_open;
+	P8PLATFORM::CEvent m_wakeEvent;
+
+	// Only touched by the recorder's own thread
+	std::map<JobKey, CRecordingJob*> m_jobs;
+	std::map<JobKey, time_t> m_finished; // Jobs that ended early, until their timer ends
+	std::set<JobKey> m_cancelled;        // Jobs stopped because their timer went away
+
+	P8PLATFORM::CMutex m_mutex;
+	std::map<std::string, CRecordingInfo> m_recordings; // By path relative to the root
+
+	friend class CRecordingJob;
+};
@@ -0,0 +1,636 @@
+/*
+ *  pvr.python - A PVR client for Kodi using Python
+ *  Copyright © 2016 RunasSudo (Yingtong Li)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "recordings.h"
+#include "catalog.h"
+#include "snapshot.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <deque>
+
+#ifdef _WIN32
+#define strcasecmp _stricmp
+#else
+#include <dirent.h>
+#include <strings.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+using namespace std;
+using namespace ADDON;
+using namespace P8PLATFORM;
+
+#define RECORDINGS_CACHE_MAGIC "PVRPYREC"
+
+// Directories are listed by this many threads during a full scan
+#define RECORDINGS_SCAN_THREADS 4
+
+// inotify events are gathered until the tree has been quiet for this long
+#define RECORDINGS_SETTLE_MS 1000
+
+// Without inotify, the whole tree is scanned again this often
+#define RECORDINGS_RESCAN_INTERVAL_MS (10 * 60 * 1000)
+
+static const char* recordingExtensions[] = {
+	".ts", ".m2ts", ".mts", ".mpg", ".mpeg", ".mkv", ".mp4", ".m4v", ".avi", ".flv", ".mov", ".wmv", ".webm", NULL
+};
+
+static bool IsRecordingFile(const string& strName)
+{
+	size_t dot = strName.rfind('.');
+	if (dot == string::npos)
+		return false;
+	for (const char** ext = recordingExtensions; *ext != NULL; ext++) {
+		if (strcasecmp(strName.c_str() + dot, *ext) == 0)
+			return true;
+	}
+	return false;
+}
+
+static string JoinPath(const string& strDirectory, const string& strName)
+{
+	return strDirectory.empty() ? strName : strDirectory + "/" + strName;
+}
+
+static string TrashPath(const string& strPath)
+{
+	return JoinPath(RECORDINGS_TRASH_DIRECTORY, strPath);
+}
+
+static bool InTrash(const string& strPath)
+{
+	return strPath.compare(0, strlen(RECORDINGS_TRASH_DIRECTORY) + 1, RECORDINGS_TRASH_DIRECTORY "/") == 0;
+}
+
+static void CopyString(char* dest, size_t size, const string& src)
+{
+	strncpy(dest, src.c_str(), size - 1);
+	dest[size - 1] = '\0';
+}
+
+// Like mkdir -p, for the parents of strPath
+static void CreateParents(const string& strPath)
+{
+#ifndef _WIN32
+	for (size_t slash = strPath.find('/', 1); slash != string::npos; slash = strPath.find('/', slash + 1)) {
+		mkdir(strPath.substr(0, slash).c_str(), 0755);
+	}
+#endif
+}
+
+// BEGIN SCANNING
+
+// Directories still to be listed, shared by the scan threads
+struct CScanJob
+{
+	CScanJob() : iBusy(0) {}
+
+	CMutex mutex;
+	deque<string> pending;
+	int iBusy; // Threads listing a directory, which may add more
+	vector<IndexedFile> files;
+};
+
+class CScanWorker : public CThread
+{
+public:
+	CScanWorker(CRecordingsIndex& index, CScanJob& job) : m_index(index), m_job(job) {}
+
+	virtual void* Process(void) {
+		Run();
+		return NULL;
+	}
+
+	// Lists directories until there are none left and nobody can add more
+	void Run() {
+		while (!m_index.IsStopped()) {
+			string strDirectory;
+			{
+				CLockObject lock(m_job.mutex);
+				if (m_job.pending.empty()) {
+					if (m_job.iBusy == 0)
+						break;
+				} else {
+					strDirectory = m_job.pending.front();
+					m_job.pending.pop_front();
+					m_job.iBusy++;
+				}
+			}
+			if (strDirectory.empty()) {
+				// Someone else is still listing, and may find more
+				Sleep(1);
+				continue;
+			}
+
+			vector<string> directories;
+			vector<IndexedFile> files;
+			List(strDirectory.substr(1), directories, files);
+
+			CLockObject lock(m_job.mutex);
+			for (vector<string>::const_iterator it = directories.begin(); it != directories.end(); ++it) {
+				m_job.pending.push_back("/" + *it);
+			}
+			m_job.files.insert(m_job.files.end(), files.begin(), files.end());
+			m_job.iBusy--;
+		}
+	}
+
+private:
+	void List(const string& strDirectory, vector<string>& directories, vector<IndexedFile>& files) {
+#ifdef _WIN32
+		(void) strDirectory; (void) directories; (void) files;
+#else
+		string strAbsolute = m_index.AbsolutePath(strDirectory);
+
+#ifdef __linux__
+		// Watch before listing, so nothing created in between is missed
+		if (m_index.m_inotify >= 0) {
+			int wd = inotify_add_watch(m_index.m_inotify, strAbsolute.c_str(),
+				IN_CREATE | IN_DELETE | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+			if (wd >= 0) {
+				CLockObject lock(m_index.m_watchMutex);
+				m_index.m_watches[wd] = strDirectory;
+			} else {
+				XBMC->Log(LOG_ERROR, "%s - Can't watch '%s': %s", __FUNCTION__, strAbsolute.c_str(), strerror(errno));
+			}
+		}
+#endif
+
+		DIR* dir = opendir(strAbsolute.c_str());
+		if (dir == NULL)
+			return;
+
+		struct dirent* entry;
+		while ((entry = readdir(dir)) != NULL) {
+			string strName = entry->d_name;
+			// Hidden entries are skipped, except for the trash at the top
+			if (strName[0] == '.' && !(strDirectory.empty() && strName == RECORDINGS_TRASH_DIRECTORY))
+				continue;
+
+			string strPath = JoinPath(strDirectory, strName);
+			struct stat st;
+			if (stat(m_index.AbsolutePath(strPath).c_str(), &st) != 0)
+				continue;
+
+			if (S_ISDIR(st.st_mode)) {
+				directories.push_back(strPath);
+			} else if (S_ISREG(st.st_mode) && IsRecordingFile(strName)) {
+				IndexedFile file;
+				file.strPath = strPath;
+				file.iModified = st.st_mtime;
+				file.iSize = st.st_size;
+				files.push_back(file);
+			}
+		}
+		closedir(dir);
+#endif
+	}
+
+	CRecordingsIndex& m_index;
+	CScanJob& m_job;
+};
+
+// Every recording file below strDirectory, listed by several threads when
+// there is more than one directory to get through
+void CRecordingsIndex::Scan(const string& strDirectory, vector<IndexedFile>& files, int iThreads)
+{
+	CScanJob job;
+	// Queued with a leading '/' so the top directory isn't an empty string
+	job.pending.push_back("/" + strDirectory);
+
+	vector<CScanWorker*> workers;
+	for (int i = 1; i < iThreads; i++) {
+		CScanWorker* worker = new CScanWorker(*this, job);
+		if (worker->CreateThread(false)) {
+			workers.push_back(worker);
+		} else {
+			delete worker;
+		}
+	}
+	CScanWorker(*this, job).Run();
+	for (vector<CScanWorker*>::iterator it = workers.begin(); it != workers.end(); ++it) {
+		(*it)->StopThread();
+		delete *it;
+	}
+
+	files.swap(job.files);
+}
+
+// END SCANNING
+
+CRecordingsIndex::CRecordingsIndex(const string& strRoot, const string& strCachePath, EnrichFunc enrich) :
+	m_strRoot(strRoot),
+	m_strCachePath(strCachePath),
+	m_enrich(enrich),
+	m_inotify(-1),
+	m_bSuspended(false),
+	m_bRescan(false)
+{
+	while (m_strRoot.size() > 1 && (m_strRoot[m_strRoot.size() - 1] == '/' || m_strRoot[m_strRoot.size() - 1] == '\\')) {
+		m_strRoot.erase(m_strRoot.size() - 1);
+	}
+
+	// Serve the last known state straight away; the scan catches up in the background
+	if (LoadCache()) {
+		XBMC->Log(LOG_DEBUG, "%s - Loaded %u cached recordings", __FUNCTION__, (unsigned int) m_recordings.size());
+	}
+}
+
+CRecordingsIndex::~CRecordingsIndex()
+{
+	StopThread();
+#ifdef __linux__
+	if (m_inotify >= 0)
+		close(m_inotify);
+#endif
+}
+
+string CRecordingsIndex::AbsolutePath(const string& strPath)
+{
+	return strPath.empty() ? m_strRoot : m_strRoot + "/" + strPath;
+}
+
+// BEGIN CACHE
+
+bool CRecordingsIndex::LoadCache()
+{
+	CSnapshotReader reader;
+	if (!reader.Open(m_strCachePath, RECORDINGS_CACHE_MAGIC, RECORDINGS_CACHE_VERSION))
+		return false;
+
+	// Only valid for the directory it was made from
+	char strRoot[1024];
+	reader.GetString(strRoot, sizeof(strRoot));
+	if (reader.Failed() || m_strRoot != strRoot)
+		return false;
+
+	map<string, CIndexedRecording> recordings;
+	uint32_t count = reader.GetUInt32();
+	for (uint32_t i = 0; i < count && !reader.Failed(); i++) {
+		CIndexedRecording indexed;
+		char strPath[1024];
+		reader.GetString(strPath, sizeof(strPath));
+		indexed.file.strPath = strPath;
+		indexed.file.iModified = reader.GetInt64();
+		indexed.file.iSize = reader.GetInt64();
+		ReadRecording(reader, indexed.recording);
+		recordings[indexed.file.strPath] = indexed;
+	}
+	if (reader.Failed() || !reader.AtEnd())
+		return false;
+
+	CLockObject lock(m_mutex);
+	m_recordings.swap(recordings);
+	return true;
+}
+
+bool CRecordingsIndex::SaveCache()
+{
+	CSnapshotWriter writer;
+	writer.PutString(m_strRoot);
+	{
+		CLockObject lock(m_mutex);
+		writer.PutUInt32(m_recordings.size());
+		for (map<string, CIndexedRecording>::const_iterator it = m_recordings.begin(); it != m_recordings.end(); ++it) {
+			writer.PutString(it->second.file.strPath);
+			writer.PutInt64(it->second.file.iModified);
+			writer.PutInt64(it->second.file.iSize);
+			WriteRecording(writer, it->second.recording);
+		}
+	}
+	return writer.Save(m_strCachePath, RECORDINGS_CACHE_MAGIC, RECORDINGS_CACHE_VERSION);
+}
+
+// END CACHE
+
+// What we can tell about a recording from the file alone
+void CRecordingsIndex::Describe(const IndexedFile& file, PVR_RECORDING& recording)
+{
+	memset(&recording, 0, sizeof(PVR_RECORDING));
+
+	bool bDeleted = InTrash(file.strPath);
+	string strPath = bDeleted ? file.strPath.substr(strlen(RECORDINGS_TRASH_DIRECTORY) + 1) : file.strPath;
+	size_t slash = strPath.rfind('/');
+	string strName = (slash == string::npos) ? strPath : strPath.substr(slash + 1);
+	string strDirectory = (slash == string::npos) ? "" : strPath.substr(0, slash);
+
+	CopyString(recording.strRecordingId, sizeof(recording.strRecordingId), strPath);
+	CopyString(recording.strTitle, sizeof(recording.strTitle), strName.substr(0, strName.rfind('.')));
+	CopyString(recording.strDirectory, sizeof(recording.strDirectory), strDirectory);
+	CopyString(recording.strStreamURL, sizeof(recording.strStreamURL), AbsolutePath(file.strPath));
+	recording.recordingTime = file.iModified;
+	recording.bIsDeleted = bDeleted;
+	recording.iChannelUid = PVR_CHANNEL_INVALID_UID;
+	recording.channelType = PVR_RECORDING_CHANNEL_TYPE_UNKNOWN;
+}
+
+// Brings everything below strDirectory in line with a fresh scan of it.
+// Returns whether anything changed.
+bool CRecordingsIndex::Reconcile(const string& strDirectory, const vector<IndexedFile>& files)
+{
+	string strPrefix = strDirectory.empty() ? "" : strDirectory + "/";
+	vector<CIndexedRecording> fresh;
+	bool changed = false;
+
+	{
+		CLockObject lock(m_mutex);
+		set<string> seen;
+		for (vector<IndexedFile>::const_iterator it = files.begin(); it != files.end(); ++it) {
+			seen.insert(it->strPath);
+			map<string, CIndexedRecording>::const_iterator known = m_recordings.find(it->strPath);
+			if (known != m_recordings.end() && known->second.file.iModified == it->iModified && known->second.file.iSize == it->iSize)
+				continue;
+
+			CIndexedRecording indexed;
+			indexed.file = *it;
+			Describe(*it, indexed.recording);
+			fresh.push_back(indexed);
+		}
+
+		map<string, CIndexedRecording>::iterator it = m_recordings.lower_bound(strPrefix);
+		while (it != m_recordings.end() && it->first.compare(0, strPrefix.size(), strPrefix) == 0) {
+			if (seen.count(it->first) == 0) {
+				m_recordings.erase(it++);
+				changed = true;
+			} else {
+				++it;
+			}
+		}
+	}
+
+	// The backend is only asked about files it hasn't seen in this state before
+	for (vector<CIndexedRecording>::iterator it = fresh.begin(); it != fresh.end() && !IsStopped(); ++it) {
+		PVR_RECORDING recording = it->recording;
+		if (m_enrich != NULL && m_enrich(AbsolutePath(it->file.strPath), recording)) {
+			// Where the file is stays ours to say
+			memcpy(recording.strRecordingId, it->recording.strRecordingId, sizeof(recording.strRecordingId));
+			recording.bIsDeleted = it->recording.bIsDeleted;
+			if (recording.strStreamURL[0] == '\0')
+				memcpy(recording.strStreamURL, it->recording.strStreamURL, sizeof(recording.strStreamURL));
+			it->recording = recording;
+		}
+
+		// The file may have been moved or deleted while the backend was asked,
+		// in which case the entry would only be a ghost
+		CLockObject lock(m_mutex);
+		struct stat st;
+		if (stat(AbsolutePath(it->file.strPath).c_str(), &st) != 0 || st.st_mtime != it->file.iModified || st.st_size != it->file.iSize)
+			continue;
+
+		m_recordings[it->file.strPath] = *it;
+		changed = true;
+	}
+
+	return changed;
+}
+
+void* CRecordingsIndex::Process(void)
+{
+#ifdef __linux__
+	m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (m_inotify < 0)
+		XBMC->Log(LOG_ERROR, "%s - inotify unavailable, rescanning periodically: %s", __FUNCTION__, strerror(errno));
+#endif
+
+	while (!IsStopped()) {
+		while (IsSuspended() && !IsStopped()) {
+			Sleep(RECORDINGS_SETTLE_MS);
+		}
+		TakeRescan();
+
+		vector<IndexedFile> files;
+		Scan("", files, RECORDINGS_SCAN_THREADS);
+		XBMC->Log(LOG_DEBUG, "%s - Found %u recordings in '%s'", __FUNCTION__, (unsigned int) files.size(), m_strRoot.c_str());
+		if (!IsStopped() && Reconcile("", files)) {
+			PVR->TriggerRecordingUpdate();
+			SaveCache();
+		}
+
+		if (m_inotify >= 0) {
+			WatchEvents();
+		} else {
+			for (int waited = 0; waited < RECORDINGS_RESCAN_INTERVAL_MS && !IsStopped() && !TakeRescan(); waited += RECORDINGS_SETTLE_MS) {
+				Sleep(RECORDINGS_SETTLE_MS);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+// Rescans the directories inotify reports changes in, once they settle down.
+// Returns when a full rescan is needed, or the thread is stopped.
+void CRecordingsIndex::WatchEvents()
+{
+#ifdef __linux__
+	set<string> dirty;
+	char buffer[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+	while (!IsStopped() && !TakeRescan()) {
+		struct pollfd pfd;
+		pfd.fd = m_inotify;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		int ready = poll(&pfd, 1, RECORDINGS_SETTLE_MS);
+		if (ready < 0 && errno != EINTR)
+			return;
+
+		if (ready > 0) {
+			ssize_t length;
+			while ((length = read(m_inotify, buffer, sizeof(buffer))) > 0) {
+				for (char* ptr = buffer; ptr < buffer + length; ) {
+					struct inotify_event* event = (struct inotify_event*) ptr;
+					ptr += sizeof(struct inotify_event) + event->len;
+
+					// Events were lost, so nothing short of a full scan will do
+					if (event->mask & IN_Q_OVERFLOW)
+						return;
+
+					CLockObject lock(m_watchMutex);
+					map<int, string>::iterator watch = m_watches.find(event->wd);
+					if (watch == m_watches.end())
+						continue;
+					if (event->mask & IN_IGNORED) {
+						m_watches.erase(watch);
+						continue;
+					}
+					dirty.insert(watch->second);
+				}
+			}
+			continue;
+		}
+
+		if (dirty.empty() || IsSuspended())
+			continue;
+
+		// A directory covers everything below it
+		bool changed = false;
+		const string* covered = NULL;
+		for (set<string>::const_iterator it = dirty.begin(); it != dirty.end() && !IsStopped(); ++it) {
+			if (covered != NULL && (covered->empty() || it->compare(0, covered->size() + 1, *covered + "/") == 0))
+				continue;
+			covered = &(*it);
+
+			vector<IndexedFile> files;
+			Scan(*it, files, 1);
+			changed |= Reconcile(*it, files);
+		}
+		dirty.clear();
+
+		if (changed) {
+			PVR->TriggerRecordingUpdate();
+			SaveCache();
+		}
+	}
+#endif
+}
+
+void CRecordingsIndex::Suspend()
+{
+	CLockObject lock(m_stateMutex);
+	m_bSuspended = true;
+}
+
+void CRecordingsIndex::Resume(bool bRescan)
+{
+	CLockObject lock(m_stateMutex);
+	m_bSuspended = false;
+	m_bRescan |= bRescan;
+}
+
+bool CRecordingsIndex::IsSuspended()
+{
+	CLockObject lock(m_stateMutex);
+	return m_bSuspended;
+}
+
+// Whether a full scan was asked for since the last call
+bool CRecordingsIndex::TakeRescan()
+{
+	CLockObject lock(m_stateMutex);
+	bool bRescan = m_bRescan;
+	m_bRescan = false;
+	return bRescan;
+}
+
+void CRecordingsIndex::TransferRecordings(ADDON_HANDLE handle, bool bDeleted)
+{
+	CLockObject lock(m_mutex);
+	for (map<string, CIndexedRecording>::const_iterator it = m_recordings.begin(); it != m_recordings.end(); ++it) {
+		if (it->second.recording.bIsDeleted == bDeleted)
+			PVR->TransferRecordingEntry(handle, &it->second.recording);
+	}
+}
+
+int CRecordingsIndex::GetRecordingsAmount(bool bDeleted)
+{
+	CLockObject lock(m_mutex);
+	int amount = 0;
+	for (map<string, CIndexedRecording>::const_iterator it = m_recordings.begin(); it != m_recordings.end(); ++it) {
+		if (it->second.recording.bIsDeleted == bDeleted)
+			amount++;
+	}
+	return amount;
+}
+
+bool CRecordingsIndex::Contains(const PVR_RECORDING& recording)
+{
+	string strPath = recording.bIsDeleted ? TrashPath(recording.strRecordingId) : recording.strRecordingId;
+	CLockObject lock(m_mutex);
+	return m_recordings.find(strPath) != m_recordings.end();
+}
+
+// Moves a recording into or out of the trash. The entry is moved along with
+// it, so the rescan this triggers finds nothing new to enrich.
+PVR_ERROR CRecordingsIndex::Move(const PVR_RECORDING& recording, bool bToTrash)
+{
+	string strFrom = bToTrash ? recording.strRecordingId : TrashPath(recording.strRecordingId);
+	string strTo = bToTrash ? TrashPath(recording.strRecordingId) : recording.strRecordingId;
+
+	CLockObject lock(m_mutex);
+	map<string, CIndexedRecording>::iterator it = m_recordings.find(strFrom);
+	if (it == m_recordings.end())
+		return PVR_ERROR_INVALID_PARAMETERS;
+
+	CreateParents(AbsolutePath(strTo));
+	if (rename(AbsolutePath(strFrom).c_str(), AbsolutePath(strTo).c_str()) != 0) {
+		XBMC->Log(LOG_ERROR, "%s - Can't move '%s' to '%s': %s", __FUNCTION__, strFrom.c_str(), strTo.c_str(), strerror(errno));
+		return PVR_ERROR_FAILED;
+	}
+
+	CIndexedRecording indexed = it->second;
+	m_recordings.erase(it);
+	indexed.file.strPath = strTo;
+	indexed.recording.bIsDeleted = bToTrash;
+	CopyString(indexed.recording.strStreamURL, sizeof(indexed.recording.strStreamURL), AbsolutePath(strTo));
+	m_recordings[strTo] = indexed;
+	return PVR_ERROR_NO_ERROR;
+}
+
+PVR_ERROR CRecordingsIndex::Delete(const PVR_RECORDING& recording)
+{
+	if (!recording.bIsDeleted)
+		return Move(recording, true);
+
+	// Already in the trash, so this one is for good
+	string strPath = TrashPath(recording.strRecordingId);
+	CLockObject lock(m_mutex);
+	if (m_recordings.find(strPath) == m_recordings.end())
+		return PVR_ERROR_INVALID_PARAMETERS;
+	if (remove(AbsolutePath(strPath).c_str()) != 0 && errno != ENOENT) {
+		XBMC->Log(LOG_ERROR, "%s - Can't delete '%s': %s", __FUNCTION__, strPath.c_str(), strerror(errno));
+		return PVR_ERROR_FAILED;
+	}
+	m_recordings.erase(strPath);
+	return PVR_ERROR_NO_ERROR;
+}
+
+PVR_ERROR CRecordingsIndex::Undelete(const PVR_RECORDING& recording)
+{
+	return Move(recording, false);
+}
+
+PVR_ERROR CRecordingsIndex::DeleteAllFromTrash(bool& bDeleted)
+{
+	PVR_ERROR error = PVR_ERROR_NO_ERROR;
+	bDeleted = false;
+	CLockObject lock(m_mutex);
+	map<string, CIndexedRecording>::iterator it = m_recordings.lower_bound(RECORDINGS_TRASH_DIRECTORY "/");
+	while (it != m_recordings.end() && InTrash(it->first)) {
+		if (remove(AbsolutePath(it->first).c_str()) != 0 && errno != ENOENT) {
+			XBMC->Log(LOG_ERROR, "%s - Can't delete '%s': %s", __FUNCTION__, it->first.c_str(), strerror(errno));
+			error = PVR_ERROR_FAILED;
+			++it;
+		} else {
+			m_recordings.erase(it++);
+			bDeleted = true;
+		}
+	}
+	return error;
+}
@@ -0,0 +1,108 @@
+#pragma once
+/*
+ *  pvr.python - A PVR client for Kodi using Python
+ *  Copyright © 2016 RunasSudo (Yingtong Li)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "client.h"
+
+#include <p8-platform/threads/threads.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#define RECORDINGS_CACHE_VERSION 1
+
+// Deleted recordings are moved here, relative to the recordings directory
+#define RECORDINGS_TRASH_DIRECTORY ".trash"
+
+// One file found while scanning
+struct IndexedFile
+{
+	std::string strPath; // Relative to the recordings directory, '/'-separated
+	int64_t iModified;
+	int64_t iSize;
+};
+
+// In-memory index of a local recordings directory. The tree is scanned in
+// parallel once, after which only the directories inotify reports as changed
+// are looked at again. Metadata is cached in userPath, so the backend's
+// EnrichRecording hook only runs for new or changed files.
+class CRecordingsIndex : public P8PLATFORM::CThread
+{
+public:
+	// Fills in extra metadata for a recording. Returns false to keep the defaults.
+	typedef bool (*EnrichFunc)(const std::string& strPath, PVR_RECORDING& recording);
+
+	CRecordingsIndex(const std::string& strRoot, const std::string& strCachePath, EnrichFunc enrich);
+	virtual ~CRecordingsIndex();
+
+	void TransferRecordings(ADDON_HANDLE handle, bool bDeleted);
+	int GetRecordingsAmount(bool bDeleted);
+	bool Contains(const PVR_RECORDING& recording);
+
+	PVR_ERROR Delete(const PVR_RECORDING& recording);
+	PVR_ERROR Undelete(const PVR_RECORDING& recording);
+	// bDeleted is set if anything was taken out of the index
+	PVR_ERROR DeleteAllFromTrash(bool& bDeleted);
+
+	// No scanning is done while suspended; changes reported meanwhile are
+	// picked up on resuming. bRescan asks for a full scan, as after the
+	// system has been asleep.
+	void Suspend();
+	void Resume(bool bRescan);
+
+	virtual void* Process(void);
+
+private:
+	struct CIndexedRecording
+	{
+		IndexedFile file;
+		PVR_RECORDING recording;
+	};
+
+	bool LoadCache();
+	bool SaveCache();
+
+	void Scan(const std::string& strDirectory, std::vector<IndexedFile>& files, int iThreads);
+	bool Reconcile(const std::string& strDirectory, const std::vector<IndexedFile>& files);
+	void Describe(const IndexedFile& file, PVR_RECORDING& recording);
+	void WatchEvents();
+	bool IsSuspended();
+	bool TakeRescan();
+	std::string AbsolutePath(const std::string& strPath);
+	PVR_ERROR Move(const PVR_RECORDING& recording, bool bToTrash);
+
+	std::string m_strRoot;
+	std::string m_strCachePath;
+	EnrichFunc m_enrich;
+
+	P8PLATFORM::CMutex m_mutex;
+	std::map<std::string, CIndexedRecording> m_recordings; // By relative path
+
+	int m_inotify;
+	P8PLATFORM::CMutex m_watchMutex;
+	std::map<int, std::string> m_watches; // Watch descriptor to relative directory
+
+	P8PLATFORM::CMutex m_stateMutex;
+	bool m_bSuspended;
+	bool m_bRescan;
+
+	friend class CScanWorker;
+};
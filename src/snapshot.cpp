@@ -0,0 +1,297 @@
+/*
+ *  pvr.python - A PVR client for Kodi using Python
+ *  Copyright © 2016 RunasSudo (Yingtong Li)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "snapshot.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#define SNAPSHOT_MAGIC_LENGTH 8
+#define SNAPSHOT_HEADER_LENGTH (SNAPSHOT_MAGIC_LENGTH + 12)
+
+static uint32_t ReadLE32(const unsigned char* p)
+{
+	return ((uint32_t) p[0]) | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void WriteLE32(unsigned char* p, uint32_t value)
+{
+	p[0] = value & 0xFF;
+	p[1] = (value >> 8) & 0xFF;
+	p[2] = (value >> 16) & 0xFF;
+	p[3] = (value >> 24) & 0xFF;
+}
+
+// Filled in when the library is loaded, before any thread can get to it
+static const struct CRC32Table
+{
+	CRC32Table()
+	{
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++)
+				c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+			entries[i] = c;
+		}
+	}
+
+	uint32_t entries[256];
+} crcTable;
+
+uint32_t SnapshotCRC32(const void* data, size_t size)
+{
+	const unsigned char* p = (const unsigned char*) data;
+	uint32_t crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < size; i++)
+		crc = crcTable.entries[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+	return crc ^ 0xFFFFFFFF;
+}
+
+// BEGIN WRITER
+
+void CSnapshotWriter::PutUInt8(uint8_t value)
+{
+	m_data.push_back((char) value);
+}
+
+void CSnapshotWriter::PutUInt32(uint32_t value)
+{
+	unsigned char buf[4];
+	WriteLE32(buf, value);
+	m_data.append((const char*) buf, 4);
+}
+
+void CSnapshotWriter::PutInt32(int32_t value)
+{
+	PutUInt32((uint32_t) value);
+}
+
+void CSnapshotWriter::PutInt64(int64_t value)
+{
+	PutUInt32((uint32_t) ((uint64_t) value & 0xFFFFFFFF));
+	PutUInt32((uint32_t) ((uint64_t) value >> 32));
+}
+
+void CSnapshotWriter::PutString(const char* value)
+{
+	if (value == NULL)
+		value = "";
+	size_t length = strlen(value);
+	PutUInt32(length);
+	m_data.append(value, length);
+}
+
+void CSnapshotWriter::PutString(const string& value)
+{
+	PutUInt32(value.size());
+	m_data.append(value);
+}
+
+bool CSnapshotWriter::Save(const string& strPath, const char* magic, uint32_t version) const
+{
+	unsigned char header[SNAPSHOT_HEADER_LENGTH];
+	memset(header, 0, sizeof(header));
+	strncpy((char*) header, magic, SNAPSHOT_MAGIC_LENGTH);
+	WriteLE32(header + SNAPSHOT_MAGIC_LENGTH, version);
+	WriteLE32(header + SNAPSHOT_MAGIC_LENGTH + 4, m_data.size());
+	WriteLE32(header + SNAPSHOT_MAGIC_LENGTH + 8, SnapshotCRC32(m_data.data(), m_data.size()));
+
+	string strTempPath = strPath + ".tmp";
+	FILE* file = fopen(strTempPath.c_str(), "wb");
+	if (!file)
+		return false;
+
+	bool ok = fwrite(header, 1, sizeof(header), file) == sizeof(header)
+		&& fwrite(m_data.data(), 1, m_data.size(), file) == m_data.size();
+	ok = (fclose(file) == 0) && ok;
+
+	if (!ok) {
+		remove(strTempPath.c_str());
+		return false;
+	}
+
+#ifdef _WIN32
+	remove(strPath.c_str()); // rename() does not replace on Windows
+#endif
+	return rename(strTempPath.c_str(), strPath.c_str()) == 0;
+}
+
+// BEGIN READER
+
+CSnapshotReader::CSnapshotReader() :
+	m_mapping(NULL),
+	m_iMappingSize(0),
+	m_payload(NULL),
+	m_iSize(0),
+	m_iPos(0),
+	m_bFailed(false)
+{
+}
+
+CSnapshotReader::~CSnapshotReader()
+{
+	Close();
+}
+
+bool CSnapshotReader::Open(const string& strPath, const char* magic, uint32_t version)
+{
+	Close();
+
+#ifdef _WIN32
+	FILE* file = fopen(strPath.c_str(), "rb");
+	if (!file)
+		return false;
+	fseek(file, 0, SEEK_END);
+	long length = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if (length < SNAPSHOT_HEADER_LENGTH) {
+		fclose(file);
+		return false;
+	}
+	m_mapping = malloc(length);
+	m_iMappingSize = length;
+	bool ok = m_mapping && fread(m_mapping, 1, length, file) == (size_t) length;
+	fclose(file);
+	if (!ok) {
+		Close();
+		return false;
+	}
+#else
+	int fd = open(strPath.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < SNAPSHOT_HEADER_LENGTH) {
+		close(fd);
+		return false;
+	}
+	void* mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED)
+		return false;
+	m_mapping = mapping;
+	m_iMappingSize = st.st_size;
+#endif
+
+	const unsigned char* header = (const unsigned char*) m_mapping;
+	uint32_t fileVersion = ReadLE32(header + SNAPSHOT_MAGIC_LENGTH);
+	uint32_t length = ReadLE32(header + SNAPSHOT_MAGIC_LENGTH + 4);
+	uint32_t crc = ReadLE32(header + SNAPSHOT_MAGIC_LENGTH + 8);
+
+	if (strncmp((const char*) header, magic, SNAPSHOT_MAGIC_LENGTH) != 0
+		|| fileVersion != version
+		|| length != m_iMappingSize - SNAPSHOT_HEADER_LENGTH
+		|| crc != SnapshotCRC32(header + SNAPSHOT_HEADER_LENGTH, length)) {
+		Close();
+		return false;
+	}
+
+	m_payload = header + SNAPSHOT_HEADER_LENGTH;
+	m_iSize = length;
+	return true;
+}
+
+void CSnapshotReader::Close()
+{
+	if (m_mapping) {
+#ifdef _WIN32
+		free(m_mapping);
+#else
+		munmap(m_mapping, m_iMappingSize);
+#endif
+	}
+	m_mapping = NULL;
+	m_iMappingSize = 0;
+	m_payload = NULL;
+	m_iSize = 0;
+	m_iPos = 0;
+	m_bFailed = false;
+}
+
+bool CSnapshotReader::Take(size_t size)
+{
+	if (m_bFailed || size > m_iSize - m_iPos) {
+		m_bFailed = true;
+		return false;
+	}
+	return true;
+}
+
+uint8_t CSnapshotReader::GetUInt8()
+{
+	if (!Take(1))
+		return 0;
+	return m_payload[m_iPos++];
+}
+
+uint32_t CSnapshotReader::GetUInt32()
+{
+	if (!Take(4))
+		return 0;
+	uint32_t value = ReadLE32(m_payload + m_iPos);
+	m_iPos += 4;
+	return value;
+}
+
+int32_t CSnapshotReader::GetInt32()
+{
+	return (int32_t) GetUInt32();
+}
+
+int64_t CSnapshotReader::GetInt64()
+{
+	uint64_t low = GetUInt32();
+	uint64_t high = GetUInt32();
+	return (int64_t) (low | (high << 32));
+}
+
+string CSnapshotReader::GetString()
+{
+	uint32_t length = GetUInt32();
+	if (!Take(length))
+		return string();
+	string value((const char*) m_payload + m_iPos, length);
+	m_iPos += length;
+	return value;
+}
+
+void CSnapshotReader::GetString(char* buffer, size_t size)
+{
+	uint32_t length = GetUInt32();
+	if (!Take(length)) {
+		buffer[0] = '\0';
+		return;
+	}
+	size_t copied = (length < size - 1) ? length : size - 1;
+	memcpy(buffer, m_payload + m_iPos, copied);
+	buffer[copied] = '\0';
+	m_iPos += length;
+}
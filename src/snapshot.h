@@ -0,0 +1,87 @@
+#pragma once
+/*
+ *  pvr.python - A PVR client for Kodi using Python
+ *  Copyright © 2016 RunasSudo (Yingtong Li)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// Snapshot files are a small fixed header followed by an opaque payload:
+//   char[8]  magic
+//   uint32   schema version
+//   uint32   payload length
+//   uint32   CRC-32 of the payload
+// All integers are little-endian. A file whose magic, version, length or
+// checksum does not match is treated as if it did not exist.
+
+uint32_t SnapshotCRC32(const void* data, size_t size);
+
+class CSnapshotWriter
+{
+public:
+	void PutUInt8(uint8_t value);
+	void PutUInt32(uint32_t value);
+	void PutInt32(int32_t value);
+	void PutInt64(int64_t value);
+	void PutString(const char* value);
+	void PutString(const std::string& value);
+
+	const std::string& Data() const { return m_data; }
+	void Clear() { m_data.clear(); }
+
+	// Writes to a temporary file next to strPath, then renames it into place
+	bool Save(const std::string& strPath, const char* magic, uint32_t version) const;
+
+private:
+	std::string m_data;
+};
+
+class CSnapshotReader
+{
+public:
+	CSnapshotReader();
+	~CSnapshotReader();
+
+	bool Open(const std::string& strPath, const char* magic, uint32_t version);
+	void Close();
+
+	uint8_t GetUInt8();
+	uint32_t GetUInt32();
+	int32_t GetInt32();
+	int64_t GetInt64();
+	std::string GetString();
+	void GetString(char* buffer, size_t size); // Truncates to fit, always NUL-terminated
+
+	// Set once a read runs past the end of the payload; all later reads return zero
+	bool Failed() const { return m_bFailed; }
+	bool AtEnd() const { return m_iPos == m_iSize; }
+
+private:
+	bool Take(size_t size);
+
+	void* m_mapping;
+	size_t m_iMappingSize;
+	const unsigned char* m_payload;
+	size_t m_iSize;
+	size_t m_iPos;
+	bool m_bFailed;
+
+	CSnapshotReader(const CSnapshotReader&);
+	CSnapshotReader& operator=(const CSnapshotReader&);
+};
@@ -0,0 +1,811 @@
+/*
+ *  pvr.python - A PVR client for Kodi using Python
+ *  Copyright © 2016 RunasSudo (Yingtong Li)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "streamprops.h"
+#include "snapshot.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+
+using namespace std;
+using namespace ADDON;
+using namespace P8PLATFORM;
+
+#define STREAMS_CACHE_MAGIC "PVRPYSTR"
+
+#define TS_PACKET_SIZE 188
+#define TS_SYNC_BYTE 0x47
+
+// A stream with no sync pattern in this much data isn't a TS
+#define TS_PROBE_SYNC_BYTES (64 * 1024)
+
+// Past this, the probe settles for whatever it has found
+#define TS_PROBE_MAX_BYTES (8 * 1024 * 1024)
+
+// Headers are looked for this far into each PES packet
+#define TS_PROBE_PES_BYTES (64 * 1024)
+
+StreamInfo::StreamInfo() :
+	iPID(0),
+	iSubtitleInfo(0),
+	iFPSScale(0),
+	iFPSRate(0),
+	iWidth(0),
+	iHeight(0),
+	fAspect(0),
+	iChannels(0),
+	iSampleRate(0),
+	iBitRate(0)
+{
+}
+
+bool StreamInfo::operator==(const StreamInfo& other) const
+{
+	return iPID == other.iPID
+		&& strCodec == other.strCodec
+		&& strLanguage == other.strLanguage
+		&& iSubtitleInfo == other.iSubtitleInfo
+		&& iFPSScale == other.iFPSScale
+		&& iFPSRate == other.iFPSRate
+		&& iWidth == other.iWidth
+		&& iHeight == other.iHeight
+		&& fAspect == other.fAspect
+		&& iChannels == other.iChannels
+		&& iSampleRate == other.iSampleRate
+		&& iBitRate == other.iBitRate;
+}
+
+// BEGIN ELEMENTARY STREAM HEADERS
+
+// Reads an RBSP most significant bit first. Reads past the end return zeros.
+class CBitReader
+{
+public:
+	CBitReader(const unsigned char* pData, size_t iSize) : m_pData(pData), m_iSize(iSize), m_iBit(0) {}
+
+	uint32_t Bits(int iCount) {
+		uint32_t value = 0;
+		while (iCount-- > 0) {
+			value <<= 1;
+			if (m_iBit < m_iSize * 8)
+				value |= (m_pData[m_iBit >> 3] >> (7 - (m_iBit & 7))) & 1;
+			m_iBit++;
+		}
+		return value;
+	}
+
+	// Exp-Golomb codes
+	uint32_t UE() {
+		int iZeros = 0;
+		while (Bits(1) == 0 && iZeros < 31 && !Overrun())
+			iZeros++;
+		return ((1u << iZeros) - 1) + Bits(iZeros);
+	}
+
+	int32_t SE() {
+		uint32_t value = UE();
+		return (value & 1) ? (int32_t) ((value + 1) / 2) : -(int32_t) (value / 2);
+	}
+
+	bool Overrun() const { return m_iBit > m_iSize * 8; }
+
+private:
+	const unsigned char* m_pData;
+	size_t m_iSize;
+	size_t m_iBit;
+};
+
+static bool ParseMPEGVideo(const unsigned char* p, size_t n, StreamInfo& stream)
+{
+	static const float aspects[] = { 0, 0, 4.0f / 3, 16.0f / 9, 2.21f };
+	static const int rates[][2] = { {0, 0}, {24000, 1001}, {24, 1}, {25, 1}, {30000, 1001}, {30, 1}, {50, 1}, {60000, 1001}, {60, 1} };
+
+	for (size_t i = 0; i + 8 <= n; i++) {
+		if (p[i] != 0 || p[i + 1] != 0 || p[i + 2] != 1 || p[i + 3] != 0xb3)
+			continue;
+
+		// Sequence header
+		const unsigned char* h = p + i + 4;
+		stream.iWidth = (h[0] << 4) | (h[1] >> 4);
+		stream.iHeight = ((h[1] & 0x0f) << 8) | h[2];
+		int aspect = h[3] >> 4;
+		int rate = h[3] & 0x0f;
+		if (aspect >= 2 && aspect <= 4)
+			stream.fAspect = aspects[aspect];
+		else if (stream.iHeight > 0)
+			stream.fAspect = (float) stream.iWidth / stream.iHeight;
+		if (rate >= 1 && rate <= 8) {
+			stream.iFPSRate = rates[rate][0];
+			stream.iFPSScale = rates[rate][1];
+		}
+		return stream.iWidth > 0 && stream.iHeight > 0;
+	}
+	return false;
+}
+
+static void SkipScalingList(CBitReader& reader, int iSize)
+{
+	int iLast = 8;
+	int iNext = 8;
+	for (int i = 0; i < iSize && iNext != 0; i++) {
+		iNext = (iLast + reader.SE() + 256) % 256;
+		if (iNext != 0)
+			iLast = iNext;
+	}
+}
+
+// Reads the resolution, aspect and frame rate from the first complete SPS
+static bool ParseH264(const unsigned char* p, size_t n, StreamInfo& stream)
+{
+	static const int sars[][2] = { {0, 0}, {1, 1}, {12, 11}, {10, 11}, {16, 11}, {40, 33}, {24, 11}, {20, 11}, {32, 11},
+		{80, 33}, {18, 11}, {15, 11}, {64, 33}, {160, 99}, {4, 3}, {3, 2}, {2, 1} };
+
+	for (size_t i = 0; i + 4 <= n; i++) {
+		if (p[i] != 0 || p[i + 1] != 0 || p[i + 2] != 1 || (p[i + 3] & 0x1f) != 7)
+			continue;
+
+		// Only parse it once the next start code shows it's all there, dropping emulation prevention bytes
+		size_t iEnd = i + 4;
+		while (iEnd + 3 <= n && !(p[iEnd] == 0 && p[iEnd + 1] == 0 && p[iEnd + 2] <= 1))
+			iEnd++;
+		if (iEnd + 3 > n)
+			return false;
+		vector<unsigned char> rbsp;
+		for (size_t j = i + 4; j < iEnd; j++) {
+			if (j >= i + 6 && p[j] == 3 && p[j - 1] == 0 && p[j - 2] == 0)
+				continue;
+			rbsp.push_back(p[j]);
+		}
+
+		CBitReader reader(rbsp.data(), rbsp.size());
+		uint32_t profile = reader.Bits(8);
+		reader.Bits(16); // Constraint flags, level
+		reader.UE();     // seq_parameter_set_id
+		uint32_t chromaFormat = 1;
+		bool bSeparateColourPlanes = false;
+		if (profile == 100 || profile == 110 || profile == 122 || profile == 244 || profile == 44 || profile == 83
+			|| profile == 86 || profile == 118 || profile == 128 || profile == 138 || profile == 139 || profile == 134 || profile == 135) {
+			chromaFormat = reader.UE();
+			if (chromaFormat == 3)
+				bSeparateColourPlanes = reader.Bits(1);
+			reader.UE(); // Luma bit depth
+			reader.UE(); // Chroma bit depth
+			reader.Bits(1);
+			if (reader.Bits(1)) {
+				for (int list = 0; list < (chromaFormat != 3 ? 8 : 12); list++) {
+					if (reader.Bits(1))
+						SkipScalingList(reader, list < 6 ? 16 : 64);
+				}
+			}
+		}
+		reader.UE(); // log2_max_frame_num_minus4
+		uint32_t pocType = reader.UE();
+		if (pocType == 0) {
+			reader.UE();
+		} else if (pocType == 1) {
+			reader.Bits(1);
+			reader.SE();
+			reader.SE();
+			uint32_t cycle = reader.UE();
+			for (uint32_t c = 0; c < cycle && !reader.Overrun(); c++)
+				reader.SE();
+		}
+		reader.UE();    // max_num_ref_frames
+		reader.Bits(1); // gaps_in_frame_num_value_allowed_flag
+		uint32_t widthInMbs = reader.UE() + 1;
+		uint32_t heightInMapUnits = reader.UE() + 1;
+		uint32_t frameMbsOnly = reader.Bits(1);
+		if (!frameMbsOnly)
+			reader.Bits(1);
+		reader.Bits(1); // direct_8x8_inference_flag
+		int iWidth = widthInMbs * 16;
+		int iHeight = (2 - frameMbsOnly) * heightInMapUnits * 16;
+		if (reader.Bits(1)) {
+			int cropX = (chromaFormat == 0 || bSeparateColourPlanes) ? 1 : 2;
+			int cropY = ((chromaFormat == 1 && !bSeparateColourPlanes) ? 2 : 1) * (2 - frameMbsOnly);
+			int left = reader.UE();
+			int right = reader.UE();
+			int top = reader.UE();
+			int bottom = reader.UE();
+			iWidth -= cropX * (left + right);
+			iHeight -= cropY * (top + bottom);
+		}
+
+		int sarWidth = 1;
+		int sarHeight = 1;
+		if (reader.Bits(1)) {
+			// VUI
+			if (reader.Bits(1)) {
+				uint32_t aspect = reader.Bits(8);
+				if (aspect == 255) {
+					sarWidth = reader.Bits(16);
+					sarHeight = reader.Bits(16);
+				} else if (aspect > 0 && aspect < sizeof(sars) / sizeof(sars[0])) {
+					sarWidth = sars[aspect][0];
+					sarHeight = sars[aspect][1];
+				}
+			}
+			if (reader.Bits(1))
+				reader.Bits(1); // Overscan
+			if (reader.Bits(1)) {
+				reader.Bits(4);
+				if (reader.Bits(1))
+					reader.Bits(24); // Colour description
+			}
+			if (reader.Bits(1)) {
+				reader.UE();
+				reader.UE(); // Chroma sample locations
+			}
+			if (reader.Bits(1)) {
+				uint32_t unitsInTick = reader.Bits(32);
+				uint32_t timeScale = reader.Bits(32);
+				if (unitsInTick > 0 && timeScale > 0) {
+					stream.iFPSRate = timeScale;
+					stream.iFPSScale = unitsInTick * 2;
+				}
+			}
+		}
+		if (reader.Overrun() || iWidth <= 0 || iHeight <= 0 || sarWidth <= 0 || sarHeight <= 0)
+			return false;
+
+		stream.iWidth = iWidth;
+		stream.iHeight = iHeight;
+		stream.fAspect = (float) (iWidth * sarWidth) / (iHeight * sarHeight);
+		return true;
+	}
+	return false;
+}
+
+static bool ParseMPEGAudio(const unsigned char* p, size_t n, StreamInfo& stream)
+{
+	static const int rates[] = { 44100, 48000, 32000 };
+	static const int bitrates[5][15] = {
+		{ 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 }, // MPEG-1 layer I
+		{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 },    // MPEG-1 layer II
+		{ 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },     // MPEG-1 layer III
+		{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 },    // MPEG-2 layer I
+		{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 } };       // MPEG-2 layers II and III
+
+	for (size_t i = 0; i + 4 <= n; i++) {
+		if (p[i] != 0xff || (p[i + 1] & 0xe0) != 0xe0)
+			continue;
+		int version = (p[i + 1] >> 3) & 3; // 0 is 2.5, 1 reserved, 2 is MPEG-2, 3 is MPEG-1
+		int layer = 4 - ((p[i + 1] >> 1) & 3);
+		int bitrate = p[i + 2] >> 4;
+		int rate = (p[i + 2] >> 2) & 3;
+		if (version == 1 || layer == 4 || bitrate == 15 || rate == 3)
+			continue;
+
+		stream.strCodec = (layer == 3) ? "mp3" : "mp2";
+		stream.iSampleRate = rates[rate] >> (version == 3 ? 0 : version == 2 ? 1 : 2);
+		stream.iChannels = ((p[i + 3] >> 6) == 3) ? 1 : 2;
+		stream.iBitRate = bitrates[version == 3 ? layer - 1 : (layer == 1 ? 3 : 4)][bitrate] * 1000;
+		return true;
+	}
+	return false;
+}
+
+static bool ParseADTS(const unsigned char* p, size_t n, StreamInfo& stream)
+{
+	static const int rates[] = { 96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000, 7350 };
+
+	for (size_t i = 0; i + 7 <= n; i++) {
+		if (p[i] != 0xff || (p[i + 1] & 0xf6) != 0xf0)
+			continue;
+		int rate = (p[i + 2] >> 2) & 0x0f;
+		int channels = ((p[i + 2] & 1) << 2) | (p[i + 3] >> 6);
+		if (rate >= 13 || channels == 0)
+			continue;
+
+		stream.iSampleRate = rates[rate];
+		stream.iChannels = (channels == 7) ? 8 : channels;
+		return true;
+	}
+	return false;
+}
+
+// AC-3 and E-AC-3 sync frames
+static bool ParseAC3(const unsigned char* p, size_t n, StreamInfo& stream)
+{
+	static const int rates[] = { 48000, 44100, 32000 };
+	static const int reducedRates[] = { 24000, 22050, 16000 };
+	static const int bitrates[] = { 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512, 576, 640 };
+	static const int blocks[] = { 1, 2, 3, 6 };
+	static const int channels[] = { 2, 1, 2, 3, 3, 4, 4, 5 };
+
+	for (size_t i = 0; i + 8 <= n; i++) {
+		if (p[i] != 0x0b || p[i + 1] != 0x77)
+			continue;
+
+		int bsid = p[i + 5] >> 3;
+		uint32_t acmod;
+		uint32_t lfeon;
+		if (bsid <= 10) {
+			int fscod = p[i + 4] >> 6;
+			int frmsizecod = p[i + 4] & 0x3f;
+			if (fscod == 3 || frmsizecod > 37)
+				continue;
+			CBitReader reader(p + i + 6, n - i - 6);
+			acmod = reader.Bits(3);
+			if ((acmod & 1) && acmod != 1)
+				reader.Bits(2); // cmixlev
+			if (acmod & 4)
+				reader.Bits(2); // surmixlev
+			if (acmod == 2)
+				reader.Bits(2); // dsurmod
+			lfeon = reader.Bits(1);
+			stream.iSampleRate = rates[fscod];
+			stream.iBitRate = bitrates[frmsizecod >> 1] * 1000;
+		} else if (bsid <= 16) {
+			CBitReader reader(p + i + 2, n - i - 2);
+			reader.Bits(5); // strmtyp, substreamid
+			uint32_t frmsiz = reader.Bits(11);
+			uint32_t fscod = reader.Bits(2);
+			int iBlocks = 6;
+			if (fscod == 3) {
+				uint32_t fscod2 = reader.Bits(2);
+				if (fscod2 == 3)
+					continue;
+				stream.iSampleRate = reducedRates[fscod2];
+			} else {
+				iBlocks = blocks[reader.Bits(2)];
+				stream.iSampleRate = rates[fscod];
+			}
+			acmod = reader.Bits(3);
+			lfeon = reader.Bits(1);
+			stream.iBitRate = (int) ((int64_t) (frmsiz + 1) * 2 * 8 * stream.iSampleRate / (iBlocks * 256));
+		} else {
+			continue;
+		}
+
+		stream.iChannels = channels[acmod] + lfeon;
+		return true;
+	}
+	return false;
+}
+
+// END ELEMENTARY STREAM HEADERS
+
+// BEGIN PROBE
+
+// CRC-32/MPEG-2, which comes out as zero over a section including its CRC
+static uint32_t SectionCRC(const unsigned char* p, size_t n)
+{
+	uint32_t crc = 0xffffffff;
+	for (size_t i = 0; i < n; i++) {
+		crc ^= (uint32_t) p[i] << 24;
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : (crc << 1);
+	}
+	return crc;
+}
+
+// Codec names for the PMT stream types. Private data (0x06) is told apart by its descriptors.
+static const char* CodecForStreamType(unsigned int iType)
+{
+	switch (iType) {
+		case 0x01: return "mpeg1video";
+		case 0x02: return "mpeg2video";
+		case 0x03:
+		case 0x04: return "mp2";
+		case 0x0f: return "aac";
+		case 0x11: return "aac_latm";
+		case 0x1b: return "h264";
+		case 0x24: return "hevc";
+		case 0x81: return "ac3";
+		case 0x87: return "eac3";
+		default: return "";
+	}
+}
+
+// Whether the probe can read more about a stream from its first headers
+static bool HasHeaders(const string& strCodec)
+{
+	return strCodec == "mpeg1video" || strCodec == "mpeg2video" || strCodec == "h264"
+		|| strCodec == "mp2" || strCodec == "aac" || strCodec == "ac3" || strCodec == "eac3";
+}
+
+static string Language(const unsigned char* p)
+{
+	if (!isalpha(p[0]) || !isalpha(p[1]) || !isalpha(p[2]))
+		return "";
+	string strLanguage;
+	for (int i = 0; i < 3; i++)
+		strLanguage += (char) tolower(p[i]);
+	return strLanguage;
+}
+
+CTSProbe::CTSProbe() :
+	m_iBytes(0),
+	m_bSynced(false),
+	m_iPmtPID(-1),
+	m_bHavePMT(false),
+	m_bDone(false),
+	m_bSucceeded(false)
+{
+}
+
+bool CTSProbe::Feed(const unsigned char* pData, size_t iSize)
+{
+	if (m_bDone)
+		return true;
+
+	m_iBytes += iSize;
+	m_pending.append((const char*) pData, iSize);
+
+	size_t iPos = 0;
+	while (!m_bDone) {
+		const unsigned char* p = (const unsigned char*) m_pending.data();
+		size_t n = m_pending.size();
+		if (!m_bSynced) {
+			// Three sync bytes a packet apart
+			while (iPos + 2 * TS_PACKET_SIZE < n
+				&& !(p[iPos] == TS_SYNC_BYTE && p[iPos + TS_PACKET_SIZE] == TS_SYNC_BYTE && p[iPos + 2 * TS_PACKET_SIZE] == TS_SYNC_BYTE))
+				iPos++;
+			if (iPos + 2 * TS_PACKET_SIZE >= n) {
+				if (m_iBytes > TS_PROBE_SYNC_BYTES && !m_bHavePMT)
+					Finish(false);
+				break;
+			}
+			m_bSynced = true;
+		}
+
+		if (iPos + TS_PACKET_SIZE > n)
+			break;
+		if (p[iPos] != TS_SYNC_BYTE) {
+			m_bSynced = false;
+			continue;
+		}
+		Packet(p + iPos);
+		iPos += TS_PACKET_SIZE;
+	}
+	m_pending.erase(0, iPos);
+
+	if (!m_bDone && m_bHavePMT && (IsComplete() || m_iBytes > TS_PROBE_MAX_BYTES))
+		Finish(true);
+	else if (!m_bDone && m_iBytes > TS_PROBE_MAX_BYTES)
+		Finish(false);
+	return m_bDone;
+}
+
+void CTSProbe::Packet(const unsigned char* p)
+{
+	if (p[1] & 0x80)
+		return; // Transport error
+
+	bool bStart = (p[1] & 0x40) != 0;
+	unsigned int iPID = ((p[1] & 0x1f) << 8) | p[2];
+	int iAdaptation = (p[3] >> 4) & 3;
+	if (!(iAdaptation & 1))
+		return;
+	size_t iOffset = 4;
+	if (iAdaptation & 2)
+		iOffset += 1 + p[4];
+	if (iOffset >= TS_PACKET_SIZE)
+		return;
+	const char* pPayload = (const char*) p + iOffset;
+	size_t iPayload = TS_PACKET_SIZE - iOffset;
+
+	if (iPID == 0 || (int) iPID == m_iPmtPID) {
+		string& section = m_sections[iPID];
+		if (bStart) {
+			size_t iPointer = (unsigned char) pPayload[0];
+			if (1 + iPointer >= iPayload) {
+				section.clear();
+				return;
+			}
+			section.assign(pPayload + 1 + iPointer, iPayload - 1 - iPointer);
+		} else if (!section.empty()) {
+			section.append(pPayload, iPayload);
+		} else {
+			return;
+		}
+
+		if (section.size() >= 3) {
+			size_t iLength = 3 + ((((unsigned char) section[1] & 0x0f) << 8) | (unsigned char) section[2]);
+			if (section.size() >= iLength) {
+				string complete = section.substr(0, iLength);
+				section.clear();
+				Section(iPID, complete);
+			}
+		}
+		return;
+	}
+
+	map<unsigned int, string>::iterator pes = m_pes.find(iPID);
+	if (pes == m_pes.end())
+		return;
+	if (bStart)
+		pes->second.assign(pPayload, iPayload);
+	else if (!pes->second.empty() && pes->second.size() < TS_PROBE_PES_BYTES)
+		pes->second.append(pPayload, iPayload);
+	else
+		return;
+
+	for (size_t i = 0; i < m_streams.size(); i++) {
+		if (m_streams[i].iPID == iPID && !m_described[i] && ParsePES(m_streams[i], pes->second)) {
+			m_described[i] = true;
+			m_pes.erase(pes);
+			break;
+		}
+	}
+}
+
+void CTSProbe::Section(unsigned int iPID, const string& strSection)
+{
+	const unsigned char* s = (const unsigned char*) strSection.data();
+	size_t n = strSection.size();
+	if (n < 12 || SectionCRC(s, n) != 0)
+		return;
+
+	if (iPID == 0 && s[0] == 0x00) {
+		// The first program's PMT; a multi-program stream isn't something a channel plays
+		for (size_t i = 8; i + 4 <= n - 4; i += 4) {
+			unsigned int iProgram = (s[i] << 8) | s[i + 1];
+			if (iProgram != 0) {
+				m_iPmtPID = ((s[i + 2] & 0x1f) << 8) | s[i + 3];
+				break;
+			}
+		}
+	} else if ((int) iPID == m_iPmtPID && s[0] == 0x02 && !m_bHavePMT) {
+		ParsePMT(s, n);
+	}
+}
+
+void CTSProbe::ParsePMT(const unsigned char* s, size_t n)
+{
+	size_t iEnd = n - 4; // Before the CRC
+	size_t i = 12 + (((s[10] & 0x0f) << 8) | s[11]);
+	while (i + 5 <= iEnd) {
+		unsigned int iType = s[i];
+		StreamInfo stream;
+		stream.iPID = ((s[i + 1] & 0x1f) << 8) | s[i + 2];
+		stream.strCodec = CodecForStreamType(iType);
+		size_t iInfo = min((size_t) (((s[i + 3] & 0x0f) << 8) | s[i + 4]), iEnd - (i + 5));
+		const unsigned char* d = s + i + 5;
+		for (size_t j = 0; j + 2 <= iInfo && j + 2 + d[j + 1] <= iInfo; j += 2 + d[j + 1]) {
+			unsigned int iTag = d[j];
+			size_t iLength = d[j + 1];
+			const unsigned char* v = d + j + 2;
+			if (iTag == 0x0a && iLength >= 3) {
+				stream.strLanguage = Language(v);
+			} else if (iType != 0x06) {
+				continue;
+			} else if (iTag == 0x05 && iLength >= 4) {
+				// Registration descriptor
+				string format((const char*) v, 4);
+				if (format == "AC-3")
+					stream.strCodec = "ac3";
+				else if (format == "EAC3")
+					stream.strCodec = "eac3";
+				else if (format == "DTS1" || format == "DTS2" || format == "DTS3")
+					stream.strCodec = "dts";
+				else if (format == "HEVC")
+					stream.strCodec = "hevc";
+			} else if (iTag == 0x6a) {
+				stream.strCodec = "ac3";
+			} else if (iTag == 0x7a) {
+				stream.strCodec = "eac3";
+			} else if (iTag == 0x7b) {
+				stream.strCodec = "dts";
+			} else if (iTag == 0x7c) {
+				stream.strCodec = "aac";
+			} else if (iTag == 0x56) {
+				stream.strCodec = "dvb_teletext";
+				if (iLength >= 3)
+					stream.strLanguage = Language(v);
+			} else if (iTag == 0x59) {
+				stream.strCodec = "dvb_subtitle";
+				if (iLength >= 8) {
+					stream.strLanguage = Language(v);
+					stream.iSubtitleInfo = ((v[4] << 8) | v[5]) | (((v[6] << 8) | v[7]) << 16);
+				}
+			}
+		}
+
+		if (!stream.strCodec.empty()) {
+			bool bHeaders = HasHeaders(stream.strCodec);
+			m_streams.push_back(stream);
+			m_described.push_back(!bHeaders);
+			if (bHeaders)
+				m_pes[stream.iPID] = string();
+		}
+		i += 5 + (((s[i + 3] & 0x0f) << 8) | s[i + 4]);
+	}
+	m_bHavePMT = true;
+}
+
+bool CTSProbe::ParsePES(StreamInfo& stream, const string& strPES)
+{
+	const unsigned char* p = (const unsigned char*) strPES.data();
+	size_t n = strPES.size();
+	if (n < 9 || p[0] != 0 || p[1] != 0 || p[2] != 1)
+		return false;
+	size_t iHeader = 9 + p[8];
+	if (n <= iHeader)
+		return false;
+	p += iHeader;
+	n -= iHeader;
+
+	if (stream.strCodec == "mpeg1video" || stream.strCodec == "mpeg2video")
+		return ParseMPEGVideo(p, n, stream);
+	if (stream.strCodec == "h264")
+		return ParseH264(p, n, stream);
+	if (stream.strCodec == "mp2")
+		return ParseMPEGAudio(p, n, stream);
+	if (stream.strCodec == "aac")
+		return ParseADTS(p, n, stream);
+	if (stream.strCodec == "ac3" || stream.strCodec == "eac3")
+		return ParseAC3(p, n, stream);
+	return true;
+}
+
+bool CTSProbe::IsComplete() const
+{
+	return find(m_described.begin(), m_described.end(), false) == m_described.end();
+}
+
+void CTSProbe::Finish(bool bSucceeded)
+{
+	m_bDone = true;
+	m_bSucceeded = bSucceeded && !m_streams.empty();
+	m_pending.clear();
+	m_sections.clear();
+	m_pes.clear();
+}
+
+// END PROBE
+
+CStreamPropertiesCache::CStreamPropertiesCache() :
+	m_bDirty(false)
+{
+}
+
+bool CStreamPropertiesCache::Load(const string& strPath)
+{
+	CSnapshotReader reader;
+	if (!reader.Open(strPath, STREAMS_CACHE_MAGIC, STREAMS_CACHE_VERSION))
+		return false;
+
+	map<unsigned int, vector<StreamInfo> > channels;
+	uint32_t channelCount = reader.GetUInt32();
+	for (uint32_t i = 0; i < channelCount && !reader.Failed(); i++) {
+		vector<StreamInfo>& streams = channels[reader.GetUInt32()];
+		uint32_t streamCount = reader.GetUInt32();
+		for (uint32_t j = 0; j < streamCount && !reader.Failed(); j++) {
+			StreamInfo stream;
+			stream.iPID = reader.GetUInt32();
+			stream.strCodec = reader.GetString();
+			stream.strLanguage = reader.GetString();
+			stream.iSubtitleInfo = reader.GetInt32();
+			stream.iFPSScale = reader.GetInt32();
+			stream.iFPSRate = reader.GetInt32();
+			stream.iWidth = reader.GetInt32();
+			stream.iHeight = reader.GetInt32();
+			uint32_t aspect = reader.GetUInt32();
+			memcpy(&stream.fAspect, &aspect, sizeof(aspect));
+			stream.iChannels = reader.GetInt32();
+			stream.iSampleRate = reader.GetInt32();
+			stream.iBitRate = reader.GetInt32();
+			streams.push_back(stream);
+		}
+	}
+	if (reader.Failed() || !reader.AtEnd())
+		return false;
+
+	CLockObject lock(m_mutex);
+	m_channels.swap(channels);
+	m_bDirty = false;
+	return true;
+}
+
+bool CStreamPropertiesCache::Save(const string& strPath)
+{
+	CSnapshotWriter writer;
+	{
+		CLockObject lock(m_mutex);
+		writer.PutUInt32(m_channels.size());
+		for (map<unsigned int, vector<StreamInfo> >::const_iterator it = m_channels.begin(); it != m_channels.end(); ++it) {
+			writer.PutUInt32(it->first);
+			writer.PutUInt32(it->second.size());
+			for (vector<StreamInfo>::const_iterator stream = it->second.begin(); stream != it->second.end(); ++stream) {
+				writer.PutUInt32(stream->iPID);
+				writer.PutString(stream->strCodec);
+				writer.PutString(stream->strLanguage);
+				writer.PutInt32(stream->iSubtitleInfo);
+				writer.PutInt32(stream->iFPSScale);
+				writer.PutInt32(stream->iFPSRate);
+				writer.PutInt32(stream->iWidth);
+				writer.PutInt32(stream->iHeight);
+				uint32_t aspect;
+				memcpy(&aspect, &stream->fAspect, sizeof(aspect)); // Kept exactly, so a reprobe compares equal
+				writer.PutUInt32(aspect);
+				writer.PutInt32(stream->iChannels);
+				writer.PutInt32(stream->iSampleRate);
+				writer.PutInt32(stream->iBitRate);
+			}
+		}
+		m_bDirty = false;
+	}
+
+	if (!writer.Save(strPath, STREAMS_CACHE_MAGIC, STREAMS_CACHE_VERSION)) {
+		CLockObject lock(m_mutex);
+		m_bDirty = true;
+		return false;
+	}
+	return true;
+}
+
+bool CStreamPropertiesCache::IsDirty()
+{
+	CLockObject lock(m_mutex);
+	return m_bDirty;
+}
+
+void CStreamPropertiesCache::Update(unsigned int iChannelUid, const CTSProbe& probe)
+{
+	CLockObject lock(m_mutex);
+	map<unsigned int, vector<StreamInfo> >::iterator it = m_channels.find(iChannelUid);
+	if (!probe.Succeeded()) {
+		if (it != m_channels.end()) {
+			XBMC->Log(LOG_DEBUG, "%s - Channel %u no longer plays as a TS", __FUNCTION__, iChannelUid);
+			m_channels.erase(it);
+			m_bDirty = true;
+		}
+	} else if (it == m_channels.end() || it->second != probe.Streams()) {
+		XBMC->Log(LOG_DEBUG, "%s - Channel %u has %u streams%s", __FUNCTION__, iChannelUid,
+			(unsigned int) probe.Streams().size(), (it != m_channels.end()) ? ", which have changed" : "");
+		m_channels[iChannelUid] = probe.Streams();
+		m_bDirty = true;
+	}
+}
+
+bool CStreamPropertiesCache::Get(unsigned int iChannelUid, PVR_STREAM_PROPERTIES& properties)
+{
+	CLockObject lock(m_mutex);
+	map<unsigned int, vector<StreamInfo> >::const_iterator it = m_channels.find(iChannelUid);
+	if (it == m_channels.end())
+		return false;
+
+	memset(&properties, 0, sizeof(PVR_STREAM_PROPERTIES));
+	for (vector<StreamInfo>::const_iterator stream = it->second.begin(); stream != it->second.end() && properties.iStreamCount < PVR_STREAM_MAX_STREAMS; ++stream) {
+		xbmc_codec_t codec = CODEC->GetCodecByName(stream->strCodec.c_str());
+		if (codec.codec_type == XBMC_CODEC_TYPE_UNKNOWN)
+			continue;
+
+		PVR_STREAM_PROPERTIES::PVR_STREAM& xbmcStream = properties.stream[properties.iStreamCount++];
+		xbmcStream.iPID = stream->iPID;
+		xbmcStream.iCodecType = codec.codec_type;
+		xbmcStream.iCodecId = codec.codec_id;
+		strncpy(xbmcStream.strLanguage, stream->strLanguage.c_str(), sizeof(xbmcStream.strLanguage) - 1);
+		xbmcStream.iSubtitleInfo = stream->iSubtitleInfo;
+		xbmcStream.iFPSScale = stream->iFPSScale;
+		xbmcStream.iFPSRate = stream->iFPSRate;
+		xbmcStream.iWidth = stream->iWidth;
+		xbmcStream.iHeight = stream->iHeight;
+		xbmcStream.fAspect = stream->fAspect;
+		xbmcStream.iChannels = stream->iChannels;
+		xbmcStream.iSampleRate = stream->iSampleRate;
+		xbmcStream.iBitRate = stream->iBitRate;
+	}
+	return properties.iStreamCount > 0;
+}
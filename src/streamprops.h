@@ -0,0 +1,112 @@
+#pragma once
+/*
+ *  pvr.python - A PVR client for Kodi using Python
+ *  Copyright © 2016 RunasSudo (Yingtong Li)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "client.h"
+
+#include <p8-platform/threads/mutex.h>
+
+#include <stddef.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#define STREAMS_CACHE_VERSION 1
+
+// One elementary stream of a channel. Codecs are kept by their FFmpeg name,
+// as Kodi's codec ids aren't stable between versions.
+struct StreamInfo
+{
+	StreamInfo();
+	bool operator==(const StreamInfo& other) const;
+
+	unsigned int iPID;
+	std::string strCodec;
+	std::string strLanguage;  // ISO 639-2, if the PMT gives one
+	int iSubtitleInfo;        // DVB subtitles: composition page, ancillary page in the top half
+	int iFPSScale;
+	int iFPSRate;
+	int iWidth;
+	int iHeight;
+	float fAspect;
+	int iChannels;
+	int iSampleRate;
+	int iBitRate;
+};
+
+// Works out the elementary streams of an MPEG transport stream from its
+// PAT and PMT, then reads the first headers of each stream for its
+// resolution or audio format. Gives up on anything that isn't a TS.
+class CTSProbe
+{
+public:
+	CTSProbe();
+
+	// Returns true once the probe has finished, whether or not it succeeded
+	bool Feed(const unsigned char* pData, size_t iSize);
+
+	bool Succeeded() const { return m_bSucceeded; }
+	const std::vector<StreamInfo>& Streams() const { return m_streams; }
+
+private:
+	void Packet(const unsigned char* pPacket);
+	void Section(unsigned int iPID, const std::string& strSection);
+	void ParsePMT(const unsigned char* pSection, size_t iSize);
+	bool ParsePES(StreamInfo& stream, const std::string& strPES);
+	bool IsComplete() const;
+	void Finish(bool bSucceeded);
+
+	std::string m_pending;                           // Part of a packet, or data not yet synced
+	size_t m_iBytes;
+	bool m_bSynced;
+	int m_iPmtPID;
+	bool m_bHavePMT;
+	std::map<unsigned int, std::string> m_sections;  // PSI being assembled, by PID
+	std::map<unsigned int, std::string> m_pes;       // Start of each PES not yet described, by PID
+	std::vector<StreamInfo> m_streams;
+	std::vector<bool> m_described;
+	bool m_bDone;
+	bool m_bSucceeded;
+};
+
+// The stream layout of each channel, as found the last time the recorder
+// probed it, so it can be handed to Kodi on the next open instead of Kodi
+// probing the stream itself. An entry is replaced when the stream turns out
+// to have changed, and dropped when it is no longer a TS.
+class CStreamPropertiesCache
+{
+public:
+	CStreamPropertiesCache();
+
+	bool Load(const std::string& strPath);
+	bool Save(const std::string& strPath);
+	bool IsDirty();
+
+	// Takes in a probe of iChannelUid's stream that has finished
+	void Update(unsigned int iChannelUid, const CTSProbe& probe);
+
+	// Returns false if the channel hasn't been probed yet
+	bool Get(unsigned int iChannelUid, PVR_STREAM_PROPERTIES& properties);
+
+private:
+	P8PLATFORM::CMutex m_mutex;
+	std::map<unsigned int, std::vector<StreamInfo> > m_channels; // By channel uid
+	bool m_bDirty;
+};
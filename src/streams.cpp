@@ -0,0 +1,200 @@
+/*
+ *  pvr.python - A PVR client for Kodi using Python
+ *  Copyright © 2016 RunasSudo (Yingtong Li)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "streams.h"
+
+#include <p8-platform/util/util.h>
+
+using namespace std;
+using namespace ADDON;
+using namespace P8PLATFORM;
+
+// BEGIN FILE SESSIONS
+
+CFileStreamSession* CFileStreamSession::Open(const string& strPath, bool bCanPause, bool bCanSeek)
+{
+	void* handle = XBMC->OpenFile(strPath.c_str(), 0);
+	if (handle == NULL) {
+		XBMC->Log(LOG_ERROR, "%s - Failed to open '%s'", __FUNCTION__, strPath.c_str());
+		return NULL;
+	}
+	return new CFileStreamSession(handle, bCanPause, bCanSeek);
+}
+
+CFileStreamSession::CFileStreamSession(void* handle, bool bCanPause, bool bCanSeek) :
+	m_handle(handle),
+	m_bCanPause(bCanPause),
+	m_bCanSeek(bCanSeek)
+{
+}
+
+CFileStreamSession::~CFileStreamSession()
+{
+	XBMC->CloseFile(m_handle);
+}
+
+int CFileStreamSession::Read(unsigned char* pBuffer, unsigned int iBufferSize)
+{
+	return XBMC->ReadFile(m_handle, pBuffer, iBufferSize);
+}
+
+long long CFileStreamSession::Seek(long long iPosition, int iWhence)
+{
+	return XBMC->SeekFile(m_handle, iPosition, iWhence);
+}
+
+long long CFileStreamSession::Position()
+{
+	return XBMC->GetFilePosition(m_handle);
+}
+
+long long CFileStreamSession::Length()
+{
+	return XBMC->GetFileLength(m_handle);
+}
+
+// END FILE SESSIONS
+
+// BEGIN SLOTS
+
+CStreamSlot::CStreamSlot() :
+	m_session(NULL),
+	m_iPosition(-1),
+	m_iLength(0),
+	m_bCanPause(false),
+	m_bCanSeek(false)
+{
+}
+
+CStreamSlot::~CStreamSlot()
+{
+	Close();
+}
+
+void CStreamSlot::Open(CStreamSession* session)
+{
+	// Nobody else has the new session yet, so it can be asked without the locks
+	long long iPosition = session ? session->Position() : -1;
+	long long iLength = session ? session->Length() : 0;
+	bool bCanPause = session ? session->CanPause() : false;
+	bool bCanSeek = session ? session->CanSeek() : false;
+
+	Abort();
+	CLockObject lock(m_mutex);
+	CLockObject statusLock(m_statusMutex);
+	SAFE_DELETE(m_session);
+	m_session = session;
+	m_iPosition = iPosition;
+	m_iLength = iLength;
+	m_bCanPause = bCanPause;
+	m_bCanSeek = bCanSeek;
+}
+
+void CStreamSlot::Close()
+{
+	Open(NULL);
+}
+
+bool CStreamSlot::IsOpen()
+{
+	CLockObject statusLock(m_statusMutex);
+	return m_session != NULL;
+}
+
+// Makes a Read in progress give up, rather than hold up replacing the session
+void CStreamSlot::Abort()
+{
+	CLockObject statusLock(m_statusMutex);
+	if (m_session)
+		m_session->Abort();
+}
+
+int CStreamSlot::Read(unsigned char* pBuffer, unsigned int iBufferSize)
+{
+	CLockObject lock(m_mutex);
+	if (!m_session)
+		return -1;
+
+	int iRead = m_session->Read(pBuffer, iBufferSize);
+	CLockObject statusLock(m_statusMutex);
+	if (iRead > 0 && m_iPosition >= 0)
+		m_iPosition += iRead;
+	return iRead;
+}
+
+long long CStreamSlot::Seek(long long iPosition, int iWhence)
+{
+	CLockObject lock(m_mutex);
+	if (!m_session)
+		return -1;
+
+	long long iResult = m_session->Seek(iPosition, iWhence);
+	CLockObject statusLock(m_statusMutex);
+	if (iResult >= 0)
+		m_iPosition = iResult;
+	return iResult;
+}
+
+long long CStreamSlot::Position()
+{
+	CTryLockObject lock(m_mutex);
+	if (lock.IsLocked() && m_session) {
+		long long iPosition = m_session->Position();
+		CLockObject statusLock(m_statusMutex);
+		m_iPosition = iPosition;
+		return iPosition;
+	}
+	CLockObject statusLock(m_statusMutex);
+	return m_iPosition;
+}
+
+long long CStreamSlot::Length()
+{
+	// A recording still being made grows, so it's asked again whenever it can be
+	CTryLockObject lock(m_mutex);
+	if (lock.IsLocked() && m_session) {
+		long long iLength = m_session->Length();
+		CLockObject statusLock(m_statusMutex);
+		m_iLength = iLength;
+		return iLength;
+	}
+	CLockObject statusLock(m_statusMutex);
+	return m_iLength;
+}
+
+bool CStreamSlot::CanPause()
+{
+	CLockObject statusLock(m_statusMutex);
+	return m_bCanPause;
+}
+
+bool CStreamSlot::CanSeek()
+{
+	CLockObject statusLock(m_statusMutex);
+	return m_bCanSeek;
+}
+
+void CStreamSlot::SignalStatus(PVR_SIGNAL_STATUS& signalStatus)
+{
+	CLockObject statusLock(m_statusMutex);
+	if (m_session)
+		m_session->SignalStatus(signalStatus);
+}
+
+// END SLOTS
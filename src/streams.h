@@ -0,0 +1,111 @@
+#pragma once
+/*
+ *  pvr.python - A PVR client for Kodi using Python
+ *  Copyright © 2016 RunasSudo (Yingtong Li)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "client.h"
+
+#include <p8-platform/threads/mutex.h>
+
+#include <string>
+
+// One open stream, carrying all of its own state. Nothing is shared between
+// sessions, so live TV, a recording being played back and the recorder can
+// each have one open at the same time. Whoever opens a session owns it, and
+// deleting it closes the stream.
+class CStreamSession
+{
+public:
+	CStreamSession() {}
+	virtual ~CStreamSession() {}
+
+	virtual int Read(unsigned char* pBuffer, unsigned int iBufferSize) = 0;
+	virtual long long Seek(long long iPosition, int iWhence) = 0;
+	virtual long long Position() = 0;
+	virtual long long Length() = 0;
+	virtual bool CanPause() = 0;
+	virtual bool CanSeek() = 0;
+
+	// Fills in what the session knows about its reception, if anything
+	virtual void SignalStatus(PVR_SIGNAL_STATUS& signalStatus) {}
+
+	// Called from another thread to make a Read in progress, and any later
+	// one, fail as soon as it can, so the session can be closed
+	virtual void Abort() {}
+};
+
+// A stream Kodi's VFS opens by itself, such as an HTTP URL or a local file
+class CFileStreamSession : public CStreamSession
+{
+public:
+	// Returns NULL if the file can't be opened
+	static CFileStreamSession* Open(const std::string& strPath, bool bCanPause, bool bCanSeek);
+	virtual ~CFileStreamSession();
+
+	virtual int Read(unsigned char* pBuffer, unsigned int iBufferSize);
+	virtual long long Seek(long long iPosition, int iWhence);
+	virtual long long Position();
+	virtual long long Length();
+	virtual bool CanPause() { return m_bCanPause; }
+	virtual bool CanSeek() { return m_bCanSeek; }
+
+private:
+	CFileStreamSession(void* handle, bool bCanPause, bool bCanSeek);
+
+	void* m_handle;
+	bool m_bCanPause;
+	bool m_bCanSeek;
+};
+
+// The session behind one of the streams Kodi addresses without a handle (the
+// live stream or the recorded stream). Opening replaces whatever was there.
+class CStreamSlot
+{
+public:
+	CStreamSlot();
+	~CStreamSlot();
+
+	void Open(CStreamSession* session);
+	void Close();
+	bool IsOpen();
+
+	// These fail like the PVR API expects when nothing is open
+	int Read(unsigned char* pBuffer, unsigned int iBufferSize);
+	long long Seek(long long iPosition, int iWhence);
+
+	// These don't wait for a Read in progress. Position and Length give what
+	// the session last said if one is.
+	long long Position();
+	long long Length();
+	bool CanPause();
+	bool CanSeek();
+	void SignalStatus(PVR_SIGNAL_STATUS& signalStatus);
+
+private:
+	void Abort();
+
+	P8PLATFORM::CMutex m_mutex;
+	P8PLATFORM::CMutex m_statusMutex; // Also held while the session is replaced
+	CStreamSession* m_session;
+
+	// Guarded by m_statusMutex
+	long long m_iPosition;
+	long long m_iLength;
+	bool m_bCanPause;
+	bool m_bCanSeek;
+};
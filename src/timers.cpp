@@ -0,0 +1,802 @@
+/*
+ *  pvr.python - A PVR client for Kodi using Python
+ *  Copyright © 2016 RunasSudo (Yingtong Li)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "timers.h"
+#include "catalog.h"
+#include "epgsearch.h"
+#include "snapshot.h"
+
+#include <algorithm>
+#include <set>
+#include <string.h>
+#include <time.h>
+
+using namespace std;
+using namespace P8PLATFORM;
+
+#define TIMERS_SNAPSHOT_MAGIC "PVRPYTMR"
+
+// Occurrences of repeating timers get client indices from here up, so they
+// never collide with the indices of real timers
+#define TIMER_OCCURRENCE_INDEX_BASE 0x80000000u
+
+// Occurrences move as time passes, so recompute them at least this often
+#define TIMER_REFRESH_INTERVAL 60
+
+static void LocalTime(time_t t, struct tm& result)
+{
+#ifdef _WIN32
+	localtime_s(&result, &t);
+#else
+	localtime_r(&t, &result);
+#endif
+}
+
+static bool IsActive(const PVR_TIMER& timer)
+{
+	switch (timer.state) {
+		case PVR_TIMER_STATE_COMPLETED:
+		case PVR_TIMER_STATE_ABORTED:
+		case PVR_TIMER_STATE_CANCELLED:
+		case PVR_TIMER_STATE_ERROR:
+		case PVR_TIMER_STATE_DISABLED:
+			return false;
+		default:
+			return true;
+	}
+}
+
+static bool IsRepeating(const PVR_TIMER& timer)
+{
+	return timer.iTimerType == TIMER_REPEATING_MANUAL;
+}
+
+static bool IsEpgSearch(const PVR_TIMER& timer)
+{
+	return timer.iTimerType == TIMER_REPEATING_EPG_SEARCH;
+}
+
+// Timers that are only ever recorded through the occurrences made from them
+static bool HasOccurrences(const PVR_TIMER& timer)
+{
+	return IsRepeating(timer) || IsEpgSearch(timer);
+}
+
+static TimerInterval MakeInterval(const PVR_TIMER& timer, time_t start, time_t end)
+{
+	TimerInterval interval;
+	interval.start = start - timer.iMarginStart * 60;
+	interval.end = end + timer.iMarginEnd * 60;
+	interval.iChannelUid = timer.iClientChannelUid;
+	interval.iClientIndex = timer.iClientIndex;
+	interval.iParentClientIndex = PVR_TIMER_NO_PARENT;
+	return interval;
+}
+
+static bool StartsBefore(const TimerInterval& a, const TimerInterval& b)
+{
+	return a.start < b.start;
+}
+
+// Gives each occurrence a tuner in start order. A recording on a channel that
+// is already being recorded shares that tuner. Returns the occurrences that
+// could not get one.
+static vector<unsigned int> AssignTuners(vector<TimerInterval> intervals, int iTuners)
+{
+	vector<unsigned int> unassigned;
+	if (iTuners <= 0)
+		return unassigned;
+
+	sort(intervals.begin(), intervals.end(), StartsBefore);
+
+	vector<TimerInterval> busy;
+	for (vector<TimerInterval>::const_iterator it = intervals.begin(); it != intervals.end(); ++it) {
+		bool shared = false;
+		for (vector<TimerInterval>::iterator tuner = busy.begin(); tuner != busy.end(); ) {
+			if (tuner->end <= it->start) {
+				tuner = busy.erase(tuner);
+				continue;
+			}
+			if (tuner->iChannelUid == it->iChannelUid) {
+				tuner->end = max(tuner->end, it->end);
+				shared = true;
+			}
+			++tuner;
+		}
+
+		if (shared)
+			continue;
+		if ((int) busy.size() < iTuners)
+			busy.push_back(*it);
+		else
+			unassigned.push_back(it->iClientIndex);
+	}
+	return unassigned;
+}
+
+// BEGIN INTERVAL TREE
+
+void CIntervalTree::Build(const vector<TimerInterval>& intervals)
+{
+	m_intervals = intervals;
+	sort(m_intervals.begin(), m_intervals.end(), StartsBefore);
+	m_maxEnd.assign(m_intervals.size(), 0);
+	Build(0, m_intervals.size());
+}
+
+time_t CIntervalTree::Build(size_t lo, size_t hi)
+{
+	if (lo >= hi)
+		return 0;
+
+	size_t mid = lo + (hi - lo) / 2;
+	time_t maxEnd = m_intervals[mid].end;
+	maxEnd = max(maxEnd, Build(lo, mid));
+	maxEnd = max(maxEnd, Build(mid + 1, hi));
+	m_maxEnd[mid] = maxEnd;
+	return maxEnd;
+}
+
+void CIntervalTree::Query(time_t start, time_t end, vector<TimerInterval>& result) const
+{
+	Query(0, m_intervals.size(), start, end, result);
+}
+
+void CIntervalTree::Query(size_t lo, size_t hi, time_t start, time_t end, vector<TimerInterval>& result) const
+{
+	if (lo >= hi)
+		return;
+
+	size_t mid = lo + (hi - lo) / 2;
+	if (m_maxEnd[mid] <= start)
+		return; // Everything below here is over before the window opens
+
+	Query(lo, mid, start, end, result);
+
+	if (m_intervals[mid].start >= end)
+		return; // This and everything to the right starts after the window closes
+
+	if (m_intervals[mid].end > start)
+		result.push_back(m_intervals[mid]);
+
+	Query(mid + 1, hi, start, end, result);
+}
+
+// BEGIN TIMER STORE
+
+CTimerStore::CTimerStore() :
+	m_iNextIndex(1),
+	m_iTuners(0),
+	m_iHorizonDays(7),
+	m_epgIndex(NULL),
+	m_iEpgGeneration(0),
+	m_bValid(false),
+	m_refreshed(0),
+	m_iNextOccurrenceIndex(TIMER_OCCURRENCE_INDEX_BASE)
+{
+}
+
+bool CTimerStore::Load(const string& strPath)
+{
+	CSnapshotReader reader;
+	if (!reader.Open(strPath, TIMERS_SNAPSHOT_MAGIC, TIMERS_SNAPSHOT_VERSION))
+		return false;
+
+	map<unsigned int, CStoredTimer> timers;
+	unsigned int iNextIndex = reader.GetUInt32();
+	uint32_t count = reader.GetUInt32();
+	for (uint32_t i = 0; i < count && !reader.Failed(); i++) {
+		CStoredTimer stored;
+		stored.bFromBackend = reader.GetUInt8() != 0;
+		stored.iBackendIndex = reader.GetUInt32();
+		ReadTimer(reader, stored.timer);
+		timers[stored.timer.iClientIndex] = stored;
+	}
+	if (reader.Failed() || !reader.AtEnd())
+		return false;
+
+	CLockObject lock(m_mutex);
+	m_timers.swap(timers);
+	m_iNextIndex = iNextIndex;
+	Invalidate();
+	return true;
+}
+
+bool CTimerStore::Save(const string& strPath)
+{
+	CSnapshotWriter writer;
+	{
+		CLockObject lock(m_mutex);
+		writer.PutUInt32(m_iNextIndex);
+		writer.PutUInt32(m_timers.size());
+		for (map<unsigned int, CStoredTimer>::const_iterator it = m_timers.begin(); it != m_timers.end(); ++it) {
+			writer.PutUInt8(it->second.bFromBackend);
+			writer.PutUInt32(it->second.iBackendIndex);
+			WriteTimer(writer, it->second.timer);
+		}
+	}
+	return writer.Save(strPath, TIMERS_SNAPSHOT_MAGIC, TIMERS_SNAPSHOT_VERSION);
+}
+
+void CTimerStore::GetTimerTypes(PVR_TIMER_TYPE types[], int* size)
+{
+	static const struct
+	{
+		unsigned int iId;
+		unsigned int iAttributes;
+		const char* strDescription;
+	} definitions[] = {
+		{ TIMER_ONCE_MANUAL,
+			PVR_TIMER_TYPE_IS_MANUAL | PVR_TIMER_TYPE_SUPPORTS_ENABLE_DISABLE | PVR_TIMER_TYPE_SUPPORTS_CHANNELS |
+			PVR_TIMER_TYPE_SUPPORTS_START_TIME | PVR_TIMER_TYPE_SUPPORTS_END_TIME | PVR_TIMER_TYPE_SUPPORTS_START_END_MARGIN |
+			PVR_TIMER_TYPE_SUPPORTS_PRIORITY | PVR_TIMER_TYPE_SUPPORTS_RECORDING_FOLDERS,
+			"One time" },
+		{ TIMER_ONCE_EPG,
+			PVR_TIMER_TYPE_SUPPORTS_ENABLE_DISABLE | PVR_TIMER_TYPE_SUPPORTS_CHANNELS |
+			PVR_TIMER_TYPE_SUPPORTS_START_TIME | PVR_TIMER_TYPE_SUPPORTS_END_TIME | PVR_TIMER_TYPE_SUPPORTS_START_END_MARGIN |
+			PVR_TIMER_TYPE_SUPPORTS_PRIORITY | PVR_TIMER_TYPE_SUPPORTS_RECORDING_FOLDERS | PVR_TIMER_TYPE_REQUIRES_EPG_TAG_ON_CREATE,
+			"One time (guide-based)" },
+		{ TIMER_ONCE_CREATED_BY_REPEATING,
+			PVR_TIMER_TYPE_IS_MANUAL | PVR_TIMER_TYPE_IS_READONLY | PVR_TIMER_TYPE_FORBIDS_NEW_INSTANCES |
+			PVR_TIMER_TYPE_SUPPORTS_CHANNELS | PVR_TIMER_TYPE_SUPPORTS_START_TIME | PVR_TIMER_TYPE_SUPPORTS_END_TIME,
+			"One time (scheduled by repeating timer)" },
+		{ TIMER_REPEATING_MANUAL,
+			PVR_TIMER_TYPE_IS_MANUAL | PVR_TIMER_TYPE_IS_REPEATING | PVR_TIMER_TYPE_SUPPORTS_ENABLE_DISABLE |
+			PVR_TIMER_TYPE_SUPPORTS_CHANNELS | PVR_TIMER_TYPE_SUPPORTS_START_TIME | PVR_TIMER_TYPE_SUPPORTS_END_TIME |
+			PVR_TIMER_TYPE_SUPPORTS_FIRST_DAY | PVR_TIMER_TYPE_SUPPORTS_WEEKDAYS | PVR_TIMER_TYPE_SUPPORTS_START_END_MARGIN |
+			PVR_TIMER_TYPE_SUPPORTS_PRIORITY | PVR_TIMER_TYPE_SUPPORTS_RECORDING_FOLDERS,
+			"Repeating" },
+		{ TIMER_ONCE_CREATED_BY_EPG_SEARCH,
+			PVR_TIMER_TYPE_IS_READONLY | PVR_TIMER_TYPE_FORBIDS_NEW_INSTANCES |
+			PVR_TIMER_TYPE_SUPPORTS_CHANNELS | PVR_TIMER_TYPE_SUPPORTS_START_TIME | PVR_TIMER_TYPE_SUPPORTS_END_TIME,
+			"One time (scheduled by guide search)" },
+		{ TIMER_REPEATING_EPG_SEARCH,
+			PVR_TIMER_TYPE_IS_REPEATING | PVR_TIMER_TYPE_SUPPORTS_ENABLE_DISABLE | PVR_TIMER_TYPE_SUPPORTS_CHANNELS |
+			PVR_TIMER_TYPE_SUPPORTS_ANY_CHANNEL | PVR_TIMER_TYPE_SUPPORTS_TITLE_EPG_MATCH | PVR_TIMER_TYPE_SUPPORTS_FULLTEXT_EPG_MATCH |
+			PVR_TIMER_TYPE_SUPPORTS_START_END_MARGIN | PVR_TIMER_TYPE_SUPPORTS_PRIORITY | PVR_TIMER_TYPE_SUPPORTS_RECORDING_FOLDERS,
+			"Guide search" },
+	};
+
+	int count = 0;
+	for (size_t i = 0; i < sizeof(definitions) / sizeof(definitions[0]) && count < *size; i++) {
+		PVR_TIMER_TYPE& type = types[count++];
+		memset(&type, 0, sizeof(PVR_TIMER_TYPE));
+		type.iId = definitions[i].iId;
+		type.iAttributes = definitions[i].iAttributes;
+		strncpy(type.strDescription, definitions[i].strDescription, sizeof(type.strDescription) - 1);
+	}
+	*size = count;
+}
+
+bool CTimerStore::SyncBackend(const vector<PVR_TIMER>& timers)
+{
+	CLockObject lock(m_mutex);
+
+	// Both sides are compared in the backend's own order, so a backend that
+	// lists its timers differently each time doesn't count as a change
+	map<unsigned int, const CStoredTimer*> previous;
+	map<unsigned int, CStoredTimer> kept;
+	for (map<unsigned int, CStoredTimer>::const_iterator it = m_timers.begin(); it != m_timers.end(); ++it) {
+		if (it->second.bFromBackend)
+			previous[it->second.iBackendIndex] = &it->second;
+		else
+			kept[it->first] = it->second;
+	}
+
+	map<unsigned int, PVR_TIMER> reported;
+	for (vector<PVR_TIMER>::const_iterator it = timers.begin(); it != timers.end(); ++it)
+		reported[it->iClientIndex] = *it;
+
+	CSnapshotWriter before;
+	for (map<unsigned int, const CStoredTimer*>::const_iterator it = previous.begin(); it != previous.end(); ++it)
+		WriteTimer(before, it->second->timer);
+
+	// A timer keeps its client index for as long as the backend reports it
+	map<unsigned int, unsigned int> indices;
+	unsigned int iNextIndex = m_iNextIndex;
+	for (map<unsigned int, PVR_TIMER>::const_iterator it = reported.begin(); it != reported.end(); ++it) {
+		map<unsigned int, const CStoredTimer*>::const_iterator known = previous.find(it->first);
+		indices[it->first] = (known != previous.end()) ? known->second->timer.iClientIndex : iNextIndex++;
+	}
+
+	CSnapshotWriter after;
+	for (map<unsigned int, PVR_TIMER>::const_iterator it = reported.begin(); it != reported.end(); ++it) {
+		CStoredTimer stored;
+		stored.timer = it->second;
+		stored.bFromBackend = true;
+		stored.iBackendIndex = it->first;
+		stored.timer.iClientIndex = indices[it->first];
+		if (stored.timer.iParentClientIndex != PVR_TIMER_NO_PARENT) {
+			map<unsigned int, unsigned int>::const_iterator parent = indices.find(stored.timer.iParentClientIndex);
+			stored.timer.iParentClientIndex = (parent != indices.end()) ? parent->second : PVR_TIMER_NO_PARENT;
+		}
+
+		// Kodi needs every timer to have one of our types
+		if (stored.timer.iTimerType == PVR_TIMER_TYPE_NONE || stored.timer.iTimerType > TIMER_TYPE_COUNT) {
+			if (stored.timer.strEpgSearchString[0] != '\0')
+				stored.timer.iTimerType = TIMER_REPEATING_EPG_SEARCH;
+			else
+				stored.timer.iTimerType = (stored.timer.iWeekdays != PVR_WEEKDAY_NONE) ? TIMER_REPEATING_MANUAL : TIMER_ONCE_MANUAL;
+		}
+
+		WriteTimer(after, stored.timer);
+		kept[stored.timer.iClientIndex] = stored;
+	}
+
+	if (before.Data() == after.Data())
+		return false;
+
+	m_timers.swap(kept);
+	m_iNextIndex = iNextIndex;
+	Invalidate();
+	return true;
+}
+
+void CTimerStore::SetTuners(int iTuners)
+{
+	CLockObject lock(m_mutex);
+	m_iTuners = iTuners;
+	Invalidate();
+}
+
+void CTimerStore::SetHorizon(int iDays)
+{
+	CLockObject lock(m_mutex);
+	m_iHorizonDays = (iDays > 0) ? iDays : 7;
+	Invalidate();
+}
+
+void CTimerStore::SetEpgIndex(CEpgSearchIndex* epgIndex)
+{
+	CLockObject lock(m_mutex);
+	m_epgIndex = epgIndex;
+	Invalidate();
+}
+
+bool CTimerStore::RefreshEpgSearches()
+{
+	CLockObject lock(m_mutex);
+	bool bSearching = false;
+	for (map<unsigned int, CStoredTimer>::const_iterator it = m_timers.begin(); it != m_timers.end() && !bSearching; ++it)
+		bSearching = IsActive(it->second.timer) && IsEpgSearch(it->second.timer);
+	if (!bSearching)
+		return false;
+
+	CSnapshotWriter before;
+	for (vector<PVR_TIMER>::const_iterator it = m_occurrences.begin(); it != m_occurrences.end(); ++it)
+		WriteTimer(before, *it);
+
+	Invalidate();
+	Refresh();
+
+	CSnapshotWriter after;
+	for (vector<PVR_TIMER>::const_iterator it = m_occurrences.begin(); it != m_occurrences.end(); ++it)
+		WriteTimer(after, *it);
+	return before.Data() != after.Data();
+}
+
+PVR_ERROR CTimerStore::Prepare(PVR_TIMER& timer)
+{
+	if (timer.iTimerType == PVR_TIMER_TYPE_NONE)
+		timer.iTimerType = TIMER_ONCE_MANUAL;
+	if (timer.iTimerType == TIMER_ONCE_CREATED_BY_REPEATING || timer.iTimerType == TIMER_ONCE_CREATED_BY_EPG_SEARCH || timer.iTimerType > TIMER_TYPE_COUNT)
+		return PVR_ERROR_INVALID_PARAMETERS;
+	if (IsRepeating(timer) && timer.iWeekdays == PVR_WEEKDAY_NONE)
+		return PVR_ERROR_INVALID_PARAMETERS;
+	if (IsEpgSearch(timer) && timer.strEpgSearchString[0] == '\0')
+		return PVR_ERROR_INVALID_PARAMETERS;
+	if (!HasOccurrences(timer) && timer.endTime <= timer.startTime)
+		return PVR_ERROR_INVALID_PARAMETERS;
+
+	CLockObject lock(m_mutex);
+	timer.iClientIndex = m_iNextIndex++;
+
+	if (timer.state != PVR_TIMER_STATE_DISABLED) {
+		timer.state = PVR_TIMER_STATE_SCHEDULED;
+
+		vector<TimerInterval> occurrences;
+		if (HasOccurrences(timer)) {
+			time_t now = time(NULL);
+			Expand(timer, now, now + m_iHorizonDays * 24 * 60 * 60, occurrences);
+		} else {
+			occurrences.push_back(MakeInterval(timer, timer.startTime, timer.endTime));
+		}
+		for (vector<TimerInterval>::const_iterator it = occurrences.begin(); it != occurrences.end(); ++it) {
+			if (Conflicts(*it)) {
+				timer.state = PVR_TIMER_STATE_CONFLICT_NOK;
+				break;
+			}
+		}
+	}
+
+	return PVR_ERROR_NO_ERROR;
+}
+
+void CTimerStore::Add(const PVR_TIMER& timer)
+{
+	CLockObject lock(m_mutex);
+	CStoredTimer stored;
+	stored.timer = timer;
+	stored.bFromBackend = false;
+	stored.iBackendIndex = 0;
+	m_timers[timer.iClientIndex] = stored;
+	Invalidate();
+}
+
+PVR_ERROR CTimerStore::Update(const PVR_TIMER& timer)
+{
+	CLockObject lock(m_mutex);
+	if (m_occurrenceParents.count(timer.iClientIndex))
+		return PVR_ERROR_REJECTED; // Read-only; the repeating timer has to be changed instead
+
+	map<unsigned int, CStoredTimer>::iterator it = m_timers.find(timer.iClientIndex);
+	if (it == m_timers.end())
+		return PVR_ERROR_INVALID_PARAMETERS;
+
+	it->second.timer = timer;
+	Invalidate();
+	return PVR_ERROR_NO_ERROR;
+}
+
+PVR_ERROR CTimerStore::Delete(unsigned int iClientIndex)
+{
+	CLockObject lock(m_mutex);
+	if (m_occurrenceParents.count(iClientIndex))
+		return PVR_ERROR_REJECTED;
+
+	if (m_timers.erase(iClientIndex) == 0)
+		return PVR_ERROR_INVALID_PARAMETERS;
+
+	Invalidate();
+	return PVR_ERROR_NO_ERROR;
+}
+
+bool CTimerStore::Get(unsigned int iClientIndex, PVR_TIMER& timer)
+{
+	CLockObject lock(m_mutex);
+	map<unsigned int, CStoredTimer>::const_iterator it = m_timers.find(iClientIndex);
+	if (it == m_timers.end())
+		return false;
+	timer = it->second.timer;
+	return true;
+}
+
+void CTimerStore::ToBackend(PVR_TIMER& timer)
+{
+	CLockObject lock(m_mutex);
+	map<unsigned int, CStoredTimer>::const_iterator it = m_timers.find(timer.iClientIndex);
+	if (it == m_timers.end() || !it->second.bFromBackend)
+		return;
+
+	timer.iClientIndex = it->second.iBackendIndex;
+	map<unsigned int, CStoredTimer>::const_iterator parent = m_timers.find(timer.iParentClientIndex);
+	if (timer.iParentClientIndex != PVR_TIMER_NO_PARENT && parent != m_timers.end() && parent->second.bFromBackend)
+		timer.iParentClientIndex = parent->second.iBackendIndex;
+}
+
+bool CTimerStore::IsOccurrence(unsigned int iClientIndex)
+{
+	CLockObject lock(m_mutex);
+	return m_occurrenceParents.count(iClientIndex) > 0;
+}
+
+void CTimerStore::Query(time_t start, time_t end, vector<TimerInterval>& result)
+{
+	CLockObject lock(m_mutex);
+	QueryLocked(start, end, result);
+}
+
+void CTimerStore::Due(time_t now, vector<PVR_TIMER>& result)
+{
+	CLockObject lock(m_mutex);
+	Refresh();
+
+	vector<TimerInterval> intervals;
+	QueryLocked(now, now + 1, intervals);
+	for (vector<TimerInterval>::const_iterator it = intervals.begin(); it != intervals.end(); ++it) {
+		map<unsigned int, PVR_TIMER_STATE>::const_iterator state = m_states.find(it->iClientIndex);
+		if (state != m_states.end() && state->second == PVR_TIMER_STATE_CONFLICT_NOK)
+			continue;
+
+		map<unsigned int, CStoredTimer>::const_iterator stored = m_timers.find(it->iClientIndex);
+		if (stored != m_timers.end()) {
+			result.push_back(stored->second.timer);
+			continue;
+		}
+
+		// Occurrences are only known from the last refresh, which covers the horizon from then on
+		for (vector<PVR_TIMER>::const_iterator occurrence = m_occurrences.begin(); occurrence != m_occurrences.end(); ++occurrence) {
+			if (occurrence->iClientIndex == it->iClientIndex) {
+				result.push_back(*occurrence);
+				break;
+			}
+		}
+	}
+}
+
+void CTimerStore::SetRecordingState(unsigned int iClientIndex, PVR_TIMER_STATE state)
+{
+	CLockObject lock(m_mutex);
+	if (state == PVR_TIMER_STATE_RECORDING) {
+		m_recordingStates[iClientIndex] = state;
+	} else {
+		m_recordingStates.erase(iClientIndex);
+		map<unsigned int, CStoredTimer>::iterator it = m_timers.find(iClientIndex);
+		bool bFinished = (state == PVR_TIMER_STATE_COMPLETED || state == PVR_TIMER_STATE_ERROR);
+		if (bFinished && it != m_timers.end() && !it->second.bFromBackend && !HasOccurrences(it->second.timer))
+			it->second.timer.state = state;
+	}
+	Invalidate();
+}
+
+void CTimerStore::TransferTimers(ADDON_HANDLE handle)
+{
+	CLockObject lock(m_mutex);
+	Refresh();
+
+	for (map<unsigned int, CStoredTimer>::const_iterator it = m_timers.begin(); it != m_timers.end(); ++it) {
+		PVR_TIMER timer = it->second.timer;
+		map<unsigned int, PVR_TIMER_STATE>::const_iterator state = m_states.find(timer.iClientIndex);
+		if (state != m_states.end())
+			timer.state = state->second;
+		PVR->TransferTimerEntry(handle, &timer);
+	}
+
+	for (vector<PVR_TIMER>::const_iterator it = m_occurrences.begin(); it != m_occurrences.end(); ++it)
+		PVR->TransferTimerEntry(handle, &(*it));
+}
+
+int CTimerStore::GetTimersAmount()
+{
+	CLockObject lock(m_mutex);
+	Refresh();
+	return m_timers.size() + m_occurrences.size();
+}
+
+void CTimerStore::Invalidate()
+{
+	m_bValid = false;
+}
+
+// Rebuilds the tree, the occurrences shown to Kodi and the conflict states
+void CTimerStore::Refresh()
+{
+	time_t now = time(NULL);
+	unsigned int iEpgGeneration = m_epgIndex ? m_epgIndex->Generation() : 0;
+	if (m_bValid && now - m_refreshed < TIMER_REFRESH_INTERVAL && iEpgGeneration == m_iEpgGeneration)
+		return;
+
+	vector<TimerInterval> intervals;
+	for (map<unsigned int, CStoredTimer>::const_iterator it = m_timers.begin(); it != m_timers.end(); ++it) {
+		const PVR_TIMER& timer = it->second.timer;
+		if (IsActive(timer) && !HasOccurrences(timer))
+			intervals.push_back(MakeInterval(timer, timer.startTime, timer.endTime));
+	}
+	m_tree.Build(intervals);
+
+	time_t horizon = now + m_iHorizonDays * 24 * 60 * 60;
+	m_occurrences.clear();
+	for (map<unsigned int, CStoredTimer>::const_iterator it = m_timers.begin(); it != m_timers.end(); ++it) {
+		const PVR_TIMER& timer = it->second.timer;
+		if (!IsActive(timer) || !HasOccurrences(timer))
+			continue;
+
+		if (IsEpgSearch(timer)) {
+			vector<EpgSearchMatch> matches;
+			Search(timer, now, horizon, matches);
+			for (vector<EpgSearchMatch>::const_iterator match = matches.begin(); match != matches.end(); ++match) {
+				PVR_TIMER child = timer;
+				child.iClientIndex = OccurrenceIndex(timer.iClientIndex, match->iChannelUid, match->startTime);
+				child.iParentClientIndex = timer.iClientIndex;
+				child.iTimerType = TIMER_ONCE_CREATED_BY_EPG_SEARCH;
+				child.iClientChannelUid = match->iChannelUid;
+				child.startTime = match->startTime;
+				child.endTime = match->endTime;
+				child.iEpgUid = match->iBroadcastId;
+				strncpy(child.strTitle, match->strTitle.c_str(), sizeof(child.strTitle) - 1);
+				child.strTitle[sizeof(child.strTitle) - 1] = '\0';
+				child.strEpgSearchString[0] = '\0';
+				child.bFullTextEpgSearch = false;
+				child.firstDay = 0;
+				child.iWeekdays = PVR_WEEKDAY_NONE;
+				child.state = PVR_TIMER_STATE_SCHEDULED;
+				m_occurrences.push_back(child);
+			}
+			continue;
+		}
+
+		vector<TimerInterval> expanded;
+		Expand(timer, now, horizon, expanded);
+		for (vector<TimerInterval>::const_iterator occurrence = expanded.begin(); occurrence != expanded.end(); ++occurrence) {
+			PVR_TIMER child = timer;
+			child.iClientIndex = occurrence->iClientIndex;
+			child.iParentClientIndex = timer.iClientIndex;
+			child.iTimerType = TIMER_ONCE_CREATED_BY_REPEATING;
+			child.startTime = occurrence->start + timer.iMarginStart * 60;
+			child.endTime = occurrence->end - timer.iMarginEnd * 60;
+			child.firstDay = 0;
+			child.iWeekdays = PVR_WEEKDAY_NONE;
+			child.state = PVR_TIMER_STATE_SCHEDULED;
+			m_occurrences.push_back(child);
+		}
+	}
+
+	m_bValid = true;
+	m_refreshed = now;
+	m_iEpgGeneration = iEpgGeneration;
+
+	vector<TimerInterval> upcoming;
+	QueryLocked(now, horizon, upcoming);
+	vector<unsigned int> conflicts = AssignTuners(upcoming, m_iTuners);
+
+	m_states.clear();
+	for (map<unsigned int, CStoredTimer>::const_iterator it = m_timers.begin(); it != m_timers.end(); ++it) {
+		if (it->second.timer.state == PVR_TIMER_STATE_CONFLICT_NOK)
+			m_states[it->first] = PVR_TIMER_STATE_SCHEDULED; // Until shown otherwise
+	}
+	for (vector<unsigned int>::const_iterator it = conflicts.begin(); it != conflicts.end(); ++it)
+		m_states[*it] = PVR_TIMER_STATE_CONFLICT_NOK;
+	for (map<unsigned int, PVR_TIMER_STATE>::const_iterator it = m_recordingStates.begin(); it != m_recordingStates.end(); ++it)
+		m_states[it->first] = it->second;
+	for (vector<PVR_TIMER>::iterator it = m_occurrences.begin(); it != m_occurrences.end(); ++it) {
+		map<unsigned int, PVR_TIMER_STATE>::const_iterator state = m_states.find(it->iClientIndex);
+		if (state != m_states.end())
+			it->state = state->second;
+	}
+
+	PruneOccurrenceIndices();
+}
+
+// Generates the occurrences of a repeating or guide search timer that overlap [start, end)
+void CTimerStore::Expand(const PVR_TIMER& timer, time_t start, time_t end, vector<TimerInterval>& result)
+{
+	if (IsEpgSearch(timer)) {
+		vector<EpgSearchMatch> matches;
+		Search(timer, start - timer.iMarginEnd * 60, end + timer.iMarginStart * 60, matches);
+		for (vector<EpgSearchMatch>::const_iterator match = matches.begin(); match != matches.end(); ++match) {
+			TimerInterval interval = MakeInterval(timer, match->startTime, match->endTime);
+			if (interval.end <= start || interval.start >= end)
+				continue;
+			interval.iChannelUid = match->iChannelUid;
+			interval.iClientIndex = OccurrenceIndex(timer.iClientIndex, match->iChannelUid, match->startTime);
+			interval.iParentClientIndex = timer.iClientIndex;
+			result.push_back(interval);
+		}
+		return;
+	}
+
+	time_t duration = timer.endTime - timer.startTime;
+	if (duration <= 0)
+		duration += 24 * 60 * 60; // Runs past midnight
+
+	struct tm timeOfDay;
+	LocalTime(timer.startTime, timeOfDay);
+
+	// Start early enough to catch an occurrence that is already running
+	time_t from = start - duration - timer.iMarginEnd * 60;
+	if (timer.firstDay > from)
+		from = timer.firstDay;
+
+	struct tm day;
+	LocalTime(from, day);
+	for (int i = 0; ; i++) {
+		struct tm occurrence = day;
+		occurrence.tm_mday += i;
+		occurrence.tm_hour = timeOfDay.tm_hour;
+		occurrence.tm_min = timeOfDay.tm_min;
+		occurrence.tm_sec = timeOfDay.tm_sec;
+		occurrence.tm_isdst = -1;
+		time_t occurrenceStart = mktime(&occurrence); // Normalises tm_mday and fills in tm_wday
+		if (occurrenceStart == (time_t) -1 || occurrenceStart - timer.iMarginStart * 60 >= end)
+			break;
+
+		unsigned int weekday = (occurrence.tm_wday == 0) ? PVR_WEEKDAY_SUNDAY : (PVR_WEEKDAY_MONDAY << (occurrence.tm_wday - 1));
+		if (!(timer.iWeekdays & weekday) || occurrenceStart < timer.firstDay)
+			continue;
+
+		TimerInterval interval = MakeInterval(timer, occurrenceStart, occurrenceStart + duration);
+		if (interval.end <= start)
+			continue;
+		interval.iClientIndex = OccurrenceIndex(timer.iClientIndex, interval.iChannelUid, occurrenceStart);
+		interval.iParentClientIndex = timer.iClientIndex;
+		result.push_back(interval);
+	}
+}
+
+void CTimerStore::QueryLocked(time_t start, time_t end, vector<TimerInterval>& result)
+{
+	if (!m_bValid)
+		Refresh();
+
+	m_tree.Query(start, end, result);
+	for (map<unsigned int, CStoredTimer>::const_iterator it = m_timers.begin(); it != m_timers.end(); ++it) {
+		if (IsActive(it->second.timer) && HasOccurrences(it->second.timer))
+			Expand(it->second.timer, start, end, result);
+	}
+}
+
+// The programmes a guide search timer would record. Where the same programme
+// starts at the same time on several channels, only the first is kept.
+void CTimerStore::Search(const PVR_TIMER& timer, time_t start, time_t end, vector<EpgSearchMatch>& result)
+{
+	if (m_epgIndex == NULL)
+		return;
+
+	vector<EpgSearchMatch> matches;
+	m_epgIndex->Search(timer.strEpgSearchString, timer.bFullTextEpgSearch, timer.iClientChannelUid, start, end, matches);
+
+	// The same programme on several channels at once is only recorded from the
+	// first of them. Matches come sorted by start, so those are next to each other.
+	size_t first = result.size();
+	for (vector<EpgSearchMatch>::const_iterator it = matches.begin(); it != matches.end(); ++it) {
+		bool bDuplicate = false;
+		for (size_t i = result.size(); i > first && result[i - 1].startTime == it->startTime && !bDuplicate; i--)
+			bDuplicate = result[i - 1].strTitle == it->strTitle && result[i - 1].strEpisodeName == it->strEpisodeName;
+		if (!bDuplicate)
+			result.push_back(*it);
+	}
+}
+
+// Occurrence indices stay the same for as long as we run, so Kodi can track them
+unsigned int CTimerStore::OccurrenceIndex(unsigned int iParentClientIndex, int iChannelUid, time_t start)
+{
+	OccurrenceKey key(iParentClientIndex, make_pair(iChannelUid, start));
+	map<OccurrenceKey, unsigned int>::const_iterator it = m_occurrenceIndices.find(key);
+	if (it != m_occurrenceIndices.end())
+		return it->second;
+
+	unsigned int iClientIndex = m_iNextOccurrenceIndex++;
+	m_occurrenceIndices[key] = iClientIndex;
+	m_occurrenceParents[iClientIndex] = iParentClientIndex;
+	return iClientIndex;
+}
+
+// Forgets the indices of occurrences that have ended, or whose timer is gone.
+// Those Kodi can still see, or the recorder is still writing, are kept.
+void CTimerStore::PruneOccurrenceIndices()
+{
+	set<unsigned int> shown;
+	for (vector<PVR_TIMER>::const_iterator it = m_occurrences.begin(); it != m_occurrences.end(); ++it)
+		shown.insert(it->iClientIndex);
+
+	for (map<OccurrenceKey, unsigned int>::iterator it = m_occurrenceIndices.begin(); it != m_occurrenceIndices.end();) {
+		bool bKeep = m_timers.count(it->first.first) > 0 && (shown.count(it->second) > 0 || m_recordingStates.count(it->second) > 0);
+		if (bKeep) {
+			++it;
+			continue;
+		}
+		m_occurrenceParents.erase(it->second);
+		m_occurrenceIndices.erase(it++);
+	}
+}
+
+// Whether an occurrence would leave some recording without a tuner
+bool CTimerStore::Conflicts(const TimerInterval& interval)
+{
+	if (m_iTuners <= 0)
+		return false;
+
+	vector<TimerInterval> overlapping;
+	QueryLocked(interval.start, interval.end, overlapping);
+	if ((int) overlapping.size() < m_iTuners)
+		return false;
+
+	overlapping.push_back(interval);
+	return !AssignTuners(overlapping, m_iTuners).empty();
+}
@@ -0,0 +1,162 @@
+#pragma once
+/*
+ *  pvr.python - A PVR client for Kodi using Python
+ *  Copyright © 2016 RunasSudo (Yingtong Li)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "client.h"
+
+#include <p8-platform/threads/mutex.h>
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define TIMERS_SNAPSHOT_VERSION 2
+
+class CEpgSearchIndex;
+struct EpgSearchMatch;
+
+// The timer types we offer through GetTimerTypes
+enum TimerTypeId
+{
+	TIMER_ONCE_MANUAL = 1,
+	TIMER_ONCE_EPG,
+	TIMER_ONCE_CREATED_BY_REPEATING,
+	TIMER_REPEATING_MANUAL,
+	TIMER_ONCE_CREATED_BY_EPG_SEARCH,
+	TIMER_REPEATING_EPG_SEARCH,
+	TIMER_TYPE_COUNT = TIMER_REPEATING_EPG_SEARCH
+};
+
+// One scheduled occurrence of a timer, margins included
+struct TimerInterval
+{
+	time_t start;
+	time_t end;
+	int iChannelUid;
+	unsigned int iClientIndex;       // The occurrence itself
+	unsigned int iParentClientIndex; // The repeating timer it came from, if any
+};
+
+// Static interval tree over a sorted array: each node is the middle of its range
+// and remembers the latest end time below it. Rebuilt whenever the timers change,
+// which is rare compared to how often it is queried.
+class CIntervalTree
+{
+public:
+	void Build(const std::vector<TimerInterval>& intervals);
+	void Query(time_t start, time_t end, std::vector<TimerInterval>& result) const;
+	size_t Size() const { return m_intervals.size(); }
+
+private:
+	time_t Build(size_t lo, size_t hi);
+	void Query(size_t lo, size_t hi, time_t start, time_t end, std::vector<TimerInterval>& result) const;
+
+	std::vector<TimerInterval> m_intervals; // Sorted by start
+	std::vector<time_t> m_maxEnd;
+};
+
+// Native timer bookkeeping. Timers reported by the backend and those added from
+// Kodi are kept together; repeating timers are only expanded into occurrences
+// for the window being looked at. Backend timers are given client indices of
+// our own, so they never collide with those handed out to Kodi's timers.
+class CTimerStore
+{
+public:
+	CTimerStore();
+
+	bool Load(const std::string& strPath);
+	bool Save(const std::string& strPath);
+
+	static void GetTimerTypes(PVR_TIMER_TYPE types[], int* size);
+
+	// Replaces the timers that came from the backend. Returns whether anything changed.
+	bool SyncBackend(const std::vector<PVR_TIMER>& timers);
+
+	void SetTuners(int iTuners);
+	void SetHorizon(int iDays);
+
+	// Where guide search timers look for programmes. Not owned.
+	void SetEpgIndex(CEpgSearchIndex* epgIndex);
+	// Runs the guide searches again after the EPG changed. Returns whether
+	// that changed the timers Kodi sees.
+	bool RefreshEpgSearches();
+
+	// Fills in the client index and state of a new timer, without storing it
+	PVR_ERROR Prepare(PVR_TIMER& timer);
+	void Add(const PVR_TIMER& timer);
+	PVR_ERROR Update(const PVR_TIMER& timer);
+	PVR_ERROR Delete(unsigned int iClientIndex);
+	bool Get(unsigned int iClientIndex, PVR_TIMER& timer);
+	// Swaps the client index of a timer from the backend for the one the backend knows it by
+	void ToBackend(PVR_TIMER& timer);
+	bool IsOccurrence(unsigned int iClientIndex);
+
+	// All occurrences overlapping [start, end)
+	void Query(time_t start, time_t end, std::vector<TimerInterval>& result);
+
+	// The one-shot timers and occurrences that should be recording at now,
+	// margins included, leaving out those there is no tuner for
+	void Due(time_t now, std::vector<PVR_TIMER>& result);
+
+	// Shows a timer as RECORDING while the recorder writes it. Any other state
+	// ends that; COMPLETED and ERROR are kept on one-shot timers added from Kodi.
+	void SetRecordingState(unsigned int iClientIndex, PVR_TIMER_STATE state);
+
+	void TransferTimers(ADDON_HANDLE handle);
+	int GetTimersAmount();
+
+private:
+	// The timer, and the channel and start of the occurrence
+	typedef std::pair<unsigned int, std::pair<int, time_t> > OccurrenceKey;
+
+	struct CStoredTimer
+	{
+		PVR_TIMER timer;
+		bool bFromBackend;
+		unsigned int iBackendIndex; // The client index the backend gave it
+	};
+
+	void Invalidate();
+	void Refresh();
+	void Expand(const PVR_TIMER& timer, time_t start, time_t end, std::vector<TimerInterval>& result);
+	void Search(const PVR_TIMER& timer, time_t start, time_t end, std::vector<EpgSearchMatch>& result);
+	void QueryLocked(time_t start, time_t end, std::vector<TimerInterval>& result);
+	unsigned int OccurrenceIndex(unsigned int iParentClientIndex, int iChannelUid, time_t start);
+	void PruneOccurrenceIndices();
+	bool Conflicts(const TimerInterval& interval);
+
+	P8PLATFORM::CMutex m_mutex;
+	std::map<unsigned int, CStoredTimer> m_timers;
+	unsigned int m_iNextIndex;
+	int m_iTuners;       // 0 for no limit
+	int m_iHorizonDays;  // How far ahead repeating timers are expanded for Kodi
+	CEpgSearchIndex* m_epgIndex;
+	unsigned int m_iEpgGeneration; // Of the index, when the occurrences were last worked out
+
+	bool m_bValid;
+	time_t m_refreshed;
+	CIntervalTree m_tree; // One-shot timers only
+	std::vector<PVR_TIMER> m_occurrences;
+	std::map<unsigned int, PVR_TIMER_STATE> m_states;
+	std::map<unsigned int, PVR_TIMER_STATE> m_recordingStates; // Set by the recorder, over the conflict states
+	std::map<OccurrenceKey, unsigned int> m_occurrenceIndices;
+	std::map<unsigned int, unsigned int> m_occurrenceParents;
+	unsigned int m_iNextOccurrenceIndex; // Never handed out twice, even once pruned
+};
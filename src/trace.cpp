@@ -0,0 +1,337 @@
+/*
+ *  pvr.python - A PVR client for Kodi using Python
+ *  Copyright © 2016 RunasSudo (Yingtong Li)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "trace.h"
+
+#include <p8-platform/threads/mutex.h>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <set>
+#include <vector>
+
+using namespace std;
+using namespace P8PLATFORM;
+
+// Events kept per thread; older ones are overwritten. Must be a power of two.
+#define TRACE_RING_SIZE 8192
+
+struct TraceEvent
+{
+	int64_t iTimestamp;
+	int64_t iValue;
+	const char* strName;
+	uint32_t type;
+};
+
+// Written only by its own thread. Readers copy events out and then check
+// that the writer hasn't lapped them in the meantime.
+struct CTraceRing
+{
+	TraceEvent events[TRACE_RING_SIZE];
+	atomic<uint64_t> head;
+	uint32_t iThread;
+	CTraceRing* next;
+};
+
+// Rings are never freed, as a dump may be reading them at any time. Those of
+// threads that have exited are taken over by new threads instead.
+static atomic<CTraceRing*> traceRings(NULL);
+static atomic<uint32_t> traceThreads(0);
+static CMutex traceFreeMutex;
+static vector<CTraceRing*> traceFreeRings;
+
+// Hands the ring of a thread on when it exits. Until the next thread laps it,
+// what it recorded can still be dumped, and a ring keeps its thread id, so
+// the threads that had it show one after another.
+struct CTraceRingHolder
+{
+	CTraceRingHolder() : ring(NULL) {}
+	~CTraceRingHolder() {
+		if (ring != NULL) {
+			CLockObject lock(traceFreeMutex);
+			traceFreeRings.push_back(ring);
+		}
+	}
+
+	CTraceRing* ring;
+};
+
+static CTraceRing* TraceThreadRing()
+{
+	static thread_local CTraceRingHolder holder;
+	if (holder.ring == NULL) {
+		{
+			CLockObject lock(traceFreeMutex);
+			if (!traceFreeRings.empty()) {
+				holder.ring = traceFreeRings.back();
+				traceFreeRings.pop_back();
+				return holder.ring;
+			}
+		}
+		CTraceRing* ring = new CTraceRing();
+		ring->head.store(0, memory_order_relaxed);
+		ring->iThread = ++traceThreads;
+		ring->next = traceRings.load(memory_order_relaxed);
+		while (!traceRings.compare_exchange_weak(ring->next, ring, memory_order_release, memory_order_relaxed)) {
+		}
+		holder.ring = ring;
+	}
+	return holder.ring;
+}
+
+int64_t TraceNow()
+{
+	return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void TraceRecord(TraceEventType type, const char* strName, int64_t iTimestamp, int64_t iValue)
+{
+	CTraceRing* ring = TraceThreadRing();
+	uint64_t head = ring->head.load(memory_order_relaxed);
+	TraceEvent& event = ring->events[head & (TRACE_RING_SIZE - 1)];
+	event.iTimestamp = iTimestamp;
+	event.iValue = iValue;
+	event.strName = strName;
+	event.type = type;
+	ring->head.store(head + 1, memory_order_release);
+}
+
+const char* TraceIntern(const string& strName)
+{
+	static CMutex mutex;
+	static set<string> names;
+	CLockObject lock(mutex);
+	return names.insert(strName).first->c_str();
+}
+
+// BEGIN DUMPING
+
+// Buffered JSON output that only uses write(), so it can run in a signal handler
+class CTraceWriter
+{
+public:
+	CTraceWriter(int fd) : m_fd(fd), m_used(0), m_bFailed(false) {}
+
+	void Put(const char* str) {
+		while (*str != '\0')
+			PutChar(*str++);
+	}
+
+	void PutInt(int64_t value) {
+		char digits[24];
+		int count = 0;
+		bool negative = (value < 0);
+		uint64_t magnitude = negative ? (uint64_t) -value : (uint64_t) value;
+		do {
+			digits[count++] = '0' + (magnitude % 10);
+			magnitude /= 10;
+		} while (magnitude > 0);
+		if (negative)
+			PutChar('-');
+		while (count > 0)
+			PutChar(digits[--count]);
+	}
+
+	void PutString(const char* str) {
+		static const char hex[] = "0123456789abcdef";
+		PutChar('"');
+		for (; *str != '\0'; str++) {
+			unsigned char c = *str;
+			if (c == '"' || c == '\\') {
+				PutChar('\\');
+				PutChar(c);
+			} else if (c < 0x20) {
+				Put("\\u00");
+				PutChar(hex[c >> 4]);
+				PutChar(hex[c & 0xf]);
+			} else {
+				PutChar(c);
+			}
+		}
+		PutChar('"');
+	}
+
+	bool Flush() {
+		size_t written = 0;
+		while (written < m_used && !m_bFailed) {
+			int result = write(m_fd, m_buffer + written, m_used - written);
+			if (result <= 0)
+				m_bFailed = true;
+			else
+				written += result;
+		}
+		m_used = 0;
+		return !m_bFailed;
+	}
+
+private:
+	void PutChar(char c) {
+		if (m_used == sizeof(m_buffer))
+			Flush();
+		m_buffer[m_used++] = c;
+	}
+
+	int m_fd;
+	char m_buffer[4096];
+	size_t m_used;
+	bool m_bFailed;
+};
+
+static const char* traceEventPhases[] = { "B", "E", "X", "C" };
+
+static bool TraceDumpToFd(int fd)
+{
+	CTraceWriter writer(fd);
+#ifdef _WIN32
+	int64_t pid = _getpid();
+#else
+	int64_t pid = getpid();
+#endif
+	bool first = true;
+
+	writer.Put("{\"traceEvents\":[");
+	for (CTraceRing* ring = traceRings.load(memory_order_acquire); ring != NULL; ring = ring->next) {
+		uint64_t head = ring->head.load(memory_order_acquire);
+		uint64_t start = (head > TRACE_RING_SIZE) ? head - TRACE_RING_SIZE : 0;
+		for (uint64_t i = start; i < head; i++) {
+			TraceEvent event = ring->events[i & (TRACE_RING_SIZE - 1)];
+			// Skip anything the thread may have overwritten while we copied it
+			if (i + TRACE_RING_SIZE <= ring->head.load(memory_order_acquire))
+				continue;
+			if (event.type > TRACE_EVENT_COUNTER || event.strName == NULL)
+				continue;
+
+			writer.Put(first ? "\n" : ",\n");
+			first = false;
+			writer.Put("{\"name\":");
+			writer.PutString(event.strName);
+			writer.Put(",\"ph\":\"");
+			writer.Put(traceEventPhases[event.type]);
+			writer.Put("\",\"ts\":");
+			writer.PutInt(event.iTimestamp);
+			writer.Put(",\"pid\":");
+			writer.PutInt(pid);
+			writer.Put(",\"tid\":");
+			writer.PutInt(ring->iThread);
+			if (event.type == TRACE_EVENT_COMPLETE) {
+				writer.Put(",\"dur\":");
+				writer.PutInt(event.iValue);
+			} else if (event.type == TRACE_EVENT_COUNTER) {
+				writer.Put(",\"args\":{\"value\":");
+				writer.PutInt(event.iValue);
+				writer.Put("}");
+			}
+			writer.Put("}");
+		}
+	}
+	writer.Put("\n]}\n");
+	return writer.Flush();
+}
+
+bool TraceDump(const string& strPath)
+{
+	static CMutex mutex;
+	CLockObject lock(mutex);
+
+#ifdef _WIN32
+	int fd = _open(strPath.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0644);
+#else
+	int fd = open(strPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif
+	if (fd < 0)
+		return false;
+	bool result = TraceDumpToFd(fd);
+	close(fd);
+	return result;
+}
+
+// END DUMPING
+
+// BEGIN CRASH HANDLING
+
+#ifndef _WIN32
+static char traceCrashPath[1024];
+static const int traceCrashSignals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+#define TRACE_CRASH_SIGNAL_COUNT (sizeof(traceCrashSignals) / sizeof(traceCrashSignals[0]))
+static struct sigaction traceOldActions[TRACE_CRASH_SIGNAL_COUNT];
+static bool traceHandlersInstalled = false;
+
+static void TraceRestoreHandlers()
+{
+	for (size_t i = 0; i < TRACE_CRASH_SIGNAL_COUNT; i++) {
+		sigaction(traceCrashSignals[i], &traceOldActions[i], NULL);
+	}
+}
+
+// Best effort: the rings are only read, and nothing here allocates
+static void TraceCrashHandler(int sig)
+{
+	TraceRestoreHandlers();
+	int fd = open(traceCrashPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd >= 0) {
+		TraceDumpToFd(fd);
+		close(fd);
+	}
+	// Carry on with whatever would have happened without us
+	raise(sig);
+}
+#endif
+
+void TraceInit(const string& strCrashPath)
+{
+#ifndef _WIN32
+	if (PVRPYTHON_TRACE_LEVEL == 0 || traceHandlersInstalled)
+		return;
+
+	strncpy(traceCrashPath, strCrashPath.c_str(), sizeof(traceCrashPath) - 1);
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = TraceCrashHandler;
+	sigemptyset(&action.sa_mask);
+	for (size_t i = 0; i < TRACE_CRASH_SIGNAL_COUNT; i++) {
+		sigaction(traceCrashSignals[i], &action, &traceOldActions[i]);
+	}
+	traceHandlersInstalled = true;
+#endif
+}
+
+void TraceShutdown()
+{
+#ifndef _WIN32
+	// Our handler mustn't outlive the library
+	if (traceHandlersInstalled) {
+		TraceRestoreHandlers();
+		traceHandlersInstalled = false;
+	}
+#endif
+}
+
+// END CRASH HANDLING
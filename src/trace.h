@@ -0,0 +1,82 @@
+#pragma once
+/*
+ *  pvr.python - A PVR client for Kodi using Python
+ *  Copyright © 2016 RunasSudo (Yingtong Li)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+
+#include <string>
+
+// 0 compiles tracing out, 1 traces calls from Kodi and Python spans, 2 also
+// traces waits for the Python lock and bytes read from streams
+#ifndef PVRPYTHON_TRACE_LEVEL
+#define PVRPYTHON_TRACE_LEVEL 0
+#endif
+
+enum TraceEventType
+{
+	TRACE_EVENT_BEGIN = 0,
+	TRACE_EVENT_END,
+	TRACE_EVENT_COMPLETE, // iValue is the duration
+	TRACE_EVENT_COUNTER
+};
+
+// Events go into a ring buffer owned by the calling thread, so recording one
+// takes no lock. strName must stay valid until the trace is dumped.
+void TraceRecord(TraceEventType type, const char* strName, int64_t iTimestamp, int64_t iValue);
+int64_t TraceNow(); // Microseconds
+
+// Returns a copy of strName that lives as long as the process
+const char* TraceIntern(const std::string& strName);
+
+// Sets where crash dumps go, and catches fatal signals to write one
+void TraceInit(const std::string& strCrashPath);
+void TraceShutdown();
+
+// Writes everything still in the rings as Chrome trace-event JSON
+bool TraceDump(const std::string& strPath);
+
+class CTraceScope
+{
+public:
+	CTraceScope(const char* strName) : m_strName(strName) { TraceRecord(TRACE_EVENT_BEGIN, m_strName, TraceNow(), 0); }
+	~CTraceScope() { TraceRecord(TRACE_EVENT_END, m_strName, TraceNow(), 0); }
+
+private:
+	const char* m_strName;
+};
+
+#if PVRPYTHON_TRACE_LEVEL >= 1
+#define TRACE_CALL() CTraceScope traceScope(__FUNCTION__)
+#define TRACE_BEGIN(name) TraceRecord(TRACE_EVENT_BEGIN, (name), TraceNow(), 0)
+#define TRACE_END(name) TraceRecord(TRACE_EVENT_END, (name), TraceNow(), 0)
+#else
+#define TRACE_CALL() ((void) 0)
+#define TRACE_BEGIN(name) ((void) 0)
+#define TRACE_END(name) ((void) 0)
+#endif
+
+#if PVRPYTHON_TRACE_LEVEL >= 2
+#define TRACE_WAIT_BEGIN() int64_t traceWaitStart = TraceNow()
+#define TRACE_WAIT_END(name) TraceRecord(TRACE_EVENT_COMPLETE, (name), traceWaitStart, TraceNow() - traceWaitStart)
+#define TRACE_COUNTER(name, value) TraceRecord(TRACE_EVENT_COUNTER, (name), TraceNow(), (value))
+#else
+#define TRACE_WAIT_BEGIN() ((void) 0)
+#define TRACE_WAIT_END(name) ((void) 0)
+#define TRACE_COUNTER(name, value) ((void) 0)
+#endif